@@ -61,6 +61,7 @@
 #include "LibraryFuncs.h"
 #include "TypeAnalysis/TBAA.h"
 
+#include "llvm/Analysis/CaptureTracking.h"
 #include "llvm/Analysis/ValueTracking.h"
 
 using namespace llvm;
@@ -98,6 +99,11 @@ cl::opt<bool>
 cl::opt<bool> EnzymeEnableRecursiveHypotheses(
     "enzyme-enable-recursive-activity", cl::init(true), cl::Hidden,
     cl::desc("Enable re-evaluation of activity analysis from updated results"));
+
+cl::opt<bool> EnzymeActivityMemoryIndex(
+    "enzyme-activity-memory-index", cl::init(true), cl::Hidden,
+    cl::desc("Only search the loads and stores which may access the same "
+             "underlying object when deducing the activity of a pointer"));
 }
 
 #include "llvm/IR/InstIterator.h"
@@ -764,12 +770,12 @@ bool ActivityAnalyzer::isConstantInstruction(TypeResults const &TR,
 
   // Branch, unreachable, and previously computed constants are inactive
   if (isa<UnreachableInst>(I) || isa<BranchInst>(I) ||
-      (ConstantInstructions.find(I) != ConstantInstructions.end())) {
+      ConstantInstructions.count(I)) {
     return true;
   }
 
   /// Previously computed inactives remain inactive
-  if ((ActiveInstructions.find(I) != ActiveInstructions.end())) {
+  if (ActiveInstructions.count(I)) {
     return false;
   }
 
@@ -1037,6 +1043,142 @@ bool ActivityAnalyzer::isConstantInstruction(TypeResults const &TR,
   return false;
 }
 
+static const Value *getMemoryIndexObject(const Value *V,
+                                         const DataLayout &DL) {
+#if LLVM_VERSION_MAJOR >= 12
+  return getUnderlyingObject(V);
+#else
+  return GetUnderlyingObject(V, DL);
+#endif
+}
+
+/// The instructions of a function which may read or write memory, in order.
+/// Unordered loads and stores are additionally indexed by the underlying object
+/// they access. Two distinct identified objects never alias, and a non-escaping
+/// local object cannot alias a pointer from an argument, load or call, so the
+/// remaining instructions are the only ones alias analysis could answer other
+/// than NoModRef for.
+class ActivityMemoryIndex {
+  /// All instructions which may read or write memory
+  SmallVector<Instruction *, 16> Insts;
+
+  /// Indices of the instructions which access an unknown object
+  SmallVector<unsigned, 8> Unknown;
+
+  /// Indices of the instructions which do not access a non-escaping local
+  SmallVector<unsigned, 8> Escaping;
+
+  /// Indices of the instructions accessing each identified object
+  DenseMap<const Value *, SmallVector<unsigned, 4>> ByObject;
+
+  const DataLayout &DL;
+
+public:
+  ActivityMemoryIndex(Function &F) : DL(F.getParent()->getDataLayout()) {
+    SmallDenseMap<const Value *, bool, 8> IsLocal;
+    for (BasicBlock &BB : F)
+      for (Instruction &I : BB) {
+        if (!I.mayReadOrWriteMemory())
+          continue;
+        unsigned idx = Insts.size();
+        Insts.push_back(&I);
+
+        const Value *Obj = nullptr;
+        if (auto LI = dyn_cast<LoadInst>(&I)) {
+          if (LI->isUnordered())
+            Obj = getMemoryIndexObject(LI->getPointerOperand(), DL);
+        } else if (auto SI = dyn_cast<StoreInst>(&I)) {
+          if (SI->isUnordered())
+            Obj = getMemoryIndexObject(SI->getPointerOperand(), DL);
+        }
+        if (!Obj || !isIdentifiedObject(Obj)) {
+          Unknown.push_back(idx);
+          Escaping.push_back(idx);
+          continue;
+        }
+        ByObject[Obj].push_back(idx);
+
+        auto found = IsLocal.find(Obj);
+        if (found == IsLocal.end()) {
+          bool local = (isa<AllocaInst>(Obj) || isNoAliasCall(Obj)) &&
+                       !PointerMayBeCaptured(Obj, /*ReturnCaptures*/ false,
+                                             /*StoreCaptures*/ true);
+          found = IsLocal.insert(std::make_pair(Obj, local)).first;
+        }
+        if (!found->second)
+          Escaping.push_back(idx);
+      }
+  }
+
+  /// Call \p check on each instruction which may access \p memval, in order,
+  /// until it returns true.
+  bool search(Value *memval, function_ref<bool(Instruction *)> check) const {
+    auto visit = [&](ArrayRef<unsigned> indices) {
+      for (unsigned idx : indices)
+        if (check(Insts[idx]))
+          return true;
+      return false;
+    };
+
+    // Alias analysis is not consulted for non-pointers.
+    if (!memval->getType()->isPointerTy()) {
+      for (auto I : Insts)
+        if (check(I))
+          return true;
+      return false;
+    }
+
+    const Value *Obj = getMemoryIndexObject(memval, DL);
+    if (isIdentifiedObject(Obj)) {
+      auto found = ByObject.find(Obj);
+      if (found == ByObject.end())
+        return visit(Unknown);
+      // Merge the accesses of this object with the unknown ones to preserve
+      // the order of the instructions.
+      ArrayRef<unsigned> Same = found->second;
+      size_t i = 0, j = 0;
+      while (i < Unknown.size() || j < Same.size()) {
+        unsigned idx;
+        if (j == Same.size() || (i < Unknown.size() && Unknown[i] < Same[j]))
+          idx = Unknown[i++];
+        else
+          idx = Same[j++];
+        if (check(Insts[idx]))
+          return true;
+      }
+      return false;
+    }
+
+    if (isa<Argument>(Obj) || isa<LoadInst>(Obj) || isa<CallBase>(Obj) ||
+        isa<IntToPtrInst>(Obj))
+      return visit(Escaping);
+
+    for (auto I : Insts)
+      if (check(I))
+        return true;
+    return false;
+  }
+};
+
+bool ActivityAnalyzer::searchMemoryInstructions(
+    TypeResults const &TR, Value *memval,
+    function_ref<bool(Instruction *)> check) {
+  Function *F = TR.getFunction();
+  if (!EnzymeActivityMemoryIndex) {
+    for (BasicBlock &BB : *F) {
+      if (notForAnalysis.count(&BB))
+        continue;
+      for (Instruction &I : BB)
+        if (check(&I))
+          return true;
+    }
+    return false;
+  }
+  if (!MemoryIndex)
+    MemoryIndex = std::make_shared<ActivityMemoryIndex>(*F);
+  return MemoryIndex->search(memval, check);
+}
+
 bool isValuePotentiallyUsedAsPointer(llvm::Value *val) {
   std::deque<llvm::Value *> todo = {val};
   SmallPtrSet<Value *, 3> seen;
@@ -1097,12 +1239,12 @@ bool ActivityAnalyzer::isConstantValue(TypeResults const &TR, Value *Val) {
   }
 
   /// If we've already shown this value to be inactive
-  if (ConstantValues.find(Val) != ConstantValues.end()) {
+  if (ConstantValues.count(Val)) {
     return true;
   }
 
   /// If we've already shown this value to be active
-  if (ActiveValues.find(Val) != ActiveValues.end()) {
+  if (ActiveValues.count(Val)) {
     return false;
   }
 
@@ -1886,6 +2028,25 @@ bool ActivityAnalyzer::isConstantValue(TypeResults const &TR, Value *Val) {
       }
     }
 
+    Value *memval = Val;
+
+    // BasicAA stupidy assumes that non-pointer's don't alias
+    // if this is a nonpointer, use something else to force alias
+    // consideration
+    if (!memval->getType()->isPointerTy()) {
+      if (auto ci = dyn_cast<CastInst>(Val)) {
+        if (ci->getOperand(0)->getType()->isPointerTy()) {
+          memval = ci->getOperand(0);
+        }
+      }
+      for (auto user : Val->users()) {
+        if (isa<CastInst>(user) && user->getType()->isPointerTy()) {
+          memval = user;
+          break;
+        }
+      }
+    }
+
     auto checkActivity = [&](Instruction *I) {
       if (notForAnalysis.count(I->getParent()))
         return false;
@@ -1914,25 +2075,7 @@ bool ActivityAnalyzer::isConstantValue(TypeResults const &TR, Value *Val) {
         }
       }
 
-      Value *memval = Val;
-
-      // BasicAA stupidy assumes that non-pointer's don't alias
-      // if this is a nonpointer, use something else to force alias
-      // consideration
-      if (!memval->getType()->isPointerTy()) {
-        if (auto ci = dyn_cast<CastInst>(Val)) {
-          if (ci->getOperand(0)->getType()->isPointerTy()) {
-            memval = ci->getOperand(0);
-          }
-        }
-        for (auto user : Val->users()) {
-          if (isa<CastInst>(user) && user->getType()->isPointerTy()) {
-            memval = user;
-            break;
-          }
-        }
-      }
-
+      countEnzymeStat(&EnzymeFunctionStats::activityModRefQueries);
 #if LLVM_VERSION_MAJOR >= 12
       auto AARes = AA.getModRefInfo(
           I, MemoryLocation(memval, LocationSize::beforeOrAfterPointer()));
@@ -2147,32 +2290,16 @@ bool ActivityAnalyzer::isConstantValue(TypeResults const &TR, Value *Val) {
     } else if (auto VI = dyn_cast<CallInst>(Val)) {
       if (VI->hasRetAttr(Attribute::NoAlias))
         allFollowersOf(VI, checkActivity);
-      else {
-        for (BasicBlock &BB : *TR.getFunction()) {
-          if (notForAnalysis.count(&BB))
-            continue;
-          for (Instruction &I : BB) {
-            if (checkActivity(&I))
-              goto activeLoadAndStore;
-          }
-        }
-      }
+      else
+        searchMemoryInstructions(TR, memval, checkActivity);
     } else if (isa<Argument>(Val) || isa<Instruction>(Val)) {
-      for (BasicBlock &BB : *TR.getFunction()) {
-        if (notForAnalysis.count(&BB))
-          continue;
-        for (Instruction &I : BB) {
-          if (checkActivity(&I))
-            goto activeLoadAndStore;
-        }
-      }
+      searchMemoryInstructions(TR, memval, checkActivity);
     } else {
       llvm::errs() << "unknown pointer value type: " << *Val << "\n";
       assert(0 && "unknown pointer value type");
       llvm_unreachable("unknown pointer value type");
     }
 
-  activeLoadAndStore:;
     if (EnzymePrintActivity) {
       llvm::errs() << " </MEMSEARCH" << (int)directions << ">" << *Val
                    << " potentiallyActiveLoad=";
@@ -2223,7 +2350,7 @@ bool ActivityAnalyzer::isConstantValue(TypeResults const &TR, Value *Val) {
 
       assert(UpHypothesis);
       // UpHypothesis.ConstantValues.insert(val);
-      if (DeducingPointers.size() == 0)
+      if (DeducingPointers.empty())
         UpHypothesis->insertConstantsFrom(TR, *Hypothesis);
       assert(directions & UP);
       bool ActiveUp =
@@ -2314,7 +2441,7 @@ bool ActivityAnalyzer::isConstantValue(TypeResults const &TR, Value *Val) {
       } else {
         InsertConstantValue(TR, Val);
         insertConstantsFrom(TR, *Hypothesis);
-        if (DeducingPointers.size() == 0)
+        if (DeducingPointers.empty())
           insertConstantsFrom(TR, *UpHypothesis);
         insertConstantsFrom(TR, *DownHypothesis);
         return true;
@@ -29,6 +29,7 @@
 
 #include <cstdint>
 #include <deque>
+#include <memory>
 
 #include <llvm/Config/llvm-config.h>
 #if LLVM_VERSION_MAJOR >= 16
@@ -48,9 +49,11 @@
 
 #include "llvm/Support/CommandLine.h"
 
+#include "llvm/ADT/ImmutableSet.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/IR/InstVisitor.h"
 
+#include "EnzymeStats.h"
 #include "TypeAnalysis/TypeAnalysis.h"
 #include "Utils.h"
 
@@ -60,14 +63,76 @@ extern llvm::cl::opt<bool> EnzymeNonmarkedGlobalsInactive;
 extern llvm::cl::opt<bool> EnzymeGlobalActivity;
 extern llvm::cl::opt<bool> EnzymeEmptyFnInactive;
 extern llvm::cl::opt<bool> EnzymeEnableRecursiveHypotheses;
+extern llvm::cl::opt<bool> EnzymeActivityMemoryIndex;
 }
 
 class PreProcessCache;
+class ActivityMemoryIndex;
 
 // A map of MPI comm allocators (otherwise inactive) to the
 // argument of the Comm* they allocate into.
 extern const llvm::StringMap<size_t> MPIInactiveCommAllocators;
 
+/// A set of values of an analyzer, shared structurally with the hypotheses
+/// forked from it. Forking takes constant time and the elements added since
+/// the fork are logged, so that a hypothesis can be merged back into an
+/// unchanged analyzer in time proportional to what the hypothesis deduced.
+template <typename T> class HypothesisSet {
+  using SetTy = llvm::ImmutableSet<T>;
+
+  typename SetTy::Factory *F;
+
+  /// The current elements
+  SetTy Set;
+
+  /// The elements of the set this one was forked from, at the time of the fork
+  SetTy Base;
+
+  /// The elements added since the fork, some of which may have been erased
+  llvm::SmallVector<T, 4> Added;
+
+public:
+  HypothesisSet(typename SetTy::Factory &F)
+      : F(&F), Set(F.getEmptySet()), Base(Set) {}
+
+  /// Create a new set with the elements of this one
+  HypothesisSet fork() const {
+    HypothesisSet Res(*F);
+    Res.Set = Set;
+    Res.Base = Set;
+    return Res;
+  }
+
+  bool count(T V) const { return Set.contains(V); }
+
+  std::pair<T, bool> insert(T V) {
+    if (Set.contains(V))
+      return std::make_pair(V, false);
+    Set = F->add(Set, V);
+    Added.push_back(V);
+    return std::make_pair(V, true);
+  }
+
+  void erase(T V) { Set = F->remove(Set, V); }
+
+  bool empty() const { return Set.isEmpty(); }
+
+  /// Call \p Fn on each element. Pointers are stored as pointers to const.
+  template <typename Fn> void forEach(Fn fn) const {
+    for (auto V : Set)
+      fn(const_cast<T>(V));
+  }
+
+  /// Whether \p Other still has the elements this set was forked with, in
+  /// which case the elements of this set missing from \p Other are among
+  /// those returned by added()
+  bool isUnchangedForkOf(const HypothesisSet &Other) const {
+    return Base.getRootWithoutRetain() == Other.Set.getRootWithoutRetain();
+  }
+
+  llvm::ArrayRef<T> added() const { return Added; }
+};
+
 /// Helper class to analyze the differential activity
 class ActivityAnalyzer {
   PreProcessCache &PPC;
@@ -93,25 +158,37 @@ private:
   /// Analyze down based off uses
   static constexpr uint8_t DOWN = 2;
 
+  /// Allocators of the sets of an analyzer and all of its hypotheses
+  struct SetFactories {
+    llvm::ImmutableSet<llvm::Instruction *>::Factory Instructions{
+        /*canonicalize*/ false};
+    llvm::ImmutableSet<llvm::Value *>::Factory Values{/*canonicalize*/ false};
+  };
+  std::shared_ptr<SetFactories> Factories;
+
   /// Instructions that don't propagate adjoints
   /// These instructions could return an active pointer, but
   /// do not propagate adjoints themselves
-  llvm::SmallPtrSet<llvm::Instruction *, 4> ConstantInstructions;
+  HypothesisSet<llvm::Instruction *> ConstantInstructions;
 
   /// Instructions that could propagate adjoints
-  llvm::SmallPtrSet<llvm::Instruction *, 20> ActiveInstructions;
+  HypothesisSet<llvm::Instruction *> ActiveInstructions;
 
   /// Values that do not contain derivative information, either
   /// directly or as a pointer to
-  llvm::SmallPtrSet<llvm::Value *, 4> ConstantValues;
+  HypothesisSet<llvm::Value *> ConstantValues;
 
   /// Values that may contain derivative information
-  llvm::SmallPtrSet<llvm::Value *, 2> ActiveValues;
+  HypothesisSet<llvm::Value *> ActiveValues;
 
   /// Intermediate pointers which are created by inactive instructions
   /// but are marked as active values to inductively determine their
   /// activity.
-  llvm::SmallPtrSet<llvm::Value *, 1> DeducingPointers;
+  HypothesisSet<llvm::Value *> DeducingPointers;
+
+  /// Memory instructions of the analyzed function indexed by the underlying
+  /// object they access, shared with all hypotheses and built on first use
+  std::shared_ptr<ActivityMemoryIndex> MemoryIndex;
 
 public:
   /// Construct the analyzer from the a previous set of constant and active
@@ -122,13 +199,20 @@ public:
       PreProcessCache &PPC, llvm::AAResults &AA_,
       const llvm::SmallPtrSetImpl<llvm::BasicBlock *> &notForAnalysis_,
       llvm::TargetLibraryInfo &TLI_,
-      const llvm::SmallPtrSetImpl<llvm::Value *> &ConstantValues,
-      const llvm::SmallPtrSetImpl<llvm::Value *> &ActiveValues,
+      const llvm::SmallPtrSetImpl<llvm::Value *> &ConstantValues_,
+      const llvm::SmallPtrSetImpl<llvm::Value *> &ActiveValues_,
       DIFFE_TYPE ActiveReturns)
       : PPC(PPC), AA(AA_), notForAnalysis(notForAnalysis_), TLI(TLI_),
         ActiveReturns(ActiveReturns), directions(UP | DOWN),
-        ConstantValues(ConstantValues.begin(), ConstantValues.end()),
-        ActiveValues(ActiveValues.begin(), ActiveValues.end()) {
+        Factories(std::make_shared<SetFactories>()),
+        ConstantInstructions(Factories->Instructions),
+        ActiveInstructions(Factories->Instructions),
+        ConstantValues(Factories->Values), ActiveValues(Factories->Values),
+        DeducingPointers(Factories->Values) {
+    for (auto V : ConstantValues_)
+      this->ConstantValues.insert(V);
+    for (auto V : ActiveValues_)
+      this->ActiveValues.insert(V);
     InsertConstValueRecursionHandler = nullptr;
   }
 
@@ -159,25 +243,56 @@ private:
   ActivityAnalyzer(ActivityAnalyzer &Other, uint8_t directions)
       : PPC(Other.PPC), AA(Other.AA), notForAnalysis(Other.notForAnalysis),
         TLI(Other.TLI), ActiveReturns(Other.ActiveReturns),
-        directions(directions),
-        ConstantInstructions(Other.ConstantInstructions),
-        ActiveInstructions(Other.ActiveInstructions),
-        ConstantValues(Other.ConstantValues), ActiveValues(Other.ActiveValues),
-        DeducingPointers(Other.DeducingPointers) {
+        directions(directions), Factories(Other.Factories),
+        ConstantInstructions(Other.ConstantInstructions.fork()),
+        ActiveInstructions(Other.ActiveInstructions.fork()),
+        ConstantValues(Other.ConstantValues.fork()),
+        ActiveValues(Other.ActiveValues.fork()),
+        DeducingPointers(Other.DeducingPointers.fork()),
+        MemoryIndex(Other.MemoryIndex) {
     assert(directions != 0);
     assert((directions & Other.directions) == directions);
     assert((directions & Other.directions) != 0);
     InsertConstValueRecursionHandler = nullptr;
+    countEnzymeStat(&EnzymeFunctionStats::activityHypotheses);
   }
 
   /// Import known constants from an existing analyzer
   void insertConstantsFrom(TypeResults const &TR,
                            ActivityAnalyzer &Hypothesis) {
-    for (auto I : Hypothesis.ConstantInstructions) {
-      InsertConstantInstruction(TR, I);
+    if (Hypothesis.ConstantInstructions.isUnchangedForkOf(
+            ConstantInstructions)) {
+      // The constants known before the fork only need to be inserted again
+      // to trigger the re-evaluations registered on them since.
+      llvm::SmallVector<llvm::Instruction *, 1> pending;
+      for (auto &pair : ReEvaluateValueIfInactiveInst)
+        if (ConstantInstructions.count(pair.first))
+          pending.push_back(pair.first);
+      for (auto I : pending)
+        InsertConstantInstruction(TR, I);
+      for (auto I : Hypothesis.ConstantInstructions.added())
+        if (Hypothesis.ConstantInstructions.count(I))
+          InsertConstantInstruction(TR, I);
+    } else {
+      Hypothesis.ConstantInstructions.forEach(
+          [&](llvm::Instruction *I) { InsertConstantInstruction(TR, I); });
     }
-    for (auto V : Hypothesis.ConstantValues) {
-      InsertConstantValue(TR, V);
+    if (Hypothesis.ConstantValues.isUnchangedForkOf(ConstantValues)) {
+      llvm::SmallVector<llvm::Value *, 1> pending;
+      for (auto &pair : ReEvaluateValueIfInactiveValue)
+        if (ConstantValues.count(pair.first))
+          pending.push_back(pair.first);
+      for (auto &pair : ReEvaluateInstIfInactiveValue)
+        if (ConstantValues.count(pair.first))
+          pending.push_back(pair.first);
+      for (auto V : pending)
+        InsertConstantValue(TR, V);
+      for (auto V : Hypothesis.ConstantValues.added())
+        if (Hypothesis.ConstantValues.count(V))
+          InsertConstantValue(TR, V);
+    } else {
+      Hypothesis.ConstantValues.forEach(
+          [&](llvm::Value *V) { InsertConstantValue(TR, V); });
     }
   }
 
@@ -185,21 +300,36 @@ private:
   void insertAllFrom(TypeResults const &TR, ActivityAnalyzer &Hypothesis,
                      llvm::Value *Orig, llvm::Value *Orig2 = nullptr) {
     insertConstantsFrom(TR, Hypothesis);
-    for (auto I : Hypothesis.ActiveInstructions) {
+    auto insertActiveInstruction = [&](llvm::Instruction *I) {
       bool inserted = ActiveInstructions.insert(I).second;
       if (inserted && directions == 3 && EnzymeEnableRecursiveHypotheses) {
         ReEvaluateInstIfInactiveValue[Orig].insert(I);
         if (Orig2 && Orig2 != Orig)
           ReEvaluateInstIfInactiveValue[Orig2].insert(I);
       }
+    };
+    // Elements known before an unchanged fork are already present.
+    if (Hypothesis.ActiveInstructions.isUnchangedForkOf(ActiveInstructions)) {
+      for (auto I : Hypothesis.ActiveInstructions.added())
+        if (Hypothesis.ActiveInstructions.count(I))
+          insertActiveInstruction(I);
+    } else {
+      Hypothesis.ActiveInstructions.forEach(insertActiveInstruction);
     }
-    for (auto V : Hypothesis.ActiveValues) {
+    auto insertActiveValue = [&](llvm::Value *V) {
       bool inserted = ActiveValues.insert(V).second;
       if (inserted && directions == 3 && EnzymeEnableRecursiveHypotheses) {
         ReEvaluateValueIfInactiveValue[Orig].insert(V);
         if (Orig2 && Orig2 != Orig)
           ReEvaluateValueIfInactiveValue[Orig2].insert(V);
       }
+    };
+    if (Hypothesis.ActiveValues.isUnchangedForkOf(ActiveValues)) {
+      for (auto V : Hypothesis.ActiveValues.added())
+        if (Hypothesis.ActiveValues.count(V))
+          insertActiveValue(V);
+    } else {
+      Hypothesis.ActiveValues.forEach(insertActiveValue);
     }
 
     for (auto &pair : Hypothesis.ReEvaluateValueIfInactiveInst) {
@@ -225,6 +355,13 @@ private:
     }
   }
 
+  /// Call \p check on each instruction of the analyzed function, in order,
+  /// that may read or write the memory pointed to by \p memval, until it
+  /// returns true. Returns whether \p check returned true.
+  bool
+  searchMemoryInstructions(TypeResults const &TR, llvm::Value *memval,
+                           llvm::function_ref<bool(llvm::Instruction *)> check);
+
   /// Is the use of value val as an argument of call CI known to be inactive
   bool isFunctionArgumentConstant(llvm::CallInst *CI, llvm::Value *val);
 
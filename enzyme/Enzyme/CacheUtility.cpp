@@ -35,6 +35,11 @@ llvm::cl::opt<bool>
     EfficientBoolCache("enzyme-smallbool", cl::init(false), cl::Hidden,
                        cl::desc("Place 8 bools together in a single byte"));
 
+llvm::cl::opt<bool> EnzymeNarrowIntCache(
+    "enzyme-narrow-int-cache", cl::init(false), cl::Hidden,
+    cl::desc("Cache integers of a combined forward+reverse pass in the "
+             "narrowest type which holds their range per scalar evolution"));
+
 llvm::cl::opt<bool> EnzymeZeroCache("enzyme-zero-cache", cl::init(false),
                                     cl::Hidden,
                                     cl::desc("Zero initialize the cache"));
@@ -43,6 +48,34 @@ llvm::cl::opt<bool>
     EnzymePrintPerf("enzyme-print-perf", cl::init(false), cl::Hidden,
                     cl::desc("Enable Enzyme to print performance info"));
 
+llvm::cl::opt<bool> EnzymeTapeArena(
+    "enzyme-tape-arena", cl::init(false), cl::Hidden,
+    cl::desc("Allocate caches of combined forward+reverse passes from a "
+             "thread-local bump arena released at the end of the reverse "
+             "pass, instead of individually malloc'ing and freeing them"));
+
+llvm::cl::opt<bool> EnzymeChunkedCache(
+    "enzyme-chunked-cache", cl::init(false), cl::Hidden,
+    cl::desc("Store caches of loops with an unknown trip count in a "
+             "directory of fixed-size blocks, avoiding copying the cache "
+             "each time it grows"));
+
+llvm::cl::opt<unsigned> EnzymeChunkedCacheBlock(
+    "enzyme-chunked-cache-block", cl::init(1024), cl::Hidden,
+    cl::desc("Number of dynamic loop iterations stored per block of a "
+             "chunked cache (rounded up to a power of two)"));
+
+llvm::cl::opt<bool> EnzymeTapeProfile(
+    "enzyme-tape-profile", cl::init(false), cl::Hidden,
+    cl::desc("Report the size and lifetime of every cache allocation to the "
+             "__enzyme_tape_profile runtime (see enzyme/tape/profile.h)"));
+
+llvm::cl::opt<unsigned long long> EnzymeCheckpointBudget(
+    "enzyme-checkpoint-budget", cl::init(0), cl::Hidden,
+    cl::desc("Memory budget in bytes for the tape of a loop, beyond which "
+             "a binomial checkpointing schedule of the loop is suggested "
+             "(0 to disable)"));
+
 llvm::cl::opt<bool> EfficientMaxCache(
     "enzyme-max-cache", cl::init(false), cl::Hidden,
     cl::desc(
@@ -780,12 +813,154 @@ bool CacheUtility::getContext(BasicBlock *BB, LoopContext &loopContext,
   return true;
 }
 
+/// Log2 of the number of dynamic loop iterations held by each block of a
+/// chunked cache
+static unsigned getChunkedCacheShift() {
+  return Log2_32_Ceil(std::max(8U, (unsigned)EnzymeChunkedCacheBlock));
+}
+
+bool CacheUtility::isChunkedCache(const SubLimitType &sublimits, int i) const {
+  // Embedders providing their own allocator get a single buffer they can
+  // reason about.
+  if (!EnzymeChunkedCache || CustomAllocator)
+    return false;
+  return sublimits[i].second.back().first.maxLimit == nullptr;
+}
+
+/// Number of loop iterations which can be reversed with snaps snapshots of the
+/// loop-carried state when no iteration is run more than reps times, that is
+/// \binom{snaps + reps}{snaps}. Saturates at UINT64_MAX.
+static uint64_t checkpointBinomial(uint64_t snaps, uint64_t reps) {
+  if (snaps > reps)
+    std::swap(snaps, reps);
+  uint64_t res = 1;
+  for (uint64_t i = 1; i <= snaps; i++) {
+    if (res > UINT64_MAX / (reps + i))
+      return UINT64_MAX;
+    res = res * (reps + i) / i;
+  }
+  return res;
+}
+
+void CacheUtility::reportCheckpointSchedule() const {
+  if (!EnzymeCheckpointBudget)
+    return;
+  uint64_t budget = EnzymeCheckpointBudget;
+  auto &DL = newFunc->getParent()->getDataLayout();
+  for (auto &pair : loopTapeUsage) {
+    BasicBlock *header = pair.first;
+    const LoopTapeUsage &usage = pair.second;
+    const LoopContext *lc = nullptr;
+    for (auto &context : loopContexts)
+      if (context.second.header == header)
+        lc = &context.second;
+    if (!lc)
+      continue;
+
+    // The state that must be snapshot to replay the loop from an iteration,
+    // not counting any memory the loop updates in place.
+    uint64_t stateBytes = 0;
+    for (auto &PN : header->phis())
+      if (&PN != lc->var)
+        stateBytes += DL.getTypeAllocSize(PN.getType());
+
+    uint64_t perIter = usage.bytesPerIteration;
+    const char *approx = usage.exact ? "" : "at least ";
+    Instruction &loc = *header->getFirstNonPHI();
+
+    uint64_t iters = 0;
+    Value *limit = lc->maxLimit;
+    if (auto CI = dyn_cast_or_null<ConstantInt>(limit))
+      iters = CI->getZExtValue() + 1;
+
+    if (iters && perIter <= budget / iters) {
+      EmitWarning("CheckpointSchedule", loc, "Tape of loop ",
+                  header->getName(), " in ", newFunc->getName(), " needs ",
+                  approx, iters * perIter, " bytes, within checkpoint budget");
+      continue;
+    }
+    if (stateBytes == 0) {
+      EmitWarning("CheckpointSchedule", loc, "Tape of loop ",
+                  header->getName(), " in ", newFunc->getName(), " needs ",
+                  approx, perIter,
+                  " bytes per iteration, but the loop carries no state in "
+                  "registers to checkpoint");
+      continue;
+    }
+    // Reversing a single iteration requires its tape in addition to the
+    // snapshots.
+    uint64_t snaps = budget > perIter ? (budget - perIter) / stateBytes : 0;
+    if (snaps == 0) {
+      EmitWarning("CheckpointSchedule", loc, "Checkpoint budget of ", budget,
+                  " bytes cannot hold a snapshot of ", stateBytes,
+                  " bytes and the tape of one iteration of loop ",
+                  header->getName(), " in ", newFunc->getName(), " (",
+                  approx, perIter, " bytes)");
+      continue;
+    }
+
+    if (!iters) {
+      EmitWarning("CheckpointSchedule", loc, "Tape of loop ",
+                  header->getName(), " in ", newFunc->getName(), " needs ",
+                  approx, perIter, " bytes per iteration; ", snaps,
+                  " snapshots of ", stateBytes,
+                  " bytes fit the checkpoint budget, reversing up to ",
+                  checkpointBinomial(snaps, 1), "/",
+                  checkpointBinomial(snaps, 2), "/",
+                  checkpointBinomial(snaps, 3),
+                  " iterations when running each at most 1/2/3 times");
+      continue;
+    }
+
+    if (snaps > iters)
+      snaps = iters;
+    uint64_t reps = 0;
+    while (checkpointBinomial(snaps, reps) < iters)
+      reps++;
+    uint64_t replayed = reps * iters - checkpointBinomial(snaps + 1, reps - 1);
+    EmitWarning("CheckpointSchedule", loc, "Tape of loop ", header->getName(),
+                " in ", newFunc->getName(), " needs ", approx, iters * perIter,
+                " bytes, exceeding checkpoint budget; binomial checkpointing "
+                "with ",
+                snaps, " snapshots of ", stateBytes, " bytes needs ",
+                snaps * stateBytes + perIter, " bytes and recomputes ",
+                replayed, " iterations, each at most ", reps, " times");
+  }
+}
+
+/// Describe the cache of the given site to the tape profiling runtime as
+/// "function<tab>file:line:col<tab>cached instruction"
+static Constant *getTapeProfileSite(IRBuilder<> &B, Function *newFunc,
+                                    Instruction *site, StringRef name) {
+  std::string str;
+  raw_string_ostream ss(str);
+  ss << newFunc->getName() << "\t";
+  if (site && site->getDebugLoc())
+    ss << site->getDebugLoc()->getFilename() << ":"
+       << site->getDebugLoc().getLine() << ":" << site->getDebugLoc().getCol();
+  else
+    ss << "?";
+  ss << "\t";
+  if (site) {
+    std::string inst;
+    raw_string_ostream is(inst);
+    site->print(is);
+    StringRef text = StringRef(is.str()).trim();
+    // Drop metadata attachments such as the debug location
+    text = text.substr(0, text.find(", !"));
+    ss << text.substr(0, 200);
+  } else
+    ss << name;
+  return B.CreateGlobalStringPtr(ss.str(), "tapeprofile.site");
+}
+
 /// Caching mechanism: creates a cache of type T in a scope given by ctx
 /// (where if ctx is in a loop there will be a corresponding number of slots)
 AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
                                               StringRef name, bool shouldFree,
                                               bool allocateInternal,
-                                              Value *extraSize) {
+                                              Value *extraSize,
+                                              Instruction *site) {
   assert(ctx.Block);
   assert(T);
 
@@ -803,6 +978,9 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
   bool isi1 = T->isIntegerTy() && cast<IntegerType>(T)->getBitWidth() == 1;
   if (EfficientBoolCache && isi1 && sublimits.size() != 0)
     types[0] = Type::getInt8Ty(T->getContext());
+  // Caches that would be freed at the end of the reverse pass can instead
+  // be released in bulk with the tape arena.
+  bool arena = shouldFree && allocateInternal && useTapeArena();
   for (size_t i = 0; i < sublimits.size(); ++i) {
     Type *allocType;
     {
@@ -813,16 +991,19 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
 
       CallInst *malloccall;
       Instruction *Zero;
-      allocType = cast<PointerType>(CreateAllocation(B, types.back(), P,
-                                                     "tmpfortypecalc",
-                                                     &malloccall, &Zero)
-                                        ->getType());
+      allocType = cast<PointerType>(
+          CreateAllocation(B, types.back(), P, "tmpfortypecalc", &malloccall,
+                           &Zero, /*isDefault*/ false, arena)
+              ->getType());
       malloctypes.push_back(cast<PointerType>(malloccall->getType()));
       for (auto &I : make_early_inc_range(reverse(*BB)))
         I.eraseFromParent();
 
       BB->eraseFromParent();
     }
+    // A chunked cache is a directory of pointers to blocks
+    if (isChunkedCache(sublimits, i))
+      allocType = PointerType::getUnqual(allocType);
     types.push_back(allocType);
   }
 
@@ -846,6 +1027,59 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
       scopeInstructions[alloc].push_back(entryBuilder.CreateStore(val, alloc));
   }
 
+  // Account the tape of this cache to the outermost loop for checkpointing
+  if (EnzymeCheckpointBudget && sublimits.size() != 0) {
+    const auto &outermost = sublimits.back().second.back().first;
+    auto &usage = loopTapeUsage[outermost.header];
+    uint64_t bytes =
+        newFunc->getParent()->getDataLayout().getTypeAllocSize(types[0]);
+    for (const auto &chunk : sublimits)
+      for (const auto &lim : chunk.second) {
+        if (lim.first.header == outermost.header)
+          continue;
+        Value *limit = lim.first.maxLimit;
+        if (auto CI = dyn_cast_or_null<ConstantInt>(limit))
+          bytes *= CI->getZExtValue() + 1;
+        else
+          usage.exact = false;
+      }
+    if (extraSize) {
+      if (auto CI = dyn_cast<ConstantInt>(extraSize))
+        bytes *= CI->getZExtValue();
+      else
+        usage.exact = false;
+    }
+    usage.bytesPerIteration += bytes;
+  }
+
+  // Report the allocations of this cache to the tape profiling runtime,
+  // recording the instructions so they are erased along with the cache.
+  bool profile = EnzymeTapeProfile && allocateInternal;
+  Constant *profileSite = nullptr;
+  // Caches grown within a loop report the bytes used by the iterations so far,
+  // given by its incremented induction variable incvar.
+  auto profileAllocation = [&](IRBuilder<> &B, Value *old, Value *ptr,
+                               Value *count, ConstantInt *byteSizeOfType,
+                               Value *incvar) {
+    auto track = [&](Value *V, Value *Orig) {
+      if (V != Orig)
+        if (auto I = dyn_cast<Instruction>(V))
+          scopeInstructions[alloc].push_back(I);
+      return V;
+    };
+    if (!profileSite)
+      profileSite = getTapeProfileSite(entryBuilder, newFunc, site, name);
+    auto i8p = getInt8PtrTy(T->getContext());
+    if (old)
+      old = track(B.CreatePointerCast(old, i8p), old);
+    ptr = track(B.CreatePointerCast(ptr, i8p), ptr);
+    if (incvar)
+      count = track(B.CreateMul(incvar, count, "", true, true), nullptr);
+    Value *bytes =
+        track(B.CreateMul(count, byteSizeOfType, "", true, true), nullptr);
+    track(CreateTapeProfile(B, profileSite, old, ptr, bytes), nullptr);
+  };
+
   Value *storeInto = alloc;
 
   // Iterating from outermost chunk to innermost chunk
@@ -901,7 +1135,8 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
         Instruction *ZeroInst = nullptr;
         Value *firstallocation = CreateAllocation(
             allocationBuilder, myType, size, name + "_malloccache", &malloccall,
-            /*ZeroMem*/ EnzymeZeroCache ? &ZeroInst : nullptr);
+            /*ZeroMem*/ EnzymeZeroCache ? &ZeroInst : nullptr,
+            /*isDefault*/ false, arena);
 
         scopeInstructions[alloc].push_back(malloccall);
         if (firstallocation != malloccall)
@@ -942,6 +1177,54 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
         for (auto post : PostCacheStore(storealloc, allocationBuilder)) {
           scopeInstructions[alloc].push_back(post);
         }
+        if (profile)
+          profileAllocation(allocationBuilder, nullptr, firstallocation, size,
+                            byteSizeOfType, /*incvar*/ nullptr);
+      } else if (isChunkedCache(sublimits, i)) {
+        llvm::PointerType *allocType = cast<PointerType>(types[i + 1]);
+
+        // Append a fixed-size block to the directory whenever the dynamic
+        // loop enters a new block of iterations. Unlike the reallocation
+        // below, cached values are never moved.
+        auto zerostore = allocationBuilder.CreateStore(
+            getUndefinedValueForType(*newFunc->getParent(), allocType,
+                                     /*forceZero*/ true),
+            storeInto);
+        scopeInstructions[alloc].push_back(zerostore);
+
+        IRBuilder<> build(containedloops.back().first.incvar->getNextNode());
+        Value *allocation = build.CreateLoad(allocType, storeInto);
+
+        auto dirType = PointerType::getUnqual(getInt8PtrTy(T->getContext()));
+        if (allocation->getType() != dirType) {
+          auto I = cast<Instruction>(build.CreateBitCast(allocation, dirType));
+          scopeInstructions[alloc].push_back(I);
+          allocation = I;
+        }
+
+        CallInst *chunkcall = nullptr;
+        Value *chunked = CreateChunkedAllocation(
+            build, allocation, myType, containedloops.back().first.incvar,
+            size, getChunkedCacheShift(), name + "_chunkedcache", &chunkcall,
+            EnzymeZeroCache && i == 0, arena);
+        scopeInstructions[alloc].push_back(chunkcall);
+
+        if (chunked->getType() != allocType) {
+          auto I = cast<Instruction>(build.CreateBitCast(chunked, allocType));
+          scopeInstructions[alloc].push_back(I);
+          chunked = I;
+        }
+
+        scopeAllocs[alloc].push_back(chunkcall);
+
+        storealloc = build.CreateStore(chunked, storeInto);
+        scopeInstructions[alloc].push_back(storealloc);
+        for (auto post : PostCacheStore(storealloc, build)) {
+          scopeInstructions[alloc].push_back(post);
+        }
+        if (profile)
+          profileAllocation(build, allocation, chunked, size, byteSizeOfType,
+                            containedloops.back().first.incvar);
       } else {
         llvm::PointerType *allocType = cast<PointerType>(types[i + 1]);
         llvm::PointerType *mallocType = malloctypes[i];
@@ -968,7 +1251,8 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
         CallInst *realloccall = nullptr;
         auto reallocation = CreateReAllocation(
             build, allocation, myType, containedloops.back().first.incvar, size,
-            name + "_realloccache", &realloccall, EnzymeZeroCache && i == 0);
+            name + "_realloccache", &realloccall, EnzymeZeroCache && i == 0,
+            arena);
 
         scopeInstructions[alloc].push_back(cast<Instruction>(reallocation));
 
@@ -989,24 +1273,36 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
         for (auto post : PostCacheStore(storealloc, build)) {
           scopeInstructions[alloc].push_back(post);
         }
+        if (profile)
+          profileAllocation(build, allocation, reallocation, size,
+                            byteSizeOfType, containedloops.back().first.incvar);
       }
 
       // Regardless of how allocated (dynamic vs static), mark it
       // as having the requisite alignment
       storealloc->setAlignment(Align(alignSize));
+      usedTapeArena |= arena;
     }
 
-    // Free the memory, if requested
-    if (shouldFree) {
+    // Free the memory, if requested. Arena allocations are instead released
+    // together once the reverse pass completes.
+    if (shouldFree && !arena) {
       if (CachePointerInvariantGroups.find(std::make_pair((Value *)alloc, i)) ==
           CachePointerInvariantGroups.end()) {
         MDNode *invgroup = MDNode::getDistinct(alloc->getContext(), {});
         CachePointerInvariantGroups[std::make_pair((Value *)alloc, i)] =
             invgroup;
       }
+      // A chunked cache is only known to hold the directory's first block
+      // pointer and terminator.
+      ConstantInt *derefSize = byteSizeOfType;
+      if (isChunkedCache(sublimits, i))
+        derefSize = ConstantInt::get(
+            byteSizeOfType->getType(),
+            2 * newFunc->getParent()->getDataLayout().getPointerSize());
       auto freecall = freeCache(
           containedloops.back().first.preheader, sublimits, i, alloc,
-          byteSizeOfType, storeInto,
+          derefSize, storeInto,
           CachePointerInvariantGroups[std::make_pair((Value *)alloc, i)]);
       if (freecall && malloccall) {
         auto ident = MDNode::getDistinct(malloccall->getContext(), {});
@@ -1022,12 +1318,21 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
     if (i != 0) {
       IRBuilder<> v(&sublimits[i - 1].second.back().first.preheader->back());
 
+      bool chunked = isChunkedCache(sublimits, i);
+      Value *blockIdx = nullptr;
       Value *idx = computeIndexOfChunk(
           /*inForwardPass*/ true, v, containedloops,
-          /*available*/ ValueToValueMapTy());
+          /*available*/ ValueToValueMapTy(), chunked ? &blockIdx : nullptr);
 
       storeInto = v.CreateLoad(types[i + 1], storeInto);
       cast<LoadInst>(storeInto)->setAlignment(Align(alignSize));
+      if (chunked) {
+        auto blockType = PointerType::getUnqual(types[i]);
+        storeInto = v.CreateInBoundsGEP(blockType, storeInto, blockIdx);
+        storeInto = v.CreateLoad(blockType, storeInto);
+        cast<LoadInst>(storeInto)->setAlignment(Align(getCacheAlignment(
+            newFunc->getParent()->getDataLayout().getPointerSize())));
+      }
       storeInto = v.CreateGEP(types[i], storeInto, idx);
       cast<GetElementPtrInst>(storeInto)->setIsInBounds(true);
     }
@@ -1038,7 +1343,7 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
 Value *CacheUtility::computeIndexOfChunk(
     bool inForwardPass, IRBuilder<> &v,
     ArrayRef<std::pair<LoopContext, llvm::Value *>> containedloops,
-    const ValueToValueMapTy &available) {
+    const ValueToValueMapTy &available, Value **blockIdx) {
   // List of loop indices in chunk from innermost to outermost
   SmallVector<Value *, 3> indices;
   // List of cumulative indices in chunk from innermost to outermost
@@ -1081,6 +1386,17 @@ Value *CacheUtility::computeIndexOfChunk(
 
   assert(indices.size() > 0);
 
+  // For a chunked cache, the outermost (dynamic) loop selects the block and
+  // the index is computed relative to the start of that block.
+  if (blockIdx) {
+    unsigned shift = getChunkedCacheShift();
+    Value *outer = indices.back();
+    *blockIdx = v.CreateLShr(outer, shift);
+    indices.back() =
+        v.CreateAnd(outer, ConstantInt::get(outer->getType(),
+                                            (1ULL << shift) - 1));
+  }
+
   // Compute the index into the pointer
   Value *idx = indices[0];
   for (unsigned ind = 1; ind < indices.size(); ++ind) {
@@ -1513,6 +1829,8 @@ Value *CacheUtility::getCachePointer(llvm::Type *T, bool inForwardPass,
 
       BB->eraseFromParent();
     }
+    if (isChunkedCache(sublimits, i))
+      allocType = PointerType::getUnqual(allocType);
     types.push_back(allocType);
   }
 
@@ -1559,8 +1877,25 @@ Value *CacheUtility::getCachePointer(llvm::Type *T, bool inForwardPass,
     const auto &containedloops = sublimits[i].second;
 
     if (containedloops.size() > 0) {
+      bool chunked = isChunkedCache(sublimits, i);
+      Value *blockIdx = nullptr;
       Value *idx = computeIndexOfChunk(inForwardPass, BuilderM, containedloops,
-                                       available);
+                                       available,
+                                       chunked ? &blockIdx : nullptr);
+      // Lookup the block holding this iteration from the directory
+      if (chunked) {
+        auto blockType = PointerType::getUnqual(types[i]);
+        next = BuilderM.CreateInBoundsGEP(blockType, next, blockIdx);
+        if (storeInInstructionsMap && isa<AllocaInst>(cache))
+          scopeInstructions[cast<AllocaInst>(cache)].push_back(
+              cast<Instruction>(next));
+        next = BuilderM.CreateLoad(blockType, next);
+        cast<LoadInst>(next)->setAlignment(Align(getCacheAlignment(
+            newFunc->getParent()->getDataLayout().getPointerSize())));
+        if (storeInInstructionsMap && isa<AllocaInst>(cache))
+          scopeInstructions[cast<AllocaInst>(cache)].push_back(
+              cast<Instruction>(next));
+      }
       if (EfficientBoolCache && isi1 && i == 0)
         idx = BuilderM.CreateLShr(
             idx, ConstantInt::get(Type::getInt64Ty(newFunc->getContext()), 3));
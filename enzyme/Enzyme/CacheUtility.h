@@ -56,7 +56,24 @@ extern "C" {
 /// Pack 8 bools together in a single byte
 extern llvm::cl::opt<bool> EfficientBoolCache;
 
+/// Cache integers in the narrowest type which losslessly holds their range
+extern llvm::cl::opt<bool> EnzymeNarrowIntCache;
+
 extern llvm::cl::opt<bool> EnzymeZeroCache;
+
+/// Allocate tape buffers from the thread-local tape arena runtime
+extern llvm::cl::opt<bool> EnzymeTapeArena;
+
+/// Store caches of dynamic loops in fixed-size blocks rather than a single
+/// reallocated buffer
+extern llvm::cl::opt<bool> EnzymeChunkedCache;
+
+/// Report every cache allocation and free to the tape profiling runtime
+extern llvm::cl::opt<bool> EnzymeTapeProfile;
+
+/// Memory budget (in bytes) against which the tape of each loop is compared
+/// to suggest a binomial checkpointing schedule
+extern llvm::cl::opt<unsigned long long> EnzymeCheckpointBudget;
 }
 
 /// Container for all loop information to synthesize gradients
@@ -265,6 +282,12 @@ public:
   SubLimitType getSubLimits(bool inForwardPass, llvm::IRBuilder<> *RB,
                             LimitContext ctx, llvm::Value *extraSize = nullptr);
 
+  /// Whether the i'th chunk of sublimits is stored as a directory of
+  /// fixed-size blocks (see CreateChunkedAllocation), rather than a single
+  /// buffer. This is only the case for chunks whose outermost loop has a
+  /// dynamic number of iterations.
+  bool isChunkedCache(const SubLimitType &sublimits, int i) const;
+
 private:
   /// Internal data structure used by getSubLimit to avoid computing the same
   /// loop limit multiple times if possible. Map's a desired limitMinus1 (see
@@ -283,11 +306,14 @@ private:
       SizeCache;
 
   /// Given a loop context, compute the corresponding index into said loop at
-  /// the IRBuilder<>
+  /// the IRBuilder<>. If blockIdx is given, the chunk is stored in blocks and
+  /// the index of the block is stored into blockIdx, with the returned index
+  /// being relative to the start of that block.
   llvm::Value *computeIndexOfChunk(
       bool inForwardPass, llvm::IRBuilder<> &v,
       llvm::ArrayRef<std::pair<LoopContext, llvm::Value *>> containedloops,
-      const llvm::ValueToValueMapTy &available);
+      const llvm::ValueToValueMapTy &available,
+      llvm::Value **blockIdx = nullptr);
 
 private:
   /// Given a cache allocation and an index denoting how many Chunks deep the
@@ -334,11 +360,13 @@ protected:
 public:
   /// Create a cache of Type T at the given LimitContext. If allocateInternal is
   /// set this will allocate the requesite memory. If extraSize is set,
-  /// allocations will be a factor of extraSize larger
+  /// allocations will be a factor of extraSize larger. If set, site is the
+  /// instruction whose value is cached, used to attribute tape profiles
   llvm::AllocaInst *createCacheForScope(LimitContext ctx, llvm::Type *T,
                                         llvm::StringRef name, bool shouldFree,
                                         bool allocateInternal = true,
-                                        llvm::Value *extraSize = nullptr);
+                                        llvm::Value *extraSize = nullptr,
+                                        llvm::Instruction *site = nullptr);
 
   /// High-level utility to "unwrap" an instruction at a new location specified
   /// by BuilderM. Depending on the mode, it will either just unwrap this
@@ -368,6 +396,33 @@ public:
 
   virtual bool assumeDynamicLoopOfSizeOne(llvm::Loop *L) const = 0;
 
+  /// Whether caches which would be freed by freeCache should instead be
+  /// allocated from the thread-local tape arena and released all at once.
+  /// Subclasses who can guarantee the arena is released after the last use of
+  /// the cache may enable this.
+  virtual bool useTapeArena() const { return false; }
+
+  /// Whether any cache has been allocated from the tape arena
+  bool usedTapeArena = false;
+
+  /// Tape usage of an outermost loop, accumulated over all of its caches
+  struct LoopTapeUsage {
+    /// Bytes cached per iteration of the loop
+    uint64_t bytesPerIteration = 0;
+    /// Whether every inner loop and cache had a constant size
+    bool exact = true;
+  };
+
+  /// Tape usage of each outermost loop by header, only recorded if a
+  /// checkpoint budget is given
+  std::map<llvm::BasicBlock *, LoopTapeUsage> loopTapeUsage;
+
+  /// For each outermost loop whose tape exceeds the checkpoint budget, emit a
+  /// remark with the number of snapshots of its loop-carried state a binomial
+  /// checkpointing schedule (see enzyme/checkpoint/revolve.h) could keep
+  /// within the budget, and the resulting recomputation.
+  void reportCheckpointSchedule() const;
+
   /// If an allocation is requested to be freed, this subclass will be called to
   /// chose how and where to free it. It is by default not implemented, falling
   /// back to an error. Subclasses who want to free memory should implement this
@@ -0,0 +1,462 @@
+//===- DerivativeCache.cpp - Persistent cache of derivative functions -----===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the content-addressed cache of derivative functions
+// kept in the directory given by -enzyme-derivative-cache-dir.
+//
+//===----------------------------------------------------------------------===//
+
+#include "DerivativeCache.h"
+
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+extern "C" {
+llvm::cl::opt<std::string> EnzymeDerivativeCacheDir(
+    "enzyme-derivative-cache-dir", cl::init(""), cl::Hidden,
+    cl::desc("Directory in which to cache derivatives across compilations"));
+
+// Options which influence the generated derivatives, and thus are part of the
+// key of each cached derivative.
+extern llvm::cl::opt<bool> EnzymePreopt;
+extern llvm::cl::opt<bool> EnzymeInline;
+extern llvm::cl::opt<bool> EnzymeNoAlias;
+extern llvm::cl::opt<bool> EnzymeAggressiveAA;
+extern llvm::cl::opt<bool> EnzymeLowerGlobals;
+extern llvm::cl::opt<bool> EnzymeCoalese;
+extern llvm::cl::opt<bool> EnzymeNameInstructions;
+extern llvm::cl::opt<bool> EnzymeSelectOpt;
+extern llvm::cl::opt<bool> EnzymeAutoSparsity;
+extern llvm::cl::opt<bool> EnzymeAlwaysInlineDiff;
+extern llvm::cl::opt<bool> EnzymeNewCache;
+extern llvm::cl::opt<bool> EnzymeMinCutCache;
+extern llvm::cl::opt<bool> EnzymeLoopInvariantCache;
+extern llvm::cl::opt<bool> EnzymeInactiveDynamic;
+extern llvm::cl::opt<bool> EnzymeRuntimeActivityCheck;
+extern llvm::cl::opt<bool> EnzymeSharedForward;
+extern llvm::cl::opt<bool> EnzymeRegisterReduce;
+extern llvm::cl::opt<bool> EnzymeSpeculatePHIs;
+extern llvm::cl::opt<bool> EnzymeFreeInternalAllocations;
+extern llvm::cl::opt<bool> EnzymeRematerialize;
+extern llvm::cl::opt<bool> EnzymeVectorSplitPhi;
+extern llvm::cl::opt<bool> EnzymeLapackCopy;
+extern llvm::cl::opt<bool> EnzymeBlasCopy;
+extern llvm::cl::opt<bool> EnzymeFastMath;
+extern llvm::cl::opt<bool> EnzymeStrongZero;
+extern llvm::cl::opt<bool> EnzymeMemmoveWarning;
+extern llvm::cl::opt<bool> EnzymeRuntimeError;
+extern llvm::cl::opt<bool> looseTypeAnalysis;
+extern llvm::cl::opt<bool> nonmarkedglobals_inactiveloads;
+extern llvm::cl::opt<bool> EnzymeJuliaAddrLoad;
+extern llvm::cl::opt<bool> EnzymeAssumeUnknownNoFree;
+extern llvm::cl::opt<bool> EnzymeNonmarkedGlobalsInactive;
+extern llvm::cl::opt<bool> EnzymeEmptyFnInactive;
+extern llvm::cl::opt<bool> EnzymeGlobalActivity;
+extern llvm::cl::opt<bool> EnzymeEnableRecursiveHypotheses;
+extern llvm::cl::opt<bool> EfficientBoolCache;
+extern llvm::cl::opt<bool> EnzymeNarrowIntCache;
+extern llvm::cl::opt<bool> EnzymeZeroCache;
+extern llvm::cl::opt<bool> EnzymeTapeArena;
+extern llvm::cl::opt<bool> EnzymeTapeProfile;
+extern llvm::cl::opt<bool> EnzymeChunkedCache;
+extern llvm::cl::opt<bool> EfficientMaxCache;
+extern llvm::cl::opt<bool> RustTypeRules;
+extern llvm::cl::opt<bool> EnzymeStrictAliasing;
+extern llvm::cl::opt<bool> EnzymeTypeWarning;
+extern llvm::cl::opt<bool> EnzymePrivatizeShadows;
+extern llvm::cl::opt<int> EnzymeInlineCount;
+extern llvm::cl::opt<int> EnzymePostOptLevel;
+extern llvm::cl::opt<int> MaxIntOffset;
+extern llvm::cl::opt<int> MaxTypeOffset;
+extern llvm::cl::opt<unsigned> EnzymeChunkedCacheBlock;
+extern llvm::cl::opt<unsigned> EnzymeMaxTypeDepth;
+extern llvm::cl::opt<unsigned> EnzymePrivatizeShadowsMax;
+extern llvm::cl::opt<unsigned long long> EnzymeCheckpointBudget;
+}
+extern llvm::cl::opt<bool> EnzymeAttributor;
+
+/// Name of the metadata recording the derivative a cached module holds
+static const char *const RootMetadataName = "enzyme.derivative_cache";
+
+/// Describe the value of all options which influence the generated
+/// derivatives, or return false if an option which is not understood to be
+/// irrelevant was set.
+static bool printCodegenOptions(raw_ostream &OS) {
+  StringSet<> Described;
+  for (const cl::opt<bool> *Opt : {&EnzymePreopt,
+                                   &EnzymeInline,
+                                   &EnzymeNoAlias,
+                                   &EnzymeAggressiveAA,
+                                   &EnzymeLowerGlobals,
+                                   &EnzymeCoalese,
+                                   &EnzymeAttributor,
+                                   &EnzymeNameInstructions,
+                                   &EnzymeSelectOpt,
+                                   &EnzymeAutoSparsity,
+                                   &EnzymeAlwaysInlineDiff,
+                                   &EnzymeNewCache,
+                                   &EnzymeMinCutCache,
+                                   &EnzymeLoopInvariantCache,
+                                   &EnzymeInactiveDynamic,
+                                   &EnzymeRuntimeActivityCheck,
+                                   &EnzymeSharedForward,
+                                   &EnzymeRegisterReduce,
+                                   &EnzymeSpeculatePHIs,
+                                   &EnzymeFreeInternalAllocations,
+                                   &EnzymeRematerialize,
+                                   &EnzymeVectorSplitPhi,
+                                   &EnzymeLapackCopy,
+                                   &EnzymeBlasCopy,
+                                   &EnzymeFastMath,
+                                   &EnzymeStrongZero,
+                                   &EnzymeMemmoveWarning,
+                                   &EnzymeRuntimeError,
+                                   &looseTypeAnalysis,
+                                   &nonmarkedglobals_inactiveloads,
+                                   &EnzymeJuliaAddrLoad,
+                                   &EnzymeAssumeUnknownNoFree,
+                                   &EnzymeNonmarkedGlobalsInactive,
+                                   &EnzymeEmptyFnInactive,
+                                   &EnzymeGlobalActivity,
+                                   &EnzymeEnableRecursiveHypotheses,
+                                   &EfficientBoolCache,
+                                   &EnzymeNarrowIntCache,
+                                   &EnzymeZeroCache,
+                                   &EnzymeTapeArena,
+                                   &EnzymeTapeProfile,
+                                   &EnzymeChunkedCache,
+                                   &EfficientMaxCache,
+                                   &RustTypeRules,
+                                   &EnzymeStrictAliasing,
+                                   &EnzymeTypeWarning,
+                                   &EnzymePrivatizeShadows}) {
+    OS << Opt->ArgStr << "=" << (bool)*Opt << "\n";
+    Described.insert(Opt->ArgStr);
+  }
+  for (const cl::opt<int> *Opt :
+       {&EnzymeInlineCount, &EnzymePostOptLevel, &MaxIntOffset,
+        &MaxTypeOffset}) {
+    OS << Opt->ArgStr << "=" << (int)*Opt << "\n";
+    Described.insert(Opt->ArgStr);
+  }
+  for (const cl::opt<unsigned> *Opt :
+       {&EnzymeChunkedCacheBlock, &EnzymeMaxTypeDepth,
+        &EnzymePrivatizeShadowsMax}) {
+    OS << Opt->ArgStr << "=" << (unsigned)*Opt << "\n";
+    Described.insert(Opt->ArgStr);
+  }
+  OS << EnzymeCheckpointBudget.ArgStr << "="
+     << (unsigned long long)EnzymeCheckpointBudget << "\n";
+  Described.insert(EnzymeCheckpointBudget.ArgStr);
+
+  // The value of any other option is unknown here, so conservatively do not
+  // cache if one which may influence code generation was given.
+  for (auto &pair : cl::getRegisteredOptions()) {
+    StringRef Name = pair.first();
+    if (Name.take_front(6) != "enzyme" || Described.count(Name))
+      continue;
+    if (Name.contains("print") || Name == "enzyme-stats" ||
+        Name == "enzyme-derivative-cache-dir" ||
+        Name == "enzyme-type-analysis-threads")
+      continue;
+    if (pair.second->getNumOccurrences())
+      return false;
+  }
+  return true;
+}
+
+/// Collect the global values referenced by Root, transitively through the
+/// bodies, initializers and attached metadata of those for which Follow
+/// returns true.
+static void collectReferenced(GlobalValue *Root,
+                              SetVector<GlobalValue *> &Referenced,
+                              function_ref<bool(GlobalValue *)> Follow) {
+  SmallVector<Constant *, 8> todo;
+  SmallPtrSet<Constant *, 16> seen;
+  SmallVector<std::pair<unsigned, MDNode *>, 2> MDs;
+  SmallPtrSet<const Metadata *, 8> seenMD;
+  std::function<void(const Metadata *)> addMetadata =
+      [&](const Metadata *MD) {
+        if (!seenMD.insert(MD).second)
+          return;
+        if (auto CAM = dyn_cast<ConstantAsMetadata>(MD))
+          todo.push_back(CAM->getValue());
+        else if (auto N = dyn_cast<MDNode>(MD))
+          for (auto &Op : N->operands())
+            if (Op)
+              addMetadata(Op);
+      };
+  todo.push_back(Root);
+  while (todo.size()) {
+    auto C = todo.pop_back_val();
+    if (!seen.insert(C).second)
+      continue;
+    auto GV = dyn_cast<GlobalValue>(C);
+    if (!GV) {
+      for (auto &Op : C->operands())
+        todo.push_back(cast<Constant>(Op));
+      continue;
+    }
+    Referenced.insert(GV);
+    if (!Follow(GV))
+      continue;
+    if (auto GO = dyn_cast<GlobalObject>(GV)) {
+      MDs.clear();
+      GO->getAllMetadata(MDs);
+      for (auto &MD : MDs)
+        addMetadata(MD.second);
+    }
+    if (auto F = dyn_cast<Function>(GV)) {
+      for (auto &Op : F->operands())
+        if (Op)
+          todo.push_back(cast<Constant>(Op));
+      for (auto &I : instructions(F))
+        for (auto &Op : I.operands())
+          if (auto C = dyn_cast<Constant>(Op))
+            todo.push_back(C);
+    } else if (auto GVar = dyn_cast<GlobalVariable>(GV)) {
+      if (GVar->hasInitializer())
+        todo.push_back(GVar->getInitializer());
+    } else if (auto GA = dyn_cast<GlobalAlias>(GV)) {
+      todo.push_back(GA->getAliasee());
+    }
+  }
+}
+
+/// Clone the definitions of Defs from M into a new module, keeping only the
+/// declarations they require.
+static std::unique_ptr<Module>
+cloneDefinitions(Module &M, const SmallPtrSetImpl<const GlobalValue *> &Defs,
+                 ValueToValueMapTy &VMap) {
+  auto Clone = CloneModule(
+      M, VMap, [&](const GlobalValue *GV) { return Defs.count(GV) != 0; });
+  for (auto &F : make_early_inc_range(*Clone))
+    if (F.isDeclaration() && F.use_empty())
+      F.eraseFromParent();
+  for (auto &GV : make_early_inc_range(Clone->globals()))
+    if (GV.isDeclaration() && GV.use_empty())
+      GV.eraseFromParent();
+  Clone->setModuleIdentifier("");
+  Clone->setSourceFileName("");
+  return Clone;
+}
+
+void DerivativeCache::begin(Module &M) {
+  clear();
+  if (EnzymeDerivativeCacheDir.empty())
+    return;
+  for (auto &GV : M.global_values())
+    Original.insert(&GV);
+}
+
+std::string DerivativeCache::getKey(Function *todiff,
+                                    StringRef Request) const {
+  if (EnzymeDerivativeCacheDir.empty() || !Original.count(todiff) ||
+      todiff->empty())
+    return "";
+
+  std::string str;
+  raw_string_ostream ss(str);
+  ss << "enzyme " << ENZYME_VERSION_MAJOR << "." << ENZYME_VERSION_MINOR << "."
+     << ENZYME_VERSION_PATCH << " llvm " << LLVM_VERSION_MAJOR << "\n";
+  if (!printCodegenOptions(ss))
+    return "";
+  ss << Request << "\n";
+
+  // The derivative may depend on the body of anything the primal references.
+  SetVector<GlobalValue *> Referenced;
+  collectReferenced(todiff, Referenced, [](GlobalValue *) { return true; });
+  SmallPtrSet<const GlobalValue *, 16> Defs(Referenced.begin(),
+                                            Referenced.end());
+  ValueToValueMapTy VMap;
+  auto Primal = cloneDefinitions(*todiff->getParent(), Defs, VMap);
+  ss << "primal " << todiff->getName() << "\n";
+  Primal->print(ss, nullptr);
+  ss.flush();
+
+  auto Hash = SHA1::hash(arrayRefFromStringRef(str));
+  return toHex(Hash, /*LowerCase*/ true);
+}
+
+Function *DerivativeCache::load(Module &M, StringRef Key) {
+  auto found = Loaded.find(Key.str());
+  if (found != Loaded.end())
+    return cast_or_null<Function>((Value *)found->second);
+
+  SmallString<128> Path(EnzymeDerivativeCacheDir);
+  sys::path::append(Path, Key + ".bc");
+  auto Buf = MemoryBuffer::getFile(Path);
+  if (!Buf)
+    return nullptr;
+  auto Parsed = parseBitcodeFile((*Buf)->getMemBufferRef(), M.getContext());
+  if (!Parsed) {
+    consumeError(Parsed.takeError());
+    return nullptr;
+  }
+  std::unique_ptr<Module> Cached = std::move(*Parsed);
+  if (Cached->getDataLayout() != M.getDataLayout())
+    return nullptr;
+
+  // Each operand describes one derivative held by the entry, the first being
+  // the one requested, as {key, linked name, name, linkage}.
+  struct Entry {
+    std::string Key;
+    std::string LinkedName;
+    std::string Name;
+    GlobalValue::LinkageTypes Linkage;
+  };
+  SmallVector<Entry, 2> Entries;
+  auto MD = Cached->getNamedMetadata(RootMetadataName);
+  if (!MD || MD->getNumOperands() == 0)
+    return nullptr;
+  for (auto Op : MD->operands()) {
+    if (Op->getNumOperands() != 4)
+      return nullptr;
+    auto EKey = dyn_cast<MDString>(Op->getOperand(0));
+    auto Linked = dyn_cast<MDString>(Op->getOperand(1));
+    auto Name = dyn_cast<MDString>(Op->getOperand(2));
+    auto Linkage = mdconst::dyn_extract<ConstantInt>(Op->getOperand(3));
+    if (!EKey || !Linked || !Name || !Linkage ||
+        !Cached->getFunction(Linked->getString()))
+      return nullptr;
+    Entries.push_back({EKey->getString().str(), Linked->getString().str(),
+                       Name->getString().str(),
+                       (GlobalValue::LinkageTypes)Linkage->getZExtValue()});
+  }
+  if (Entries[0].Key != Key)
+    return nullptr;
+  MD->eraseFromParent();
+
+  if (Linker::linkModules(M, std::move(Cached)))
+    return nullptr;
+  Function *Result = nullptr;
+  for (auto &E : Entries) {
+    auto F = M.getFunction(E.LinkedName);
+    if (!F)
+      continue;
+    F->setLinkage(E.Linkage);
+    F->setName(E.Name);
+    Loaded.emplace(E.Key, F);
+    if (!Result)
+      Result = F;
+  }
+  return Result;
+}
+
+void DerivativeCache::record(StringRef Key, Function *NewF) {
+  Pending.emplace_back(Key.str(), NewF);
+}
+
+void DerivativeCache::flush() {
+  auto ToWrite = std::move(Pending);
+  Pending.clear();
+  if (ToWrite.empty() ||
+      sys::fs::create_directories(EnzymeDerivativeCacheDir.getValue()))
+    return;
+
+  for (auto &pair : ToWrite) {
+    auto F = cast_or_null<Function>((Value *)pair.second);
+    if (!F || F->empty())
+      continue;
+
+    // Everything Enzyme created for the derivative is stored with it, while
+    // the original module is referred to by name, which is not possible for
+    // values with local linkage.
+    SetVector<GlobalValue *> Referenced;
+    collectReferenced(F, Referenced,
+                      [&](GlobalValue *GV) { return !Original.count(GV); });
+    SmallPtrSet<const GlobalValue *, 16> Defs;
+    bool Legal = true;
+    for (auto GV : Referenced) {
+      if (!Original.count(GV))
+        Defs.insert(GV);
+      else if (GV->hasLocalLinkage())
+        Legal = false;
+    }
+    if (!Legal)
+      continue;
+
+    ValueToValueMapTy VMap;
+    auto Cached = cloneDefinitions(*F->getParent(), Defs, VMap);
+    auto &Ctx = Cached->getContext();
+    auto RootMD = Cached->getOrInsertNamedMetadata(RootMetadataName);
+
+    // Derivatives created while differentiating F are stored with it, and are
+    // named so that they can be reused once the entry has been loaded.
+    auto addEntry = [&](StringRef EKey, Function *Orig) {
+      auto NewF = cast<Function>(VMap[Orig]);
+      std::string LinkedName = (RootMetadataName + Twine(".") + EKey).str();
+      Metadata *Ops[] = {
+          MDString::get(Ctx, EKey), MDString::get(Ctx, LinkedName),
+          MDString::get(Ctx, NewF->getName()),
+          ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(Ctx),
+                                                   NewF->getLinkage()))};
+      RootMD->addOperand(MDNode::get(Ctx, Ops));
+      NewF->setName(LinkedName);
+      NewF->setLinkage(GlobalValue::ExternalLinkage);
+    };
+    addEntry(pair.first, F);
+    for (auto &nested : ToWrite) {
+      auto NF = cast_or_null<Function>((Value *)nested.second);
+      if (NF && NF != F && Defs.count(NF))
+        addEntry(nested.first, NF);
+    }
+    if (verifyModule(*Cached))
+      continue;
+
+    // Write to a temporary file first so that concurrent compilations never
+    // read a partially written entry.
+    SmallString<128> Path(EnzymeDerivativeCacheDir);
+    sys::path::append(Path, pair.first + ".bc");
+    SmallString<128> TmpPath;
+    int FD;
+    if (sys::fs::createUniqueFile(Path + ".%%%%%%.tmp", FD, TmpPath))
+      continue;
+    {
+      raw_fd_ostream OS(FD, /*shouldClose*/ true);
+      WriteBitcodeToFile(*Cached, OS);
+    }
+    if (sys::fs::rename(TmpPath, Path))
+      sys::fs::remove(TmpPath);
+  }
+}
+
+void DerivativeCache::clear() {
+  Original.clear();
+  Pending.clear();
+  Loaded.clear();
+}
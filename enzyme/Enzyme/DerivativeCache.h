@@ -0,0 +1,88 @@
+//===- DerivativeCache.h - Persistent cache of derivative functions -------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a content-addressed cache of derivative functions kept
+// in the directory given by -enzyme-derivative-cache-dir, which allows
+// derivatives of unchanged functions to be reused across compilations.
+//
+// A derivative is keyed by a hash of the IR of the function being
+// differentiated and everything it references, the parameters of the request,
+// the Enzyme version and the options which influence code generation. The
+// cached value is a bitcode module holding the derivative and the functions
+// and globals Enzyme created for it, which is linked into the module on a hit.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef ENZYME_DERIVATIVE_CACHE_H
+#define ENZYME_DERIVATIVE_CACHE_H
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+/// Directory of the persistent derivative cache, disabled if empty
+extern llvm::cl::opt<std::string> EnzymeDerivativeCacheDir;
+}
+
+class DerivativeCache {
+private:
+  /// Global values of the module before any derivative was created
+  llvm::SmallPtrSet<const llvm::GlobalValue *, 32> Original;
+
+  /// Derivatives created by this compilation which are to be written to the
+  /// cache once complete
+  std::vector<std::pair<std::string, llvm::WeakTrackingVH>> Pending;
+
+  /// Derivatives linked into the module from the cache, including those
+  /// contained within another cached derivative
+  std::map<std::string, llvm::WeakTrackingVH> Loaded;
+
+public:
+  /// Start caching derivatives created in M
+  void begin(llvm::Module &M);
+
+  /// Return the key of the derivative of todiff described by Request, or an
+  /// empty string if it may not be cached
+  std::string getKey(llvm::Function *todiff, llvm::StringRef Request) const;
+
+  /// Link the derivative with the given key into M, returning null if it is
+  /// not present in the cache
+  llvm::Function *load(llvm::Module &M, llvm::StringRef Key);
+
+  /// Write the derivative NewF to the cache under Key once all derivatives
+  /// have been created
+  void record(llvm::StringRef Key, llvm::Function *NewF);
+
+  /// Write all recorded derivatives which still exist to the cache
+  void flush();
+
+  void clear();
+};
+
+#endif
@@ -37,6 +37,7 @@
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Value.h"
@@ -51,6 +52,18 @@
 
 using namespace llvm;
 
+extern "C" {
+llvm::cl::opt<bool> EnzymePrivatizeShadows(
+    "enzyme-privatize-shadows", cl::init(true), cl::Hidden,
+    cl::desc("Accumulate the adjoints of shared memory repeatedly read within "
+             "a parallel region into thread-private copies, instead of with "
+             "an atomic update per read"));
+
+llvm::cl::opt<unsigned> EnzymePrivatizeShadowsMax(
+    "enzyme-privatize-shadows-max", cl::init(16), cl::Hidden,
+    cl::desc("Maximum number of shadow locations privatized per function"));
+}
+
 DiffeGradientUtils::DiffeGradientUtils(
     EnzymeLogic &Logic, Function *newFunc_, Function *oldFunc_,
     TargetLibraryInfo &TLI, TypeAnalysis &TA, TypeResults TR,
@@ -783,7 +796,14 @@ CallInst *DiffeGradientUtils::freeCache(BasicBlock *forwardPreheader,
       (unsigned)newFunc->getParent()->getDataLayout().getPointerSize());
   forfree->setAlignment(Align(align));
 
-  CallInst *ci = CreateDealloc(tbuild, forfree);
+  // The profiling runtime is told of the free beforehand, and the report is
+  // erased along with the free if the cache is moved onto the tape.
+  if (EnzymeTapeProfile)
+    scopeFrees[alloc].insert(CreateTapeProfileFree(tbuild, forfree));
+
+  CallInst *ci = isChunkedCache(sublimits, i)
+                     ? CreateChunkedDealloc(tbuild, forfree)
+                     : CreateDealloc(tbuild, forfree);
   if (ci) {
     if (newFunc->getSubprogram())
       ci->setDebugLoc(DILocation::get(newFunc->getContext(), 0, 0,
@@ -793,6 +813,150 @@ CallInst *DiffeGradientUtils::freeCache(BasicBlock *forwardPreheader,
   return ci;
 }
 
+/// Whether the memory pointed to by Arg is only ever read in its function,
+/// through Arg or any pointer which may alias it.
+static bool isOnlyReadArgument(Argument *Arg, AAResults &AA) {
+  SmallVector<Value *, 4> todo = {Arg};
+  SmallPtrSet<Value *, 4> seen;
+  while (todo.size()) {
+    auto cur = todo.pop_back_val();
+    if (!seen.insert(cur).second)
+      continue;
+    for (auto U : cur->users()) {
+      if (isa<GetElementPtrInst>(U) || isa<CastInst>(U)) {
+        todo.push_back(U);
+        continue;
+      }
+      if (auto LI = dyn_cast<LoadInst>(U))
+        if (LI->getPointerOperand() == cur && !LI->isVolatile())
+          continue;
+      return false;
+    }
+  }
+
+  // Arg does not escape within the function, so only calls given a pointer
+  // which may alias it can write to it.
+  for (auto &I : instructions(Arg->getParent())) {
+    if (!I.mayWriteToMemory())
+      continue;
+    Value *ptr = nullptr;
+    if (auto SI = dyn_cast<StoreInst>(&I))
+      ptr = SI->getPointerOperand();
+    else if (auto RMW = dyn_cast<AtomicRMWInst>(&I))
+      ptr = RMW->getPointerOperand();
+    else if (auto CAS = dyn_cast<AtomicCmpXchgInst>(&I))
+      ptr = CAS->getPointerOperand();
+    else if (auto CB = dyn_cast<CallBase>(&I)) {
+      for (auto &op : CB->args())
+        if (op->getType()->isPointerTy() && !AA.isNoAlias(op, Arg))
+          return false;
+      continue;
+    }
+    if (ptr && !AA.isNoAlias(ptr, Arg))
+      return false;
+  }
+  return true;
+}
+
+bool DiffeGradientUtils::accumulatePrivatizedShadow(
+    Instruction *orig, Value *origptr, Value *ptr, Value *dif, Type *addingType,
+    IRBuilder<> &BuilderM, MaybeAlign align) {
+  if (!EnzymePrivatizeShadows || !addingType->isFloatingPointTy() ||
+      dif->getType() != addingType)
+    return false;
+  auto Arch = llvm::Triple(newFunc->getParent()->getTargetTriple()).getArch();
+  if (Arch == Triple::amdgcn)
+    return false;
+
+  // Every thread runs this function over its share of the iterations, so a
+  // fixed shadow location updated within a loop is contended by all of them.
+  // Instead each thread sums its contribution privately, adding the total to
+  // the shared location once on return.
+  auto &DL = newFunc->getParent()->getDataLayout();
+  APInt Offset(DL.getIndexTypeSizeInBits(ptr->getType()), 0);
+  auto Base = dyn_cast<Argument>(
+      ptr->stripAndAccumulateInBoundsConstantOffsets(DL, Offset));
+  if (!Base)
+    return false;
+
+  PrivatizedShadow *Found = nullptr;
+  for (auto &P : privatizedShadows)
+    if (P.Base == Base && P.Offset == Offset.getSExtValue() &&
+        P.Ty == addingType)
+      Found = &P;
+
+  if (!Found) {
+    if (privatizedShadows.size() >= EnzymePrivatizeShadowsMax)
+      return false;
+
+    // An update outside of any loop happens once per thread regardless.
+    auto BB = reverseBlockToPrimal.find(BuilderM.GetInsertBlock());
+    LoopContext lc;
+    if (BB == reverseBlockToPrimal.end() || !getContext(BB->second, lc))
+      return false;
+
+    // The shadow must not be read in this function, as it would not observe
+    // the privately accumulated values. It is only read by the adjoints of
+    // writes to the primal, so it suffices that the primal memory is never
+    // written here.
+    APInt OrigOffset(DL.getIndexTypeSizeInBits(origptr->getType()), 0);
+    auto OrigBase = dyn_cast<Argument>(
+        origptr->stripAndAccumulateInBoundsConstantOffsets(DL, OrigOffset));
+    if (!OrigBase || !isOnlyReadArgument(OrigBase, *OrigAA))
+      return false;
+
+    IRBuilder<> A(inversionAllocs);
+    auto Private =
+        A.CreateAlloca(addingType, nullptr, OrigBase->getName() + "'priv");
+    A.CreateStore(Constant::getNullValue(addingType), Private);
+    privatizedShadows.push_back(
+        {Base, Offset.getSExtValue(), addingType, Private, align});
+    Found = &privatizedShadows.back();
+  }
+
+  dif = SanitizeDerivatives(orig, dif, BuilderM);
+  Value *prev = BuilderM.CreateLoad(addingType, Found->Private);
+  BuilderM.CreateStore(BuilderM.CreateFAdd(prev, dif), Found->Private);
+  return true;
+}
+
+void DiffeGradientUtils::reducePrivatizedShadows() {
+  if (privatizedShadows.empty())
+    return;
+  for (auto &BB : *newFunc) {
+    auto RI = dyn_cast_or_null<ReturnInst>(BB.getTerminator());
+    if (!RI)
+      continue;
+    IRBuilder<> B(RI);
+    B.setFastMathFlags(getFast());
+    for (auto &P : privatizedShadows) {
+      auto PT = cast<PointerType>(P.Base->getType());
+      Value *ptr = P.Base;
+      if (P.Offset != 0) {
+        auto i8 = Type::getInt8Ty(ptr->getContext());
+        ptr = B.CreatePointerCast(
+            ptr, PointerType::get(i8, PT->getAddressSpace()));
+        ptr = B.CreateInBoundsGEP(
+            i8, ptr,
+            ConstantInt::get(Type::getInt64Ty(ptr->getContext()), P.Offset));
+      }
+      ptr = B.CreatePointerCast(
+          ptr, PointerType::get(P.Ty, PT->getAddressSpace()));
+      Value *sum = B.CreateLoad(P.Ty, P.Private);
+#if LLVM_VERSION_MAJOR >= 13
+      B.CreateAtomicRMW(AtomicRMWInst::FAdd, ptr, sum, P.Alignment,
+                        AtomicOrdering::Monotonic, SyncScope::System);
+#else
+      AtomicRMWInst *rmw =
+          B.CreateAtomicRMW(AtomicRMWInst::FAdd, ptr, sum,
+                            AtomicOrdering::Monotonic, SyncScope::System);
+      if (P.Alignment)
+        rmw->setAlignment(*P.Alignment);
+#endif
+    }
+  }
+}
+
 void DiffeGradientUtils::addToInvertedPtrDiffe(Instruction *orig,
                                                Value *origVal, Type *addingType,
                                                unsigned start, unsigned size,
@@ -939,6 +1103,15 @@ void DiffeGradientUtils::addToInvertedPtrDiffe(Instruction *orig,
   if (backwardsOnlyShadows.find(TmpOrig) != backwardsOnlyShadows.end())
     Atomic = false;
 
+  if (Atomic && !mask && getWidth() == 1) {
+    MaybeAlign alignv = align;
+    if (alignv && start % alignv->value() != 0)
+      alignv = Align(1);
+    if (accumulatePrivatizedShadow(orig, origptr, ptr, dif, addingType,
+                                   BuilderM, alignv))
+      return;
+  }
+
   if (Atomic) {
     // For amdgcn constant AS is 4 and if the primal is in it we need to cast
     // the derivative value to AS 1
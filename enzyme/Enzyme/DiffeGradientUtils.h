@@ -110,6 +110,37 @@ public:
             int i, llvm::AllocaInst *alloc, llvm::ConstantInt *byteSizeOfType,
             llvm::Value *storeInto, llvm::MDNode *InvariantMD) override;
 
+  /// Caches of a combined forward and reverse pass are all dead once the
+  /// reverse pass returns, so they may be released together from the tape
+  /// arena (unless an embedder provided its own allocator).
+  bool useTapeArena() const override {
+    return EnzymeTapeArena && FreeMemory && !omp && !CustomAllocator &&
+           mode == DerivativeMode::ReverseModeCombined;
+  }
+
+  /// A thread-private accumulator for a location of shadow memory shared
+  /// between all threads executing this function.
+  struct PrivatizedShadow {
+    llvm::Value *Base;
+    int64_t Offset;
+    llvm::Type *Ty;
+    llvm::AllocaInst *Private;
+    llvm::MaybeAlign Alignment;
+  };
+  llvm::SmallVector<PrivatizedShadow, 2> privatizedShadows;
+
+  /// Add dif to a thread-private copy of the shared shadow location ptr rather
+  /// than atomically, returning false if this is not legal or profitable.
+  bool accumulatePrivatizedShadow(llvm::Instruction *orig, llvm::Value *origptr,
+                                  llvm::Value *ptr, llvm::Value *dif,
+                                  llvm::Type *addingType,
+                                  llvm::IRBuilder<> &BuilderM,
+                                  llvm::MaybeAlign align);
+
+  /// Reduce the thread-private accumulators into the shared shadow memory
+  /// before the reverse pass returns.
+  void reducePrivatizedShadows();
+
   /// align is the alignment that should be specified for load/store to pointer
   void addToInvertedPtrDiffe(llvm::Instruction *orig, llvm::Value *origVal,
                              llvm::Type *addingType, unsigned start,
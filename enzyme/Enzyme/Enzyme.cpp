@@ -75,6 +75,7 @@
 #include "ActivityAnalysis.h"
 #include "DiffeGradientUtils.h"
 #include "EnzymeLogic.h"
+#include "EnzymeStats.h"
 #include "GradientUtils.h"
 #include "TraceInterface.h"
 #include "TraceUtils.h"
@@ -113,6 +114,11 @@ llvm::cl::opt<bool> EnzymeAttributor("enzyme-attributor", cl::init(false),
 llvm::cl::opt<bool> EnzymeOMPOpt("enzyme-omp-opt", cl::init(false), cl::Hidden,
                                  cl::desc("Whether to enable openmp opt"));
 
+llvm::cl::opt<unsigned> EnzymeTypeAnalysisThreads(
+    "enzyme-type-analysis-threads", cl::init(1), cl::Hidden,
+    cl::desc("Number of threads used to analyze the types of all functions "
+             "being differentiated in a module ahead of time"));
+
 llvm::cl::opt<std::string> EnzymeTruncateAll(
     "enzyme-truncate-all", cl::init(""), cl::Hidden,
     cl::desc(
@@ -643,6 +649,9 @@ static bool ReplaceOriginalCall(IRBuilder<> &Builder, Value *ret,
 class EnzymeBase {
 public:
   EnzymeLogic Logic;
+  /// Type information of functions to differentiate which was computed ahead
+  /// of time by analyzeTypeArgs
+  std::map<Function *, FnTypeInfo> PrecomputedTypeArgs;
   EnzymeBase(bool PostOpt)
       : Logic(EnzymePostOpt.getNumOccurrences() ? EnzymePostOpt : PostOpt) {
     // initializeLowerAutodiffIntrinsicPass(*PassRegistry::getPassRegistry());
@@ -1340,8 +1349,7 @@ public:
                     overwritten_args});
   }
 
-  static FnTypeInfo populate_type_args(TypeAnalysis &TA, llvm::Function *fn,
-                                       DerivativeMode mode) {
+  static FnTypeInfo default_type_args(llvm::Function *fn) {
     FnTypeInfo type_args(fn);
     for (auto &a : type_args.Function->args()) {
       TypeTree dt;
@@ -1378,11 +1386,80 @@ public:
       dt = ConcreteType(fn->getReturnType()->getScalarType());
     }
     type_args.Return = dt.Only(-1, nullptr);
-
-    type_args = TA.analyzeFunction(type_args).getAnalyzedTypeInfo();
     return type_args;
   }
 
+  FnTypeInfo populate_type_args(TypeAnalysis &TA, llvm::Function *fn,
+                                DerivativeMode mode) {
+    auto found = PrecomputedTypeArgs.find(fn);
+    if (found != PrecomputedTypeArgs.end())
+      return found->second;
+    return TA.analyzeFunction(default_type_args(fn)).getAnalyzedTypeInfo();
+  }
+
+  /// Analyze the types of the functions differentiated in M concurrently,
+  /// ahead of lowering the calls which differentiate them. Functions whose
+  /// analysis may depend on IR modified by lowering (i.e. which may reach a
+  /// call to an Enzyme function) are left to be analyzed when lowered.
+  void analyzeTypeArgs(Module &M) {
+    PrecomputedTypeArgs.clear();
+    if (EnzymeTypeAnalysisThreads <= 1 || EnzymeTruncateAll != "")
+      return;
+
+    auto isEnzymeCall = [](Instruction &I) {
+      auto CI = dyn_cast<CallInst>(&I);
+      if (!CI)
+        return false;
+      auto Fn = dyn_cast<Function>(CI->getCalledOperand()->stripPointerCasts());
+      return Fn && Fn->getName().contains("__enzyme_");
+    };
+
+    SmallPtrSet<Function *, 4> callsEnzyme;
+    SetVector<Function *> toAnalyze;
+    for (Function &F : M) {
+      for (Instruction &I : instructions(F)) {
+        if (!isEnzymeCall(I))
+          continue;
+        callsEnzyme.insert(&F);
+        auto CI = cast<CallInst>(&I);
+        auto Name = cast<Function>(CI->getCalledOperand()->stripPointerCasts())
+                        ->getName();
+        if (!(Name.contains("__enzyme_autodiff") ||
+              Name.contains("__enzyme_fwddiff") ||
+              Name.contains("__enzyme_fwdsplit") ||
+              Name.contains("__enzyme_augmentfwd") ||
+              Name.contains("__enzyme_reverse")))
+          continue;
+        if (CI->arg_size() == 0)
+          continue;
+        Value *fn = CI->getArgOperand(0);
+        if (CI->hasStructRetAttr() && CI->arg_size() > 1)
+          fn = CI->getArgOperand(1);
+        if (auto F = dyn_cast_or_null<Function>(GetFunctionFromValue(fn)))
+          if (!F->empty())
+            toAnalyze.insert(F);
+      }
+    }
+
+    SmallVector<FnTypeInfo, 4> queries;
+    for (auto F : toAnalyze) {
+      SmallPtrSet<GlobalValue *, 16> resources;
+      collectTypeAnalysisResources(F, resources);
+      if (llvm::any_of(resources, [&](GlobalValue *GV) {
+            auto F = dyn_cast<Function>(GV);
+            return F && callsEnzyme.count(F);
+          }))
+        continue;
+      queries.push_back(default_type_args(F));
+    }
+
+    TypeAnalysis TA(Logic.PPC.FAM);
+    auto results = TA.analyzeFunctions(queries, EnzymeTypeAnalysisThreads);
+    for (size_t i = 0; i < queries.size(); i++)
+      PrecomputedTypeArgs.emplace(queries[i].Function,
+                                  results[i].getAnalyzedTypeInfo());
+  }
+
   static FloatRepresentation getDefaultFloatRepr(unsigned width) {
     switch (width) {
     case 16:
@@ -2892,6 +2969,9 @@ public:
     }
 
     if (Changed && EnzymeAttributor) {
+      // Attributes may change the results of type analysis
+      PrecomputedTypeArgs.clear();
+
       // TODO consider enabling when attributor does not delete
       // dead internal functions, which invalidates Enzyme's cache
       // code left here to re-enable upon Attributor patch
@@ -2961,6 +3041,7 @@ public:
 
   bool run(Module &M) {
     Logic.clear();
+    Logic.DiskCache.begin(M);
 
     for (Function &F : make_early_inc_range(M)) {
       attributeKnownFunctions(F);
@@ -3017,6 +3098,8 @@ public:
     }
 #endif
 
+    analyzeTypeArgs(M);
+
     std::set<Function *> done;
     for (Function &F : M) {
       if (F.empty())
@@ -3024,6 +3107,7 @@ public:
 
       changed |= lowerEnzymeCalls(F, done);
     }
+    PrecomputedTypeArgs.clear();
 
     for (Function &F : M) {
       if (F.empty())
@@ -3205,8 +3289,11 @@ public:
 
     for (const auto &pair : Logic.PPC.cache)
       pair.second->eraseFromParent();
+    Logic.DiskCache.flush();
     Logic.clear();
 
+    writeEnzymeStats();
+
     if (changed && Logic.PostOpt) {
       TimeTraceScope timeScope("Enzyme PostOpt", M.getName());
 
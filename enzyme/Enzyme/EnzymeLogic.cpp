@@ -83,6 +83,7 @@
 #include "llvm/ADT/StringSet.h"
 
 #include "DiffeGradientUtils.h"
+#include "EnzymeStats.h"
 #include "FunctionUtils.h"
 #include "GradientUtils.h"
 #include "InstructionBatcher.h"
@@ -124,6 +125,11 @@ cl::opt<bool> EnzymeAssumeUnknownNoFree(
     "enzyme-assume-unknown-nofree", cl::init(false), cl::Hidden,
     cl::desc("Assume unknown instructions are nofree as needed"));
 
+cl::opt<bool> EnzymeSharedActivity(
+    "enzyme-shared-activity", cl::init(true), cl::Hidden,
+    cl::desc("Share the activity analysis of a function between derivatives "
+             "with the same argument and return activity"));
+
 LLVMValueRef (*EnzymeFixupReturn)(LLVMBuilderRef, LLVMValueRef) = nullptr;
 }
 
@@ -140,6 +146,7 @@ struct CacheAnalysis {
   LoopInfo &OrigLI;
   DominatorTree &OrigDT;
   TargetLibraryInfo &TLI;
+  OverwriteCache &Overwrites;
   const SmallPtrSetImpl<BasicBlock *> &unnecessaryBlocks;
   const std::vector<bool> &overwritten_args;
   DerivativeMode mode;
@@ -152,12 +159,13 @@ struct CacheAnalysis {
           &rematerializableAllocations,
       TypeResults &TR, AAResults &AA, Function *oldFunc, ScalarEvolution &SE,
       LoopInfo &OrigLI, DominatorTree &OrigDT, TargetLibraryInfo &TLI,
+      OverwriteCache &Overwrites,
       const SmallPtrSetImpl<BasicBlock *> &unnecessaryBlocks,
       const std::vector<bool> &overwritten_args, DerivativeMode mode, bool omp)
       : allocationsWithGuaranteedFree(allocationsWithGuaranteedFree),
         rematerializableAllocations(rematerializableAllocations), TR(TR),
         AA(AA), oldFunc(oldFunc), SE(SE), OrigLI(OrigLI), OrigDT(OrigDT),
-        TLI(TLI), unnecessaryBlocks(unnecessaryBlocks),
+        TLI(TLI), Overwrites(Overwrites), unnecessaryBlocks(unnecessaryBlocks),
         overwritten_args(overwritten_args), mode(mode), omp(omp) {}
 
   bool is_value_mustcache_from_origin(Value *obj) {
@@ -353,8 +361,8 @@ struct CacheAnalysis {
           }
         }
 
-        if (!overwritesToMemoryReadBy(&TR, AA, TLI, SE, OrigLI, OrigDT, &li,
-                                      inst2)) {
+        if (!Overwrites.overwritesToMemoryReadBy(&TR, AA, TLI, SE, OrigLI,
+                                                 OrigDT, &li, inst2)) {
           return false;
         }
 
@@ -376,7 +384,8 @@ struct CacheAnalysis {
                     return false;
                   }
 
-                  if (!writesToMemoryReadBy(&TR, AA, TLI, &li, mid)) {
+                  if (!Overwrites.writesToMemoryReadBy(&TR, AA, TLI, &li,
+                                                       mid)) {
                     return false;
                   }
 
@@ -1027,7 +1036,7 @@ void calculateUnusedValuesInFunction(
                       return /*earlyBreak*/ false;
                   }
 
-                  if (writesToMemoryReadBy(
+                  if (gutils->Overwrites.writesToMemoryReadBy(
                           &gutils->TR, *gutils->OrigAA, TLI,
                           /*maybeReader*/ const_cast<MemTransferInst *>(mti),
                           /*maybeWriter*/ I)) {
@@ -1187,7 +1196,7 @@ void calculateUnusedStoresInFunction(
                 return /*earlyBreak*/ false;
 
               // if (I == &MTI) return;
-              if (writesToMemoryReadBy(
+              if (gutils->Overwrites.writesToMemoryReadBy(
                       &gutils->TR, *gutils->OrigAA, TLI,
                       /*maybeReader*/ const_cast<MemTransferInst *>(mti),
                       /*maybeWriter*/ I)) {
@@ -1588,9 +1597,10 @@ bool legalCombinedForwardReverse(
       auto consider = [&](Instruction *user) {
         if (!user->mayReadFromMemory())
           return false;
-        if (writesToMemoryReadBy(&gutils->TR, *gutils->OrigAA, gutils->TLI,
-                                 /*maybeReader*/ user,
-                                 /*maybeWriter*/ inst)) {
+        if (gutils->Overwrites.writesToMemoryReadBy(
+                &gutils->TR, *gutils->OrigAA, gutils->TLI,
+                /*maybeReader*/ user,
+                /*maybeWriter*/ inst)) {
 
           propagate(user);
           // Fast return if not legal
@@ -1621,9 +1631,10 @@ bool legalCombinedForwardReverse(
       if (!post->mayWriteToMemory())
         return false;
 
-      if (writesToMemoryReadBy(&gutils->TR, *gutils->OrigAA, gutils->TLI,
-                               /*maybeReader*/ inst,
-                               /*maybeWriter*/ post)) {
+      if (gutils->Overwrites.writesToMemoryReadBy(
+              &gutils->TR, *gutils->OrigAA, gutils->TLI,
+              /*maybeReader*/ inst,
+              /*maybeWriter*/ post)) {
         if (EnzymePrintPerf) {
           if (called)
             llvm::errs() << " [mem] failed to replace function "
@@ -1993,6 +2004,8 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
     unsigned width, bool AtomicAdd, bool omp) {
 
   TimeTraceScope timeScope("CreateAugmentedPrimal", todiff->getName());
+  EnzymeStatsScope statsScope(todiff,
+                              to_string(DerivativeMode::ReverseModePrimal));
 
   if (returnUsed)
     assert(!todiff->getReturnType()->isEmptyTy() &&
@@ -2040,6 +2053,7 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
 
   auto found = AugmentedCachedFunctions.find(tup);
   if (found != AugmentedCachedFunctions.end()) {
+    statsScope.setCached();
     return found->second;
   }
   TargetLibraryInfo &TLI = PPC.FAM.getResult<TargetLibraryAnalysis>(*todiff);
@@ -2409,8 +2423,9 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
                    gutils->rematerializableAllocations, gutils->TR,
                    *gutils->OrigAA, gutils->oldFunc,
                    PPC.FAM.getResult<ScalarEvolutionAnalysis>(*gutils->oldFunc),
-                   *gutils->OrigLI, *gutils->OrigDT, TLI, guaranteedUnreachable,
-                   _overwritten_argsPP, DerivativeMode::ReverseModePrimal, omp);
+                   *gutils->OrigLI, *gutils->OrigDT, TLI, gutils->Overwrites,
+                   guaranteedUnreachable, _overwritten_argsPP,
+                   DerivativeMode::ReverseModePrimal, omp);
   const std::map<CallInst *, const std::vector<bool>> overwritten_args_map =
       CA.compute_overwritten_args_for_callsites();
   gutils->overwritten_args_map_ptr = &overwritten_args_map;
@@ -2668,6 +2683,8 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
 
   gutils->eraseFictiousPHIs();
 
+  gutils->reportCheckpointSchedule();
+
   if (llvm::verifyFunction(*gutils->newFunc, &llvm::errs())) {
     llvm::errs() << *gutils->oldFunc << "\n";
     llvm::errs() << *gutils->newFunc << "\n";
@@ -2705,6 +2722,10 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
     }
   }
 
+  countEnzymeStat(
+      &EnzymeFunctionStats::tapeBytes,
+      nf->getParent()->getDataLayout().getTypeAllocSize(tapeType));
+
   bool recursive =
       AugmentedCachedFunctions.find(tup)->second.fn->getNumUses() > 0 ||
       forceAnonymousTape;
@@ -3668,11 +3689,44 @@ void createInvertedTerminator(DiffeGradientUtils *gutils,
   }
 }
 
+/// Describe the parameters of a request for a derivative of todiff which
+/// make up part of its key in the persistent derivative cache.
+static void
+printDerivativeCacheRequest(raw_ostream &ss, Function *todiff,
+                            DerivativeMode mode, DIFFE_TYPE retType,
+                            ArrayRef<DIFFE_TYPE> constant_args,
+                            const std::vector<bool> &overwritten_args,
+                            unsigned width, Type *additionalType,
+                            const FnTypeInfo &typeInfo, bool PostOpt) {
+  ss << "mode=" << to_string(mode) << " retType=" << to_string(retType)
+     << " width=" << width << " PostOpt=" << PostOpt << "\n";
+  ss << "additionalType=";
+  if (additionalType)
+    ss << *additionalType;
+  ss << "\nreturn " << typeInfo.Return.str() << "\n";
+  for (auto &arg : todiff->args()) {
+    auto idx = arg.getArgNo();
+    ss << "arg " << idx;
+    if (idx < constant_args.size())
+      ss << " " << to_string(constant_args[idx]);
+    if (idx < overwritten_args.size())
+      ss << " overwritten=" << overwritten_args[idx];
+    auto found = typeInfo.Arguments.find(&arg);
+    if (found != typeInfo.Arguments.end())
+      ss << " " << found->second.str();
+    auto known = typeInfo.KnownValues.find(&arg);
+    if (known != typeInfo.KnownValues.end())
+      ss << " " << to_string(known->second);
+    ss << "\n";
+  }
+}
+
 Function *EnzymeLogic::CreatePrimalAndGradient(
     RequestContext context, const ReverseCacheKey &&key, TypeAnalysis &TA,
     const AugmentedReturn *augmenteddata, bool omp) {
 
   TimeTraceScope timeScope("CreatePrimalAndGradient", key.todiff->getName());
+  EnzymeStatsScope statsScope(key.todiff, to_string(key.mode));
 
   assert(key.mode == DerivativeMode::ReverseModeCombined ||
          key.mode == DerivativeMode::ReverseModeGradient);
@@ -3688,10 +3742,14 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
   Function *prevFunction = nullptr;
   if (ReverseCachedFunctions.find(key) != ReverseCachedFunctions.end()) {
     prevFunction = ReverseCachedFunctions.find(key)->second;
-    if (!hasMetadata(prevFunction, "enzyme_placeholder"))
+    if (!hasMetadata(prevFunction, "enzyme_placeholder")) {
+      statsScope.setCached();
       return prevFunction;
-    if (augmenteddata && !augmenteddata->isComplete)
+    }
+    if (augmenteddata && !augmenteddata->isComplete) {
+      statsScope.setCached();
       return prevFunction;
+    }
   }
 
   if (key.returnUsed)
@@ -4104,6 +4162,31 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
     assert(augmenteddata->constant_args == key.constant_args);
   }
 
+  // Combined derivatives do not depend on any other derivative's tape and may
+  // be shared across compilations.
+  std::string DiskKey;
+  if (key.mode == DerivativeMode::ReverseModeCombined && !augmenteddata &&
+      !omp && !prevFunction) {
+    std::string str;
+    raw_string_ostream ss(str);
+    ss << "returnUsed=" << key.returnUsed
+       << " shadowReturnUsed=" << key.shadowReturnUsed
+       << " freeMemory=" << key.freeMemory << " AtomicAdd=" << key.AtomicAdd
+       << " forceAnonymousTape=" << key.forceAnonymousTape << "\n";
+    printDerivativeCacheRequest(ss, key.todiff, key.mode, key.retType,
+                                key.constant_args, key.overwritten_args,
+                                key.width, key.additionalType, oldTypeInfo,
+                                PostOpt);
+    DiskKey = DiskCache.getKey(key.todiff, ss.str());
+    if (DiskKey.size())
+      if (auto F = DiskCache.load(*key.todiff->getParent(), DiskKey)) {
+        statsScope.setCached();
+        return insert_or_assign2<ReverseCacheKey, Function *>(
+                   ReverseCachedFunctions, key, F)
+            ->second;
+      }
+  }
+
   ReturnType retVal =
       key.returnUsed ? (key.shadowReturnUsed ? ReturnType::ArgsWithTwoReturns
                                              : ReturnType::ArgsWithReturn)
@@ -4169,8 +4252,8 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
                    gutils->rematerializableAllocations, gutils->TR,
                    *gutils->OrigAA, gutils->oldFunc,
                    PPC.FAM.getResult<ScalarEvolutionAnalysis>(*gutils->oldFunc),
-                   *gutils->OrigLI, *gutils->OrigDT, TLI, guaranteedUnreachable,
-                   _overwritten_argsPP, key.mode, omp);
+                   *gutils->OrigLI, *gutils->OrigDT, TLI, gutils->Overwrites,
+                   guaranteedUnreachable, _overwritten_argsPP, key.mode, omp);
   const std::map<CallInst *, const std::vector<bool>> overwritten_args_map =
       (augmenteddata) ? augmenteddata->overwritten_args_map
                       : CA.compute_overwritten_args_for_callsites();
@@ -4411,6 +4494,24 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
 
   gutils->eraseFictiousPHIs();
 
+  gutils->reportCheckpointSchedule();
+
+  gutils->reducePrivatizedShadows();
+
+  // Caches allocated from the tape arena are not individually freed, instead
+  // release everything allocated since entry once the reverse pass is done.
+  if (gutils->usedTapeArena) {
+    IRBuilder<> markBuilder(gutils->inversionAllocs,
+                            gutils->inversionAllocs->begin());
+    Value *mark = CreateTapeArenaMark(markBuilder);
+    for (auto &BB : *gutils->newFunc) {
+      if (auto RI = dyn_cast_or_null<ReturnInst>(BB.getTerminator())) {
+        IRBuilder<> releaseBuilder(RI);
+        CreateTapeArenaRelease(releaseBuilder, mark);
+      }
+    }
+  }
+
   BasicBlock *entry = &gutils->newFunc->getEntryBlock();
 
   auto Arch =
@@ -4528,6 +4629,8 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
   if (EnzymePrint) {
     llvm::errs() << *nf << "\n";
   }
+  if (DiskKey.size())
+    DiskCache.record(DiskKey, nf);
   return nf;
 }
 
@@ -4540,6 +4643,7 @@ Function *EnzymeLogic::CreateForwardDiff(
     const AugmentedReturn *augmenteddata, bool omp) {
 
   TimeTraceScope timeScope("CreateForwardDiff", todiff->getName());
+  EnzymeStatsScope statsScope(todiff, to_string(mode));
 
   assert(retType != DIFFE_TYPE::OUT_DIFF);
 
@@ -4564,6 +4668,7 @@ Function *EnzymeLogic::CreateForwardDiff(
                          oldTypeInfo};
 
   if (ForwardCachedFunctions.find(tup) != ForwardCachedFunctions.end()) {
+    statsScope.setCached();
     return ForwardCachedFunctions.find(tup)->second;
   }
 
@@ -4750,6 +4855,22 @@ Function *EnzymeLogic::CreateForwardDiff(
                 "Cannot use provided custom derivative pass");
   }
 
+  std::string DiskKey;
+  if (mode == DerivativeMode::ForwardMode && !augmenteddata && !omp) {
+    std::string str;
+    raw_string_ostream ss(str);
+    ss << "returnUsed=" << returnUsed << " freeMemory=" << freeMemory << "\n";
+    printDerivativeCacheRequest(ss, todiff, mode, retType, constant_args,
+                                _overwritten_args, width, additionalArg,
+                                oldTypeInfo, PostOpt);
+    DiskKey = DiskCache.getKey(todiff, ss.str());
+    if (DiskKey.size())
+      if (auto F = DiskCache.load(*todiff->getParent(), DiskKey)) {
+        statsScope.setCached();
+        return ForwardCachedFunctions[tup] = F;
+      }
+  }
+
   bool retActive = retType != DIFFE_TYPE::CONSTANT;
 
   ReturnType retVal =
@@ -4825,8 +4946,8 @@ Function *EnzymeLogic::CreateForwardDiff(
         gutils->rematerializableAllocations, gutils->TR, *gutils->OrigAA,
         gutils->oldFunc,
         PPC.FAM.getResult<ScalarEvolutionAnalysis>(*gutils->oldFunc),
-        *gutils->OrigLI, *gutils->OrigDT, TLI, guaranteedUnreachable,
-        _overwritten_argsPP, mode, omp);
+        *gutils->OrigLI, *gutils->OrigDT, TLI, gutils->Overwrites,
+        guaranteedUnreachable, _overwritten_argsPP, mode, omp);
     const std::map<CallInst *, const std::vector<bool>> overwritten_args_map =
         CA.compute_overwritten_args_for_callsites();
     gutils->overwritten_args_map_ptr = &overwritten_args_map;
@@ -4978,6 +5099,8 @@ Function *EnzymeLogic::CreateForwardDiff(
   if (EnzymePrint) {
     llvm::errs() << *nf << "\n";
   }
+  if (DiskKey.size())
+    DiskCache.record(DiskKey, nf);
   return nf;
 }
 
@@ -5664,6 +5787,10 @@ llvm::Function *EnzymeLogic::CreateTruncateFunc(RequestContext context,
     report_fatal_error("function failed verification (5)");
   }
 
+  // Header-only runtimes (e.g. enzyme/fprt/softfloat.h) mark their operations
+  // always_inline so that they are folded into the truncated function.
+  PPC.AlwaysInline(NewF);
+
   return NewF;
 }
 
@@ -6613,8 +6740,62 @@ llvm::Function *EnzymeLogic::CreateNoFree(RequestContext context, Function *F) {
   return NewF;
 }
 
+std::shared_ptr<ActivityAnalyzer> EnzymeLogic::getActivityAnalyzer(
+    Function *oldFunc, TargetLibraryInfo &TLI,
+    const SmallPtrSetImpl<Value *> &constants,
+    const SmallPtrSetImpl<Value *> &actives, DIFFE_TYPE ReturnActivity,
+    const FnTypeInfo &typeInfo) {
+  auto create = [&](const SmallPtrSetImpl<Value *> &constants,
+                    const SmallPtrSetImpl<Value *> &actives) {
+    auto entry = std::make_shared<ActivityCacheEntry>();
+    entry->notForAnalysis = getGuaranteedUnreachable(oldFunc);
+    entry->ATA = std::make_unique<ActivityAnalyzer>(
+        PPC, PPC.getAAResultsFromFunction(oldFunc), entry->notForAnalysis, TLI,
+        constants, actives, ReturnActivity);
+    return entry;
+  };
+  if (!EnzymeSharedActivity) {
+    auto entry = create(constants, actives);
+    return std::shared_ptr<ActivityAnalyzer>(entry, entry->ATA.get());
+  }
+
+  // The values of the derivative itself, such as its shadow arguments, are
+  // never queried. They are left out so that the analysis can be shared.
+  auto getAnalyzedValues = [&](const SmallPtrSetImpl<Value *> &values) {
+    std::vector<Value *> res;
+    for (auto V : values) {
+      if (auto A = dyn_cast<Argument>(V))
+        if (A->getParent() != oldFunc)
+          continue;
+      if (auto I = dyn_cast<Instruction>(V))
+        if (I->getParent()->getParent() != oldFunc)
+          continue;
+      res.push_back(V);
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+  };
+  ActivityCacheKey key(oldFunc, &TLI, getAnalyzedValues(constants),
+                       getAnalyzedValues(actives), ReturnActivity, typeInfo);
+  auto found = ActivityCache.find(key);
+  if (found == ActivityCache.end()) {
+    SmallPtrSet<Value *, 4> analyzedConstants(std::get<2>(key).begin(),
+                                              std::get<2>(key).end());
+    SmallPtrSet<Value *, 4> analyzedActives(std::get<3>(key).begin(),
+                                            std::get<3>(key).end());
+    found = ActivityCache
+                .emplace(key, create(analyzedConstants, analyzedActives))
+                .first;
+  }
+  auto &entry = found->second;
+  return std::shared_ptr<ActivityAnalyzer>(entry, entry->ATA.get());
+}
+
 void EnzymeLogic::clear() {
+  ActivityCache.clear();
+  OverwriteCaches.clear();
   PPC.clear();
+  DiskCache.clear();
   AugmentedCachedFunctions.clear();
   ReverseCachedFunctions.clear();
   NoFreeCachedFunctions.clear();
@@ -45,6 +45,7 @@
 #include "llvm/Support/ErrorHandling.h"
 
 #include "ActivityAnalysis.h"
+#include "DerivativeCache.h"
 #include "FunctionUtils.h"
 #include "TraceUtils.h"
 #include "TypeAnalysis/TypeAnalysis.h"
@@ -416,6 +417,9 @@ public:
 
   EnzymeLogic(bool PostOpt) : PostOpt(PostOpt) {}
 
+  /// Derivatives persisted across compilations
+  DerivativeCache DiskCache;
+
   struct AugmentedCacheKey {
     llvm::Function *fn;
     DIFFE_TYPE retType;
@@ -605,6 +609,38 @@ public:
       std::tuple<llvm::Function *, ProbProgMode, bool, TraceInterface *>;
   std::map<TraceCacheKey, llvm::Function *> TraceCachedFunctions;
 
+  /// Activity analysis of a preprocessed function, shared by all derivatives
+  /// of it (e.g. an augmented forward pass and its reverse pass) with the same
+  /// constant and active values, return activity and argument types.
+  struct ActivityCacheEntry {
+    llvm::SmallPtrSet<llvm::BasicBlock *, 4> notForAnalysis;
+    std::unique_ptr<ActivityAnalyzer> ATA;
+  };
+  using ActivityCacheKey =
+      std::tuple<llvm::Function *, llvm::TargetLibraryInfo *,
+                 std::vector<llvm::Value *>, std::vector<llvm::Value *>,
+                 DIFFE_TYPE, FnTypeInfo>;
+  std::map<ActivityCacheKey, std::shared_ptr<ActivityCacheEntry>>
+      ActivityCache;
+
+  /// Return the activity analyzer of \p oldFunc for the given constant and
+  /// active values, return activity and argument types, creating it if needed.
+  std::shared_ptr<ActivityAnalyzer>
+  getActivityAnalyzer(llvm::Function *oldFunc, llvm::TargetLibraryInfo &TLI,
+                      const llvm::SmallPtrSetImpl<llvm::Value *> &constants,
+                      const llvm::SmallPtrSetImpl<llvm::Value *> &actives,
+                      DIFFE_TYPE ReturnActivity, const FnTypeInfo &typeInfo);
+
+  /// Overwrite queries over a preprocessed function, shared by all derivatives
+  /// of it with the same argument types.
+  using OverwriteCacheKey = std::pair<llvm::Function *, FnTypeInfo>;
+  std::map<OverwriteCacheKey, OverwriteCache> OverwriteCaches;
+
+  OverwriteCache &getOverwriteCache(llvm::Function *oldFunc,
+                                    const FnTypeInfo &typeInfo) {
+    return OverwriteCaches[OverwriteCacheKey(oldFunc, typeInfo)];
+  }
+
   /// Create the reverse pass, or combined forward+reverse derivative function.
   ///  \p context the instruction which requested this derivative (or null).
   ///  \p augmented is the data structure created by prior call to an
@@ -0,0 +1,173 @@
+//===- EnzymeStats.cpp - Per-function statistics of differentiation -------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file collects counters of the work Enzyme performs to differentiate
+// each function and writes them as JSON.
+//
+//===----------------------------------------------------------------------===//
+
+#include "EnzymeStats.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <vector>
+
+using namespace llvm;
+
+extern "C" {
+llvm::cl::opt<std::string> EnzymeStatsFile(
+    "enzyme-stats", cl::init(""), cl::Hidden, cl::value_desc("file.json"),
+    cl::desc("Write counters of type analysis, activity analysis, caching "
+             "and tape size for each differentiated function to this file "
+             "as JSON"));
+}
+
+/// Statistics of derivatives being created, innermost last. Kept per thread
+/// as type analyses may run concurrently.
+static std::vector<EnzymeFunctionStats *> &getStatsStack() {
+  static thread_local std::vector<EnzymeFunctionStats *> stack;
+  return stack;
+}
+
+/// Statistics of all derivatives created in this process
+static std::vector<EnzymeFunctionStats> &getCollectedStats() {
+  static std::vector<EnzymeFunctionStats> collected;
+  return collected;
+}
+
+EnzymeFunctionStats *getCurrentEnzymeStats() {
+  auto &stack = getStatsStack();
+  if (stack.empty())
+    return nullptr;
+  return stack.back();
+}
+
+void EnzymeFunctionStats::add(const EnzymeFunctionStats &other) {
+  typeWorklistPops += other.typeWorklistPops;
+  typePHIHypothesisRounds += other.typePHIHypothesisRounds;
+  activityHypotheses += other.activityHypotheses;
+  activityModRefQueries += other.activityModRefQueries;
+  unwrapCacheHits += other.unwrapCacheHits;
+  unwrapCacheMisses += other.unwrapCacheMisses;
+  lookupCacheHits += other.lookupCacheHits;
+  lookupCacheMisses += other.lookupCacheMisses;
+  minCutCached += other.minCutCached;
+  minCutRecomputed += other.minCutRecomputed;
+  tapeBytes += other.tapeBytes;
+  overwriteCacheHits += other.overwriteCacheHits;
+  overwriteCacheMisses += other.overwriteCacheMisses;
+}
+
+EnzymeStatsScope::EnzymeStatsScope(const Function *F, StringRef mode) {
+  if (EnzymeStatsFile.empty())
+    return;
+  stats = std::make_unique<EnzymeFunctionStats>();
+  stats->function = F->getName().str();
+  stats->mode = mode.str();
+  getStatsStack().push_back(stats.get());
+}
+
+EnzymeStatsScope::~EnzymeStatsScope() {
+  if (!stats)
+    return;
+  auto &stack = getStatsStack();
+  assert(stack.back() == stats.get());
+  stack.pop_back();
+
+  // Requests served from the cache of previously created derivatives do no
+  // work and are not reported.
+  if (cached)
+    return;
+  getCollectedStats().push_back(std::move(*stats));
+}
+
+EnzymeStatsCollector::EnzymeStatsCollector(EnzymeFunctionStats *stats)
+    : stats(stats) {
+  if (stats)
+    getStatsStack().push_back(stats);
+}
+
+EnzymeStatsCollector::~EnzymeStatsCollector() {
+  if (!stats)
+    return;
+  auto &stack = getStatsStack();
+  assert(stack.back() == stats);
+  stack.pop_back();
+}
+
+void addEnzymeStats(const EnzymeFunctionStats &stats) {
+  if (auto *current = getCurrentEnzymeStats())
+    current->add(stats);
+}
+
+void writeEnzymeStats() {
+  if (EnzymeStatsFile.empty())
+    return;
+
+  std::error_code EC;
+  raw_fd_ostream out(EnzymeStatsFile, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Could not open Enzyme statistics file " << EnzymeStatsFile
+           << ": " << EC.message() << "\n";
+    return;
+  }
+
+  json::OStream J(out, /*IndentSize*/ 2);
+  J.object([&] {
+    J.attributeArray("functions", [&] {
+      for (const auto &S : getCollectedStats()) {
+        J.object([&] {
+          J.attribute("function", S.function);
+          J.attribute("mode", S.mode);
+          J.attributeObject("typeAnalysis", [&] {
+            J.attribute("worklistPops", (int64_t)S.typeWorklistPops);
+            J.attribute("phiHypothesisRounds",
+                        (int64_t)S.typePHIHypothesisRounds);
+          });
+          J.attributeObject("activityAnalysis", [&] {
+            J.attribute("hypotheses", (int64_t)S.activityHypotheses);
+            J.attribute("modRefQueries", (int64_t)S.activityModRefQueries);
+          });
+          J.attributeObject("unwrapCache", [&] {
+            J.attribute("hits", (int64_t)S.unwrapCacheHits);
+            J.attribute("misses", (int64_t)S.unwrapCacheMisses);
+          });
+          J.attributeObject("lookupCache", [&] {
+            J.attribute("hits", (int64_t)S.lookupCacheHits);
+            J.attribute("misses", (int64_t)S.lookupCacheMisses);
+          });
+          J.attributeObject("minCut", [&] {
+            J.attribute("cached", (int64_t)S.minCutCached);
+            J.attribute("recomputed", (int64_t)S.minCutRecomputed);
+          });
+          J.attribute("tapeBytes", (int64_t)S.tapeBytes);
+          J.attributeObject("overwriteCache", [&] {
+            J.attribute("hits", (int64_t)S.overwriteCacheHits);
+            J.attribute("misses", (int64_t)S.overwriteCacheMisses);
+          });
+        });
+      }
+    });
+  });
+  out << "\n";
+}
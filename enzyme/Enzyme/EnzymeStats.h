@@ -0,0 +1,124 @@
+//===- EnzymeStats.h - Per-function statistics of differentiation ---------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares counters of the work Enzyme performs to differentiate
+// each function, written as JSON to the file given by -enzyme-stats.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef ENZYME_STATS_H
+#define ENZYME_STATS_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+extern "C" {
+/// File to write per-function statistics of differentiation to as JSON
+extern llvm::cl::opt<std::string> EnzymeStatsFile;
+}
+
+/// Counters of the work done to create a single derivative function. Work
+/// done for a callee which is itself differentiated is accounted to the callee.
+struct EnzymeFunctionStats {
+  /// Name of the function being differentiated
+  std::string function;
+  /// Derivative mode being created
+  std::string mode;
+
+  /// Values popped from the type analysis worklist
+  uint64_t typeWorklistPops = 0;
+  /// Rounds of type analysis PHI hypotheses
+  uint64_t typePHIHypothesisRounds = 0;
+  /// Activity analyzers forked to test an up or down hypothesis
+  uint64_t activityHypotheses = 0;
+  /// Alias analysis mod/ref queries made by activity analysis
+  uint64_t activityModRefQueries = 0;
+  /// unwrapM requests served from / missing in unwrap_cache
+  uint64_t unwrapCacheHits = 0;
+  uint64_t unwrapCacheMisses = 0;
+  /// lookupM requests served from / missing in lookup_cache
+  uint64_t lookupCacheHits = 0;
+  uint64_t lookupCacheMisses = 0;
+  /// Values the min-cut heuristic chose to cache, or to recompute
+  uint64_t minCutCached = 0;
+  uint64_t minCutRecomputed = 0;
+  /// Size of the tape struct of an augmented forward pass
+  uint64_t tapeBytes = 0;
+  /// Overwrite queries served from / missing in the OverwriteCache
+  uint64_t overwriteCacheHits = 0;
+  uint64_t overwriteCacheMisses = 0;
+
+  /// Add the counters of other to these
+  void add(const EnzymeFunctionStats &other);
+};
+
+/// Statistics of the derivative currently being created, or null if
+/// statistics are not being collected.
+EnzymeFunctionStats *getCurrentEnzymeStats();
+
+/// Add n to the given counter of the derivative being created, if any.
+static inline void countEnzymeStat(uint64_t EnzymeFunctionStats::*counter,
+                                   uint64_t n = 1) {
+  if (auto *stats = getCurrentEnzymeStats())
+    stats->*counter += n;
+}
+
+/// Account all counters updated during its lifetime to the derivative of F in
+/// the given mode. Scopes nest, with the innermost scope receiving the
+/// counts.
+class EnzymeStatsScope {
+public:
+  EnzymeStatsScope(const llvm::Function *F, llvm::StringRef mode);
+  ~EnzymeStatsScope();
+
+  /// Mark the derivative as served from a cache of previously created
+  /// derivatives, in which case it is not reported.
+  void setCached() { cached = true; }
+
+private:
+  std::unique_ptr<EnzymeFunctionStats> stats;
+  bool cached = false;
+};
+
+/// Account the counters updated by the current thread during its lifetime to
+/// stats, if not null. Used by helper threads, whose counts are then added to
+/// the derivative which requested the work with addEnzymeStats.
+class EnzymeStatsCollector {
+public:
+  EnzymeStatsCollector(EnzymeFunctionStats *stats);
+  ~EnzymeStatsCollector();
+
+private:
+  EnzymeFunctionStats *stats;
+};
+
+/// Add the given counters to the derivative being created, if any.
+void addEnzymeStats(const EnzymeFunctionStats &stats);
+
+/// Write the statistics of all derivatives created so far to EnzymeStatsFile,
+/// if given.
+void writeEnzymeStats();
+
+#endif
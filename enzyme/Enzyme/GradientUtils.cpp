@@ -35,6 +35,7 @@
 #include "Utils.h"
 
 #include "DifferentialUseAnalysis.h"
+#include "EnzymeStats.h"
 #include "LibraryFuncs.h"
 #include "TypeAnalysis/TBAA.h"
 
@@ -187,15 +188,16 @@ GradientUtils::GradientUtils(
       notForAnalysis(getGuaranteedUnreachable(oldFunc_)),
       ATA(oldFunc_->empty()
               ? nullptr
-              : new ActivityAnalyzer(
-                    Logic.PPC, Logic.PPC.getAAResultsFromFunction(oldFunc_),
-                    notForAnalysis, TLI_, constantvalues_, activevals_,
-                    ReturnActivity)),
+              : Logic.getActivityAnalyzer(oldFunc_, TLI_, constantvalues_,
+                                          activevals_, ReturnActivity,
+                                          TR_.getAnalyzedTypeInfo())),
       overwritten_args_map_ptr(nullptr), unnecessaryValuesP(nullptr),
       tid(nullptr), numThreads(nullptr),
       OrigAA(oldFunc_->empty() ? ((AAResults *)nullptr)
                                : &Logic.PPC.getAAResultsFromFunction(oldFunc_)),
-      TA(TA_), TR(TR_), omp(omp), width(width),
+      TA(TA_), TR(TR_),
+      Overwrites(Logic.getOverwriteCache(oldFunc_, TR_.getAnalyzedTypeInfo())),
+      omp(omp), width(width),
       shadowReturnUsed(shadowReturnUsed_), ArgDiffeTypes(ArgDiffeTypes_) {
   if (oldFunc_->empty())
     return;
@@ -757,11 +759,13 @@ Value *GradientUtils::unwrapM(Value *const val, IRBuilder<> &BuilderM,
               llvm::errs() << "unwrap_cache[cidx]: " << *cachedValue << "\n";
             }
             assert(cachedValue->getType() == val->getType());
+            countEnzymeStat(&EnzymeFunctionStats::unwrapCacheHits);
             return cachedValue;
           }
         }
       }
     }
+    countEnzymeStat(&EnzymeFunctionStats::unwrapCacheMisses);
   }
 
   if (this->mode == DerivativeMode::ReverseModeGradient ||
@@ -2407,7 +2411,9 @@ void GradientUtils::ensureLookupCached(Instruction *inst, bool shouldFree,
   LimitContext lctx(/*ReverseLimit*/ reverseBlocks.size() > 0, scope);
 
   AllocaInst *cache =
-      createCacheForScope(lctx, inst->getType(), inst->getName(), shouldFree);
+      createCacheForScope(lctx, inst->getType(), inst->getName(), shouldFree,
+                          /*allocateInternal*/ true, /*extraSize*/ nullptr,
+                          /*site*/ inst);
   assert(cache);
   Value *Val = inst;
   insert_or_assign(
@@ -2416,6 +2422,32 @@ void GradientUtils::ensureLookupCached(Instruction *inst, bool shouldFree,
   storeInstructionInCache(lctx, inst, cache, TBAA);
 }
 
+IntegerType *GradientUtils::getNarrowCacheType(Instruction *inst,
+                                               bool &isSigned) {
+  auto IT = dyn_cast<IntegerType>(inst->getType());
+  if (!IT || IT->getBitWidth() <= 8)
+    return nullptr;
+  auto origInst = isOriginal(inst);
+  if (!origInst || !OrigSE || !OrigSE->isSCEVable(origInst->getType()))
+    return nullptr;
+  auto S = OrigSE->getSCEV(origInst);
+  auto unsignedRange = OrigSE->getUnsignedRange(S);
+  auto signedRange = OrigSE->getSignedRange(S);
+  for (unsigned width : {8, 16, 32}) {
+    if (width >= IT->getBitWidth())
+      break;
+    if (unsignedRange.getActiveBits() <= width) {
+      isSigned = false;
+      return IntegerType::get(inst->getContext(), width);
+    }
+    if (signedRange.getMinSignedBits() <= width) {
+      isSigned = true;
+      return IntegerType::get(inst->getContext(), width);
+    }
+  }
+  return nullptr;
+}
+
 Value *GradientUtils::fixLCSSA(Instruction *inst, BasicBlock *forwardBlock,
                                bool legalInBlock) {
   assert(inst->getName() != "<badref>");
@@ -3009,15 +3041,15 @@ Value *GradientUtils::cacheForReverse(IRBuilder<> &BuilderQ, Value *malloc,
     if (toadd->getContext().supportsTypedPointers()) {
 #endif
       Type *innerType = toadd->getType();
-      for (size_t i = 0,
-                  limit = getSubLimits(
-                              /*inForwardPass*/ true, nullptr,
-                              LimitContext(
-                                  /*ReverseLimit*/ reverseBlocks.size() > 0,
-                                  BuilderQ.GetInsertBlock()))
-                              .size();
-           i < limit; ++i) {
+      auto sublimits =
+          getSubLimits(/*inForwardPass*/ true, nullptr,
+                       LimitContext(/*ReverseLimit*/ reverseBlocks.size() > 0,
+                                    BuilderQ.GetInsertBlock()));
+      for (size_t i = 0, limit = sublimits.size(); i < limit; ++i) {
         innerType = innerType->getPointerElementType();
+        // Chunked caches have an additional directory level
+        if (isChunkedCache(sublimits, i))
+          innerType = innerType->getPointerElementType();
       }
       if (EfficientBoolCache && malloc->getType()->isIntegerTy() &&
           toadd->getType() != innerType &&
@@ -3269,7 +3301,9 @@ BasicBlock *GradientUtils::prepRematerializedLoopEntry(LoopContext &lc) {
           auto found = scopeMap.find(inst);
           if (found == scopeMap.end()) {
             AllocaInst *cache = createCacheForScope(
-                lctx, inst->getType(), inst->getName(), /*shouldFree*/ true);
+                lctx, inst->getType(), inst->getName(), /*shouldFree*/ true,
+                /*allocate*/ true, /*extraSize*/ nullptr,
+                /*site*/ dyn_cast<Instruction>(inst));
             assert(cache);
             found = insert_or_assign(
                 scopeMap, inst,
@@ -3647,6 +3681,38 @@ BasicBlock *GradientUtils::prepRematerializedLoopEntry(LoopContext &lc) {
 
 /// Given an edge from BB to branchingBlock get the corresponding block to
 /// branch to in the reverse pass
+/// Create the loop metadata of the reverse of L, carrying over any hints the
+/// primal loop was given for vectorization and interleaving. The accesses of
+/// the reverse loop mirror those of the primal, so a loop which was requested
+/// to be vectorized typically has a reverse which is profitable to vectorize.
+static MDNode *getReverseLoopID(Loop *L) {
+  MDNode *LoopID = L->getLoopID();
+  if (!LoopID)
+    return nullptr;
+  SmallVector<Metadata *, 4> MDs = {nullptr};
+  for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; ++i) {
+    auto Hint = dyn_cast<MDNode>(LoopID->getOperand(i));
+    if (!Hint || Hint->getNumOperands() == 0)
+      continue;
+    auto Name = dyn_cast<MDString>(Hint->getOperand(0));
+    if (!Name)
+      continue;
+    // Whether the primal was vectorized says nothing about the reverse, and
+    // follow-up attributes refer to loops which do not exist in the reverse.
+    if (Name->getString() == "llvm.loop.isvectorized" ||
+        startsWith(Name->getString(), "llvm.loop.vectorize.followup"))
+      continue;
+    if (startsWith(Name->getString(), "llvm.loop.vectorize.") ||
+        startsWith(Name->getString(), "llvm.loop.interleave."))
+      MDs.push_back(Hint);
+  }
+  if (MDs.size() == 1)
+    return nullptr;
+  auto ReverseID = MDNode::getDistinct(LoopID->getContext(), MDs);
+  ReverseID->replaceOperandWith(0, ReverseID);
+  return ReverseID;
+}
+
 BasicBlock *GradientUtils::getReverseOrLatchMerge(BasicBlock *BB,
                                                   BasicBlock *branchingBlock) {
   assert(BB);
@@ -3706,7 +3772,9 @@ BasicBlock *GradientUtils::getReverseOrLatchMerge(BasicBlock *BB,
     Value *sub = tbuild.CreateAdd(av, ConstantInt::get(av->getType(), -1), "",
                                   /*NUW*/ false, /*NSW*/ true);
     tbuild.CreateStore(sub, lc.antivaralloc);
-    tbuild.CreateBr(resumeblock);
+    auto backedge = tbuild.CreateBr(resumeblock);
+    if (auto ReverseID = getReverseLoopID(L))
+      backedge->setMetadata(LLVMContext::MD_loop, ReverseID);
     return newBlocksForLoop_cache[tup] = incB;
   }
 
@@ -3976,7 +4044,7 @@ bool GradientUtils::legalRecompute(const Value *val,
             allFollowersOf(
                 const_cast<Instruction *>(orig), [&](Instruction *I) -> bool {
                   if (I->mayWriteToMemory() &&
-                      writesToMemoryReadBy(
+                      Overwrites.writesToMemoryReadBy(
                           &TR, *OrigAA, TLI,
                           /*maybeReader*/ const_cast<Instruction *>(orig),
                           /*maybeWriter*/ I)) {
@@ -4007,7 +4075,7 @@ bool GradientUtils::legalRecompute(const Value *val,
                   const_cast<GradientUtils *>(this)->LI, origStart,
                   const_cast<Instruction *>(orig), [&](Instruction *I) -> bool {
                     if (I->mayWriteToMemory() &&
-                        writesToMemoryReadBy(
+                        Overwrites.writesToMemoryReadBy(
                             &TR, *OrigAA, TLI,
                             /*maybeReader*/ const_cast<Instruction *>(orig),
                             /*maybeWriter*/ I)) {
@@ -6471,6 +6539,7 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
       assert(result->getType());
       result = BuilderM.CreateBitCast(result, val->getType());
       assert(result->getType() == inst->getType());
+      countEnzymeStat(&EnzymeFunctionStats::lookupCacheHits);
       return result;
     }
   }
@@ -6593,9 +6662,11 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
       assert(result->getType());
       result = BuilderM.CreateBitCast(result, val->getType());
       assert(result->getType() == inst->getType());
+      countEnzymeStat(&EnzymeFunctionStats::lookupCacheHits);
       return result;
     }
   }
+  countEnzymeStat(&EnzymeFunctionStats::lookupCacheMisses);
 
   // TODO consider call as part of
   bool lrc = false, src = false;
@@ -6651,9 +6722,10 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
               allInstructionsBetween(
                   *OrigLI, orig2, origInst, [&](Instruction *I) -> bool {
                     if (I->mayWriteToMemory() &&
-                        writesToMemoryReadBy(&TR, *OrigAA, TLI,
-                                             /*maybeReader*/ origInst,
-                                             /*maybeWriter*/ I)) {
+                        Overwrites.writesToMemoryReadBy(
+                            &TR, *OrigAA, TLI,
+                            /*maybeReader*/ origInst,
+                            /*maybeWriter*/ I)) {
                       failed = true;
                       // llvm::errs() << "FAILED: " << *I << "\n";
                       return /*earlyBreak*/ true;
@@ -6731,8 +6803,8 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
                   *OrigLI, SI, origInst, [&](Instruction *potentialAlias) {
                     if (!potentialAlias->mayWriteToMemory())
                       return false;
-                    if (!writesToMemoryReadBy(&TR, *OrigAA, TLI, origInst,
-                                              potentialAlias))
+                    if (!Overwrites.writesToMemoryReadBy(
+                            &TR, *OrigAA, TLI, origInst, potentialAlias))
                       return false;
 
                     if (auto II = dyn_cast<IntrinsicInst>(potentialAlias)) {
@@ -6749,8 +6821,8 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
                               if (mid == SI)
                                 return false;
 
-                              if (!writesToMemoryReadBy(&TR, *OrigAA, TLI,
-                                                        origInst, mid)) {
+                              if (!Overwrites.writesToMemoryReadBy(
+                                      &TR, *OrigAA, TLI, origInst, mid)) {
                                 return false;
                               }
                               lastStore = false;
@@ -6949,9 +7021,10 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
                       *OrigLI, &*origTerm, origInst,
                       [&](Instruction *I) -> bool {
                         if (I->mayWriteToMemory() &&
-                            writesToMemoryReadBy(&TR, *OrigAA, TLI,
-                                                 /*maybeReader*/ tmpload,
-                                                 /*maybeWriter*/ I)) {
+                            Overwrites.writesToMemoryReadBy(
+                                &TR, *OrigAA, TLI,
+                                /*maybeReader*/ tmpload,
+                                /*maybeWriter*/ I)) {
                           failed = true;
                           return /*earlyBreak*/ true;
                         }
@@ -6975,9 +7048,10 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
                         *OrigLI, &*origTerm, origInst,
                         [&](Instruction *I) -> bool {
                           if (I->mayWriteToMemory() &&
-                              writesToMemoryReadBy(&TR, *OrigAA, TLI,
-                                                   /*maybeReader*/ tmpload,
-                                                   /*maybeWriter*/ I)) {
+                              Overwrites.writesToMemoryReadBy(
+                                  &TR, *OrigAA, TLI,
+                                  /*maybeReader*/ tmpload,
+                                  /*maybeWriter*/ I)) {
                             failed = true;
                             return /*earlyBreak*/ true;
                           }
@@ -7009,7 +7083,9 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
                     assert(reverseBlocks.size());
                     cache = createCacheForScope(lctx, AT, li->getName(),
                                                 /*shouldFree*/ true,
-                                                /*allocate*/ true);
+                                                /*allocate*/ true,
+                                                /*extraSize*/ nullptr,
+                                                /*site*/ li);
                     assert(cache);
                     scopeMap.insert(
                         std::make_pair(AI, std::make_pair(cache, lctx)));
@@ -7180,9 +7256,10 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
               allInstructionsBetween(
                   *OrigLI, &*origTerm, origInst, [&](Instruction *I) -> bool {
                     if (I->mayWriteToMemory() &&
-                        writesToMemoryReadBy(&TR, *OrigAA, TLI,
-                                             /*maybeReader*/ origInst,
-                                             /*maybeWriter*/ I)) {
+                        Overwrites.writesToMemoryReadBy(
+                            &TR, *OrigAA, TLI,
+                            /*maybeReader*/ origInst,
+                            /*maybeWriter*/ I)) {
                       failed = true;
                       return /*earlyBreak*/ true;
                     }
@@ -7209,9 +7286,10 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
               allInstructionsBetween(
                   *OrigLI, &*origTerm, origInst, [&](Instruction *I) -> bool {
                     if (I->mayWriteToMemory() &&
-                        writesToMemoryReadBy(&TR, *OrigAA, TLI,
-                                             /*maybeReader*/ origInst,
-                                             /*maybeWriter*/ I)) {
+                        Overwrites.writesToMemoryReadBy(
+                            &TR, *OrigAA, TLI,
+                            /*maybeReader*/ origInst,
+                            /*maybeWriter*/ I)) {
                       failed = true;
                       return /*earlyBreak*/ true;
                     }
@@ -7260,7 +7338,8 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
               assert(reverseBlocks.size());
               cache = createCacheForScope(lctx, li->getType(), li->getName(),
                                           /*shouldFree*/ true,
-                                          /*allocate*/ true, /*extraSize*/ lim);
+                                          /*allocate*/ true, /*extraSize*/ lim,
+                                          /*site*/ li);
               assert(cache);
               scopeMap.insert(
                   std::make_pair(inst, std::make_pair(cache, lctx)));
@@ -7381,6 +7460,44 @@ Value *GradientUtils::lookupM(Value *val, IRBuilder<> &BuilderM,
     }
   }
 
+  // Integers cached within a loop are stored truncated to the narrowest type
+  // holding their range, and extended back when looked up.
+  auto foundNarrow = narrowCaches.find(inst);
+  if (foundNarrow == narrowCaches.end() && EnzymeNarrowIntCache &&
+      mode == DerivativeMode::ReverseModeCombined &&
+      scopeMap.find(inst) == scopeMap.end() && !inst->isTerminator() &&
+      LI.getLoopFor(scopeI)) {
+    bool isSigned = false;
+    if (auto narrowTy = getNarrowCacheType(inst, isSigned)) {
+      IRBuilder<> NB(inst->getParent());
+      if (isa<PHINode>(inst))
+        NB.SetInsertPoint(&*inst->getParent()->getFirstInsertionPt());
+      else
+        NB.SetInsertPoint(getNextNonDebugInstruction(inst));
+      auto narrow = cast<Instruction>(
+          NB.CreateTrunc(inst, narrowTy, inst->getName() + "_narrow"));
+      foundNarrow =
+          narrowCaches.emplace(inst, std::make_pair(narrow, isSigned)).first;
+    }
+  }
+  if (foundNarrow != narrowCaches.end()) {
+    Instruction *narrow = foundNarrow->second.first;
+    ensureLookupCached(narrow, /*shouldFree*/ true, scopeI);
+    assert(!isOriginalBlock(*BuilderM.GetInsertBlock()));
+    auto found = findInMap(scopeMap, (Value *)narrow);
+    Value *result = lookupValueFromCache(
+        narrow->getType(), /*isForwardPass*/ false, BuilderM, found->second,
+        found->first, /*isi1*/ false, available);
+    if (foundNarrow->second.second)
+      result = BuilderM.CreateSExt(result, inst->getType());
+    else
+      result = BuilderM.CreateZExt(result, inst->getType());
+    lookup_cache[BuilderM.GetInsertBlock()][val] = result;
+    if (result->getType() != val->getType())
+      result = BuilderM.CreateBitCast(result, val->getType());
+    return result;
+  }
+
   ensureLookupCached(inst, /*shouldFree*/ true, scopeI,
                      inst->getMetadata(LLVMContext::MD_tbaa));
   bool isi1 = inst->getType()->isIntegerTy() &&
@@ -8210,9 +8327,11 @@ void GradientUtils::computeMinCache() {
         }
     }
 
+    countEnzymeStat(&EnzymeFunctionStats::minCutCached, MinReq.size());
     for (auto V : Intermediates) {
       knownRecomputeHeuristic[V] = !MinReq.count(V);
       if (!MinReq.count(V) && NeedGraph.count(V)) {
+        countEnzymeStat(&EnzymeFunctionStats::minCutRecomputed);
         if (auto CI = dyn_cast<CallInst>(V))
           if (getFuncNameFromCall(CI) == "julia.call")
             assert(0);
@@ -8918,8 +9037,9 @@ void GradientUtils::computeForwardingProperties(Instruction *V) {
       SmallVector<Instruction *, 2> results;
       mayExecuteAfter(results, LI, storingOps, outer);
       for (auto res : results) {
-        if (overwritesToMemoryReadBy(&TR, *OrigAA, TLI, *OrigSE, *OrigLI,
-                                     *OrigDT, LI, res, outer)) {
+        if (Overwrites.overwritesToMemoryReadBy(&TR, *OrigAA, TLI, *OrigSE,
+                                                *OrigLI, *OrigDT, LI, res,
+                                                outer)) {
           EmitWarning("NotPromotable", *LI,
                       " Could not promote shadow allocation ", *V,
                       " due to pointer load ", *LI,
@@ -8973,8 +9093,9 @@ void GradientUtils::computeForwardingProperties(Instruction *V) {
     SmallVector<Instruction *, 2> results;
     mayExecuteAfter(results, LI, storingOps, outer);
     for (auto res : results) {
-      if (overwritesToMemoryReadBy(&TR, *OrigAA, TLI, *OrigSE, *OrigLI, *OrigDT,
-                                   LI, res, outer)) {
+      if (Overwrites.overwritesToMemoryReadBy(&TR, *OrigAA, TLI, *OrigSE,
+                                              *OrigLI, *OrigDT, LI, res,
+                                              outer)) {
         EmitWarning("NotPromotable", *LI, " Could not promote allocation ", *V,
                     " due to load ", *LI,
                     " which does not postdominates store ", *res);
@@ -8989,8 +9110,9 @@ void GradientUtils::computeForwardingProperties(Instruction *V) {
     SmallVector<Instruction *, 2> results;
     mayExecuteAfter(results, LI.loadCall, storingOps, outer);
     for (auto res : results) {
-      if (overwritesToMemoryReadBy(&TR, *OrigAA, TLI, *OrigSE, *OrigLI, *OrigDT,
-                                   LI.loadCall, res, outer)) {
+      if (Overwrites.overwritesToMemoryReadBy(&TR, *OrigAA, TLI, *OrigSE,
+                                              *OrigLI, *OrigDT, LI.loadCall,
+                                              res, outer)) {
         EmitWarning("NotPromotable", *LI.loadCall,
                     " Could not promote allocation ", *V,
                     " due to load-like call ", *LI.loadCall,
@@ -369,6 +369,8 @@ public:
   llvm::AAResults *OrigAA;
   TypeAnalysis &TA;
   TypeResults TR;
+  /// Overwrite queries over oldFunc, shared with other derivatives of it
+  OverwriteCache &Overwrites;
   bool omp;
 
 private:
@@ -491,6 +493,17 @@ public:
                           llvm::BasicBlock *scope = nullptr,
                           llvm::MDNode *TBAA = nullptr);
 
+  /// Truncations of integer instructions which are cached in place of the
+  /// instruction, along with whether they are recovered by sign extension
+  std::map<llvm::Instruction *, std::pair<llvm::Instruction *, bool>>
+      narrowCaches;
+
+  /// If the integer instruction inst can be cached losslessly in a narrower
+  /// integer type per the scalar evolution of the original function, return
+  /// that type, setting isSigned if it must be sign extended when looked up.
+  llvm::IntegerType *getNarrowCacheType(llvm::Instruction *inst,
+                                        bool &isSigned);
+
   std::map<llvm::Instruction *,
            llvm::ValueMap<llvm::BasicBlock *, llvm::WeakTrackingVH>>
       lcssaFixes;
@@ -310,38 +310,50 @@ public:
 protected:
   ChangeResult merge(const AbstractDenseLattice &lattice) {
     const auto &rhs = static_cast<const MemoryActivity &>(lattice);
+    if (&rhs == this)
+      return ChangeResult::NoChange;
     ChangeResult result = ChangeResult::NoChange;
-    DenseSet<DistinctAttr> known;
-    auto lhsRange = llvm::make_first_range(activityStates);
-    auto rhsRange = llvm::make_first_range(rhs.activityStates);
-    known.insert(lhsRange.begin(), lhsRange.end());
-    known.insert(rhsRange.begin(), rhsRange.end());
 
+    // Classes without an explicit state take the state of other classes,
+    // which is merged last. States equal to the merged state of other classes
+    // are dropped to keep the map small.
     MemoryActivityState updatedOther(otherMemoryActivity);
     result |= updatedOther.merge(rhs.otherMemoryActivity);
-    DenseMap<DistinctAttr, MemoryActivityState> updated;
-    for (DistinctAttr d : known) {
-      auto lhsIt = activityStates.find(d);
-      auto rhsIt = rhs.activityStates.find(d);
-      bool isKnownInLHS = lhsIt != activityStates.end();
-      bool isKnownInRHS = rhsIt != rhs.activityStates.end();
-      const MemoryActivityState *lhsActivity =
-          isKnownInLHS ? &lhsIt->getSecond() : &otherMemoryActivity;
-      const MemoryActivityState *rhsActivity =
-          isKnownInRHS ? &rhsIt->getSecond() : &rhs.otherMemoryActivity;
-      MemoryActivityState updatedActivity(*lhsActivity);
-      (void)updatedActivity.merge(*rhsActivity);
-      if ((lhsIt != activityStates.end() &&
-           updatedActivity != lhsIt->getSecond()) ||
-          (lhsIt == activityStates.end() &&
-           updatedActivity != otherMemoryActivity)) {
+
+    // Classes only known in RHS are computed against the state of other
+    // classes of LHS before anything is updated.
+    SmallVector<std::pair<DistinctAttr, MemoryActivityState>> added;
+    for (const auto &[d, rhsActivity] : rhs.activityStates) {
+      if (activityStates.count(d))
+        continue;
+      MemoryActivityState updatedActivity(otherMemoryActivity);
+      (void)updatedActivity.merge(rhsActivity);
+      if (updatedActivity != otherMemoryActivity)
         result |= ChangeResult::Change;
-      }
       if (updatedActivity != updatedOther)
-        updated.try_emplace(d, updatedActivity);
+        added.emplace_back(d, updatedActivity);
+    }
+
+    SmallVector<DistinctAttr> removed;
+    for (auto &[d, lhsActivity] : activityStates) {
+      auto rhsIt = rhs.activityStates.find(d);
+      const MemoryActivityState &rhsActivity =
+          rhsIt != rhs.activityStates.end() ? rhsIt->getSecond()
+                                            : rhs.otherMemoryActivity;
+      MemoryActivityState previous(lhsActivity);
+      (void)lhsActivity.merge(rhsActivity);
+      if (lhsActivity != previous)
+        result |= ChangeResult::Change;
+      if (lhsActivity == updatedOther)
+        removed.push_back(d);
     }
-    std::swap(updated, activityStates);
-    return otherMemoryActivity.merge(rhs.otherMemoryActivity) | result;
+
+    for (DistinctAttr d : removed)
+      activityStates.erase(d);
+    for (const auto &[d, activity] : added)
+      activityStates.try_emplace(d, activity);
+    otherMemoryActivity = updatedOther;
+    return result;
   }
 
 private:
@@ -133,7 +133,13 @@ public:
 
   bool operator==(const SetLattice<ValueT> &other) const {
     assert(isCanonical() && other.isCanonical());
-    return state == other.state && llvm::equal(elements, other.elements);
+    // The iteration order of a DenseSet depends on its insertion history, so
+    // compare by membership rather than element-wise.
+    if (state != other.state || elements.size() != other.elements.size())
+      return false;
+    return llvm::all_of(elements, [&](ValueT element) {
+      return other.elements.contains(element);
+    });
   }
 
   LLVM_DUMP_METHOD void print(llvm::raw_ostream &os) const {
@@ -253,31 +259,20 @@ public:
   ChangeResult join(const AbstractDenseLattice &other) {
     const auto &rhs =
         static_cast<const MapOfSetsLattice<KeyT, ElementT> &>(other);
-    llvm::SmallDenseSet<DistinctAttr> keys;
-    auto lhsRange = llvm::make_first_range(map);
-    auto rhsRange = llvm::make_first_range(rhs.map);
-    keys.insert(lhsRange.begin(), lhsRange.end());
-    keys.insert(rhsRange.begin(), rhsRange.end());
+    if (&rhs == this)
+      return ChangeResult::NoChange;
 
+    // Keys only present in LHS are left as is, so it suffices to walk RHS and
+    // update LHS in place.
     ChangeResult result = ChangeResult::NoChange;
-    for (DistinctAttr key : keys) {
-      auto lhsIt = map.find(key);
-      auto rhsIt = rhs.map.find(key);
-      assert(lhsIt != map.end() || rhsIt != rhs.map.end());
-
-      // If present in both, join.
-      if (lhsIt != map.end() && rhsIt != rhs.map.end()) {
-        result |= lhsIt->getSecond().join(rhsIt->getSecond());
-        continue;
-      }
-
-      // Copy from RHS if available only there.
-      if (lhsIt == map.end()) {
-        map.try_emplace(rhsIt->getFirst(), rhsIt->getSecond());
+    for (const auto &[key, rhsElements] : rhs.map) {
+      bool inserted;
+      decltype(map.begin()) lhsIt;
+      std::tie(lhsIt, inserted) = map.try_emplace(key, rhsElements);
+      if (inserted)
         result = ChangeResult::Change;
-      }
-
-      // Do nothing if available only in LHS.
+      else
+        result |= lhsIt->getSecond().join(rhsElements);
     }
     return result;
   }
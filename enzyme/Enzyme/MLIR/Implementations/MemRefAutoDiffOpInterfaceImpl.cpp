@@ -17,7 +17,9 @@
 #include "Interfaces/GradientUtils.h"
 #include "Interfaces/GradientUtilsReverse.h"
 
+#include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
 #include "mlir/IR/DialectRegistry.h"
 #include "mlir/Support/LogicalResult.h"
 
@@ -52,6 +54,16 @@ struct LoadOpInterfaceReverse
           retrievedArguments.push_back(retrievedValue);
         }
 
+        // Iterations of a parallel loop may load the same element, so their
+        // adjoints accumulate into the shadow atomically.
+        if (op->getParentOfType<scf::ParallelOp>() &&
+            isa<FloatType>(gradient.getType())) {
+          builder.create<memref::AtomicRMWOp>(
+              loadOp.getLoc(), gradient.getType(), arith::AtomicRMWKind::addf,
+              gradient, memrefGradient, ArrayRef<Value>(retrievedArguments));
+          return success();
+        }
+
         Value loadedGradient =
             builder.create<memref::LoadOp>(loadOp.getLoc(), memrefGradient,
                                            ArrayRef<Value>(retrievedArguments));
@@ -11,18 +11,22 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "Dialect/Ops.h"
 #include "Implementations/CoreDialectsAutoDiffImplementations.h"
 #include "Interfaces/AutoDiffOpInterface.h"
 #include "Interfaces/AutoDiffTypeInterface.h"
 #include "Interfaces/EnzymeLogic.h"
 #include "Interfaces/GradientUtils.h"
 #include "Interfaces/GradientUtilsReverse.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/Dialect/SCF/IR/SCF.h"
 #include "mlir/IR/DialectRegistry.h"
 #include "mlir/IR/Types.h"
 #include "mlir/Interfaces/ControlFlowInterfaces.h"
 #include "mlir/Support/LogicalResult.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/STLExtras.h"
 #include <functional>
 
@@ -183,6 +187,225 @@ struct ForOpInterfaceReverse
   }
 };
 
+// Return the position of the current iteration of a parallel loop along each
+// dimension, counting from zero.
+static SmallVector<Value> getIterationIndices(OpBuilder &builder, Location loc,
+                                              ValueRange ivs, ValueRange lbs,
+                                              ValueRange steps) {
+  SmallVector<Value> indices;
+  for (auto [iv, lb, step] : llvm::zip(ivs, lbs, steps)) {
+    Value offset = builder.create<arith::SubIOp>(loc, iv, lb);
+    indices.push_back(builder.create<arith::DivUIOp>(loc, offset, step));
+  }
+  return indices;
+}
+
+struct ParallelOpInterfaceReverse
+    : public ReverseAutoDiffOpInterface::ExternalModel<
+          ParallelOpInterfaceReverse, scf::ParallelOp> {
+  LogicalResult createReverseModeAdjoint(Operation *op, OpBuilder &builder,
+                                         MGradientUtilsReverse *gutils,
+                                         SmallVector<Value> caches) const {
+    auto parallelOp = cast<scf::ParallelOp>(op);
+    if (parallelOp.getNumResults() != 0)
+      return op->emitError()
+             << "reverse mode of scf.parallel with reductions is not supported";
+
+    Location loc = op->getLoc();
+    unsigned numLoops = parallelOp.getNumLoops();
+    SmallVector<Value> lbs, ubs, steps;
+    for (unsigned i = 0; i < numLoops; i++) {
+      lbs.push_back(gutils->popCache(caches[i], builder));
+      ubs.push_back(gutils->popCache(caches[numLoops + i], builder));
+      steps.push_back(gutils->popCache(caches[2 * numLoops + i], builder));
+    }
+
+    // The adjoint iterations are independent as well and run in parallel.
+    auto revParallel = builder.create<scf::ParallelOp>(loc, lbs, ubs, steps);
+    // erase scf reduce
+    revParallel.getBody()->begin()->erase();
+    Block *revBody = revParallel.getBody();
+
+    auto newParallel = cast<scf::ParallelOp>(gutils->getNewFromOriginal(op));
+    Block *primalBody = newParallel.getBody();
+
+    // Rather than sharing a stack between all iterations, each iteration
+    // stores the values it caches in its own slot of a buffer with one entry
+    // per iteration. Caches are created as placeholders here and replaced by
+    // the slots once the body has been differentiated.
+    SmallVector<std::pair<Value, Value>> slotCaches;
+    auto hook = [&](Type t) {
+      OpBuilder primalBuilder(primalBody, primalBody->begin());
+      Value pushCache = primalBuilder.create<enzyme::InitOp>(loc, t);
+      OpBuilder revBuilder(revBody, revBody->begin());
+      Value popCache = revBuilder.create<enzyme::InitOp>(loc, t);
+      slotCaches.push_back({pushCache, popCache});
+      return std::make_pair(pushCache, popCache);
+    };
+
+    // Adjoints of values defined outside the loop are accumulated by each
+    // iteration into a gradient of its own and combined by scf.reduce.
+    llvm::SetVector<Value> captured;
+    op->walk([&](Operation *nested) {
+      if (nested == op)
+        return;
+      for (Value v : nested->getOperands()) {
+        if (op->getRegion(0).isAncestor(v.getParentRegion()) ||
+            gutils->isConstantValue(v))
+          continue;
+        auto iface = dyn_cast<AutoDiffTypeInterface>(v.getType());
+        if (iface && !iface.isMutable())
+          captured.insert(v);
+      }
+    });
+    SmallVector<Value> sharedDiffes;
+    for (Value v : captured)
+      sharedDiffes.push_back(gutils->exchangeDifferential(v, nullptr));
+
+    SmallVector<Value> reducedValues, locals;
+    auto buildReduceOp = [&](OpBuilder &builder, Block *oBB) {
+      auto loc = oBB->rbegin()->getLoc();
+      for (Value v : captured) {
+        Value local = gutils->exchangeDifferential(v, nullptr);
+        if (!local)
+          continue;
+        reducedValues.push_back(v);
+        locals.push_back(builder.create<enzyme::GetOp>(
+            loc, gutils->getShadowType(v.getType()), local));
+      }
+      auto reduceOp = builder.create<scf::ReduceOp>(loc, locals);
+      for (auto &&[region, local] :
+           llvm::zip(reduceOp.getReductions(), locals)) {
+        Block &block = region.front();
+        OpBuilder reduceBuilder(&block, block.end());
+        Value sum = cast<AutoDiffTypeInterface>(local.getType())
+                        .createAddOp(reduceBuilder, loc, block.getArgument(0),
+                                     block.getArgument(1));
+        reduceBuilder.create<scf::ReduceReturnOp>(loc, sum);
+      }
+    };
+
+    Block *initializationBlock = gutils->setInitializationBlock(revBody);
+    gutils->registerCacheCreatorHook(hook);
+    Block *oBB = parallelOp.getBody();
+    gutils->mapReverseModeBlocks.map(oBB, revBody);
+    auto sub = gutils->Logic.visitChildren(oBB, revBody, gutils);
+    if (sub.succeeded())
+      gutils->Logic.handlePredecessors(oBB, primalBody, revBody, gutils,
+                                       buildReduceOp);
+    gutils->deregisterCacheCreatorHook(hook);
+    gutils->setInitializationBlock(initializationBlock);
+    for (auto &&[v, shared] : llvm::zip(captured, sharedDiffes))
+      gutils->exchangeDifferential(v, shared);
+    if (!sub.succeeded())
+      return sub;
+
+    if (!locals.empty()) {
+      OpBuilder initBuilder(revParallel);
+      SmallVector<Value> inits;
+      for (Value local : locals)
+        inits.push_back(cast<AutoDiffTypeInterface>(local.getType())
+                            .createNullValue(initBuilder, loc));
+      auto reduced = initBuilder.create<scf::ParallelOp>(loc, lbs, ubs, steps,
+                                                         inits);
+      reduced.getRegion().takeBody(revParallel.getRegion());
+      revParallel.erase();
+      revParallel = reduced;
+      for (auto &&[v, result] : llvm::zip(reducedValues, reduced.getResults()))
+        gutils->addToDiffe(v, result, builder);
+    }
+
+    if (slotCaches.empty())
+      return success();
+
+    // Allocate the slots before the primal loop and retrieve them before its
+    // adjoint.
+    OpBuilder cacheBuilder(newParallel);
+    SmallVector<Value> tripCounts;
+    Value zero = cacheBuilder.create<arith::ConstantIndexOp>(loc, 0);
+    for (auto [lb, ub, step] : llvm::zip(newParallel.getLowerBound(),
+                                         newParallel.getUpperBound(),
+                                         newParallel.getStep())) {
+      Value extent = cacheBuilder.create<arith::SubIOp>(loc, ub, lb);
+      Value tripCount =
+          cacheBuilder.create<arith::CeilDivSIOp>(loc, extent, step);
+      Value empty = cacheBuilder.create<arith::CmpIOp>(
+          loc, arith::CmpIPredicate::sle, extent, zero);
+      tripCounts.push_back(
+          cacheBuilder.create<arith::SelectOp>(loc, empty, zero, tripCount));
+    }
+    OpBuilder primalIndexBuilder(primalBody, primalBody->begin());
+    SmallVector<Value> primalIndices = getIterationIndices(
+        primalIndexBuilder, loc, newParallel.getInductionVars(),
+        newParallel.getLowerBound(), newParallel.getStep());
+    OpBuilder revIndexBuilder(revBody, revBody->begin());
+    SmallVector<Value> revIndices = getIterationIndices(
+        revIndexBuilder, loc, revParallel.getInductionVars(), lbs, steps);
+
+    OpBuilder slotBuilder(revParallel);
+    for (auto [pushCache, popCache] : slotCaches) {
+      enzyme::PushOp push;
+      if (pushCache.hasOneUse())
+        push = dyn_cast<enzyme::PushOp>(*pushCache.user_begin());
+      enzyme::PopOp pop;
+      if (popCache.hasOneUse())
+        pop = dyn_cast<enzyme::PopOp>(*popCache.user_begin());
+      if (!push || push->getBlock() != primalBody || !pop ||
+          pop->getBlock() != revBody)
+        return op->emitError() << "reverse mode of scf.parallel requires "
+                                  "values to be cached once per iteration";
+
+      Type elementType = cast<enzyme::CacheType>(pushCache.getType()).getType();
+      auto slotType = MemRefType::get(
+          SmallVector<int64_t>(numLoops, ShapedType::kDynamic), elementType);
+      Value slots =
+          cacheBuilder.create<memref::AllocOp>(loc, slotType, tripCounts);
+      Value cache = gutils->initAndPushCache(slots, cacheBuilder);
+
+      OpBuilder pushBuilder(push);
+      pushBuilder.create<memref::StoreOp>(push.getLoc(), push.getValue(), slots,
+                                          primalIndices);
+      push.erase();
+      pushCache.getDefiningOp()->erase();
+
+      Value revSlots = gutils->popCache(cache, slotBuilder);
+      OpBuilder popBuilder(pop);
+      Value cached =
+          popBuilder.create<memref::LoadOp>(pop.getLoc(), revSlots, revIndices);
+      pop.getOutput().replaceAllUsesWith(cached);
+      pop.erase();
+      popCache.getDefiningOp()->erase();
+
+      builder.create<memref::DeallocOp>(loc, revSlots);
+    }
+    return success();
+  }
+
+  SmallVector<Value> cacheValues(Operation *op,
+                                 MGradientUtilsReverse *gutils) const {
+    auto parallelOp = cast<scf::ParallelOp>(op);
+
+    Operation *newOp = gutils->getNewFromOriginal(op);
+    OpBuilder cacheBuilder(newOp);
+    SmallVector<Value> caches;
+
+    for (Value lb : parallelOp.getLowerBound())
+      caches.push_back(gutils->initAndPushCache(gutils->getNewFromOriginal(lb),
+                                                cacheBuilder));
+    for (Value ub : parallelOp.getUpperBound())
+      caches.push_back(gutils->initAndPushCache(gutils->getNewFromOriginal(ub),
+                                                cacheBuilder));
+    for (Value step : parallelOp.getStep())
+      caches.push_back(gutils->initAndPushCache(
+          gutils->getNewFromOriginal(step), cacheBuilder));
+
+    return caches;
+  }
+
+  void createShadowValues(Operation *op, OpBuilder &builder,
+                          MGradientUtilsReverse *gutils) const {}
+};
+
 } // namespace
 
 void mlir::enzyme::registerSCFDialectAutoDiffInterface(
@@ -190,5 +413,6 @@ void mlir::enzyme::registerSCFDialectAutoDiffInterface(
   registry.addExtension(+[](MLIRContext *context, scf::SCFDialect *) {
     registerInterfaces(context);
     scf::ForOp::attachInterface<ForOpInterfaceReverse>(*context);
+    scf::ParallelOp::attachInterface<ParallelOpInterfaceReverse>(*context);
   });
 }
@@ -24,6 +24,8 @@
 #include "mlir/IR/Dominance.h"
 #include "llvm/ADT/BreadthFirstIterator.h"
 
+#include <utility>
+
 using namespace mlir;
 using namespace mlir::enzyme;
 
@@ -48,7 +50,7 @@ Type mlir::enzyme::MGradientUtilsReverse::getIndexCacheType() {
 }
 
 Type mlir::enzyme::MGradientUtilsReverse::getIndexType() {
-  return mlir::IntegerType::get(initializationBlock->begin()->getContext(), 32);
+  return mlir::IntegerType::get(newFunc.getContext(), 32);
 }
 
 Value mlir::enzyme::MGradientUtilsReverse::insertInit(Type t) {
@@ -59,8 +61,7 @@ Value mlir::enzyme::MGradientUtilsReverse::insertInit(Type t) {
 
 // Cache
 Type mlir::enzyme::MGradientUtilsReverse::getCacheType(Type t) {
-  Type cacheType =
-      CacheType::get(initializationBlock->begin()->getContext(), t);
+  Type cacheType = CacheType::get(newFunc.getContext(), t);
   return cacheType;
 }
 
@@ -100,6 +101,19 @@ Value MGradientUtilsReverse::popCache(Value cache, OpBuilder &builder) {
       cache);
 }
 
+Block *MGradientUtilsReverse::setInitializationBlock(Block *block) {
+  return std::exchange(initializationBlock, block);
+}
+
+Value MGradientUtilsReverse::exchangeDifferential(Value oval, Value shadow) {
+  Value previous = differentials.lookupOrNull(oval);
+  if (shadow)
+    differentials.map(oval, shadow);
+  else
+    differentials.erase(oval);
+  return previous;
+}
+
 Operation *
 mlir::enzyme::MGradientUtilsReverse::cloneWithNewOperands(OpBuilder &B,
                                                           Operation *op) {
@@ -57,6 +57,15 @@ public:
 
   Value popCache(Value cache, OpBuilder &builder);
 
+  // Set the block at whose start gradients and caches are created, returning
+  // the previous one. Within the reverse of a parallel loop this is the loop
+  // body, so that every iteration accumulates into gradients of its own.
+  Block *setInitializationBlock(Block *block);
+
+  // Set the gradient holding the adjoint of a non-mutable value, returning the
+  // previous one. A null gradient is created on its next use.
+  Value exchangeDifferential(Value oval, Value shadow);
+
   void createReverseModeBlocks(Region &oldFunc, Region &newFunc);
 
   static MGradientUtilsReverse *CreateFromClone(
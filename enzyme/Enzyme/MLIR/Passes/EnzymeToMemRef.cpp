@@ -14,6 +14,7 @@
 #include "Dialect/Ops.h"
 #include "PassDetails.h"
 #include "Passes/Passes.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/ControlFlow/IR/ControlFlowOps.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
@@ -130,6 +131,65 @@ struct LoweredCache {
     return SymbolRefAttr::get(context, funcName);
   }
 
+  FlatSymbolRefAttr getOrInsertReserveFunction(Location loc, ModuleOp moduleOp,
+                                               OpBuilder &b) const {
+    MLIRContext *context = b.getContext();
+    std::string funcName = "__enzyme_reserve_";
+    llvm::raw_string_ostream funcStream{funcName};
+    funcStream << elementType;
+    if (moduleOp.lookupSymbol<func::FuncOp>(funcName)) {
+      return SymbolRefAttr::get(context, funcName);
+    }
+
+    OpBuilder::InsertionGuard insertionGuard(b);
+    b.setInsertionPointToStart(moduleOp.getBody());
+
+    auto reserveFnType = FunctionType::get(
+        context, /*inputs=*/
+        {elements.getType(), size.getType(), capacity.getType(),
+         b.getIndexType()},
+        /*outputs=*/{});
+    auto reserveFn = b.create<func::FuncOp>(loc, funcName, reserveFnType);
+    reserveFn.setPrivate();
+    Block *entryBlock = reserveFn.addEntryBlock();
+    b.setInsertionPointToStart(entryBlock);
+    BlockArgument elementsField = reserveFn.getArgument(0);
+    BlockArgument sizeField = reserveFn.getArgument(1);
+    BlockArgument capacityField = reserveFn.getArgument(2);
+    BlockArgument count = reserveFn.getArgument(3);
+
+    Value sizeVal = b.create<memref::LoadOp>(loc, sizeField);
+    Value capacityVal = b.create<memref::LoadOp>(loc, capacityField);
+    Value required = b.create<arith::AddIOp>(loc, sizeVal, count);
+
+    Value predicate = b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::ugt,
+                                              required, capacityVal);
+    b.create<scf::IfOp>(
+        loc, predicate, [&](OpBuilder &thenBuilder, Location loc) {
+          // Grow at least geometrically so that reserving in an outer loop
+          // stays amortized.
+          Value two = thenBuilder.create<arith::ConstantIndexOp>(loc, 2);
+          Value doubled =
+              thenBuilder.create<arith::MulIOp>(loc, capacityVal, two);
+          Value larger = thenBuilder.create<arith::CmpIOp>(
+              loc, arith::CmpIPredicate::ugt, required, doubled);
+          Value newCapacity = thenBuilder.create<arith::SelectOp>(
+              loc, larger, required, doubled);
+          Value oldElements =
+              thenBuilder.create<memref::LoadOp>(loc, elementsField);
+          Value newElements = thenBuilder.create<memref::AllocOp>(
+              loc, oldElements.getType().cast<MemRefType>(), newCapacity);
+          thenBuilder.create<memref::CopyOp>(loc, oldElements, newElements);
+          thenBuilder.create<memref::DeallocOp>(loc, oldElements);
+          thenBuilder.create<memref::StoreOp>(loc, newElements, elementsField);
+          thenBuilder.create<memref::StoreOp>(loc, newCapacity, capacityField);
+          thenBuilder.create<scf::YieldOp>(loc);
+        });
+    b.create<func::ReturnOp>(loc);
+
+    return SymbolRefAttr::get(context, funcName);
+  }
+
   void emitPush(Location loc, Value value, OpBuilder &b,
                 FlatSymbolRefAttr pushFn) const {
     b.create<func::CallOp>(
@@ -215,6 +275,77 @@ struct LoweredCache {
   }
 };
 
+/// A loop which runs a push or pop on a cache exactly once per iteration, and
+/// whose trip count can be computed before the loop is entered.
+struct CountedLoop {
+  Operation *loop;
+  Value inductionVar;
+
+  /// Return the loop around op if op is the only use of cache in the loop and
+  /// runs on every iteration, or null otherwise.
+  static std::optional<CountedLoop> get(Operation *op, Value cache) {
+    Operation *loop = op->getParentOp();
+    Value iv;
+    if (auto forOp = dyn_cast_or_null<scf::ForOp>(loop)) {
+      iv = forOp.getInductionVar();
+    } else if (auto forOp = dyn_cast_or_null<affine::AffineForOp>(loop)) {
+      if (!forOp.hasConstantBounds())
+        return {};
+      iv = forOp.getInductionVar();
+    } else {
+      return {};
+    }
+    if (!iv.getType().isIndex() ||
+        op->getBlock() != &loop->getRegion(0).front())
+      return {};
+
+    // The cache must already exist when the loop is entered, and nothing else
+    // in the loop may observe its size.
+    if (!cache.getParentRegion()->isAncestor(loop->getParentRegion()))
+      return {};
+    for (Operation *user : cache.getUsers())
+      if (user != op && loop->isAncestor(user))
+        return {};
+    return CountedLoop{loop, iv};
+  }
+
+  /// Emit the number of iterations of the loop, to be placed before it.
+  Value emitTripCount(Location loc, OpBuilder &b) const {
+    if (auto forOp = dyn_cast<affine::AffineForOp>(loop)) {
+      int64_t extent =
+          forOp.getConstantUpperBound() - forOp.getConstantLowerBound();
+      int64_t step = forOp.getStepAsInt();
+      return b.create<arith::ConstantIndexOp>(
+          loc, extent > 0 ? (extent + step - 1) / step : 0);
+    }
+    auto forOp = cast<scf::ForOp>(loop);
+    Value zero = b.create<arith::ConstantIndexOp>(loc, 0);
+    Value extent = b.create<arith::SubIOp>(loc, forOp.getUpperBound(),
+                                           forOp.getLowerBound());
+    Value tripCount =
+        b.create<arith::CeilDivSIOp>(loc, extent, forOp.getStep());
+    Value empty = b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::sle,
+                                          extent, zero);
+    return b.create<arith::SelectOp>(loc, empty, zero, tripCount);
+  }
+
+  /// Emit the number of the current iteration, counting from zero.
+  Value emitIteration(Location loc, OpBuilder &b) const {
+    Value lowerBound, step;
+    if (auto forOp = dyn_cast<affine::AffineForOp>(loop)) {
+      lowerBound = b.create<arith::ConstantIndexOp>(
+          loc, forOp.getConstantLowerBound());
+      step = b.create<arith::ConstantIndexOp>(loc, forOp.getStepAsInt());
+    } else {
+      auto forOp = cast<scf::ForOp>(loop);
+      lowerBound = forOp.getLowerBound();
+      step = forOp.getStep();
+    }
+    Value offset = b.create<arith::SubIOp>(loc, inductionVar, lowerBound);
+    return b.create<arith::DivUIOp>(loc, offset, step);
+  }
+};
+
 struct InitOpConversion : public OpConversionPattern<enzyme::InitOp> {
   using OpConversionPattern::OpConversionPattern;
 
@@ -279,6 +410,39 @@ struct PushOpConversion : public OpConversionPattern<enzyme::PushOp> {
   matchAndRewrite(enzyme::PushOp op, OpAdaptor adaptor,
                   ConversionPatternRewriter &rewriter) const override {
     Location loc = op.getLoc();
+    // A push run once per iteration of a counted loop reserves space for the
+    // whole loop up front and becomes a plain store.
+    if (auto countedLoop = CountedLoop::get(op, op.getCache())) {
+      OpBuilder::InsertionGuard insertionGuard(rewriter);
+      rewriter.setInsertionPoint(countedLoop->loop);
+      auto cache = LoweredCache::getFromEnzymeCache(loc, getTypeConverter(),
+                                                    op.getCache(), rewriter);
+      if (!cache.has_value()) {
+        return failure();
+      }
+      FlatSymbolRefAttr reserveFn = cache->getOrInsertReserveFunction(
+          loc, op->getParentOfType<ModuleOp>(), rewriter);
+      Value tripCount = countedLoop->emitTripCount(loc, rewriter);
+      rewriter.create<func::CallOp>(
+          loc, reserveFn, /*results=*/TypeRange{},
+          /*operands=*/
+          ValueRange{cache->elements, cache->size, cache->capacity,
+                     tripCount});
+      Value base = rewriter.create<memref::LoadOp>(loc, cache->size);
+      Value elements = rewriter.create<memref::LoadOp>(loc, cache->elements);
+
+      rewriter.setInsertionPointAfter(countedLoop->loop);
+      Value newSize = rewriter.create<arith::AddIOp>(loc, base, tripCount);
+      rewriter.create<memref::StoreOp>(loc, newSize, cache->size);
+
+      rewriter.setInsertionPoint(op);
+      Value index = rewriter.create<arith::AddIOp>(
+          loc, base, countedLoop->emitIteration(loc, rewriter));
+      rewriter.replaceOpWithNewOp<memref::StoreOp>(op, op.getValue(), elements,
+                                                   index);
+      return success();
+    }
+
     auto loweredCache = LoweredCache::getFromEnzymeCache(
         loc, getTypeConverter(), op.getCache(), rewriter);
     if (!loweredCache.has_value()) {
@@ -300,6 +464,36 @@ struct PopOpConversion : public OpConversionPattern<enzyme::PopOp> {
   matchAndRewrite(enzyme::PopOp op, OpAdaptor adaptor,
                   ConversionPatternRewriter &rewriter) const override {
     Location loc = op.getLoc();
+    // A pop run once per iteration of a counted loop checks the size of the
+    // cache once and becomes a plain load.
+    if (auto countedLoop = CountedLoop::get(op, op.getCache())) {
+      OpBuilder::InsertionGuard insertionGuard(rewriter);
+      rewriter.setInsertionPoint(countedLoop->loop);
+      auto cache = LoweredCache::getFromEnzymeCache(loc, getTypeConverter(),
+                                                    op.getCache(), rewriter);
+      if (!cache.has_value()) {
+        return failure();
+      }
+      Value tripCount = countedLoop->emitTripCount(loc, rewriter);
+      Value size = rewriter.create<memref::LoadOp>(loc, cache->size);
+      Value pred = rewriter.create<arith::CmpIOp>(
+          loc, arith::CmpIPredicate::uge, size, tripCount);
+      rewriter.create<cf::AssertOp>(loc, pred, "pop on empty cache");
+      Value elements = rewriter.create<memref::LoadOp>(loc, cache->elements);
+      Value one = rewriter.create<arith::ConstantIndexOp>(loc, 1);
+      Value last = rewriter.create<arith::SubIOp>(loc, size, one);
+
+      rewriter.setInsertionPointAfter(countedLoop->loop);
+      Value newSize = rewriter.create<arith::SubIOp>(loc, size, tripCount);
+      rewriter.create<memref::StoreOp>(loc, newSize, cache->size);
+
+      rewriter.setInsertionPoint(op);
+      Value index = rewriter.create<arith::SubIOp>(
+          loc, last, countedLoop->emitIteration(loc, rewriter));
+      rewriter.replaceOpWithNewOp<memref::LoadOp>(op, elements, index);
+      return success();
+    }
+
     auto loweredCache = LoweredCache::getFromEnzymeCache(
         loc, getTypeConverter(), op.getCache(), rewriter);
     if (!loweredCache.has_value()) {
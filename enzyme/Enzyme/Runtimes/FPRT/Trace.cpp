@@ -25,9 +25,10 @@
 //
 //===----------------------------------------------------------------------===//
 
-#include <list>
+#include <deque>
 #include <stdint.h>
 #include <stdlib.h>
+#include <vector>
 
 #define __ENZYME_MPFR_ATTRIBUTES
 #define __ENZYME_MPFR_ORIGINAL_ATTRIBUTES
@@ -38,9 +39,21 @@ typedef struct {
   double v;
 } __enzyme_fp;
 
-// TODO ultimately we probably want a linked list of arrays or something like
-// that for this
-static std::list<__enzyme_fp> FPs;
+// Traced values of the current thread. A deque allocates them in chunks and
+// never moves them, and deleted values are reused before allocating new ones.
+static thread_local std::deque<__enzyme_fp> FPs;
+static thread_local std::vector<__enzyme_fp *> FreeFPs;
+
+static __enzyme_fp *__enzyme_fprt_alloc(double v) {
+  if (!FreeFPs.empty()) {
+    __enzyme_fp *a = FreeFPs.back();
+    FreeFPs.pop_back();
+    a->v = v;
+    return a;
+  }
+  FPs.push_back({v});
+  return &FPs.back();
+}
 
 static bool __enzyme_fprt_is_mem_mode(int64_t mode) { return mode & 0b0001; }
 static bool __enzyme_fprt_is_op_mode(int64_t mode) { return mode & 0b0010; }
@@ -62,24 +75,20 @@ double __enzyme_fprt_64_52_get(double _a, int64_t exponent, int64_t significand,
 __ENZYME_MPFR_ATTRIBUTES
 double __enzyme_fprt_64_52_new(double _a, int64_t exponent, int64_t significand,
                                int64_t mode) {
-  FPs.push_back({_a});
-  __enzyme_fp *a = &FPs.back();
-  return __enzyme_fprt_ptr_to_double(a);
+  return __enzyme_fprt_ptr_to_double(__enzyme_fprt_alloc(_a));
 }
 
 __ENZYME_MPFR_ATTRIBUTES
 __enzyme_fp *__enzyme_fprt_64_52_new_intermediate(int64_t exponent,
                                                   int64_t significand,
                                                   int64_t mode) {
-  FPs.push_back({0});
-  __enzyme_fp *a = &FPs.back();
-  return a;
+  return __enzyme_fprt_alloc(0);
 }
 
 __ENZYME_MPFR_ATTRIBUTES
 void __enzyme_fprt_64_52_delete(double a, int64_t exponent, int64_t significand,
                                 int64_t mode) {
-  // TODO
+  FreeFPs.push_back(__enzyme_fprt_double_to_ptr(a));
 }
 
 #define __ENZYME_MPFR_SINGOP(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME, FROM_TYPE, \
@@ -40,17 +40,21 @@
 #include "llvm/IR/Value.h"
 
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/TypeFinder.h"
 
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/TimeProfiler.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "llvm/ADT/EquivalenceClasses.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringSet.h"
 
 #include "llvm/IR/InlineAsm.h"
 
+#include "../EnzymeStats.h"
 #include "../Utils.h"
 #include "TypeAnalysis.h"
 
@@ -238,6 +242,15 @@ bool dontAnalyze(StringRef str) {
   return false;
 }
 
+/// Obtain a function analysis result while holding the Type Analysis IR lock,
+/// as the analysis manager may be shared by concurrent analyses.
+template <typename AnalysisT>
+static typename AnalysisT::Result &
+getLockedResult(FunctionAnalysisManager &FAM, Function &F) {
+  std::lock_guard<std::recursive_mutex> guard(getTypeAnalysisIRLock());
+  return FAM.getResult<AnalysisT>(F);
+}
+
 TypeAnalyzer::TypeAnalyzer(const FnTypeInfo &fn, TypeAnalysis &TA,
                            uint8_t direction)
     : MST(EnzymePrintType ? new ModuleSlotTracker(fn.Function->getParent())
@@ -245,11 +258,11 @@ TypeAnalyzer::TypeAnalyzer(const FnTypeInfo &fn, TypeAnalysis &TA,
       notForAnalysis(getGuaranteedUnreachable(fn.Function)), intseen(),
       fntypeinfo(fn), interprocedural(TA), direction(direction), Invalid(false),
       PHIRecur(false),
-      TLI(TA.FAM.getResult<TargetLibraryAnalysis>(*fn.Function)),
-      DT(TA.FAM.getResult<DominatorTreeAnalysis>(*fn.Function)),
-      PDT(TA.FAM.getResult<PostDominatorTreeAnalysis>(*fn.Function)),
-      LI(TA.FAM.getResult<LoopAnalysis>(*fn.Function)),
-      SE(TA.FAM.getResult<ScalarEvolutionAnalysis>(*fn.Function)) {
+      TLI(getLockedResult<TargetLibraryAnalysis>(TA.FAM, *fn.Function)),
+      DT(getLockedResult<DominatorTreeAnalysis>(TA.FAM, *fn.Function)),
+      PDT(getLockedResult<PostDominatorTreeAnalysis>(TA.FAM, *fn.Function)),
+      LI(getLockedResult<LoopAnalysis>(TA.FAM, *fn.Function)),
+      SE(getLockedResult<ScalarEvolutionAnalysis>(TA.FAM, *fn.Function)) {
 
   assert(fntypeinfo.KnownValues.size() ==
          fntypeinfo.Function->getFunctionType()->getNumParams());
@@ -484,6 +497,8 @@ FnTypeInfo::knownIntegralValues(llvm::Value *val, const DominatorTree &DT,
     }
   }
   if (auto pn = dyn_cast<PHINode>(val)) {
+    // ScalarEvolution registers value handles with the LLVMContext
+    std::unique_lock<std::recursive_mutex> guard(getTypeAnalysisIRLock());
     if (SE.isSCEVable(pn->getType()))
       if (auto S = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(pn))) {
         if (auto StartC = dyn_cast<SCEVConstant>(S->getStart())) {
@@ -554,6 +569,7 @@ FnTypeInfo::knownIntegralValues(llvm::Value *val, const DominatorTree &DT,
         }
       }
 
+    guard.unlock();
     for (unsigned i = 0; i < pn->getNumIncomingValues(); ++i) {
       auto a = pn->getIncomingValue(i);
       auto b = pn->getIncomingBlock(i);
@@ -661,6 +677,33 @@ FnTypeInfo::knownIntegralValues(llvm::Value *val, const DominatorTree &DT,
   return intseen[val];
 }
 
+std::recursive_mutex &getTypeAnalysisIRLock() {
+  static std::recursive_mutex lock;
+  return lock;
+}
+
+/// Compute the offset in bytes of the element at Indices within an aggregate
+/// of type T, as a GEP of a pointer to T with a leading zero index would.
+/// Unlike materializing such a GEP, this does not create any constants and is
+/// thus safe to call while other functions are being analyzed.
+static uint64_t getConstantAggregateOffset(const DataLayout &DL, Type *T,
+                                           ArrayRef<unsigned> Indices) {
+  uint64_t Offset = 0;
+  for (auto idx : Indices) {
+    if (auto ST = dyn_cast<StructType>(T)) {
+      Offset += DL.getStructLayout(ST)->getElementOffset(idx);
+      T = ST->getElementType(idx);
+      continue;
+    }
+    if (auto AT = dyn_cast<ArrayType>(T))
+      T = AT->getElementType();
+    else
+      T = cast<VectorType>(T)->getElementType();
+    Offset += idx * DL.getTypeAllocSize(T);
+  }
+  return Offset;
+}
+
 /// Given a constant value, deduce any type information applicable
 void getConstantAnalysis(Constant *Val, TypeAnalyzer &TA,
                          std::map<llvm::Value *, TypeTree> &analysis) {
@@ -742,20 +785,7 @@ void getConstantAnalysis(Constant *Val, TypeAnalyzer &TA,
                       7) /
                      8;
 
-      Value *vec[2] = {
-          ConstantInt::get(Type::getInt64Ty(Val->getContext()), 0),
-          ConstantInt::get(Type::getInt32Ty(Val->getContext()), i),
-      };
-      auto g2 = GetElementPtrInst::Create(
-          Val->getType(),
-          UndefValue::get(PointerType::getUnqual(Val->getType())), vec);
-      APInt ai(DL.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-      g2->accumulateConstantOffset(DL, ai);
-      // Using destructor rather than eraseFromParent
-      //   as g2 has no parent
-      delete g2;
-
-      int Off = (int)ai.getLimitedValue();
+      int Off = (int)getConstantAggregateOffset(DL, Val->getType(), {i});
       if (auto VT = dyn_cast<VectorType>(Val->getType()))
         if (VT->getElementType()->isIntegerTy(1))
           Off = i / 8;
@@ -795,20 +825,7 @@ void getConstantAnalysis(Constant *Val, TypeAnalyzer &TA,
                       7) /
                      8;
 
-      Value *vec[2] = {
-          ConstantInt::get(Type::getInt64Ty(Val->getContext()), 0),
-          ConstantInt::get(Type::getInt32Ty(Val->getContext()), i),
-      };
-      auto g2 = GetElementPtrInst::Create(
-          Val->getType(),
-          UndefValue::get(PointerType::getUnqual(Val->getType())), vec);
-      APInt ai(DL.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-      g2->accumulateConstantOffset(DL, ai);
-      // Using destructor rather than eraseFromParent
-      //   as g2 has no parent
-      delete g2;
-
-      int Off = (int)ai.getLimitedValue();
+      int Off = (int)getConstantAggregateOffset(DL, Val->getType(), {i});
 
       getConstantAnalysis(Op, TA, analysis);
       auto mid = analysis[Op];
@@ -849,6 +866,9 @@ void getConstantAnalysis(Constant *Val, TypeAnalyzer &TA,
       return;
     }
 
+    // Materializing the expression modifies the use lists of its (possibly
+    // shared) operands.
+    std::lock_guard<std::recursive_mutex> guard(getTypeAnalysisIRLock());
     auto I = CE->getAsInstruction();
     I->insertBefore(TA.fntypeinfo.Function->getEntryBlock().getTerminator());
 
@@ -1152,7 +1172,12 @@ void TypeAnalyzer::updateAnalysis(Value *Val, TypeTree Data, Value *Origin) {
       addToWorkList(Val);
 
     // Add users and operands of the value so they can update from the new
-    // operand/use
+    // operand/use. Constants are shared with other functions, whose analysis
+    // may concurrently materialize instructions using them.
+    std::unique_lock<std::recursive_mutex> guard(getTypeAnalysisIRLock(),
+                                                 std::defer_lock);
+    if (isa<Constant>(Val))
+      guard.lock();
     for (User *U : Val->users()) {
       if (U != Origin) {
 
@@ -1468,6 +1493,7 @@ void TypeAnalyzer::runPHIHypotheses() {
     return;
   bool Changed;
   do {
+    countEnzymeStat(&EnzymeFunctionStats::typePHIHypothesisRounds);
     Changed = false;
     for (BasicBlock &BB : *fntypeinfo.Function) {
       for (Instruction &inst : BB) {
@@ -1566,6 +1592,7 @@ void TypeAnalyzer::run() {
     while (!Invalid && workList.size()) {
       auto todo = *workList.begin();
       workList.erase(workList.begin());
+      countEnzymeStat(&EnzymeFunctionStats::typeWorklistPops);
       if (auto call = dyn_cast<CallBase>(todo)) {
         StringRef funcName = getFuncNameFromCall(call);
         auto ci = getFunctionFromCall(call);
@@ -1597,6 +1624,7 @@ void TypeAnalyzer::run() {
     while (!Invalid && workList.size()) {
       auto todo = *workList.begin();
       workList.erase(workList.begin());
+      countEnzymeStat(&EnzymeFunctionStats::typeWorklistPops);
       if (auto ci = dyn_cast<CallBase>(todo)) {
         pendingCalls.push_back(ci);
         continue;
@@ -1658,6 +1686,9 @@ void TypeAnalyzer::visitConstantExpr(ConstantExpr &CE) {
     visitGEPOperator(*cast<GEPOperator>(&CE));
     return;
   }
+  // Materializing the expression modifies the use lists of its (possibly
+  // shared) operands.
+  std::lock_guard<std::recursive_mutex> guard(getTypeAnalysisIRLock());
   auto I = CE.getAsInstruction();
   I->insertBefore(fntypeinfo.Function->getEntryBlock().getTerminator());
   analysis[I] = analysis[&CE];
@@ -2607,17 +2638,8 @@ void TypeAnalyzer::visitShuffleVectorInst(ShuffleVectorInst &I) {
   for (size_t i = 0; i < mask.size(); ++i) {
     int newOff;
     {
-      Value *vec[2] = {ConstantInt::get(Type::getInt64Ty(I.getContext()), 0),
-                       ConstantInt::get(Type::getInt64Ty(I.getContext()), i)};
-      auto ud =
-          UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-      auto g2 = GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-      APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-      g2->accumulateConstantOffset(dl, ai);
-      // Using destructor rather than eraseFromParent
-      //   as g2 has no parent
-      delete g2;
-      newOff = (int)ai.getLimitedValue();
+      newOff = (int)getConstantAggregateOffset(dl, I.getOperand(0)->getType(),
+                                               {(unsigned)i});
       // there is a bug in LLVM, this is the correct offset
       if (cast<VectorType>(I.getOperand(lhs)->getType())
               ->getElementType()
@@ -2640,25 +2662,14 @@ void TypeAnalyzer::visitShuffleVectorInst(ShuffleVectorInst &I) {
       }
     } else {
       if ((size_t)mask[i] < numFirst) {
-        Value *vec[2] = {
-            ConstantInt::get(Type::getInt64Ty(I.getContext()), 0),
-            ConstantInt::get(Type::getInt64Ty(I.getContext()), mask[i])};
-        auto ud =
-            UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-        auto g2 =
-            GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-        APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-        g2->accumulateConstantOffset(dl, ai);
-        // Using destructor rather than eraseFromParent
-        //   as g2 has no parent
-        int oldOff = (int)ai.getLimitedValue();
+        int oldOff = (int)getConstantAggregateOffset(
+            dl, I.getOperand(0)->getType(), {(unsigned)mask[i]});
         // there is a bug in LLVM, this is the correct offset
         if (cast<VectorType>(I.getOperand(lhs)->getType())
                 ->getElementType()
                 ->isIntegerTy(1)) {
           oldOff = mask[i] / 8;
         }
-        delete g2;
         if (direction & UP) {
           updateAnalysis(I.getOperand(lhs),
                          getAnalysis(&I).ShiftIndices(dl, newOff, size, oldOff),
@@ -2669,25 +2680,14 @@ void TypeAnalyzer::visitShuffleVectorInst(ShuffleVectorInst &I) {
                         .ShiftIndices(dl, oldOff, size, newOff);
         }
       } else {
-        Value *vec[2] = {ConstantInt::get(Type::getInt64Ty(I.getContext()), 0),
-                         ConstantInt::get(Type::getInt64Ty(I.getContext()),
-                                          mask[i] - numFirst)};
-        auto ud =
-            UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-        auto g2 =
-            GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-        APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-        g2->accumulateConstantOffset(dl, ai);
-        // Using destructor rather than eraseFromParent
-        //   as g2 has no parent
-        int oldOff = (int)ai.getLimitedValue();
+        int oldOff = (int)getConstantAggregateOffset(
+            dl, I.getOperand(0)->getType(), {(unsigned)(mask[i] - numFirst)});
         // there is a bug in LLVM, this is the correct offset
         if (cast<VectorType>(I.getOperand(lhs)->getType())
                 ->getElementType()
                 ->isIntegerTy(1)) {
           oldOff = (mask[i] - numFirst) / 8;
         }
-        delete g2;
         if (direction & UP) {
           updateAnalysis(I.getOperand(rhs),
                          getAnalysis(&I).ShiftIndices(dl, newOff, size, oldOff),
@@ -2708,20 +2708,8 @@ void TypeAnalyzer::visitShuffleVectorInst(ShuffleVectorInst &I) {
 
 void TypeAnalyzer::visitExtractValueInst(ExtractValueInst &I) {
   auto &dl = fntypeinfo.Function->getParent()->getDataLayout();
-  SmallVector<Value *, 4> vec;
-  vec.push_back(ConstantInt::get(Type::getInt64Ty(I.getContext()), 0));
-  for (auto ind : I.indices()) {
-    vec.push_back(ConstantInt::get(Type::getInt32Ty(I.getContext()), ind));
-  }
-  auto ud = UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-  auto g2 = GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-  APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-  g2->accumulateConstantOffset(dl, ai);
-  // Using destructor rather than eraseFromParent
-  //   as g2 has no parent
-  delete g2;
-
-  int off = (int)ai.getLimitedValue();
+  int off = (int)getConstantAggregateOffset(dl, I.getOperand(0)->getType(),
+                                            I.getIndices());
   int size = dl.getTypeSizeInBits(I.getType()) / 8;
 
   if (direction & DOWN)
@@ -2737,56 +2725,35 @@ void TypeAnalyzer::visitExtractValueInst(ExtractValueInst &I) {
 
 void TypeAnalyzer::visitInsertValueInst(InsertValueInst &I) {
   auto &dl = fntypeinfo.Function->getParent()->getDataLayout();
-  SmallVector<Value *, 4> vec = {
-      ConstantInt::get(Type::getInt64Ty(I.getContext()), 0)};
-  for (auto ind : I.indices()) {
-    vec.push_back(ConstantInt::get(Type::getInt32Ty(I.getContext()), ind));
-  }
-  auto ud = UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-  auto g2 = GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-  APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-  g2->accumulateConstantOffset(dl, ai);
-  delete g2;
-  // Using destructor rather than eraseFromParent
-  //   as g2 has no parent
+  auto AggTy = I.getOperand(0)->getType();
+  SmallVector<unsigned, 4> vec(I.idx_begin(), I.idx_end());
+  uint64_t ai = getConstantAggregateOffset(dl, AggTy, vec);
 
   // Compute the offset at the next logical element [e.g. adding 1 to the last
   // index, carrying the value on overflow]
+  uint64_t aiend = dl.getTypeAllocSize(AggTy);
   for (ssize_t i = vec.size() - 1; i >= 0; i--) {
-    auto CI = cast<ConstantInt>(vec[i]);
-    auto val = CI->getZExtValue();
-    if (i == 0) {
-      vec[i] = ConstantInt::get(CI->getType(), val + 1);
-      break;
-    }
-    auto subTy = GetElementPtrInst::getIndexedType(
-        I.getOperand(0)->getType(), ArrayRef<Value *>(vec).slice(0, i));
-    if (auto ST = dyn_cast<StructType>(subTy)) {
-      if (val + 1 == ST->getNumElements()) {
-        vec.erase(vec.begin() + i, vec.end());
-        continue;
-      }
-      vec[i] = ConstantInt::get(CI->getType(), val + 1);
-      break;
-    } else {
-      auto AT = cast<ArrayType>(subTy);
-      if (val + 1 == AT->getNumElements()) {
-        vec.erase(vec.begin() + i, vec.end());
-        continue;
-      }
-      vec[i] = ConstantInt::get(CI->getType(), val + 1);
-      break;
+    auto val = vec[i];
+    auto subTy = ExtractValueInst::getIndexedType(
+        AggTy, ArrayRef<unsigned>(vec).slice(0, i));
+    size_t numElements;
+    if (auto ST = dyn_cast<StructType>(subTy))
+      numElements = ST->getNumElements();
+    else
+      numElements = cast<ArrayType>(subTy)->getNumElements();
+    if (val + 1 == numElements) {
+      vec.erase(vec.begin() + i, vec.end());
+      continue;
     }
+    vec[i] = val + 1;
+    aiend = getConstantAggregateOffset(dl, AggTy, vec);
+    break;
   }
-  g2 = GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-  APInt aiend(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-  g2->accumulateConstantOffset(dl, aiend);
-  delete g2;
 
-  int off = (int)ai.getLimitedValue();
+  int off = (int)ai;
 
   int agg_size = (dl.getTypeSizeInBits(I.getType()) + 7) / 8;
-  int ins_size = (int)(aiend - ai).getLimitedValue();
+  int ins_size = (int)(aiend - ai);
   int ins2_size =
       (dl.getTypeSizeInBits(I.getInsertedValueOperand()->getType()) + 7) / 8;
 
@@ -5458,30 +5425,13 @@ void TypeAnalyzer::visitCallBase(CallBase &call) {
           auto T = ST->getTypeAtIndex(i);
           ConcreteType CT(BaseType::Unknown);
 
-          Value *vec[2] = {
-              ConstantInt::get(Type::getInt64Ty(call.getContext()), 0),
-              ConstantInt::get(Type::getInt32Ty(call.getContext()), i)};
-          auto ud = UndefValue::get(PointerType::getUnqual(ST));
-          auto g2 = GetElementPtrInst::Create(ST, ud, vec);
-          APInt ai(DL.getIndexSizeInBits(0), 0);
-          g2->accumulateConstantOffset(DL, ai);
-          delete g2;
-          size_t Offset = ai.getZExtValue();
+          size_t Offset = DL.getStructLayout(ST)->getElementOffset(i);
 
           size_t nextOffset;
           if (i + 1 == ST->getNumElements())
             nextOffset = (DL.getTypeSizeInBits(ST) + 7) / 8;
-          else {
-            Value *vec[2] = {
-                ConstantInt::get(Type::getInt64Ty(call.getContext()), 0),
-                ConstantInt::get(Type::getInt32Ty(call.getContext()), i + 1)};
-            auto ud = UndefValue::get(PointerType::getUnqual(ST));
-            auto g2 = GetElementPtrInst::Create(ST, ud, vec);
-            APInt ai(DL.getIndexSizeInBits(0), 0);
-            g2->accumulateConstantOffset(DL, ai);
-            delete g2;
-            nextOffset = ai.getZExtValue();
-          }
+          else
+            nextOffset = DL.getStructLayout(ST)->getElementOffset(i + 1);
 
           if (T->isFloatingPointTy()) {
             CT = T;
@@ -5826,13 +5776,37 @@ void TypeAnalyzer::visitIPOCall(CallBase &call, Function &fn) {
   }
 }
 
+std::shared_ptr<TypeAnalyzer>
+TypeAnalysisCache::lookup(const FnTypeInfo &fn) const {
+  unsigned idx = getShardIndex(fn.Function);
+  std::lock_guard<std::mutex> guard(locks[idx]);
+  auto found = shards[idx].find(fn);
+  if (found == shards[idx].end())
+    return nullptr;
+  return found->second;
+}
+
+std::shared_ptr<TypeAnalyzer>
+TypeAnalysisCache::insert(const FnTypeInfo &fn,
+                          std::shared_ptr<TypeAnalyzer> analysis) {
+  unsigned idx = getShardIndex(fn.Function);
+  std::lock_guard<std::mutex> guard(locks[idx]);
+  return shards[idx].emplace(fn, std::move(analysis)).first->second;
+}
+
+void TypeAnalysisCache::clear() {
+  for (unsigned idx = 0; idx < NumShards; idx++) {
+    std::lock_guard<std::mutex> guard(locks[idx]);
+    shards[idx].clear();
+  }
+}
+
 TypeResults TypeAnalysis::analyzeFunction(const FnTypeInfo &fn) {
   assert(fn.KnownValues.size() ==
          fn.Function->getFunctionType()->getNumParams());
   assert(fn.Function);
-  auto found = analyzedFunctions.find(fn);
-  if (found != analyzedFunctions.end()) {
-    auto &analysis = *found->second;
+  if (auto found = analyzedFunctions.lookup(fn)) {
+    auto &analysis = *found;
     if (analysis.fntypeinfo.Function != fn.Function) {
       llvm::errs() << " queryFunc: " << *fn.Function << "\n";
       llvm::errs() << " analysisFunc: " << *analysis.fntypeinfo.Function
@@ -5846,8 +5820,9 @@ TypeResults TypeAnalysis::analyzeFunction(const FnTypeInfo &fn) {
   if (fn.Function->empty())
     return TypeResults(nullptr);
 
-  auto res = analyzedFunctions.emplace(fn, new TypeAnalyzer(fn, *this));
-  auto &analysis = *res.first->second;
+  auto res = analyzedFunctions.insert(
+      fn, std::shared_ptr<TypeAnalyzer>(new TypeAnalyzer(fn, *this)));
+  auto &analysis = *res;
 
   if (EnzymePrintType) {
     llvm::errs() << "analyzing function " << fn.Function->getName() << "\n";
@@ -5878,7 +5853,7 @@ TypeResults TypeAnalysis::analyzeFunction(const FnTypeInfo &fn) {
   assert(analysis.fntypeinfo.Function == fn.Function);
 
   {
-    auto &analysis = *analyzedFunctions.find(fn)->second;
+    auto &analysis = *analyzedFunctions.lookup(fn);
     if (analysis.fntypeinfo.Function != fn.Function) {
       llvm::errs() << " queryFunc: " << *fn.Function << "\n";
       llvm::errs() << " analysisFunc: " << *analysis.fntypeinfo.Function
@@ -5889,12 +5864,132 @@ TypeResults TypeAnalysis::analyzeFunction(const FnTypeInfo &fn) {
 
   // Store the steady state result (if changed) to avoid
   // a second analysis later.
-  analyzedFunctions.emplace(TypeResults(analysis).getAnalyzedTypeInfo(),
-                            res.first->second);
+  analyzedFunctions.insert(TypeResults(analysis).getAnalyzedTypeInfo(), res);
 
   return TypeResults(analysis);
 }
 
+void collectTypeAnalysisResources(Function *F,
+                                  SmallPtrSetImpl<GlobalValue *> &Res) {
+  SmallVector<Function *, 4> todoFns = {F};
+  SmallVector<Constant *, 8> todoConsts;
+  SmallPtrSet<Constant *, 16> seenConsts;
+  Res.insert(F);
+  auto addConstant = [&](Constant *C) {
+    if (!seenConsts.insert(C).second)
+      return;
+    if (auto GV = dyn_cast<GlobalValue>(C)) {
+      if (auto Fn = dyn_cast<Function>(GV)) {
+        if (!Fn->empty() && Res.insert(Fn).second)
+          todoFns.push_back(Fn);
+        return;
+      }
+      if (!Res.insert(GV).second)
+        return;
+      if (auto GVar = dyn_cast<GlobalVariable>(GV))
+        if (GVar->hasInitializer())
+          todoConsts.push_back(GVar->getInitializer());
+      return;
+    }
+    todoConsts.push_back(C);
+  };
+  while (todoFns.size() || todoConsts.size()) {
+    if (todoConsts.size()) {
+      auto C = todoConsts.pop_back_val();
+      for (auto &Op : C->operands())
+        addConstant(cast<Constant>(Op));
+      continue;
+    }
+    auto Fn = todoFns.pop_back_val();
+    for (auto &I : instructions(Fn))
+      for (auto &Op : I.operands())
+        if (auto C = dyn_cast<Constant>(Op))
+          addConstant(C);
+  }
+}
+
+std::vector<TypeResults>
+TypeAnalysis::analyzeFunctions(ArrayRef<FnTypeInfo> fns, unsigned Threads) {
+  std::vector<TypeResults> results(fns.size(), TypeResults(nullptr));
+
+  // Custom rules and printing are not known to be safe to run concurrently.
+  if (Threads <= 1 || fns.size() <= 1 || EnzymePrintType ||
+      !CustomRules.empty()) {
+    for (size_t i = 0; i < fns.size(); i++)
+      results[i] = analyzeFunction(fns[i]);
+    return results;
+  }
+
+  // Queries which may touch a common function or global must be run by the
+  // same thread, as an in-progress analysis is visible in the cache and may
+  // temporarily insert instructions into the function being analyzed.
+  EquivalenceClasses<size_t> groups;
+  DenseMap<GlobalValue *, size_t> owner;
+  SetVector<Function *> reachable;
+  for (size_t i = 0; i < fns.size(); i++) {
+    groups.insert(i);
+    SmallPtrSet<GlobalValue *, 16> resources;
+    collectTypeAnalysisResources(fns[i].Function, resources);
+    for (auto GV : resources) {
+      auto found = owner.try_emplace(GV, i);
+      if (!found.second)
+        groups.unionSets(found.first->second, i);
+      if (auto F = dyn_cast<Function>(GV))
+        reachable.insert(F);
+    }
+  }
+
+  // Compute state which is lazily created on first use, and thus otherwise
+  // modified concurrently, ahead of time.
+  for (auto F : reachable) {
+    FAM.getResult<TargetLibraryAnalysis>(*F);
+    FAM.getResult<DominatorTreeAnalysis>(*F);
+    FAM.getResult<PostDominatorTreeAnalysis>(*F);
+    FAM.getResult<LoopAnalysis>(*F);
+    FAM.getResult<ScalarEvolutionAnalysis>(*F);
+  }
+  if (fns.size()) {
+    Module &M = *fns[0].Function->getParent();
+    auto &DL = M.getDataLayout();
+    TypeFinder StructTypes;
+    StructTypes.run(M, /*onlyNamed*/ false);
+    for (auto ST : StructTypes)
+      if (ST->isSized())
+        DL.getStructLayout(ST);
+  }
+
+#if LLVM_VERSION_MAJOR >= 19
+  DefaultThreadPool Pool(hardware_concurrency(Threads));
+#else
+  ThreadPool Pool(hardware_concurrency(Threads));
+#endif
+  // The work of each group is counted separately and then accounted to the
+  // derivative requesting the analyses, if any.
+  bool collectStats = getCurrentEnzymeStats() != nullptr;
+  std::vector<EnzymeFunctionStats> groupStats;
+  if (collectStats)
+    groupStats.resize(groups.getNumClasses());
+  size_t groupIdx = 0;
+  for (auto GI = groups.begin(), GE = groups.end(); GI != GE; ++GI) {
+    if (!GI->isLeader())
+      continue;
+    SmallVector<size_t, 4> group(groups.member_begin(GI), groups.member_end());
+    llvm::sort(group);
+    EnzymeFunctionStats *stats =
+        collectStats ? &groupStats[groupIdx] : nullptr;
+    groupIdx++;
+    Pool.async([this, group, fns, &results, stats]() {
+      EnzymeStatsCollector collector(stats);
+      for (auto i : group)
+        results[i] = analyzeFunction(fns[i]);
+    });
+  }
+  Pool.wait();
+  for (auto &stats : groupStats)
+    addEnzymeStats(stats);
+  return results;
+}
+
 TypeResults::TypeResults(TypeAnalyzer &analyzer) : analyzer(&analyzer) {}
 TypeResults::TypeResults(std::nullptr_t) : analyzer(nullptr) {}
 
@@ -6195,20 +6290,8 @@ TypeTree defaultTypeTreeForLLVM(llvm::Type *ET, llvm::Instruction *I,
     for (size_t i = 0; i < ST->getNumElements(); i++) {
       auto SubT =
           defaultTypeTreeForLLVM(ST->getElementType(i), I, intIsPointer);
-      Value *vec[2] = {
-          ConstantInt::get(Type::getInt64Ty(I->getContext()), 0),
-          ConstantInt::get(Type::getInt32Ty(I->getContext()), i),
-      };
-      auto g2 = GetElementPtrInst::Create(
-          ST, UndefValue::get(PointerType::getUnqual(ST)), vec);
-      APInt ai(DL.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-      g2->accumulateConstantOffset(DL, ai);
-      // Using destructor rather than eraseFromParent
-      //   as g2 has no parent
-      delete g2;
-
       auto size = (DL.getTypeSizeInBits(ST->getElementType(i)) + 7) / 8;
-      int Off = (int)ai.getLimitedValue();
+      int Off = (int)DL.getStructLayout(ST)->getElementOffset(i);
       Out |= SubT.ShiftIndices(DL, 0, size, Off);
     }
     return Out;
@@ -6219,19 +6302,7 @@ TypeTree defaultTypeTreeForLLVM(llvm::Type *ET, llvm::Instruction *I,
 
     TypeTree Out;
     for (size_t i = 0; i < AT->getNumElements(); i++) {
-      Value *vec[2] = {
-          ConstantInt::get(Type::getInt64Ty(I->getContext()), 0),
-          ConstantInt::get(Type::getInt32Ty(I->getContext()), i),
-      };
-      auto g2 = GetElementPtrInst::Create(
-          AT, UndefValue::get(PointerType::getUnqual(AT)), vec);
-      APInt ai(DL.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-      g2->accumulateConstantOffset(DL, ai);
-      // Using destructor rather than eraseFromParent
-      //   as g2 has no parent
-      delete g2;
-
-      int Off = (int)ai.getLimitedValue();
+      int Off = (int)getConstantAggregateOffset(DL, AT, {(unsigned)i});
       auto size = (DL.getTypeSizeInBits(AT->getElementType()) + 7) / 8;
       Out |= SubT.ShiftIndices(DL, 0, size, Off);
     }
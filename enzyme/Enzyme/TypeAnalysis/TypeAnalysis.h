@@ -27,6 +27,7 @@
 
 #include <cstdint>
 #include <deque>
+#include <mutex>
 
 #include <llvm/Config/llvm-config.h>
 
@@ -384,6 +385,46 @@ public:
 };
 
 /// Full interprocedural TypeAnalysis
+/// Lock held by Type Analysis while modifying or querying state shared between
+/// functions (use lists of constants, value handles and the function analysis
+/// manager), allowing independent functions to be analyzed concurrently.
+std::recursive_mutex &getTypeAnalysisIRLock();
+
+/// Thread-safe map of possible query states to TypeAnalyzer intermediate
+/// results. Entries are sharded by the analyzed function, so that concurrent
+/// analyses of different functions rarely contend for the same lock.
+class TypeAnalysisCache {
+public:
+  typedef std::map<FnTypeInfo, std::shared_ptr<TypeAnalyzer>> Shard;
+
+private:
+  static constexpr unsigned NumShards = 16;
+  mutable std::mutex locks[NumShards];
+  Shard shards[NumShards];
+
+  static unsigned getShardIndex(const llvm::Function *F) {
+    return llvm::DenseMapInfo<const llvm::Function *>::getHashValue(F) %
+           NumShards;
+  }
+
+public:
+  /// Return the cached analysis of fn, or null if not present
+  std::shared_ptr<TypeAnalyzer> lookup(const FnTypeInfo &fn) const;
+
+  /// Cache analysis as the result of fn unless already present, returning
+  /// the cached result
+  std::shared_ptr<TypeAnalyzer>
+  insert(const FnTypeInfo &fn, std::shared_ptr<TypeAnalyzer> analysis);
+
+  /// Return the entries for analyses of F. Must not be called while
+  /// entries are being inserted concurrently.
+  const Shard &getShard(const llvm::Function *F) const {
+    return shards[getShardIndex(F)];
+  }
+
+  void clear();
+};
+
 class TypeAnalysis {
 public:
   llvm::FunctionAnalysisManager &FAM;
@@ -397,15 +438,27 @@ public:
       CustomRules;
 
   /// Map of possible query states to TypeAnalyzer intermediate results
-  std::map<FnTypeInfo, std::shared_ptr<TypeAnalyzer>> analyzedFunctions;
+  TypeAnalysisCache analyzedFunctions;
 
   /// Analyze a particular function, returning the results
   TypeResults analyzeFunction(const FnTypeInfo &fn);
 
+  /// Analyze a set of functions, returning the results in the same order.
+  /// Queries which cannot reach a common function or global are analyzed
+  /// concurrently on up to Threads threads.
+  std::vector<TypeResults> analyzeFunctions(llvm::ArrayRef<FnTypeInfo> fns,
+                                            unsigned Threads);
+
   /// Clear existing analyses
   void clear();
 };
 
+/// Collect the defined functions and global variables whose IR may be read or
+/// modified when analyzing F, i.e. those transitively referenced by its
+/// instructions.
+void collectTypeAnalysisResources(
+    llvm::Function *F, llvm::SmallPtrSetImpl<llvm::GlobalValue *> &Res);
+
 TypeTree defaultTypeTreeForLLVM(llvm::Type *ET, llvm::Instruction *I,
                                 bool intIsPointer = true);
 FnTypeInfo preventTypeAnalysisLoops(const FnTypeInfo &oldTypeInfo_,
@@ -135,7 +135,7 @@ bool printTypeAnalyses(llvm::Function &F) {
   TA.analyzeFunction(type_args);
   for (Function &f : *F.getParent()) {
 
-    for (auto &analysis : TA.analyzedFunctions) {
+    for (auto &analysis : TA.analyzedFunctions.getShard(&f)) {
       if (analysis.first.Function != &f)
         continue;
       auto &ta = *analysis.second;
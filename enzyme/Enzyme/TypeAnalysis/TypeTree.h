@@ -31,6 +31,7 @@
 #ifndef ENZYME_TYPE_ANALYSIS_TYPE_TREE_H
 #define ENZYME_TYPE_ANALYSIS_TYPE_TREE_H 1
 
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 #include <map>
@@ -41,6 +42,7 @@
 #include "../Utils.h"
 #include "BaseType.h"
 #include "ConcreteType.h"
+#include "TypeTreeMap.h"
 
 /// Maximum offset for type trees to keep
 extern "C" {
@@ -64,7 +66,7 @@ static inline std::string to_string(const std::vector<int> x) {
 class TypeTree;
 
 typedef std::shared_ptr<const TypeTree> TypeResult;
-typedef std::map<const std::vector<int>, ConcreteType> ConcreteTypeMapType;
+typedef TypeTreeMap ConcreteTypeMapType;
 typedef std::map<const std::vector<int>, const TypeResult> TypeTreeMapType;
 
 /// Class representing the underlying types of values as
@@ -73,13 +75,13 @@ class TypeTree : public std::enable_shared_from_this<TypeTree> {
 private:
   // mapping of known indices to type if one exists
   ConcreteTypeMapType mapping;
-  std::vector<int> minIndices;
+  llvm::SmallVector<int, 4> minIndices;
 
 public:
   TypeTree() {}
   TypeTree(ConcreteType dat) {
     if (dat != ConcreteType(BaseType::Unknown)) {
-      mapping.insert(std::pair<const std::vector<int>, ConcreteType>({}, dat));
+      mapping.emplace(IndexPath(), dat);
     }
   }
 
@@ -249,7 +251,7 @@ public:
       return false;
     }
     if (SeqSize == 0) {
-      mapping.insert(std::pair<const std::vector<int>, ConcreteType>(Seq, CT));
+      mapping.emplace(Seq, CT);
       return true;
     }
 
@@ -277,7 +279,10 @@ public:
     // Check if there is an existing match, e.g. [-1, -1, -1] and inserting
     // [-1, 8, -1]
     {
-      for (const auto &pair : llvm::make_early_inc_range(mapping)) {
+      for (auto it = mapping.begin(), next = it; it != mapping.end();
+           it = next) {
+        ++next;
+        const auto &pair = *it;
         if (pair.first.size() == SeqSize) {
           // Whether the the inserted val (e.g. [-1, 0] or [0, 0]) is at least
           // as general as the existing map val (e.g. [0, 0]).
@@ -334,7 +339,7 @@ public:
               // previous equivalent values or values overwritten by
               // an anything are removed
               changed = true;
-              mapping.erase(pair.first);
+              next = mapping.erase(it);
               continue;
             }
 
@@ -346,7 +351,7 @@ public:
                   (CT == BaseType::Integer &&
                    pair.second == BaseType::Pointer)) {
                 changed = true;
-                mapping.erase(pair.first);
+                next = mapping.erase(it);
                 continue;
               }
 
@@ -384,7 +389,10 @@ public:
     }
 
     if (possibleDeletion) {
-      for (const auto &pair : llvm::make_early_inc_range(mapping)) {
+      for (auto it = mapping.begin(), next = it; it != mapping.end();
+           it = next) {
+        ++next;
+        const auto &pair = *it;
         size_t i = 0;
         bool mustKeep = false;
         bool considerErase = false;
@@ -399,7 +407,7 @@ public:
           ++i;
         }
         if (!mustKeep && considerErase) {
-          mapping.erase(pair.first);
+          next = mapping.erase(it);
           changed = true;
         }
       }
@@ -420,7 +428,7 @@ public:
     }
     if (considerErase && !keep)
       return changed;
-    mapping.insert(std::pair<const std::vector<int>, ConcreteType>(Seq, CT));
+    mapping.emplace(Seq, CT);
     return true;
   }
 
@@ -503,8 +511,7 @@ public:
       Vec.push_back(Off);
       for (auto Val : pair.first)
         Vec.push_back(Val);
-      Result.mapping.insert(
-          std::pair<const std::vector<int>, ConcreteType>(Vec, pair.second));
+      Result.mapping.emplace(Vec, pair.second);
     }
     return Result;
   }
@@ -521,8 +528,7 @@ public:
 
       if (pair.first[0] == -1) {
         std::vector<int> next(pair.first.begin() + 1, pair.first.end());
-        Result.mapping.insert(
-            std::pair<const std::vector<int>, ConcreteType>(next, pair.second));
+        Result.mapping.emplace(next, pair.second);
         for (size_t i = 0, Len = next.size(); i < Len; ++i) {
           if (i == Result.minIndices.size())
             Result.minIndices.push_back(next[i]);
@@ -566,7 +572,7 @@ public:
       if (pair.first[0] == -1) {
         // For "all index" calculations, explicitly
         // add mappings for regions in range
-        auto next = pair.first;
+        std::vector<int> next(pair.first);
         for (size_t i = 0; i < start; ++i) {
           next[0] = i;
           Result.orIn(next, pair.second);
@@ -703,7 +709,7 @@ public:
     }
 
     // TypeTree mappings which did not get combined
-    std::map<const std::vector<int>, ConcreteType> unCombinedToAdd;
+    TypeTreeMap unCombinedToAdd;
 
     // TypeTree mappings which did get combined into an outer -1
     std::map<const std::vector<int>, ConcreteType> combinedToAdd;
@@ -1019,7 +1025,7 @@ public:
             // orIn returns if changed, update the value in the map if so
             // with the new value.
             if (prev.orIn(found->second, /*pointerIntSame*/ false))
-              found->second = prev;
+              Result.mapping.assign(found, prev);
           } else {
             Result.mapping.emplace(next, pair.second);
           }
@@ -1070,9 +1076,9 @@ public:
 
   /// Replace all integer subtypes with anything
   void ReplaceIntWithAnything() {
-    for (auto &pair : mapping) {
-      if (pair.second == BaseType::Integer) {
-        pair.second = BaseType::Anything;
+    for (auto it = mapping.begin(); it != mapping.end(); ++it) {
+      if (it->second == BaseType::Integer) {
+        it = mapping.assign(it, BaseType::Anything);
       }
     }
   }
@@ -1096,10 +1102,7 @@ public:
     if (*this == RHS)
       return false;
     minIndices = RHS.minIndices;
-    mapping.clear();
-    for (const auto &elems : RHS.mapping) {
-      mapping.emplace(elems);
-    }
+    mapping = RHS.mapping;
     return true;
   }
 
@@ -1133,7 +1136,10 @@ public:
       // Check if there is an existing match, e.g. [-1, -1, -1] and inserting
       // [-1, 8, -1]
       {
-        for (const auto &pair : llvm::make_early_inc_range(mapping)) {
+        for (auto it = mapping.begin(), next = it; it != mapping.end();
+             it = next) {
+          ++next;
+          const auto &pair = *it;
           if (pair.first.size() == SeqSize) {
             // Whether the the inserted val (e.g. [-1, 0] or [0, 0]) is at least
             // as general as the existing map val (e.g. [0, 0]).
@@ -1178,7 +1184,7 @@ public:
               if (CT == BaseType::Anything) {
                 // If both at same index, remove old index
                 if (newMoreGeneralThanOld)
-                  mapping.erase(pair.first);
+                  next = mapping.erase(it);
                 continue;
               }
 
@@ -1193,7 +1199,7 @@ public:
               if (CT == BaseType::Anything || CT == pair.second) {
                 // previous equivalent values or values overwritten by
                 // an anything are removed
-                mapping.erase(pair.first);
+                next = mapping.erase(it);
                 continue;
               }
 
@@ -1204,7 +1210,7 @@ public:
                      pair.second == BaseType::Integer) ||
                     (CT == BaseType::Integer &&
                      pair.second == BaseType::Pointer)) {
-                  mapping.erase(pair.first);
+                  next = mapping.erase(it);
                   continue;
                 }
 
@@ -1292,15 +1298,20 @@ public:
   bool andIn(const TypeTree &RHS) {
     bool changed = false;
 
-    for (auto &pair : llvm::make_early_inc_range(mapping)) {
+    for (auto it = mapping.begin(), next = it; it != mapping.end();
+         it = next) {
+      ++next;
+      ConcreteType CT = it->second;
       ConcreteType other = BaseType::Unknown;
-      auto fd = RHS.mapping.find(pair.first);
+      auto fd = RHS.mapping.find(it->first);
       if (fd != RHS.mapping.end()) {
         other = fd->second;
       }
-      changed = (pair.second &= other);
-      if (pair.second == BaseType::Unknown) {
-        mapping.erase(pair.first);
+      changed = (CT &= other);
+      if (CT == BaseType::Unknown) {
+        next = mapping.erase(it);
+      } else if (changed) {
+        next = std::next(mapping.assign(it, CT));
       }
     }
 
@@ -1319,13 +1330,16 @@ public:
                llvm::BinaryOperator::BinaryOps Op) {
     bool changed = false;
 
-    for (auto &pair : llvm::make_early_inc_range(mapping)) {
+    for (auto it = mapping.begin(), next = it; it != mapping.end();
+         it = next) {
+      ++next;
+      const auto &pair = *it;
       // TODO propagate non-first level operands:
       // Special handling is necessary here because a pointer to an int
       // binop with something should not apply the binop rules to the
       // underlying data but instead a different rule
       if (pair.first.size() > 0) {
-        mapping.erase(pair.first);
+        next = mapping.erase(it);
         continue;
       }
 
@@ -1344,9 +1358,9 @@ public:
         return changed;
       }
       if (CT == BaseType::Unknown) {
-        mapping.erase(pair.first);
-      } else {
-        pair.second = CT;
+        next = mapping.erase(it);
+      } else if (CT != pair.second) {
+        next = std::next(mapping.assign(it, CT));
       }
     }
 
@@ -1369,7 +1383,7 @@ public:
           return changed;
         }
         if (CT != BaseType::Unknown) {
-          mapping.insert(std::make_pair(pair.first, CT));
+          mapping.emplace(pair.first, CT);
         }
       }
     }
@@ -1407,9 +1421,8 @@ public:
         base = pair.second;
         continue;
       }
-      auto next(pair.first);
-      next.erase(next.begin());
-      todo[pair.first[0]].mapping.insert(std::make_pair(next, pair.second));
+      std::vector<int> next(pair.first.begin() + 1, pair.first.end());
+      todo[pair.first[0]].mapping.emplace(next, pair.second);
     }
     subMD.push_back(llvm::MDString::get(ctx, base.str()));
     for (auto pair : todo) {
@@ -1425,7 +1438,7 @@ public:
         llvm::cast<llvm::MDString>(md->getOperand(0))->getString(),
         md->getContext());
     if (base != BaseType::Unknown)
-      mapping.insert(std::make_pair(prev, base));
+      mapping.emplace(prev, base);
     for (size_t i = 1; i < md->getNumOperands(); i += 2) {
       auto off = llvm::cast<llvm::ConstantInt>(
                      llvm::cast<llvm::ConstantAsMetadata>(md->getOperand(i))
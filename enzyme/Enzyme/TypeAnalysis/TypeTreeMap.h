@@ -0,0 +1,228 @@
+//===- TypeTreeMap.h - Flat storage of Type Analysis Type Trees  ----------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains the storage used by TypeTrees to map sequences of memory
+// offsets to ConcreteTypes.
+//
+// Offset sequences are interned into IndexPaths, which are never freed and
+// compare equal if and only if they point to the same sequence. This makes
+// copying a mapping from one TypeTree to another, as done by most TypeTree
+// operations, a pointer copy rather than a vector allocation.
+//
+// The mapping itself is a vector of (IndexPath, ConcreteType) pairs kept
+// sorted in the same lexicographic order as a
+// std::map<std::vector<int>, ConcreteType>, so that iteration order (and thus
+// the result of TypeTree operations) is unchanged. The vector is shared
+// between copies of a TypeTreeMap and only copied once one of them is
+// modified.
+//
+//===----------------------------------------------------------------------===//
+#ifndef ENZYME_TYPE_ANALYSIS_TYPE_TREE_MAP_H
+#define ENZYME_TYPE_ANALYSIS_TYPE_TREE_MAP_H 1
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "ConcreteType.h"
+
+/// An interned sequence of memory offsets
+class IndexPath {
+private:
+  const std::vector<int> *path;
+
+  /// Return the unique copy of Seq, creating it if needed
+  static const std::vector<int> *intern(llvm::ArrayRef<int> Seq) {
+    static std::mutex lock;
+    static std::deque<std::vector<int>> paths;
+    static llvm::DenseMap<llvm::ArrayRef<int>, const std::vector<int> *> table;
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = table.find(Seq);
+    if (found != table.end())
+      return found->second;
+    paths.emplace_back(Seq.begin(), Seq.end());
+    const std::vector<int> *result = &paths.back();
+    // Key on the interned copy, which is never modified or moved.
+    table[llvm::ArrayRef<int>(result->data(), result->size())] = result;
+    return result;
+  }
+
+public:
+  IndexPath() {
+    static const std::vector<int> *empty = intern({});
+    path = empty;
+  }
+  explicit IndexPath(llvm::ArrayRef<int> Seq) : path(intern(Seq)) {}
+
+  operator const std::vector<int> &() const { return *path; }
+  llvm::ArrayRef<int> getArrayRef() const { return *path; }
+
+  size_t size() const { return path->size(); }
+  bool empty() const { return path->empty(); }
+  int operator[](size_t i) const { return (*path)[i]; }
+  std::vector<int>::const_iterator begin() const { return path->begin(); }
+  std::vector<int>::const_iterator end() const { return path->end(); }
+
+  bool operator==(const IndexPath &RHS) const { return path == RHS.path; }
+  bool operator!=(const IndexPath &RHS) const { return path != RHS.path; }
+  /// Lexicographic order of the underlying offsets
+  bool operator<(const IndexPath &RHS) const {
+    return path != RHS.path && *path < *RHS.path;
+  }
+};
+
+/// Sorted, copy-on-write map of IndexPaths to ConcreteTypes. The interface
+/// follows std::map, except that entries can only be modified through the map
+/// and iterators are invalidated by any modification.
+class TypeTreeMap {
+public:
+  typedef std::pair<IndexPath, ConcreteType> value_type;
+  typedef std::vector<value_type> Storage;
+  typedef Storage::const_iterator const_iterator;
+
+private:
+  /// Sorted entries, possibly shared with other maps. Null if empty.
+  std::shared_ptr<Storage> entries;
+
+  static bool keyLess(const value_type &LHS, llvm::ArrayRef<int> RHS) {
+    return std::lexicographical_compare(LHS.first.begin(), LHS.first.end(),
+                                        RHS.begin(), RHS.end());
+  }
+
+  const_iterator lower_bound(llvm::ArrayRef<int> Seq) const {
+    if (!entries)
+      return end();
+    return std::lower_bound(entries->begin(), entries->end(), Seq, keyLess);
+  }
+
+  /// Obtain storage which is not shared with any other map, translating the
+  /// given position into it.
+  Storage::iterator makeUnique(const_iterator pos) {
+    size_t idx = entries ? pos - entries->cbegin() : 0;
+    if (!entries)
+      entries = std::make_shared<Storage>();
+    else if (entries.use_count() != 1)
+      entries = std::make_shared<Storage>(*entries);
+    return entries->begin() + idx;
+  }
+
+  std::pair<const_iterator, bool> emplaceAt(const_iterator pos,
+                                            IndexPath Seq, ConcreteType CT) {
+    auto it = makeUnique(pos);
+    it = entries->emplace(it, Seq, CT);
+    return std::make_pair(const_iterator(it), true);
+  }
+
+public:
+  const_iterator begin() const {
+    return entries ? entries->cbegin() : const_iterator();
+  }
+  const_iterator end() const {
+    return entries ? entries->cend() : const_iterator();
+  }
+  size_t size() const { return entries ? entries->size() : 0; }
+  bool empty() const { return size() == 0; }
+
+  const_iterator find(llvm::ArrayRef<int> Seq) const {
+    auto it = lower_bound(Seq);
+    if (it != end() && it->first.getArrayRef() == Seq)
+      return it;
+    return end();
+  }
+  const_iterator find(const IndexPath &Seq) const {
+    auto it = lower_bound(Seq.getArrayRef());
+    if (it != end() && it->first == Seq)
+      return it;
+    return end();
+  }
+  size_t count(llvm::ArrayRef<int> Seq) const { return find(Seq) != end(); }
+
+  /// Insert CT at Seq unless Seq is already present
+  std::pair<const_iterator, bool> emplace(const IndexPath &Seq,
+                                          ConcreteType CT) {
+    auto it = lower_bound(Seq.getArrayRef());
+    if (it != end() && it->first == Seq)
+      return std::make_pair(it, false);
+    return emplaceAt(it, Seq, CT);
+  }
+  std::pair<const_iterator, bool> emplace(llvm::ArrayRef<int> Seq,
+                                          ConcreteType CT) {
+    auto it = lower_bound(Seq);
+    if (it != end() && it->first.getArrayRef() == Seq)
+      return std::make_pair(it, false);
+    return emplaceAt(it, IndexPath(Seq), CT);
+  }
+  std::pair<const_iterator, bool> insert(const value_type &pair) {
+    return emplace(pair.first, pair.second);
+  }
+
+  /// Insert CT at Seq, replacing any existing type
+  void insert_or_assign(llvm::ArrayRef<int> Seq, ConcreteType CT) {
+    auto found = emplace(Seq, CT);
+    if (!found.second)
+      assign(found.first, CT);
+  }
+
+  /// Replace the type of the entry at pos, returning the position of the
+  /// entry after the modification.
+  const_iterator assign(const_iterator pos, ConcreteType CT) {
+    auto it = makeUnique(pos);
+    it->second = CT;
+    return it;
+  }
+
+  /// Erase the entry at pos, returning the position of the following entry
+  const_iterator erase(const_iterator pos) {
+    auto it = makeUnique(pos);
+    return entries->erase(it);
+  }
+  size_t erase(llvm::ArrayRef<int> Seq) {
+    auto found = find(Seq);
+    if (found == end())
+      return 0;
+    erase(found);
+    return 1;
+  }
+
+  void clear() { entries.reset(); }
+
+  bool operator==(const TypeTreeMap &RHS) const {
+    if (entries == RHS.entries)
+      return true;
+    if (size() != RHS.size())
+      return false;
+    return std::equal(begin(), end(), RHS.begin());
+  }
+  bool operator!=(const TypeTreeMap &RHS) const { return !(*this == RHS); }
+  bool operator<(const TypeTreeMap &RHS) const {
+    if (entries == RHS.entries)
+      return false;
+    return std::lexicographical_compare(begin(), end(), RHS.begin(),
+                                        RHS.end());
+  }
+};
+
+#endif
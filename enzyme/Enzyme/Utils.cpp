@@ -47,6 +47,7 @@
 
 #include "llvm-c/Core.h"
 
+#include "EnzymeStats.h"
 #include "LibraryFuncs.h"
 
 using namespace llvm;
@@ -83,6 +84,18 @@ llvm::cl::opt<bool>
 llvm::cl::opt<bool>
     EnzymeBlasCopy("enzyme-blas-copy", cl::init(true), cl::Hidden,
                    cl::desc("Use blas copy calls to cache vectors"));
+llvm::cl::opt<bool> EnzymeLapackPackedCache(
+    "enzyme-lapack-packed-cache", cl::init(false), cl::Hidden,
+    cl::desc("Cache only the referenced triangle of triangular and symmetric "
+             "matrices, in packed storage, if lapack copies are used"));
+llvm::cl::opt<bool> EnzymeBlasFuseLanes(
+    "enzyme-blas-fuse-lanes", cl::init(true), cl::Hidden,
+    cl::desc("Compute the lanes of vector forward mode blas derivatives with "
+             "one call on packed shadows where possible"));
+llvm::cl::opt<bool> EnzymeOverwriteCache(
+    "enzyme-overwrite-cache", cl::init(true), cl::Hidden,
+    cl::desc("Memoize whether instructions may overwrite memory read by "
+             "others across the derivatives of a function"));
 llvm::cl::opt<bool>
     EnzymeFastMath("enzyme-fast-math", cl::init(true), cl::Hidden,
                    cl::desc("Use fast math on derivative compuation"));
@@ -127,11 +140,73 @@ llvm::PointerType *getDefaultAnonymousTapeType(llvm::LLVMContext &C) {
   return getInt8PtrTy(C);
 }
 
+/// Return (creating if necessary) a declaration of the tape arena (or tape
+/// profiling) runtime function of the given name and type. The default
+/// implementation of these lives in include/enzyme/tape/arena.h (respectively
+/// include/enzyme/tape/profile.h)
+static FunctionCallee getTapeArenaFunction(Module &M, StringRef name,
+                                           FunctionType *FT) {
+  auto F = M.getOrInsertFunction(name, FT);
+  if (auto Fn = dyn_cast<Function>(F.getCallee()))
+    Fn->addFnAttr(Attribute::NoUnwind);
+  return F;
+}
+
+CallInst *CreateTapeArenaMark(IRBuilder<> &B) {
+  auto &M = *B.GetInsertBlock()->getParent()->getParent();
+  auto FT = FunctionType::get(getInt8PtrTy(M.getContext()), {}, false);
+  return B.CreateCall(getTapeArenaFunction(M, "__enzyme_tape_arena_mark", FT),
+                      {}, "tapearena_mark");
+}
+
+CallInst *CreateTapeArenaRelease(IRBuilder<> &B, Value *Mark) {
+  auto &M = *B.GetInsertBlock()->getParent()->getParent();
+  Type *tys[] = {getInt8PtrTy(M.getContext())};
+  auto FT = FunctionType::get(Type::getVoidTy(M.getContext()), tys, false);
+  auto releaseF = getTapeArenaFunction(M, "__enzyme_tape_arena_release", FT);
+  return B.CreateCall(releaseF, {Mark});
+}
+
+CallInst *CreateTapeProfile(IRBuilder<> &B, Value *Site, Value *Old,
+                            Value *Ptr, Value *Bytes) {
+  auto &M = *B.GetInsertBlock()->getParent()->getParent();
+  auto i8p = getInt8PtrTy(M.getContext());
+  Type *tys[] = {i8p, i8p, i8p, Type::getInt64Ty(M.getContext())};
+  auto FT = FunctionType::get(Type::getVoidTy(M.getContext()), tys, false);
+  auto profileF = getTapeArenaFunction(M, "__enzyme_tape_profile", FT);
+  // The profiling runtime only accesses its own state, and so does not clobber
+  // any memory of the program.
+  if (auto Fn = dyn_cast<Function>(profileF.getCallee()))
+    Fn->addFnAttr(Attribute::InaccessibleMemOnly);
+  Value *args[] = {B.CreatePointerCast(Site, i8p),
+                   Old ? B.CreatePointerCast(Old, i8p)
+                       : (Value *)ConstantPointerNull::get(i8p),
+                   B.CreatePointerCast(Ptr, i8p), Bytes};
+  return B.CreateCall(profileF, args);
+}
+
+CallInst *CreateTapeProfileFree(IRBuilder<> &B, Value *Ptr) {
+  auto &M = *B.GetInsertBlock()->getParent()->getParent();
+  Type *tys[] = {getInt8PtrTy(M.getContext())};
+  auto FT = FunctionType::get(Type::getVoidTy(M.getContext()), tys, false);
+  auto profileF = getTapeArenaFunction(M, "__enzyme_tape_profile_free", FT);
+  if (auto Fn = dyn_cast<Function>(profileF.getCallee()))
+    Fn->addFnAttr(Attribute::InaccessibleMemOnly);
+  return B.CreateCall(profileF,
+                      {B.CreatePointerCast(Ptr, getInt8PtrTy(M.getContext()))});
+}
+
 Function *getOrInsertExponentialAllocator(Module &M, Function *newFunc,
-                                          bool ZeroInit, llvm::Type *RT) {
+                                          bool ZeroInit, llvm::Type *RT,
+                                          bool Arena) {
   bool custom = true;
   llvm::PointerType *allocType;
-  {
+  if (Arena) {
+    // Arena buffers are resized by the arena runtime, which can grow the
+    // topmost buffer in place.
+    custom = false;
+    allocType = getInt8PtrTy(M.getContext());
+  } else {
     auto i64 = Type::getInt64Ty(newFunc->getContext());
     BasicBlock *BB = BasicBlock::Create(M.getContext(), "entry", newFunc);
     IRBuilder<> B(BB);
@@ -151,6 +226,8 @@ Function *getOrInsertExponentialAllocator(Module &M, Function *newFunc,
   std::string name = "__enzyme_exponentialallocation";
   if (ZeroInit)
     name += "zero";
+  if (Arena)
+    name += ".arena";
   if (custom)
     name += ".custom@" + std::to_string((size_t)RT);
 
@@ -203,7 +280,15 @@ Function *getOrInsertExponentialAllocator(Module &M, Function *newFunc,
                      ConstantInt::get(next->getType(), 0),
                      B.CreateLShr(next, ConstantInt::get(next->getType(), 1)));
 
-  if (!custom) {
+  if (Arena) {
+    Type *tys[] = {allocType, types[1], types[1]};
+    auto reallocF = getTapeArenaFunction(
+        M, "__enzyme_tape_arena_realloc",
+        FunctionType::get(allocType, tys, false));
+
+    Value *args[] = {ptr, prevSize, next};
+    gVal = B.CreateCall(reallocF, args);
+  } else if (!custom) {
     auto reallocF = M.getOrInsertFunction("realloc", allocType, allocType,
                                           Type::getInt64Ty(M.getContext()));
 
@@ -268,7 +353,8 @@ llvm::Value *CreateReAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
                                 llvm::Type *T, llvm::Value *OuterCount,
                                 llvm::Value *InnerCount,
                                 const llvm::Twine &Name,
-                                llvm::CallInst **caller, bool ZeroMem) {
+                                llvm::CallInst **caller, bool ZeroMem,
+                                bool Arena) {
   auto newFunc = B.GetInsertBlock()->getParent();
 
   Value *tsize = ConstantInt::get(
@@ -286,16 +372,216 @@ llvm::Value *CreateReAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
 
   auto realloccall =
       B.CreateCall(getOrInsertExponentialAllocator(*newFunc->getParent(),
-                                                   newFunc, ZeroMem, T),
+                                                   newFunc, ZeroMem, T, Arena),
                    idxs, Name);
   if (caller)
     *caller = realloccall;
   return realloccall;
 }
 
+/// Return (creating if necessary) the helper which appends a new block to a
+/// chunked cache directory. A directory is a null-terminated array of pointers
+/// to blocks each holding 2^shift iterations of the dynamic loop. The helper
+/// is called with the number of iterations (including the current one) and
+/// only allocates when the current iteration begins a new block. The
+/// directory itself grows by doubling, but only ever copies block pointers,
+/// never the cached data.
+static Function *getOrInsertChunkedAllocator(Module &M, bool ZeroInit,
+                                             bool Arena) {
+  auto &C = M.getContext();
+  auto i64 = Type::getInt64Ty(C);
+  auto BPT = getInt8PtrTy(C);
+  auto DPT = PointerType::getUnqual(BPT);
+
+  Type *types[] = {DPT, i64, i64, i64};
+  std::string name = "__enzyme_chunkedallocation";
+  if (ZeroInit)
+    name += "zero";
+  if (Arena)
+    name += ".arena";
+
+  FunctionType *FT = FunctionType::get(DPT, types, false);
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FT).getCallee());
+
+  if (!F->empty())
+    return F;
+
+  F->setLinkage(Function::LinkageTypes::InternalLinkage);
+  F->addFnAttr(Attribute::AlwaysInline);
+  F->addFnAttr(Attribute::NoUnwind);
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *newblock = BasicBlock::Create(C, "newblock", F);
+  BasicBlock *growdir = BasicBlock::Create(C, "growdir", F);
+  BasicBlock *insert = BasicBlock::Create(C, "insert", F);
+  BasicBlock *ok = BasicBlock::Create(C, "ok", F);
+
+  IRBuilder<> B(entry);
+
+  Argument *dir = F->arg_begin();
+  dir->setName("dir");
+  Argument *size = dir + 1;
+  size->setName("size");
+  Argument *bsize = size + 1;
+  bsize->setName("bsize");
+  Argument *shift = bsize + 1;
+  shift->setName("shift");
+
+  // Iteration being stored, and the block which will hold it.
+  Value *iter = B.CreateSub(size, ConstantInt::get(i64, 1), "", true, true);
+  Value *slot = B.CreateLShr(iter, shift, "slot");
+  Value *mask = B.CreateSub(B.CreateShl(ConstantInt::get(i64, 1), shift),
+                            ConstantInt::get(i64, 1));
+  B.CreateCondBr(B.CreateICmpEQ(B.CreateAnd(iter, mask),
+                                ConstantInt::get(i64, 0)),
+                 newblock, ok);
+
+  // The directory holds a power of two number of entries and must fit the
+  // new block and the null terminator, so grow it whenever slot+1 is a power
+  // of two (including the very first block).
+  B.SetInsertPoint(newblock);
+  Value *used = B.CreateAdd(slot, ConstantInt::get(i64, 1), "", true, true);
+  auto popCnt = Intrinsic::getDeclaration(&M, Intrinsic::ctpop, {i64});
+  B.CreateCondBr(B.CreateICmpEQ(B.CreateCall(popCnt, {used}),
+                                ConstantInt::get(i64, 1)),
+                 growdir, insert);
+
+  B.SetInsertPoint(growdir);
+  auto psize = ConstantInt::get(i64, M.getDataLayout().getPointerSize());
+  Value *next = B.CreateMul(B.CreateShl(used, ConstantInt::get(i64, 1)),
+                            psize, "", true, true);
+  Value *gDir;
+  if (Arena) {
+    Value *prevSize = B.CreateSelect(
+        B.CreateICmpEQ(slot, ConstantInt::get(i64, 0)),
+        ConstantInt::get(i64, 0), B.CreateMul(used, psize, "", true, true));
+    Type *tys[] = {BPT, i64, i64};
+    auto reallocF = getTapeArenaFunction(M, "__enzyme_tape_arena_realloc",
+                                         FunctionType::get(BPT, tys, false));
+    Value *args[] = {B.CreatePointerCast(dir, BPT), prevSize, next};
+    gDir = B.CreateCall(reallocF, args);
+  } else {
+    auto reallocF = M.getOrInsertFunction("realloc", BPT, BPT, i64);
+    Value *args[] = {B.CreatePointerCast(dir, BPT), next};
+    gDir = B.CreateCall(reallocF, args);
+  }
+  gDir = B.CreatePointerCast(gDir, DPT);
+  B.CreateBr(insert);
+
+  B.SetInsertPoint(insert);
+  auto dirphi = B.CreatePHI(DPT, 2);
+  dirphi->addIncoming(gDir, growdir);
+  dirphi->addIncoming(dir, newblock);
+
+  Instruction *ZeroInst = nullptr;
+  Value *block = CreateAllocation(B, B.getInt8Ty(), bsize, "block", nullptr,
+                                  ZeroInit ? &ZeroInst : nullptr,
+                                  /*isDefault*/ false, Arena);
+  block = B.CreatePointerCast(block, BPT);
+  B.CreateStore(block, B.CreateInBoundsGEP(BPT, dirphi, slot));
+  B.CreateStore(ConstantPointerNull::get(BPT),
+                B.CreateInBoundsGEP(BPT, dirphi, used));
+  B.CreateBr(ok);
+
+  B.SetInsertPoint(ok);
+  auto phi = B.CreatePHI(DPT, 2);
+  phi->addIncoming(dirphi, insert);
+  phi->addIncoming(dir, entry);
+  B.CreateRet(phi);
+  return F;
+}
+
+llvm::Value *CreateChunkedAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
+                                     llvm::Type *T, llvm::Value *OuterCount,
+                                     llvm::Value *InnerCount, unsigned Shift,
+                                     const llvm::Twine &Name,
+                                     llvm::CallInst **caller, bool ZeroMem,
+                                     bool Arena) {
+  auto &M = *B.GetInsertBlock()->getParent()->getParent();
+  auto i64 = Type::getInt64Ty(M.getContext());
+
+  Value *tsize =
+      ConstantInt::get(i64, M.getDataLayout().getTypeAllocSizeInBits(T) / 8);
+
+  Value *idxs[] = {
+      /*directory*/
+      B.CreatePointerCast(prev,
+                          PointerType::getUnqual(getInt8PtrTy(M.getContext()))),
+      /*incrementing value, a new block is needed every 2^shift*/
+      OuterCount,
+      /*block size (element x subloops x iterations per block)*/
+      B.CreateShl(B.CreateMul(tsize, InnerCount, "", /*NUW*/ true,
+                              /*NSW*/ true),
+                  Shift, "", /*NUW*/ true, /*NSW*/ true),
+      /*log2 of iterations per block*/
+      ConstantInt::get(i64, Shift)};
+
+  auto chunkcall = B.CreateCall(
+      getOrInsertChunkedAllocator(M, ZeroMem, Arena), idxs, Name);
+  if (caller)
+    *caller = chunkcall;
+  return chunkcall;
+}
+
+/// Return (creating if necessary) the helper which frees every block of a
+/// chunked cache directory, followed by the directory itself.
+static Function *getOrInsertChunkedDeallocator(Module &M) {
+  auto &C = M.getContext();
+  auto i64 = Type::getInt64Ty(C);
+  auto BPT = getInt8PtrTy(C);
+  auto DPT = PointerType::getUnqual(BPT);
+
+  FunctionType *FT = FunctionType::get(Type::getVoidTy(C), {DPT}, false);
+  Function *F = cast<Function>(
+      M.getOrInsertFunction("__enzyme_chunkedfree", FT).getCallee());
+
+  if (!F->empty())
+    return F;
+
+  F->setLinkage(Function::LinkageTypes::InternalLinkage);
+  F->addFnAttr(Attribute::NoUnwind);
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *loop = BasicBlock::Create(C, "loop", F);
+  BasicBlock *body = BasicBlock::Create(C, "body", F);
+  BasicBlock *done = BasicBlock::Create(C, "done", F);
+  BasicBlock *end = BasicBlock::Create(C, "end", F);
+
+  Argument *dir = F->arg_begin();
+  dir->setName("dir");
+
+  IRBuilder<> B(entry);
+  B.CreateCondBr(B.CreateIsNull(dir), end, loop);
+
+  B.SetInsertPoint(loop);
+  auto idx = B.CreatePHI(i64, 2, "idx");
+  idx->addIncoming(ConstantInt::get(i64, 0), entry);
+  Value *block = B.CreateLoad(BPT, B.CreateInBoundsGEP(BPT, dir, idx));
+  B.CreateCondBr(B.CreateIsNull(block), done, body);
+
+  B.SetInsertPoint(body);
+  CreateDealloc(B, block);
+  idx->addIncoming(B.CreateAdd(idx, ConstantInt::get(i64, 1), "", true, true),
+                   body);
+  B.CreateBr(loop);
+
+  B.SetInsertPoint(done);
+  CreateDealloc(B, dir);
+  B.CreateBr(end);
+
+  B.SetInsertPoint(end);
+  B.CreateRetVoid();
+  return F;
+}
+
+CallInst *CreateChunkedDealloc(llvm::IRBuilder<> &B, llvm::Value *ToFree) {
+  auto &M = *B.GetInsertBlock()->getParent()->getParent();
+  Value *args[] = {B.CreatePointerCast(
+      ToFree, PointerType::getUnqual(getInt8PtrTy(M.getContext())))};
+  return B.CreateCall(getOrInsertChunkedDeallocator(M), args);
+}
+
 Value *CreateAllocation(IRBuilder<> &Builder, llvm::Type *T, Value *Count,
                         const Twine &Name, CallInst **caller,
-                        Instruction **ZeroMem, bool isDefault) {
+                        Instruction **ZeroMem, bool isDefault, bool Arena) {
   Value *res;
   auto &M = *Builder.GetInsertBlock()->getParent()->getParent();
   auto AlignI = M.getDataLayout().getTypeAllocSizeInBits(T) / 8;
@@ -321,6 +607,24 @@ Value *CreateAllocation(IRBuilder<> &Builder, llvm::Type *T, Value *Count,
       *ZeroMem = cast_or_null<Instruction>(unwrap(wzeromem));
       ZeroMem = nullptr;
     }
+  } else if (Arena) {
+    Type *tys[] = {Count->getType()};
+    auto allocF = getTapeArenaFunction(
+        M, "__enzyme_tape_arena_alloc",
+        FunctionType::get(getInt8PtrTy(M.getContext()), tys, false));
+    Value *args[] = {Builder.CreateMul(Align, Count, "", true, true)};
+    malloccall = Builder.CreateCall(allocF, args);
+#if LLVM_VERSION_MAJOR >= 14
+    malloccall->addAttributeAtIndex(AttributeList::ReturnIndex,
+                                    Attribute::NoAlias);
+    malloccall->addAttributeAtIndex(AttributeList::ReturnIndex,
+                                    Attribute::NonNull);
+#else
+    malloccall->addAttribute(AttributeList::ReturnIndex, Attribute::NoAlias);
+    malloccall->addAttribute(AttributeList::ReturnIndex, Attribute::NonNull);
+#endif
+    res = Builder.CreatePointerCast(malloccall, PointerType::getUnqual(T));
+    res->setName(Name);
   } else {
 #if LLVM_VERSION_MAJOR > 17
     res =
@@ -940,6 +1244,69 @@ void callMemcpyStridedLapack(llvm::IRBuilder<> &B, llvm::Module &M,
   B.CreateCall(fn, args, bundles);
 }
 
+void callMemcpyPackedLapack(llvm::IRBuilder<> &B, llvm::Module &M,
+                            BlasInfo blas, llvm::ArrayRef<llvm::Value *> args,
+                            llvm::ArrayRef<llvm::OperandBundleDef> bundles,
+                            bool unpack) {
+  auto copy_name = std::string(blas.prefix) + blas.floatType +
+                   (unpack ? "tpttr" : "trttp") + blas.suffix;
+
+  SmallVector<Type *, 1> tys;
+  for (auto arg : args)
+    tys.push_back(arg->getType());
+
+  auto FT = FunctionType::get(Type::getVoidTy(M.getContext()), tys, false);
+  auto fn = M.getOrInsertFunction(copy_name, FT);
+  if (auto F = GetFunctionFromValue(fn.getCallee()))
+    attributeKnownFunctions(*F);
+
+  B.CreateCall(fn, args, bundles);
+}
+
+llvm::Value *copyShadowLanes(llvm::IRBuilder<> &B, llvm::Module &M,
+                             BlasInfo blas, llvm::IRBuilder<> &entryBuilder,
+                             llvm::IntegerType *IT, llvm::Type *fpTy,
+                             llvm::Value *trans, llvm::Value *rows,
+                             llvm::Value *cols, llvm::Value *shadow,
+                             llvm::Value *ld, llvm::Value *packed,
+                             unsigned width, bool unpack) {
+  // Only used for Fortran blas, so all integer arguments are passed by
+  // reference and there is no layout.
+  Value *normal = trans ? is_normal(B, trans, /*byRef*/ true, /*cublas*/ false)
+                        : B.getTrue();
+  Value *len_rows = load_if_ref(B, IT, rows, /*byRef*/ true);
+  Value *len_cols = load_if_ref(B, IT, cols, /*byRef*/ true);
+  Value *wide = ConstantInt::get(IT, width);
+
+  // op(X) = X: lanes side by side, each a rows x cols block.
+  // op(X) = X^T: lanes on top of each other, each a cols x rows block.
+  Value *stride = CreateSelect(B, normal, B.CreateMul(len_rows, len_cols),
+                               len_cols);
+  Value *packed_ld = to_blas_callconv(
+      B, CreateSelect(B, normal, len_rows, B.CreateMul(len_cols, wide)),
+      /*byRef*/ true, /*cublas*/ false, nullptr, entryBuilder, "packed.ld");
+  packed_ld = B.CreatePointerCast(packed_ld, ld->getType());
+  Value *stored_rows = CreateSelect(B, normal, rows, cols);
+  Value *stored_cols = CreateSelect(B, normal, cols, rows);
+  Value *uplo = to_blas_callconv(B, ConstantInt::get(B.getInt8Ty(), 'G'),
+                                 /*byRef*/ true, /*cublas*/ false, nullptr,
+                                 entryBuilder, "packed.uplo");
+
+  for (unsigned i = 0; i < width; i++) {
+    Value *lane = GradientUtils::extractMeta(B, shadow, i);
+    Value *block = B.CreateInBoundsGEP(
+        fpTy, packed, B.CreateMul(stride, ConstantInt::get(IT, i)));
+    block = B.CreatePointerCast(block, lane->getType());
+    SmallVector<Value *, 7> args = {uplo, stored_rows, stored_cols};
+    if (unpack)
+      args.append({block, packed_ld, lane, ld});
+    else
+      args.append({lane, ld, block, packed_ld});
+    callMemcpyStridedLapack(B, M, blas, args, {});
+  }
+  return packed_ld;
+}
+
 void callSPMVDiagUpdate(IRBuilder<> &B, Module &M, BlasInfo blas,
                         IntegerType *IT, Type *BlasCT, Type *BlasFPT,
                         Type *BlasPT, Type *BlasIT, Type *fpTy,
@@ -2547,6 +2914,49 @@ bool writesToMemoryReadBy(const TypeResults *TR, llvm::AAResults &AA,
   llvm_unreachable("unknown inst2");
 }
 
+bool OverwriteCache::writesToMemoryReadBy(const TypeResults *TR,
+                                          llvm::AAResults &AA,
+                                          llvm::TargetLibraryInfo &TLI,
+                                          llvm::Instruction *maybeReader,
+                                          llvm::Instruction *maybeWriter) {
+  if (!EnzymeOverwriteCache)
+    return ::writesToMemoryReadBy(TR, AA, TLI, maybeReader, maybeWriter);
+  auto found = Writes.find(WritesKey(maybeReader, maybeWriter));
+  if (found != Writes.end()) {
+    countEnzymeStat(&EnzymeFunctionStats::overwriteCacheHits);
+    return found->second;
+  }
+  countEnzymeStat(&EnzymeFunctionStats::overwriteCacheMisses);
+  bool res = ::writesToMemoryReadBy(TR, AA, TLI, maybeReader, maybeWriter);
+  Writes[WritesKey(maybeReader, maybeWriter)] = res;
+  return res;
+}
+
+bool OverwriteCache::overwritesToMemoryReadBy(
+    const TypeResults *TR, llvm::AAResults &AA, llvm::TargetLibraryInfo &TLI,
+    llvm::ScalarEvolution &SE, llvm::LoopInfo &LI, llvm::DominatorTree &DT,
+    llvm::Instruction *maybeReader, llvm::Instruction *maybeWriter,
+    llvm::Loop *scope) {
+  if (!EnzymeOverwriteCache)
+    return ::overwritesToMemoryReadBy(TR, AA, TLI, SE, LI, DT, maybeReader,
+                                      maybeWriter, scope);
+  // Only the scalar evolution refinement is specific to this query, the
+  // underlying writesToMemoryReadBy is shared with plain queries.
+  if (!writesToMemoryReadBy(TR, AA, TLI, maybeReader, maybeWriter))
+    return false;
+  auto key = std::make_pair(WritesKey(maybeReader, maybeWriter), scope);
+  auto found = Overwrites.find(key);
+  if (found != Overwrites.end()) {
+    countEnzymeStat(&EnzymeFunctionStats::overwriteCacheHits);
+    return found->second;
+  }
+  countEnzymeStat(&EnzymeFunctionStats::overwriteCacheMisses);
+  bool res = ::overwritesToMemoryReadBy(TR, AA, TLI, SE, LI, DT, maybeReader,
+                                        maybeWriter, scope);
+  Overwrites[key] = res;
+  return res;
+}
+
 // Find the base pointer of ptr and the offset in bytes from the start of
 // the returned base pointer to this value.
 AllocaInst *getBaseAndOffset(Value *ptr, size_t &offset) {
@@ -2921,7 +3331,8 @@ llvm::Optional<BlasInfo> extractBLAS(llvm::StringRef in)
   const char *extractable[] = {
       "dot",  "scal",  "axpy",  "gemv",  "gemm",  "spmv",  "syrk",
       "nrm2", "trmm",  "trmv",  "symm",  "potrf", "potrs", "copy",
-      "spmv", "syr2k", "potrs", "getrf", "getrs", "trtrs", "getri"};
+      "spmv", "syr2k", "potrs", "getrf", "getrs", "trtrs", "getri",
+      "gesv"};
   const char *floatType[] = {"s", "d", "c", "z"};
   const char *prefixes[] = {"" /*Fortran*/, "cblas_"};
   const char *suffixes[] = {"", "_", "64_", "_64_"};
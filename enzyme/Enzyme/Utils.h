@@ -94,9 +94,16 @@ extern llvm::cl::opt<bool> EnzymePrintPerf;
 extern llvm::cl::opt<bool> EnzymeStrongZero;
 extern llvm::cl::opt<bool> EnzymeBlasCopy;
 extern llvm::cl::opt<bool> EnzymeLapackCopy;
+extern llvm::cl::opt<bool> EnzymeLapackPackedCache;
+extern llvm::cl::opt<bool> EnzymeBlasFuseLanes;
+extern llvm::cl::opt<bool> EnzymeOverwriteCache;
 extern LLVMValueRef (*CustomErrorHandler)(const char *, LLVMValueRef, ErrorType,
                                           const void *, LLVMValueRef,
                                           LLVMBuilderRef);
+extern LLVMValueRef (*CustomAllocator)(LLVMBuilderRef, LLVMTypeRef,
+                                       /*Count*/ LLVMValueRef,
+                                       /*Align*/ LLVMValueRef, uint8_t,
+                                       LLVMValueRef *);
 }
 
 llvm::SmallVector<llvm::Instruction *, 2> PostCacheStore(llvm::StoreInst *SI,
@@ -106,7 +113,7 @@ llvm::Value *CreateAllocation(llvm::IRBuilder<> &B, llvm::Type *T,
                               llvm::Value *Count, const llvm::Twine &Name = "",
                               llvm::CallInst **caller = nullptr,
                               llvm::Instruction **ZeroMem = nullptr,
-                              bool isDefault = false);
+                              bool isDefault = false, bool Arena = false);
 llvm::CallInst *CreateDealloc(llvm::IRBuilder<> &B, llvm::Value *ToFree);
 void ZeroMemory(llvm::IRBuilder<> &Builder, llvm::Type *T, llvm::Value *obj,
                 bool isTape);
@@ -116,7 +123,44 @@ llvm::Value *CreateReAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
                                 llvm::Value *InnerCount,
                                 const llvm::Twine &Name = "",
                                 llvm::CallInst **caller = nullptr,
-                                bool ZeroMem = false);
+                                bool ZeroMem = false, bool Arena = false);
+
+/// Create a call which appends a block of 2^Shift outer iterations to the
+/// chunked cache directory prev when OuterCount begins a new block, returning
+/// the (possibly moved) directory. Unlike CreateReAllocation, previously
+/// cached values are never copied.
+llvm::Value *CreateChunkedAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
+                                     llvm::Type *T, llvm::Value *OuterCount,
+                                     llvm::Value *InnerCount, unsigned Shift,
+                                     const llvm::Twine &Name = "",
+                                     llvm::CallInst **caller = nullptr,
+                                     bool ZeroMem = false, bool Arena = false);
+
+/// Create a call which frees every block of a chunked cache directory as
+/// well as the directory itself.
+llvm::CallInst *CreateChunkedDealloc(llvm::IRBuilder<> &B,
+                                     llvm::Value *ToFree);
+
+/// Create a call to the tape arena runtime which records the current top of
+/// the thread-local tape arena, to later be passed to
+/// CreateTapeArenaRelease.
+llvm::CallInst *CreateTapeArenaMark(llvm::IRBuilder<> &B);
+
+/// Create a call to the tape arena runtime which releases all tape buffers
+/// allocated since the given mark, retaining the underlying memory for reuse.
+llvm::CallInst *CreateTapeArenaRelease(llvm::IRBuilder<> &B,
+                                       llvm::Value *Mark);
+
+/// Create a call to the tape profiling runtime reporting that the cache of the
+/// given site now holds Bytes at Ptr, replacing the allocation at Old (which
+/// may be null).
+llvm::CallInst *CreateTapeProfile(llvm::IRBuilder<> &B, llvm::Value *Site,
+                                  llvm::Value *Old, llvm::Value *Ptr,
+                                  llvm::Value *Bytes);
+
+/// Create a call to the tape profiling runtime reporting that the cache at Ptr
+/// is being freed.
+llvm::CallInst *CreateTapeProfileFree(llvm::IRBuilder<> &B, llvm::Value *Ptr);
 
 llvm::PointerType *getDefaultAnonymousTapeType(llvm::LLVMContext &C);
 
@@ -704,6 +748,25 @@ void callMemcpyStridedLapack(llvm::IRBuilder<> &B, llvm::Module &M,
                              BlasInfo blas, llvm::ArrayRef<llvm::Value *> args,
                              llvm::ArrayRef<llvm::OperandBundleDef> bundles);
 
+/// Convert the referenced triangle of a matrix to packed storage using lapack
+/// trttp, or back to a full matrix using tpttr if unpack is set
+void callMemcpyPackedLapack(llvm::IRBuilder<> &B, llvm::Module &M,
+                            BlasInfo blas, llvm::ArrayRef<llvm::Value *> args,
+                            llvm::ArrayRef<llvm::OperandBundleDef> bundles,
+                            bool unpack);
+
+/// Copy the lanes dX_i of the vector shadow of a matrix, used by a Fortran
+/// blas call as op(dX_i) with rows x cols dimensions, into the matrix packed
+/// such that op(packed) = [op(dX_0) ... op(dX_width-1)], or back out of it if
+/// unpack is set. Returns the leading dimension of packed, by reference.
+llvm::Value *copyShadowLanes(llvm::IRBuilder<> &B, llvm::Module &M,
+                             BlasInfo blas, llvm::IRBuilder<> &entryBuilder,
+                             llvm::IntegerType *IT, llvm::Type *fpTy,
+                             llvm::Value *trans, llvm::Value *rows,
+                             llvm::Value *cols, llvm::Value *shadow,
+                             llvm::Value *ld, llvm::Value *packed,
+                             unsigned width, bool unpack);
+
 void callSPMVDiagUpdate(llvm::IRBuilder<> &B, llvm::Module &M, BlasInfo blas,
                         llvm::IntegerType *IT, llvm::Type *BlasCT,
                         llvm::Type *BlasFPT, llvm::Type *BlasPT,
@@ -996,6 +1059,30 @@ bool overwritesToMemoryReadBy(const TypeResults *TR, llvm::AAResults &AA,
                               llvm::Instruction *maybeReader,
                               llvm::Instruction *maybeWriter,
                               llvm::Loop *scope = nullptr);
+
+/// Memoized writesToMemoryReadBy and overwritesToMemoryReadBy queries over a
+/// function which is not modified while the cache is in use, such as the
+/// preprocessed function shared by the derivatives of a function.
+class OverwriteCache {
+public:
+  bool writesToMemoryReadBy(const TypeResults *TR, llvm::AAResults &AA,
+                            llvm::TargetLibraryInfo &TLI,
+                            llvm::Instruction *maybeReader,
+                            llvm::Instruction *maybeWriter);
+
+  bool overwritesToMemoryReadBy(const TypeResults *TR, llvm::AAResults &AA,
+                                llvm::TargetLibraryInfo &TLI,
+                                llvm::ScalarEvolution &SE, llvm::LoopInfo &LI,
+                                llvm::DominatorTree &DT,
+                                llvm::Instruction *maybeReader,
+                                llvm::Instruction *maybeWriter,
+                                llvm::Loop *scope = nullptr);
+
+private:
+  using WritesKey = std::pair<llvm::Instruction *, llvm::Instruction *>;
+  llvm::DenseMap<WritesKey, bool> Writes;
+  llvm::DenseMap<std::pair<WritesKey, llvm::Loop *>, bool> Overwrites;
+};
 static inline void
 /// Call the function f for all instructions that happen between inst1 and inst2
 /// If the function returns true, the iteration will early exit
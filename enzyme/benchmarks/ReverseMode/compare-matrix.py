@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+# Compares two result files written by run-matrix.py and reports the
+# benchmark/configuration pairs that got slower or use more memory.
+#
+# Exits with 1 if any metric regressed by more than the threshold.
+
+import argparse
+import json
+import sys
+
+# Metrics that are compared, smaller is better for all of them.
+METRICS = ["gradient", "ratio", "compile-time", "tape-bytes", "peak-rss-kb"]
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data, {(r["benchmark"], r["config"]): r for r in data["results"]}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('baseline', help="Results of the reference build")
+    parser.add_argument('current', help="Results of the build to check")
+    parser.add_argument('--threshold', type=float, default=0.1, help="Relative change reported as a regression (default 0.1)")
+    parser.add_argument('--metric', action='append', choices=METRICS, help="Metric to compare (default all)")
+    args = parser.parse_args()
+
+    base_data, base = load(args.baseline)
+    cur_data, cur = load(args.current)
+    print("baseline {} ({}), current {} ({})".format(
+        base_data["commit"], base_data["llvm-version"], cur_data["commit"], cur_data["llvm-version"]))
+
+    regressions = 0
+    for key in sorted(cur):
+        if key not in base:
+            print("{} [{}]: no baseline".format(*key))
+            continue
+        for metric in args.metric or METRICS:
+            old, new = base[key].get(metric), cur[key].get(metric)
+            if old is None or new is None or old <= 0:
+                continue
+            change = (new - old) / old
+            status = "ok"
+            if change > args.threshold:
+                status = "REGRESSION"
+                regressions += 1
+            elif change < -args.threshold:
+                status = "improvement"
+            if status != "ok":
+                print("{} [{}] {}: {:g} -> {:g} ({:+.1%}) {}".format(key[0], key[1], metric, old, new, change, status))
+    for key in sorted(set(base) - set(cur)):
+        print("{} [{}]: missing from current results".format(*key))
+
+    print("{} regression(s)".format(regressions))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
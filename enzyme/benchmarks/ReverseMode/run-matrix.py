@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+# Builds and runs the ReverseMode benchmarks under a matrix of Enzyme options
+# and writes the results as JSON.
+#
+# For every benchmark and configuration this records the primal and gradient
+# time, their ratio, the time taken by the Enzyme pass, the tape size reported
+# by -enzyme-stats and the peak resident set size of the benchmark. Compare two
+# result files with compare-matrix.py.
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCHDIR = os.path.dirname(os.path.abspath(__file__))
+
+# Enzyme options of each configuration, in addition to the default options.
+CONFIGS = {
+    "default": [],
+    "no-mincut-cache": ["-enzyme-mincut-cache=0"],
+    "no-loop-invariant-cache": ["-enzyme-loop-invariant-cache=0"],
+    "smallbool": ["-enzyme-smallbool=1"],
+    "max-cache": ["-enzyme-max-cache=1"],
+    "post-opt-level-1": ["-enzyme-post-opt-level=1"],
+    "post-opt-level-2": ["-enzyme-post-opt-level=2"],
+}
+
+# How the primal and gradient time are found in the output of each benchmark.
+# Text outputs are given as (section, regex) where section is the line after
+# which the time is printed (None for anywhere) and the last match is used.
+# The ADBench benchmarks write results.json instead.
+ADBENCH = {"adbench": True}
+BENCHMARKS = {
+    "ba": ADBENCH,
+    "gmm": ADBENCH,
+    "hand": ADBENCH,
+    "lstm": ADBENCH,
+    "fft": {
+        "primal": (None, r"^Enzyme real ([0-9.]+)"),
+        "gradient": (None, r"^Enzyme combined ([0-9.]+)"),
+    },
+    "ode": {
+        "primal": (None, r"^Enzyme real ([0-9.]+)"),
+        "gradient": (None, r"^Enzyme combined ([0-9.]+)"),
+    },
+    "ode-const": {
+        "primal": (None, r"^Enzyme real ([0-9.]+)"),
+        "gradient": (None, r"^Enzyme combined ([0-9.]+)"),
+    },
+    "ode-real": {
+        "primal": (None, r"^Enzyme real ([0-9.]+)"),
+        "gradient": (None, r"^Enzyme combined ([0-9.]+)"),
+    },
+    "logsumexp": {
+        "primal": (None, r"^enzyme forward ([0-9.]+)"),
+        "gradient": (None, r"^enzyme forward and reverse ([0-9.]+)"),
+    },
+    "matdescent": {
+        "primal": (None, r"^([0-9.]+) res="),
+        "gradient": (None, r"^([0-9.]+) res'="),
+    },
+    "taylorlog": {
+        "primal": ("enzyme", r"^([0-9.]+) res="),
+        "gradient": ("enzyme", r"^([0-9.]+) res'="),
+    },
+    "nn": {
+        "primal": ("Regular", r"^([0-9.]+)$"),
+        "gradient": ("Enzyme", r"^([0-9.]+)$"),
+    },
+}
+
+SECTIONS = {"Regular", "Enzyme", "Adept", "Tapenade", "adept", "tapenade", "enzyme"}
+
+
+def get_git_revision_hash():
+    try:
+        return subprocess.check_output(['git', 'rev-parse', 'HEAD'], cwd=BENCHDIR, stderr=subprocess.STDOUT).decode('ascii').strip()
+    except:
+        return "N/A"
+
+
+def parse_makefile(bench):
+    """Returns the name of the benchmark's object and result targets."""
+    with open(os.path.join(BENCHDIR, bench, "Makefile.make")) as f:
+        text = f.read()
+    obj = re.search(r"^(\w[^\s%]*)\.o: \1-opt\.ll", text, re.M)
+    results = re.search(r"^(results\.(?:txt|json)):", text, re.M)
+    if not obj or not results:
+        raise RuntimeError("unexpected Makefile.make for " + bench)
+    return obj.group(1), results.group(1)
+
+
+def find_time(lines, section, regex):
+    if section is not None:
+        if section not in lines:
+            return None
+        start = lines.index(section) + 1
+        end = start
+        while end < len(lines) and lines[end] not in SECTIONS:
+            end += 1
+        lines = lines[start:end]
+    value = None
+    for line in lines:
+        m = re.match(regex, line)
+        if m:
+            value = float(m.group(1))
+    return value
+
+
+def parse_results(bench, path):
+    spec = BENCHMARKS[bench]
+    if spec.get("adbench"):
+        with open(path) as f:
+            suites = json.load(f)
+        gradient = 0.0
+        for suite in suites:
+            for tool in suite["tools"]:
+                if tool["name"] == "Enzyme combined":
+                    gradient += tool["runtime"]
+        return None, gradient
+    with open(path) as f:
+        lines = [l.strip() for l in f.read().splitlines()]
+    return find_time(lines, *spec["primal"]), find_time(lines, *spec["gradient"])
+
+
+def tape_bytes(stats):
+    if not os.path.exists(stats):
+        return None
+    with open(stats) as f:
+        return sum(fn["tapeBytes"] for fn in json.load(f)["functions"])
+
+
+def run(cmd, cwd, env, log):
+    """Runs cmd and returns the peak resident set size of it and its children
+    in kilobytes."""
+    print("+ " + " ".join(cmd), file=log, flush=True)
+    proc = subprocess.Popen(cmd, cwd=cwd, env=env, stdout=log, stderr=subprocess.STDOUT)
+    _, status, usage = os.wait4(proc.pid, 0)
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    if proc.returncode != 0:
+        raise subprocess.CalledProcessError(proc.returncode, cmd)
+    return usage.ru_maxrss
+
+
+def run_benchmark(bench, config, args, env, log):
+    cwd = os.path.join(BENCHDIR, bench)
+    name, results = parse_makefile(bench)
+    make = ["make", "-f", "Makefile.make"]
+    run(make + ["clean"], cwd, env, log)
+    run(make + [name + "-unopt.ll"], cwd, env, log)
+
+    # The Enzyme pass is run here rather than by make so that it can be timed.
+    # make then picks up the existing -raw.ll.
+    with tempfile.TemporaryDirectory() as tmp:
+        stats = os.path.join(tmp, "stats.json")
+        opt = [os.path.join(args.llvm_tools_dir, "opt"), name + "-unopt.ll"] + args.load.split() + \
+            CONFIGS[config] + ["-enzyme-stats=" + stats, "-enzyme", "-o", name + "-raw.ll", "-S"]
+        start = time.perf_counter()
+        run(opt, cwd, env, log)
+        compile_time = time.perf_counter() - start
+        tape = tape_bytes(stats)
+
+    run(make + [name + ".o"], cwd, env, log)
+    peak_rss = run(make + [results], cwd, env, log)
+
+    primal, gradient = parse_results(bench, os.path.join(cwd, results))
+    return {
+        "benchmark": bench,
+        "config": config,
+        "flags": CONFIGS[config],
+        "primal": primal,
+        "gradient": gradient,
+        "ratio": gradient / primal if primal and gradient is not None else None,
+        "compile-time": compile_time,
+        "tape-bytes": tape,
+        "peak-rss-kb": peak_rss,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--llvm-tools-dir', required=True, help="Directory containing clang, opt and llvm-config")
+    parser.add_argument('--load', required=True, help="opt arguments loading the Enzyme plugin")
+    parser.add_argument('--bench-flags', default="", help="Compiler flags of the benchmarks (BENCH)")
+    parser.add_argument('--bench-link', default="", help="Linker flags of the benchmarks (BENCHLINK)")
+    parser.add_argument('--bench-ldpath', default="", help="Library path of the benchmarks")
+    parser.add_argument('-b', '--benchmark', action='append', choices=sorted(BENCHMARKS), help="Benchmark to run (default all)")
+    parser.add_argument('-c', '--config', action='append', choices=sorted(CONFIGS), help="Configuration to run (default all)")
+    parser.add_argument('-o', '--output', required=True, help="JSON file to write the results to")
+    parser.add_argument('--log', default=None, help="File to write the build and benchmark output to (default stderr)")
+    args = parser.parse_args()
+
+    env = dict(os.environ)
+    env["PATH"] = os.pathsep.join([args.llvm_tools_dir, env.get("PATH", "")])
+    env["LD_LIBRARY_PATH"] = os.pathsep.join([args.bench_ldpath, env.get("LD_LIBRARY_PATH", "")])
+    env["BENCH"] = args.bench_flags
+    env["BENCHLINK"] = args.bench_link
+    env["LOAD"] = args.load
+
+    log = open(args.log, "w") if args.log else sys.stderr
+    results = []
+    failures = 0
+    for bench in args.benchmark or sorted(BENCHMARKS):
+        for config in args.config or list(CONFIGS):
+            try:
+                res = run_benchmark(bench, config, args, env, log)
+            except (subprocess.CalledProcessError, RuntimeError, OSError, ValueError) as e:
+                print("{} [{}] failed: {}".format(bench, config, e), file=sys.stderr)
+                failures += 1
+                continue
+            print("{} [{}] primal={} gradient={} compile={:.3f}s".format(
+                bench, config, res["primal"], res["gradient"], res["compile-time"]))
+            results.append(res)
+
+    llvm_version = subprocess.check_output([os.path.join(args.llvm_tools_dir, "llvm-config"), "--version"]).decode('ascii').strip()
+    with open(args.output, "w") as f:
+        json.dump({
+            "commit": get_git_revision_hash(),
+            "timestamp": datetime.datetime.now(datetime.timezone.utc).isoformat(),
+            "platform": platform.platform(),
+            "llvm-version": llvm_version,
+            "results": results,
+        }, f, indent=4)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,97 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+// Compares the cost of the truncation runtimes (enzyme/fprt/mpfr.h and
+// enzyme/fprt/softfloat.h, selected with -include) on the kernels of the
+// Truncate integration tests, for the formats we usually evaluate.
+
+#ifndef RUNTIME
+#define RUNTIME "unknown"
+#endif
+
+float tdiff(struct timeval *start, struct timeval *end) {
+  return (end->tv_sec - start->tv_sec) + 1e-6 * (end->tv_usec - start->tv_usec);
+}
+
+__attribute__((noinline)) double compute(double *A, double *B, double *C,
+                                         int n) {
+  for (int i = 0; i < n; i++) {
+    C[i] = A[i] * 2 + B[i] * sqrt(A[i]);
+  }
+  return C[0];
+}
+
+__attribute__((noinline)) double dot(double *A, double *B, double *C, int n) {
+  double res = 0;
+  for (int i = 0; i < n; i++)
+    res += A[i] * B[i];
+  C[0] = res;
+  return res;
+}
+
+__attribute__((noinline)) double stencil(double *A, double *B, double *C,
+                                         int n) {
+  for (int i = 1; i < n - 1; i++)
+    C[i] = A[i] + 0.25 * (A[i - 1] - 2 * A[i] + A[i + 1]) * B[i];
+  return C[1];
+}
+
+typedef double (*kernel_ty)(double *, double *, double *, int);
+
+extern kernel_ty __enzyme_truncate_op_func(...);
+
+static void run(const char *kernel, const char *format, kernel_ty f, double *A,
+                double *B, double *C, int n, int reps) {
+  struct timeval start, end;
+  double res = 0;
+  gettimeofday(&start, NULL);
+  for (int r = 0; r < reps; r++)
+    res += f(A, B, C, n);
+  gettimeofday(&end, NULL);
+  printf("%s %s %s %0.6f res=%f\n", RUNTIME, kernel, format,
+         tdiff(&start, &end), res);
+}
+
+#define BENCH(KERNEL)                                                          \
+  run(#KERNEL, "double", KERNEL, A, B, C, n, reps);                            \
+  run(#KERNEL, "fp32", __enzyme_truncate_op_func(KERNEL, 64, 8, 23), A, B, C,  \
+      n, reps);                                                                \
+  run(#KERNEL, "tf32", __enzyme_truncate_op_func(KERNEL, 64, 8, 10), A, B, C,  \
+      n, reps);                                                                \
+  run(#KERNEL, "fp16", __enzyme_truncate_op_func(KERNEL, 64, 5, 10), A, B, C,  \
+      n, reps);                                                                \
+  run(#KERNEL, "bf16", __enzyme_truncate_op_func(KERNEL, 64, 8, 7), A, B, C,   \
+      n, reps);                                                                \
+  run(#KERNEL, "fp8e4m3", __enzyme_truncate_op_func(KERNEL, 64, 4, 3), A, B,   \
+      C, n, reps);                                                             \
+  run(#KERNEL, "fp8e5m2", __enzyme_truncate_op_func(KERNEL, 64, 5, 2), A, B,   \
+      C, n, reps);
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printf("usage %s n reps\n", argv[0]);
+    return 1;
+  }
+  int n = atoi(argv[1]);
+  int reps = atoi(argv[2]);
+
+  double *A = (double *)malloc(sizeof(double) * n);
+  double *B = (double *)malloc(sizeof(double) * n);
+  double *C = (double *)malloc(sizeof(double) * n);
+  for (int i = 0; i < n; i++) {
+    A[i] = 1 + (i % 17) * 0.37;
+    B[i] = 1 + (i % 5) * 0.11;
+    C[i] = 0;
+  }
+
+  BENCH(compute)
+  BENCH(dot)
+  BENCH(stencil)
+
+  free(A);
+  free(B);
+  free(C);
+  return 0;
+}
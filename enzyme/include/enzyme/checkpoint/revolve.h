@@ -0,0 +1,278 @@
+//===- checkpoint/revolve - Binomial checkpointing of time loops ----------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains a runtime for differentiating long-running loops with a
+// binomial (Revolve) checkpointing schedule.
+//
+// Rather than differentiating the whole loop, which requires a tape of every
+// iteration, the loop body is written as a step function taking the
+// loop-carried state. Only the state at a bounded number of iterations
+// (snapshots) is stored; in the reverse pass segments of the loop are replayed
+// from the nearest snapshot and each step is differentiated individually
+// (e.g. by calling __enzyme_autodiff on the step function). For a given
+// number of snapshots, the binomial schedule of Griewank and Walther minimizes
+// the number of replayed steps.
+//
+// The number of snapshots can be derived from a memory budget with
+// __enzyme_checkpoint_snaps_for_budget, and the resulting recompute versus
+// memory trade-off is reported by __enzyme_checkpoint_report. The compiler
+// reports the tape size of each loop and the corresponding schedule with
+// -enzyme-checkpoint-budget=<bytes>.
+//
+// All functions are weak so that they can be replaced by a custom
+// implementation.
+//
+//===----------------------------------------------------------------------===//
+#ifndef __ENZYME_RUNTIME_ENZYME_CHECKPOINT_REVOLVE__
+#define __ENZYME_RUNTIME_ENZYME_CHECKPOINT_REVOLVE__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __ENZYME_CHECKPOINT_ATTRIBUTES __attribute__((weak))
+
+// Advance state in place from step to step + 1.
+typedef void (*__enzyme_checkpoint_forward)(void *state, int64_t step,
+                                            void *data);
+
+// Given state at step, propagate the adjoint (held in data) of the state after
+// step to the adjoint of the state before it. The state may be clobbered.
+typedef void (*__enzyme_checkpoint_adjoint)(void *state, int64_t step,
+                                            void *data);
+
+typedef struct {
+  // Number of loop iterations.
+  int64_t steps;
+  // Number of state snapshots, including the initial state.
+  int64_t snaps;
+  // Largest number of times any step is run forward (excluding its adjoint).
+  int64_t repetitions;
+  // Total number of forward steps replayed.
+  int64_t forward_steps;
+  // Bytes of state snapshots.
+  int64_t snapshot_bytes;
+} __enzyme_checkpoint_stats;
+
+// Number of steps which can be reversed with snaps snapshots (including the
+// initial state) if no step is run forward more than reps times,
+// \binom{snaps + reps}{snaps}. Saturates at INT64_MAX.
+__ENZYME_CHECKPOINT_ATTRIBUTES
+int64_t __enzyme_checkpoint_binomial(int64_t snaps, int64_t reps) {
+  if (snaps > reps) {
+    int64_t tmp = snaps;
+    snaps = reps;
+    reps = tmp;
+  }
+  // \binom{snaps + reps}{snaps} = \prod_{i=1}^{snaps} (reps + i) / i
+  int64_t res = 1;
+  for (int64_t i = 1; i <= snaps; i++) {
+    if (res > INT64_MAX / (reps + i))
+      return INT64_MAX;
+    res = res * (reps + i) / i;
+  }
+  return res;
+}
+
+// Minimal number of times a step must be run forward to reverse steps
+// iterations with snaps snapshots.
+__ENZYME_CHECKPOINT_ATTRIBUTES
+int64_t __enzyme_checkpoint_repetitions(int64_t steps, int64_t snaps) {
+  int64_t reps = 0;
+  while (__enzyme_checkpoint_binomial(snaps, reps) < steps)
+    reps++;
+  return reps;
+}
+
+// Total number of forward steps replayed by the binomial schedule,
+// reps * steps - \binom{snaps + reps}{snaps + 1}.
+__ENZYME_CHECKPOINT_ATTRIBUTES
+int64_t __enzyme_checkpoint_forward_steps(int64_t steps, int64_t snaps) {
+  if (steps <= 1)
+    return 0;
+  int64_t reps = __enzyme_checkpoint_repetitions(steps, snaps);
+  return reps * steps - __enzyme_checkpoint_binomial(snaps + 1, reps - 1);
+}
+
+// Largest number of snapshots of state_size bytes which fit in budget bytes,
+// but no more than are useful for steps iterations. Returns 0 if not even the
+// initial state fits.
+__ENZYME_CHECKPOINT_ATTRIBUTES
+int64_t __enzyme_checkpoint_snaps_for_budget(int64_t steps, int64_t state_size,
+                                             int64_t budget) {
+  if (state_size <= 0)
+    return steps;
+  int64_t snaps = budget / state_size;
+  if (snaps > steps)
+    snaps = steps;
+  return snaps;
+}
+
+typedef struct {
+  char *snapshots;
+  size_t state_size;
+  void *state;
+  __enzyme_checkpoint_forward forward;
+  __enzyme_checkpoint_adjoint adjoint;
+  void *data;
+  __enzyme_checkpoint_stats *stats;
+  int64_t *runs;
+} __enzyme_checkpoint_ctx;
+
+static void __enzyme_checkpoint_advance(__enzyme_checkpoint_ctx *ctx,
+                                        int64_t from, int64_t to) {
+  for (int64_t i = from; i < to; i++) {
+    ctx->forward(ctx->state, i, ctx->data);
+    ctx->stats->forward_steps++;
+    if (++ctx->runs[i] > ctx->stats->repetitions)
+      ctx->stats->repetitions = ctx->runs[i];
+  }
+}
+
+static void __enzyme_checkpoint_restore(__enzyme_checkpoint_ctx *ctx,
+                                        int64_t slot) {
+  memcpy(ctx->state, ctx->snapshots + slot * ctx->state_size,
+         ctx->state_size);
+}
+
+// Reverse steps [begin, end), where state currently holds the state at begin,
+// which is also stored in snapshot slot, and slots after slot are free.
+static void __enzyme_checkpoint_reverse(__enzyme_checkpoint_ctx *ctx,
+                                        int64_t begin, int64_t end,
+                                        int64_t slot, int64_t snaps) {
+  while (end - begin > 1 && snaps > 1) {
+    // Place the next snapshot such that the right part [mid, end) can be
+    // reversed with one fewer snapshot and the left part [begin, mid) with one
+    // fewer repetition, within the range for which the total number of
+    // replayed steps is minimal.
+    int64_t n = end - begin;
+    int64_t reps = __enzyme_checkpoint_repetitions(n, snaps);
+    int64_t left = __enzyme_checkpoint_binomial(snaps, reps - 1);
+    if (left > n - __enzyme_checkpoint_binomial(snaps - 1, reps - 1))
+      left = n - __enzyme_checkpoint_binomial(snaps - 1, reps - 1);
+    if (left < n - __enzyme_checkpoint_binomial(snaps - 1, reps))
+      left = n - __enzyme_checkpoint_binomial(snaps - 1, reps);
+    if (left < 1)
+      left = 1;
+    if (left > n - 1)
+      left = n - 1;
+    int64_t mid = begin + left;
+    __enzyme_checkpoint_advance(ctx, begin, mid);
+    memcpy(ctx->snapshots + (slot + 1) * ctx->state_size, ctx->state,
+           ctx->state_size);
+    __enzyme_checkpoint_reverse(ctx, mid, end, slot + 1, snaps - 1);
+    __enzyme_checkpoint_restore(ctx, slot);
+    end = mid;
+  }
+  // Without free snapshots, replay from begin for every step.
+  for (int64_t i = end - 1; i >= begin; i--) {
+    if (i != end - 1)
+      __enzyme_checkpoint_restore(ctx, slot);
+    __enzyme_checkpoint_advance(ctx, begin, i);
+    ctx->adjoint(ctx->state, i, ctx->data);
+  }
+}
+
+// Differentiate steps iterations of forward, starting from state (of
+// state_size bytes), with at most snaps snapshots of the state. On return,
+// state holds the state after the final step and data holds whatever adjoint
+// computes for step 0. If stats is non-null, it is filled with the cost of the
+// schedule. Returns nonzero on failure.
+__ENZYME_CHECKPOINT_ATTRIBUTES
+int __enzyme_checkpoint_loop(int64_t steps, int64_t snaps, void *state,
+                             size_t state_size,
+                             __enzyme_checkpoint_forward forward,
+                             __enzyme_checkpoint_adjoint adjoint, void *data,
+                             __enzyme_checkpoint_stats *stats) {
+  __enzyme_checkpoint_stats local;
+  if (!stats)
+    stats = &local;
+  stats->steps = steps;
+  stats->snaps = snaps;
+  stats->repetitions = 0;
+  stats->forward_steps = 0;
+  stats->snapshot_bytes = snaps * (int64_t)state_size;
+  if (snaps < 1)
+    return 1;
+  if (steps <= 0)
+    return 0;
+  if (snaps > steps)
+    snaps = steps;
+
+  __enzyme_checkpoint_ctx ctx;
+  // One extra buffer retains the final state for the caller.
+  ctx.snapshots = (char *)malloc((snaps + 1) * state_size);
+  ctx.runs = (int64_t *)calloc(steps, sizeof(int64_t));
+  if (!ctx.snapshots || !ctx.runs) {
+    free(ctx.snapshots);
+    free(ctx.runs);
+    return 1;
+  }
+  ctx.state_size = state_size;
+  ctx.state = state;
+  ctx.forward = forward;
+  ctx.adjoint = adjoint;
+  ctx.data = data;
+  ctx.stats = stats;
+
+  memcpy(ctx.snapshots, state, state_size);
+
+  // Compute the primal result of the loop first, so that it can be returned.
+  __enzyme_checkpoint_advance(&ctx, 0, steps);
+  char *final = ctx.snapshots + snaps * state_size;
+  memcpy(final, state, state_size);
+  __enzyme_checkpoint_restore(&ctx, 0);
+  for (int64_t i = 0; i < steps; i++)
+    ctx.runs[i] = 0;
+  stats->repetitions = 0;
+  stats->forward_steps = 0;
+
+  __enzyme_checkpoint_reverse(&ctx, 0, steps, 0, snaps);
+
+  memcpy(state, final, state_size);
+  free(ctx.snapshots);
+  free(ctx.runs);
+  return 0;
+}
+
+// Print the recompute versus memory trade-off of a checkpointing schedule.
+__ENZYME_CHECKPOINT_ATTRIBUTES
+void __enzyme_checkpoint_report(FILE *out,
+                                const __enzyme_checkpoint_stats *stats) {
+  fprintf(out,
+          "checkpointing %lld steps with %lld snapshots (%lld bytes): "
+          "%lld replayed forward steps (%.2f per step), at most %lld per "
+          "step\n",
+          (long long)stats->steps, (long long)stats->snaps,
+          (long long)stats->snapshot_bytes, (long long)stats->forward_steps,
+          stats->steps ? (double)stats->forward_steps / stats->steps : 0.,
+          (long long)stats->repetitions);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ENZYME_RUNTIME_ENZYME_CHECKPOINT_REVOLVE__
@@ -27,6 +27,7 @@
 #include <mpfr.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -86,10 +87,44 @@ extern "C" {
 static bool __enzyme_fprt_is_mem_mode(int64_t mode) { return mode & 0b0001; }
 static bool __enzyme_fprt_is_op_mode(int64_t mode) { return mode & 0b0010; }
 
-typedef struct {
+// Objects are carved out of thread-local slabs of this many objects. Deleted
+// objects are kept on a free list, together with their MPFR limbs, and reused
+// by later allocations on the same thread.
+#ifndef __ENZYME_MPFR_SLAB_SIZE
+#define __ENZYME_MPFR_SLAB_SIZE 4096
+#endif
+
+typedef struct __enzyme_fp {
   mpfr_t v;
+  // Next object on the free list once deleted.
+  struct __enzyme_fp *next_free;
+  // Constants are shared by every execution of their call site and are never
+  // deleted.
+  int is_const;
 } __enzyme_fp;
 
+typedef struct __enzyme_fp_slab {
+  struct __enzyme_fp_slab *next;
+  __enzyme_fp fps[__ENZYME_MPFR_SLAB_SIZE];
+} __enzyme_fp_slab;
+
+typedef struct {
+  const void *site;
+  uint64_t bits;
+  int64_t significand;
+  __enzyme_fp *fp;
+} __enzyme_fp_const_entry;
+
+typedef struct {
+  __enzyme_fp_slab *slabs;
+  size_t slab_used;
+  __enzyme_fp *free_list;
+  // Open addressing hash table of constants, with a power of two capacity.
+  __enzyme_fp_const_entry *consts;
+  size_t consts_capacity;
+  size_t consts_size;
+} __enzyme_fp_allocator;
+
 static double __enzyme_fprt_ptr_to_double(__enzyme_fp *p) {
   return *((double *)(&p));
 }
@@ -97,6 +132,106 @@ static __enzyme_fp *__enzyme_fprt_double_to_ptr(double d) {
   return *((__enzyme_fp **)(&d));
 }
 
+// The allocator of the calling thread.
+__ENZYME_MPFR_ATTRIBUTES
+__enzyme_fp_allocator *__enzyme_fprt_allocator(void) {
+  static __thread __enzyme_fp_allocator allocator;
+  return &allocator;
+}
+
+__ENZYME_MPFR_ATTRIBUTES
+__enzyme_fp *__enzyme_fprt_alloc(int64_t significand) {
+  __enzyme_fp_allocator *allocator = __enzyme_fprt_allocator();
+  __enzyme_fp *a = allocator->free_list;
+  if (a) {
+    allocator->free_list = a->next_free;
+    if (mpfr_get_prec(a->v) != (mpfr_prec_t)significand)
+      mpfr_set_prec(a->v, significand);
+  } else {
+    if (!allocator->slabs || allocator->slab_used == __ENZYME_MPFR_SLAB_SIZE) {
+      __enzyme_fp_slab *slab =
+          (__enzyme_fp_slab *)malloc(sizeof(__enzyme_fp_slab));
+      if (!slab)
+        abort();
+      slab->next = allocator->slabs;
+      allocator->slabs = slab;
+      allocator->slab_used = 0;
+    }
+    a = &allocator->slabs->fps[allocator->slab_used++];
+    mpfr_init2(a->v, significand);
+  }
+  a->next_free = NULL;
+  a->is_const = 0;
+  return a;
+}
+
+__ENZYME_MPFR_ATTRIBUTES
+void __enzyme_fprt_free(__enzyme_fp *a) {
+  if (a->is_const)
+    return;
+  __enzyme_fp_allocator *allocator = __enzyme_fprt_allocator();
+  a->next_free = allocator->free_list;
+  allocator->free_list = a;
+}
+
+static size_t __enzyme_fprt_const_slot(const __enzyme_fp_const_entry *consts,
+                                       size_t capacity, const void *site,
+                                       uint64_t bits, int64_t significand) {
+  uint64_t hash = bits * 0x9E3779B97F4A7C15ull;
+  hash ^= (uint64_t)(uintptr_t)site + ((uint64_t)significand << 48);
+  hash ^= hash >> 29;
+  size_t slot = hash & (capacity - 1);
+  while (consts[slot].fp &&
+         (consts[slot].site != site || consts[slot].bits != bits ||
+          consts[slot].significand != significand))
+    slot = (slot + 1) & (capacity - 1);
+  return slot;
+}
+
+// The constant a as used at site, created on its first use.
+__ENZYME_MPFR_ATTRIBUTES
+__enzyme_fp *__enzyme_fprt_get_const(const void *site, double a,
+                                     int64_t significand) {
+  __enzyme_fp_allocator *allocator = __enzyme_fprt_allocator();
+  uint64_t bits;
+  memcpy(&bits, &a, sizeof(bits));
+
+  if (2 * (allocator->consts_size + 1) > allocator->consts_capacity) {
+    size_t capacity =
+        allocator->consts_capacity ? 2 * allocator->consts_capacity : 64;
+    __enzyme_fp_const_entry *consts = (__enzyme_fp_const_entry *)calloc(
+        capacity, sizeof(__enzyme_fp_const_entry));
+    if (!consts)
+      abort();
+    for (size_t i = 0; i < allocator->consts_capacity; i++) {
+      __enzyme_fp_const_entry *entry = &allocator->consts[i];
+      if (entry->fp)
+        consts[__enzyme_fprt_const_slot(consts, capacity, entry->site,
+                                        entry->bits, entry->significand)] =
+            *entry;
+    }
+    free(allocator->consts);
+    allocator->consts = consts;
+    allocator->consts_capacity = capacity;
+  }
+
+  __enzyme_fp_const_entry *entry =
+      &allocator->consts[__enzyme_fprt_const_slot(
+          allocator->consts, allocator->consts_capacity, site, bits,
+          significand)];
+  if (!entry->fp) {
+    __enzyme_fp *fp = __enzyme_fprt_alloc(significand);
+    mpfr_set_d(fp->v, a, __ENZYME_MPFR_DEFAULT_ROUNDING_MODE);
+    fp->is_const = 1;
+    entry->site = site;
+    entry->bits = bits;
+    entry->significand = significand;
+    entry->fp = fp;
+    allocator->consts_size++;
+  }
+  return entry->fp;
+}
+
 __ENZYME_MPFR_ATTRIBUTES
 double __enzyme_fprt_64_52_get(double _a, int64_t exponent, int64_t significand,
                                int64_t mode) {
@@ -107,33 +242,32 @@ double __enzyme_fprt_64_52_get(double _a, int64_t exponent, int64_t significand,
 __ENZYME_MPFR_ATTRIBUTES
 double __enzyme_fprt_64_52_new(double _a, int64_t exponent, int64_t significand,
                                int64_t mode) {
-  __enzyme_fp *a = (__enzyme_fp *)malloc(sizeof(__enzyme_fp));
-  mpfr_init2(a->v, significand);
+  __enzyme_fp *a = __enzyme_fprt_alloc(significand);
   mpfr_set_d(a->v, _a, __ENZYME_MPFR_DEFAULT_ROUNDING_MODE);
   return __enzyme_fprt_ptr_to_double(a);
 }
 
-__ENZYME_MPFR_ATTRIBUTES
+// Constants are created once per call site (and thread) rather than every time
+// a flop uses them. This must not be inlined, so that the return address is
+// the call site in the truncated code.
+__ENZYME_MPFR_ATTRIBUTES __attribute__((noinline))
 double __enzyme_fprt_64_52_const(double _a, int64_t exponent,
                                  int64_t significand, int64_t mode) {
-  // TODO This should really be called only once for an appearance in the code,
-  // currently it is called every time a flop uses a constant.
-  return __enzyme_fprt_64_52_new(_a, exponent, significand, mode);
+  return __enzyme_fprt_ptr_to_double(
+      __enzyme_fprt_get_const(__builtin_return_address(0), _a, significand));
 }
 
 __ENZYME_MPFR_ATTRIBUTES
 __enzyme_fp *__enzyme_fprt_64_52_new_intermediate(int64_t exponent,
                                                   int64_t significand,
                                                   int64_t mode) {
-  __enzyme_fp *a = (__enzyme_fp *)malloc(sizeof(__enzyme_fp));
-  mpfr_init2(a->v, significand);
-  return a;
+  return __enzyme_fprt_alloc(significand);
 }
 
 __ENZYME_MPFR_ATTRIBUTES
 void __enzyme_fprt_64_52_delete(double a, int64_t exponent, int64_t significand,
                                 int64_t mode) {
-  free(__enzyme_fprt_double_to_ptr(a));
+  __enzyme_fprt_free(__enzyme_fprt_double_to_ptr(a));
 }
 
 #define __ENZYME_MPFR_SINGOP(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME, FROM_TYPE, \
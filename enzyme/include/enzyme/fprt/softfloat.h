@@ -0,0 +1,292 @@
+//===- fprt/softfloat - Native soft-float runtime -------------------------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains a header-only implementation of the truncation runtime
+// which emulates small floating point formats (bf16, fp16, tf32, fp8 and
+// friends) natively, without MPFR. It is a drop-in replacement for
+// enzyme/fprt/mpfr.h and provides the same functions, generated from the same
+// flops.def.
+//
+// Every operation is evaluated in double and the result is rounded to the
+// target format with integer operations on its bit pattern. Unlike the MPFR
+// runtime, the format is emulated completely: a format with e exponent bits
+// and s significand bits has a precision of s + 1 bits, IEEE style subnormals,
+// and overflows to infinity. For significands of up to 25 bits the result of
+// + - * / and sqrt is correctly rounded, as rounding the double result a second
+// time is innocuous [Figueroa, "When is double rounding innocuous?"]. Other
+// functions are within an ulp of the correctly rounded result.
+//
+// A truncated value is stored in a double holding its (exactly representable)
+// value, so both the op and the mem truncation modes are supported and the
+// runtime does not allocate. The operations are always inlined into the
+// truncated functions, where they can be vectorized like the original code.
+// As they are static, this header must be included in every translation unit
+// which is truncated.
+//
+//===----------------------------------------------------------------------===//
+#ifndef __ENZYME_RUNTIME_ENZYME_SOFTFLOAT__
+#define __ENZYME_RUNTIME_ENZYME_SOFTFLOAT__
+
+#ifdef __ENZYME_RUNTIME_ENZYME_MPFR__
+#error "enzyme/fprt/softfloat.h and enzyme/fprt/mpfr.h cannot be used together"
+#endif
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The operations are emitted in every translation unit that includes this
+// header, even if unused, so that the truncation pass can find and inline them.
+#define __ENZYME_SOFTFLOAT_ATTRIBUTES                                          \
+  static inline __attribute__((always_inline, used))
+#define __ENZYME_SOFTFLOAT_INTERNAL static inline __attribute__((always_inline))
+#define __ENZYME_MPFR_ORIGINAL_ATTRIBUTES __attribute__((weak))
+// flops.def passes a rounding mode to every operation, we only support round
+// to nearest even.
+#define __ENZYME_MPFR_DEFAULT_ROUNDING_MODE 0
+
+#define __ENZYME_SOFTFLOAT_SIGN 0x8000000000000000ull
+#define __ENZYME_SOFTFLOAT_INF 0x7ff0000000000000ull
+#define __ENZYME_SOFTFLOAT_MANTISSA 0x000fffffffffffffull
+
+__ENZYME_SOFTFLOAT_INTERNAL
+double __enzyme_fprt_softfloat_pow2(int64_t e) {
+  uint64_t bits = (uint64_t)(e + 1023) << 52;
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+// Rounds a to nearest even in the format with the given exponent and
+// significand widths.
+__ENZYME_SOFTFLOAT_INTERNAL
+double __enzyme_fprt_softfloat_round(double a, int64_t exponent,
+                                     int64_t significand) {
+  uint64_t bits;
+  memcpy(&bits, &a, sizeof(bits));
+  uint64_t sign = bits & __ENZYME_SOFTFLOAT_SIGN;
+  uint64_t abs = bits ^ sign;
+  // Zeros, infinities and NaNs are preserved.
+  if (abs == 0 || abs >= __ENZYME_SOFTFLOAT_INF)
+    return a;
+
+  int64_t bias = ((int64_t)1 << (exponent - 1)) - 1;
+  int64_t emin = 1 - bias;
+  int64_t field = (int64_t)(abs >> 52);
+  int64_t e = field ? field - 1023 : -1022;
+
+  if (e >= emin) {
+    // Normal in the target format. Rounding the bit pattern rounds the
+    // significand, and a carry out of it correctly bumps the exponent.
+    int64_t drop = 52 - significand;
+    if (drop > 0) {
+      uint64_t lsb = (abs >> drop) & 1;
+      abs += ((uint64_t)1 << (drop - 1)) - 1 + lsb;
+      abs &= ~(((uint64_t)1 << drop) - 1);
+    }
+    if ((int64_t)(abs >> 52) - 1023 > bias)
+      abs = __ENZYME_SOFTFLOAT_INF;
+  } else {
+    // Subnormal in the target format, round to a multiple of its smallest
+    // subnormal 2^(emin - significand).
+    uint64_t m = field ? (abs & __ENZYME_SOFTFLOAT_MANTISSA) | (1ull << 52)
+                       : abs;
+    int64_t shift = 52 - significand + (emin - e);
+    uint64_t k = 0;
+    if (shift <= 53) {
+      uint64_t lsb = (m >> shift) & 1;
+      k = (m + ((uint64_t)1 << (shift - 1)) - 1 + lsb) >> shift;
+    }
+    double r = (double)k * __enzyme_fprt_softfloat_pow2(-significand) *
+               __enzyme_fprt_softfloat_pow2(emin);
+    memcpy(&abs, &r, sizeof(abs));
+  }
+
+  bits = abs | sign;
+  memcpy(&a, &bits, sizeof(a));
+  return a;
+}
+
+// The double precision operation corresponding to each MPFR function used in
+// flops.def.
+#define __ENZYME_SOFTFLOAT_UNOP(MPFR_FUNC_NAME, EXPR)                          \
+  __ENZYME_SOFTFLOAT_INTERNAL                                                  \
+  double __enzyme_fprt_softfloat_##MPFR_FUNC_NAME(double a) { return EXPR; }
+#define __ENZYME_SOFTFLOAT_BINOP(MPFR_FUNC_NAME, ARG2, EXPR)                   \
+  __ENZYME_SOFTFLOAT_INTERNAL                                                  \
+  double __enzyme_fprt_softfloat_##MPFR_FUNC_NAME(double a, ARG2 b) {          \
+    return EXPR;                                                               \
+  }
+
+__ENZYME_SOFTFLOAT_BINOP(add, double, a + b)
+__ENZYME_SOFTFLOAT_BINOP(sub, double, a - b)
+__ENZYME_SOFTFLOAT_BINOP(mul, double, a * b)
+__ENZYME_SOFTFLOAT_BINOP(div, double, a / b)
+__ENZYME_SOFTFLOAT_BINOP(fmod, double, fmod(a, b))
+__ENZYME_SOFTFLOAT_BINOP(remainder, double, remainder(a, b))
+__ENZYME_SOFTFLOAT_BINOP(pow, double, pow(a, b))
+__ENZYME_SOFTFLOAT_BINOP(pow_si, int32_t, pow(a, (double)b))
+__ENZYME_SOFTFLOAT_BINOP(copysign, double, copysign(a, b))
+__ENZYME_SOFTFLOAT_BINOP(dim, double, fdim(a, b))
+__ENZYME_SOFTFLOAT_BINOP(atan2, double, atan2(a, b))
+__ENZYME_SOFTFLOAT_BINOP(hypot, double, hypot(a, b))
+__ENZYME_SOFTFLOAT_BINOP(max, double, fmax(a, b))
+__ENZYME_SOFTFLOAT_BINOP(min, double, fmin(a, b))
+
+__ENZYME_SOFTFLOAT_UNOP(sqrt, sqrt(a))
+__ENZYME_SOFTFLOAT_UNOP(cbrt, cbrt(a))
+__ENZYME_SOFTFLOAT_UNOP(abs, fabs(a))
+__ENZYME_SOFTFLOAT_UNOP(atanh, atanh(a))
+__ENZYME_SOFTFLOAT_UNOP(acosh, acosh(a))
+__ENZYME_SOFTFLOAT_UNOP(asinh, asinh(a))
+__ENZYME_SOFTFLOAT_UNOP(atan, atan(a))
+__ENZYME_SOFTFLOAT_UNOP(acos, acos(a))
+__ENZYME_SOFTFLOAT_UNOP(asin, asin(a))
+__ENZYME_SOFTFLOAT_UNOP(tanh, tanh(a))
+__ENZYME_SOFTFLOAT_UNOP(cosh, cosh(a))
+__ENZYME_SOFTFLOAT_UNOP(sinh, sinh(a))
+__ENZYME_SOFTFLOAT_UNOP(tan, tan(a))
+__ENZYME_SOFTFLOAT_UNOP(cos, cos(a))
+__ENZYME_SOFTFLOAT_UNOP(sin, sin(a))
+__ENZYME_SOFTFLOAT_UNOP(exp, exp(a))
+__ENZYME_SOFTFLOAT_UNOP(exp2, exp2(a))
+__ENZYME_SOFTFLOAT_UNOP(expm1, expm1(a))
+__ENZYME_SOFTFLOAT_UNOP(log, log(a))
+__ENZYME_SOFTFLOAT_UNOP(log2, log2(a))
+__ENZYME_SOFTFLOAT_UNOP(log10, log10(a))
+__ENZYME_SOFTFLOAT_UNOP(log1p, log1p(a))
+__ENZYME_SOFTFLOAT_UNOP(erf, erf(a))
+__ENZYME_SOFTFLOAT_UNOP(erfc, erfc(a))
+__ENZYME_SOFTFLOAT_UNOP(gamma, tgamma(a))
+__ENZYME_SOFTFLOAT_UNOP(lngamma, lgamma(a))
+__ENZYME_SOFTFLOAT_UNOP(rint, nearbyint(a))
+__ENZYME_SOFTFLOAT_UNOP(rint_trunc, trunc(a))
+__ENZYME_SOFTFLOAT_UNOP(rint_round, round(a))
+__ENZYME_SOFTFLOAT_UNOP(rint_floor, floor(a))
+__ENZYME_SOFTFLOAT_UNOP(rint_ceil, ceil(a))
+
+// Truncated values are plain doubles, so creating one only rounds it.
+__ENZYME_SOFTFLOAT_ATTRIBUTES
+double __enzyme_fprt_64_52_get(double a, int64_t exponent, int64_t significand,
+                               int64_t mode) {
+  return a;
+}
+
+__ENZYME_SOFTFLOAT_ATTRIBUTES
+double __enzyme_fprt_64_52_new(double a, int64_t exponent, int64_t significand,
+                               int64_t mode) {
+  return __enzyme_fprt_softfloat_round(a, exponent, significand);
+}
+
+__ENZYME_SOFTFLOAT_ATTRIBUTES
+double __enzyme_fprt_64_52_const(double a, int64_t exponent,
+                                 int64_t significand, int64_t mode) {
+  return __enzyme_fprt_softfloat_round(a, exponent, significand);
+}
+
+__ENZYME_SOFTFLOAT_ATTRIBUTES
+void __enzyme_fprt_64_52_delete(double a, int64_t exponent, int64_t significand,
+                                int64_t mode) {}
+
+#define __ENZYME_MPFR_SINGOP(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME, FROM_TYPE, \
+                             RET, MPFR_GET, ARG1, MPFR_SET_ARG1,               \
+                             ROUNDING_MODE)                                    \
+  __ENZYME_SOFTFLOAT_ATTRIBUTES                                                \
+  RET __enzyme_fprt_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME(                  \
+      ARG1 a, int64_t exponent, int64_t significand, int64_t mode) {           \
+    double ma = __enzyme_fprt_softfloat_round(a, exponent, significand);       \
+    return (RET)__enzyme_fprt_softfloat_round(                                 \
+        __enzyme_fprt_softfloat_##MPFR_FUNC_NAME(ma), exponent, significand);  \
+  }
+
+#define __ENZYME_MPFR_BIN_INT(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME,           \
+                              FROM_TYPE, RET, MPFR_GET, ARG1, MPFR_SET_ARG1,   \
+                              ARG2, ROUNDING_MODE)                             \
+  __ENZYME_SOFTFLOAT_ATTRIBUTES                                                \
+  RET __enzyme_fprt_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME(                  \
+      ARG1 a, ARG2 b, int64_t exponent, int64_t significand, int64_t mode) {   \
+    double ma = __enzyme_fprt_softfloat_round(a, exponent, significand);       \
+    return (RET)__enzyme_fprt_softfloat_round(                                 \
+        __enzyme_fprt_softfloat_##MPFR_FUNC_NAME(ma, b), exponent,             \
+        significand);                                                          \
+  }
+
+#define __ENZYME_MPFR_BIN(OP_TYPE, LLVM_OP_NAME, MPFR_FUNC_NAME, FROM_TYPE,    \
+                          RET, MPFR_GET, ARG1, MPFR_SET_ARG1, ARG2,            \
+                          MPFR_SET_ARG2, ROUNDING_MODE)                        \
+  __ENZYME_SOFTFLOAT_ATTRIBUTES                                                \
+  RET __enzyme_fprt_##FROM_TYPE##_##OP_TYPE##_##LLVM_OP_NAME(                  \
+      ARG1 a, ARG2 b, int64_t exponent, int64_t significand, int64_t mode) {   \
+    double ma = __enzyme_fprt_softfloat_round(a, exponent, significand);       \
+    double mb = __enzyme_fprt_softfloat_round(b, exponent, significand);       \
+    return (RET)__enzyme_fprt_softfloat_round(                                 \
+        __enzyme_fprt_softfloat_##MPFR_FUNC_NAME(ma, mb), exponent,            \
+        significand);                                                          \
+  }
+
+// Like the MPFR runtime, the product is rounded before it is added.
+#define __ENZYME_MPFR_FMULADD(LLVM_OP_NAME, FROM_TYPE, TYPE, MPFR_TYPE,        \
+                              LLVM_TYPE, ROUNDING_MODE)                        \
+  __ENZYME_SOFTFLOAT_ATTRIBUTES                                                \
+  TYPE __enzyme_fprt_##FROM_TYPE##_intr_##LLVM_OP_NAME##_##LLVM_TYPE(          \
+      TYPE a, TYPE b, TYPE c, int64_t exponent, int64_t significand,           \
+      int64_t mode) {                                                          \
+    double ma = __enzyme_fprt_softfloat_round(a, exponent, significand);       \
+    double mb = __enzyme_fprt_softfloat_round(b, exponent, significand);       \
+    double mc = __enzyme_fprt_softfloat_round(c, exponent, significand);       \
+    double mmul =                                                              \
+        __enzyme_fprt_softfloat_round(ma * mb, exponent, significand);         \
+    return (TYPE)__enzyme_fprt_softfloat_round(mmul + mc, exponent,            \
+                                               significand);                   \
+  }
+
+#define __ENZYME_MPFR_FCMP_IMPL(NAME, ORDERED, CMP, FROM_TYPE, TYPE, MPFR_GET, \
+                                ROUNDING_MODE)                                 \
+  __ENZYME_SOFTFLOAT_ATTRIBUTES                                                \
+  bool __enzyme_fprt_##FROM_TYPE##_fcmp_##NAME(                                \
+      TYPE a, TYPE b, int64_t exponent, int64_t significand, int64_t mode) {   \
+    double ma = __enzyme_fprt_softfloat_round(a, exponent, significand);       \
+    double mb = __enzyme_fprt_softfloat_round(b, exponent, significand);       \
+    if (isnan(ma) || isnan(mb))                                                \
+      return !ORDERED;                                                         \
+    int ret = (ma > mb) - (ma < mb);                                           \
+    return ret CMP;                                                            \
+  }
+
+__ENZYME_MPFR_ORIGINAL_ATTRIBUTES
+bool __enzyme_fprt_original_64_52_intr_llvm_is_fpclass_f64(double a,
+                                                           int32_t tests);
+__ENZYME_SOFTFLOAT_ATTRIBUTES bool
+__enzyme_fprt_64_52_intr_llvm_is_fpclass_f64(double a, int32_t tests) {
+  return __enzyme_fprt_original_64_52_intr_llvm_is_fpclass_f64(a, tests);
+}
+
+#include "flops.def"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // #ifndef __ENZYME_RUNTIME_ENZYME_SOFTFLOAT__
@@ -0,0 +1,458 @@
+//===- jacobian/sparse - Compressed sparse Jacobians and Hessians ---------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains a runtime for computing sparse Jacobians and Hessians
+// with far fewer derivative sweeps than there are inputs.
+//
+// Columns of a Jacobian which share no row (structurally orthogonal columns)
+// can be computed by a single forward sweep whose seed is the sum of their unit
+// vectors. The columns are grouped with a greedy Curtis-Powell-Reid coloring
+// and the colors are evaluated width at a time by a vector forward sweep
+// (e.g. __enzyme_fwddiff with enzyme_width and enzyme_dupv), so that a banded
+// Jacobian of bandwidth b needs about (2b + 1) / width sweeps rather than one
+// per input. Rows are grouped in the same way for reverse sweeps. Symmetric
+// Hessians use a star coloring (Gebremedhin, Manne and Pothen), which needs
+// fewer colors than a column coloring while still allowing every entry to be
+// read directly from the compressed Hessian-vector products.
+//
+// Sweeps are given as callbacks taking width seed directions and returning the
+// corresponding directional derivatives. Both are stored direction-major: the
+// seed of direction d for input j is seeds[d * n + j], where n is the number
+// of inputs of the sweep, and its result for output i is out[d * m + i], where
+// m is the number of outputs. Sweeps are always called with the full width;
+// unused directions have a zero seed.
+//
+// Sparsity patterns are in compressed sparse row (CSR) format and the values
+// of the Jacobian are returned in the order of the pattern's column indices.
+// If the pattern is not known, __enzyme_detect_sparsity probes it with dense
+// forward sweeps.
+//
+// All functions are weak so that they can be replaced by a custom
+// implementation.
+//
+//===----------------------------------------------------------------------===//
+#ifndef __ENZYME_RUNTIME_ENZYME_JACOBIAN_SPARSE__
+#define __ENZYME_RUNTIME_ENZYME_JACOBIAN_SPARSE__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __ENZYME_JACOBIAN_ATTRIBUTES __attribute__((weak))
+
+// Compute the derivatives in width seed directions. For a forward sweep the
+// seeds are input tangents and out holds output tangents, for a reverse sweep
+// the seeds are output adjoints and out holds input adjoints, and for a
+// Hessian-vector product out holds H * seed.
+typedef void (*__enzyme_jacobian_sweep)(const double *seeds, double *out,
+                                        int64_t width, void *data);
+
+// Sparsity pattern of a rows x cols matrix in CSR format. The column indices of
+// row i are colind[rowptr[i]] to colind[rowptr[i + 1] - 1].
+typedef struct {
+  int64_t rows;
+  int64_t cols;
+  const int64_t *rowptr;
+  const int64_t *colind;
+} __enzyme_sparsity_pattern;
+
+// Compute the transpose of pattern into transpose, whose index arrays are
+// allocated with malloc and must be freed by the caller. Returns 0 on success.
+__ENZYME_JACOBIAN_ATTRIBUTES
+int __enzyme_sparsity_transpose(const __enzyme_sparsity_pattern *pattern,
+                                __enzyme_sparsity_pattern *transpose) {
+  int64_t nnz = pattern->rowptr[pattern->rows];
+  int64_t *rowptr = (int64_t *)calloc(pattern->cols + 1, sizeof(int64_t));
+  int64_t *colind = (int64_t *)malloc((nnz ? nnz : 1) * sizeof(int64_t));
+  if (!rowptr || !colind) {
+    free(rowptr);
+    free(colind);
+    return -1;
+  }
+  for (int64_t k = 0; k < nnz; k++)
+    rowptr[pattern->colind[k] + 1]++;
+  for (int64_t j = 0; j < pattern->cols; j++)
+    rowptr[j + 1] += rowptr[j];
+  // Rows are visited in order, so the transpose is sorted as well.
+  for (int64_t i = 0; i < pattern->rows; i++)
+    for (int64_t k = pattern->rowptr[i]; k < pattern->rowptr[i + 1]; k++)
+      colind[rowptr[pattern->colind[k]]++] = i;
+  for (int64_t j = pattern->cols; j > 0; j--)
+    rowptr[j] = rowptr[j - 1];
+  rowptr[0] = 0;
+
+  transpose->rows = pattern->cols;
+  transpose->cols = pattern->rows;
+  transpose->rowptr = rowptr;
+  transpose->colind = colind;
+  return 0;
+}
+
+// Greedily color the columns of A such that no two columns sharing a row have
+// the same color, given the transpose AT of A.
+__ENZYME_JACOBIAN_ATTRIBUTES
+int64_t __enzyme_color_distance2(const __enzyme_sparsity_pattern *A,
+                                 const __enzyme_sparsity_pattern *AT,
+                                 int64_t *colors) {
+  int64_t *forbidden = (int64_t *)malloc((A->cols + 1) * sizeof(int64_t));
+  if (!forbidden)
+    return -1;
+  for (int64_t j = 0; j < A->cols; j++) {
+    colors[j] = -1;
+    forbidden[j] = -1;
+  }
+
+  int64_t ncolors = 0;
+  for (int64_t j = 0; j < A->cols; j++) {
+    for (int64_t k = AT->rowptr[j]; k < AT->rowptr[j + 1]; k++) {
+      int64_t i = AT->colind[k];
+      for (int64_t l = A->rowptr[i]; l < A->rowptr[i + 1]; l++) {
+        int64_t c = colors[A->colind[l]];
+        if (c >= 0)
+          forbidden[c] = j;
+      }
+    }
+    int64_t c = 0;
+    while (c < ncolors && forbidden[c] == j)
+      c++;
+    colors[j] = c;
+    if (c == ncolors)
+      ncolors++;
+  }
+  free(forbidden);
+  return ncolors;
+}
+
+// Color the columns of the pattern such that the columns of each color are
+// structurally orthogonal (Curtis-Powell-Reid). colors must hold pattern->cols
+// entries. Returns the number of colors, or -1 on allocation failure.
+__ENZYME_JACOBIAN_ATTRIBUTES
+int64_t __enzyme_color_columns(const __enzyme_sparsity_pattern *pattern,
+                               int64_t *colors) {
+  __enzyme_sparsity_pattern transpose;
+  if (__enzyme_sparsity_transpose(pattern, &transpose))
+    return -1;
+  int64_t ncolors = __enzyme_color_distance2(pattern, &transpose, colors);
+  free((void *)transpose.rowptr);
+  free((void *)transpose.colind);
+  return ncolors;
+}
+
+// Color the rows of the pattern such that no two rows of the same color share
+// a column. colors must hold pattern->rows entries. Returns the number of
+// colors, or -1 on allocation failure.
+__ENZYME_JACOBIAN_ATTRIBUTES
+int64_t __enzyme_color_rows(const __enzyme_sparsity_pattern *pattern,
+                            int64_t *colors) {
+  __enzyme_sparsity_pattern transpose;
+  if (__enzyme_sparsity_transpose(pattern, &transpose))
+    return -1;
+  int64_t ncolors = __enzyme_color_distance2(&transpose, pattern, colors);
+  free((void *)transpose.rowptr);
+  free((void *)transpose.colind);
+  return ncolors;
+}
+
+// Star color the adjacency graph of a structurally symmetric pattern: adjacent
+// vertices have different colors and every path on four vertices uses at least
+// three colors. Diagonal entries are ignored. colors must hold pattern->cols
+// entries. Returns the number of colors, or -1 on allocation failure.
+__ENZYME_JACOBIAN_ATTRIBUTES
+int64_t __enzyme_star_color(const __enzyme_sparsity_pattern *pattern,
+                            int64_t *colors) {
+  int64_t n = pattern->cols;
+  const int64_t *rowptr = pattern->rowptr;
+  const int64_t *colind = pattern->colind;
+  int64_t *forbidden = (int64_t *)malloc((n + 1) * sizeof(int64_t));
+  if (!forbidden)
+    return -1;
+  for (int64_t v = 0; v < n; v++) {
+    colors[v] = -1;
+    forbidden[v] = -1;
+  }
+
+  // Algorithm 4.1 of Gebremedhin, Manne and Pothen, "What Color Is Your
+  // Jacobian? Graph Coloring for Computing Derivatives", SIAM Review 2005.
+  int64_t ncolors = 0;
+  for (int64_t v = 0; v < n; v++) {
+    for (int64_t k = rowptr[v]; k < rowptr[v + 1]; k++) {
+      int64_t w = colind[k];
+      if (w == v)
+        continue;
+      if (colors[w] >= 0)
+        forbidden[colors[w]] = v;
+      for (int64_t l = rowptr[w]; l < rowptr[w + 1]; l++) {
+        int64_t x = colind[l];
+        if (x == w || x == v || colors[x] < 0)
+          continue;
+        if (colors[w] < 0) {
+          // v and x would be the ends of a path through an uncolored vertex.
+          forbidden[colors[x]] = v;
+          continue;
+        }
+        // Avoid a two-colored path v - w - x - y.
+        for (int64_t m = rowptr[x]; m < rowptr[x + 1]; m++) {
+          int64_t y = colind[m];
+          if (y != x && y != w && colors[y] == colors[w]) {
+            forbidden[colors[x]] = v;
+            break;
+          }
+        }
+      }
+    }
+    int64_t c = 0;
+    while (c < ncolors && forbidden[c] == v)
+      c++;
+    colors[v] = c;
+    if (c == ncolors)
+      ncolors++;
+  }
+  free(forbidden);
+  return ncolors;
+}
+
+// Compute the values of a sparse Jacobian with forward sweeps of the given
+// width over a column coloring. values must hold one entry per nonzero of the
+// pattern. Returns the number of sweeps, or -1 on allocation failure.
+__ENZYME_JACOBIAN_ATTRIBUTES
+int64_t __enzyme_sparse_jacobian_forward(
+    const __enzyme_sparsity_pattern *pattern, __enzyme_jacobian_sweep jvp,
+    void *data, int64_t width, double *values) {
+  int64_t rows = pattern->rows, cols = pattern->cols;
+  if (width < 1)
+    width = 1;
+  int64_t *colors = (int64_t *)malloc((cols + 1) * sizeof(int64_t));
+  double *seeds = (double *)malloc((width * cols + 1) * sizeof(double));
+  double *out = (double *)malloc((width * rows + 1) * sizeof(double));
+  int64_t ncolors = colors ? __enzyme_color_columns(pattern, colors) : -1;
+  if (ncolors < 0 || !seeds || !out) {
+    free(colors);
+    free(seeds);
+    free(out);
+    return -1;
+  }
+
+  int64_t sweeps = 0;
+  for (int64_t first = 0; first < ncolors; first += width, sweeps++) {
+    memset(seeds, 0, width * cols * sizeof(double));
+    for (int64_t j = 0; j < cols; j++)
+      if (colors[j] >= first && colors[j] < first + width)
+        seeds[(colors[j] - first) * cols + j] = 1.0;
+    jvp(seeds, out, width, data);
+    for (int64_t i = 0; i < rows; i++)
+      for (int64_t k = pattern->rowptr[i]; k < pattern->rowptr[i + 1]; k++) {
+        int64_t c = colors[pattern->colind[k]];
+        if (c >= first && c < first + width)
+          values[k] = out[(c - first) * rows + i];
+      }
+  }
+  free(colors);
+  free(seeds);
+  free(out);
+  return sweeps;
+}
+
+// Compute the values of a sparse Jacobian with reverse sweeps of the given
+// width over a row coloring. values must hold one entry per nonzero of the
+// pattern. Returns the number of sweeps, or -1 on allocation failure.
+__ENZYME_JACOBIAN_ATTRIBUTES
+int64_t __enzyme_sparse_jacobian_reverse(
+    const __enzyme_sparsity_pattern *pattern, __enzyme_jacobian_sweep vjp,
+    void *data, int64_t width, double *values) {
+  int64_t rows = pattern->rows, cols = pattern->cols;
+  if (width < 1)
+    width = 1;
+  int64_t *colors = (int64_t *)malloc((rows + 1) * sizeof(int64_t));
+  double *seeds = (double *)malloc((width * rows + 1) * sizeof(double));
+  double *out = (double *)malloc((width * cols + 1) * sizeof(double));
+  int64_t ncolors = colors ? __enzyme_color_rows(pattern, colors) : -1;
+  if (ncolors < 0 || !seeds || !out) {
+    free(colors);
+    free(seeds);
+    free(out);
+    return -1;
+  }
+
+  int64_t sweeps = 0;
+  for (int64_t first = 0; first < ncolors; first += width, sweeps++) {
+    memset(seeds, 0, width * rows * sizeof(double));
+    for (int64_t i = 0; i < rows; i++)
+      if (colors[i] >= first && colors[i] < first + width)
+        seeds[(colors[i] - first) * rows + i] = 1.0;
+    vjp(seeds, out, width, data);
+    for (int64_t i = 0; i < rows; i++) {
+      int64_t c = colors[i];
+      if (c < first || c >= first + width)
+        continue;
+      for (int64_t k = pattern->rowptr[i]; k < pattern->rowptr[i + 1]; k++)
+        values[k] = out[(c - first) * cols + pattern->colind[k]];
+    }
+  }
+  free(colors);
+  free(seeds);
+  free(out);
+  return sweeps;
+}
+
+// Compute the values of a sparse symmetric Hessian from Hessian-vector
+// products of the given width over a star coloring. The pattern must be
+// structurally symmetric. values must hold one entry per nonzero of the
+// pattern. Returns the number of sweeps, or -1 on allocation failure.
+__ENZYME_JACOBIAN_ATTRIBUTES
+int64_t __enzyme_sparse_hessian(const __enzyme_sparsity_pattern *pattern,
+                                __enzyme_jacobian_sweep hvp, void *data,
+                                int64_t width, double *values) {
+  int64_t n = pattern->cols;
+  const int64_t *rowptr = pattern->rowptr;
+  const int64_t *colind = pattern->colind;
+  if (width < 1)
+    width = 1;
+  int64_t *colors = (int64_t *)malloc((n + 1) * sizeof(int64_t));
+  int64_t ncolors = colors ? __enzyme_star_color(pattern, colors) : -1;
+  double *seeds = (double *)malloc((width * n + 1) * sizeof(double));
+  double *out = (double *)malloc((width * n + 1) * sizeof(double));
+  // Compressed Hessian H * S, stored as compressed[i * ncolors + c].
+  double *compressed =
+      (double *)malloc(((ncolors > 0 ? ncolors : 0) * n + 1) * sizeof(double));
+  int64_t *count = (int64_t *)malloc(((ncolors > 0 ? ncolors : 0) + 1) *
+                                     sizeof(int64_t));
+  int64_t *stamp = (int64_t *)malloc(((ncolors > 0 ? ncolors : 0) + 1) *
+                                     sizeof(int64_t));
+  if (ncolors < 0 || !seeds || !out || !compressed || !count || !stamp) {
+    free(colors);
+    free(seeds);
+    free(out);
+    free(compressed);
+    free(count);
+    free(stamp);
+    return -1;
+  }
+
+  int64_t sweeps = 0;
+  for (int64_t first = 0; first < ncolors; first += width, sweeps++) {
+    memset(seeds, 0, width * n * sizeof(double));
+    for (int64_t j = 0; j < n; j++)
+      if (colors[j] >= first && colors[j] < first + width)
+        seeds[(colors[j] - first) * n + j] = 1.0;
+    hvp(seeds, out, width, data);
+    for (int64_t d = 0; d < width && first + d < ncolors; d++)
+      for (int64_t i = 0; i < n; i++)
+        compressed[i * ncolors + first + d] = out[d * n + i];
+  }
+
+  // In a star coloring, for every off-diagonal entry (i, j) either j is the
+  // only neighbor of i with its color, in which case H_ij is entry (i, color j)
+  // of the compressed Hessian, or i is the only neighbor of j with its color.
+  for (int64_t c = 0; c < ncolors; c++)
+    stamp[c] = -1;
+  for (int64_t i = 0; i < n; i++) {
+    for (int64_t k = rowptr[i]; k < rowptr[i + 1]; k++) {
+      int64_t c = colors[colind[k]];
+      if (colind[k] == i)
+        continue;
+      if (stamp[c] != i) {
+        stamp[c] = i;
+        count[c] = 0;
+      }
+      count[c]++;
+    }
+    for (int64_t k = rowptr[i]; k < rowptr[i + 1]; k++) {
+      int64_t j = colind[k];
+      if (j == i || count[colors[j]] == 1)
+        values[k] = compressed[i * ncolors + colors[j]];
+      else
+        values[k] = compressed[j * ncolors + colors[i]];
+    }
+  }
+  free(colors);
+  free(seeds);
+  free(out);
+  free(compressed);
+  free(count);
+  free(stamp);
+  return sweeps;
+}
+
+// Detect the sparsity pattern of a rows x cols Jacobian by evaluating it
+// densely with forward sweeps of the given width. rowptr must hold rows + 1
+// entries and *colind is set to the column indices, allocated with malloc.
+// Returns the number of nonzeros, or -1 on allocation failure.
+//
+// Entries which happen to be zero at the point of evaluation are missed, so
+// the pattern should be detected at a generic point (e.g. a random one) rather
+// than at one where the inputs are zero or otherwise special.
+__ENZYME_JACOBIAN_ATTRIBUTES
+int64_t __enzyme_detect_sparsity(int64_t rows, int64_t cols,
+                                 __enzyme_jacobian_sweep jvp, void *data,
+                                 int64_t width, int64_t *rowptr,
+                                 int64_t **colind) {
+  if (width < 1)
+    width = 1;
+  // Detected pattern as a dense row-major mask.
+  char *mask = (char *)calloc(rows * cols + 1, 1);
+  double *seeds = (double *)malloc((width * cols + 1) * sizeof(double));
+  double *out = (double *)malloc((width * rows + 1) * sizeof(double));
+  if (!mask || !seeds || !out) {
+    free(mask);
+    free(seeds);
+    free(out);
+    return -1;
+  }
+
+  for (int64_t first = 0; first < cols; first += width) {
+    memset(seeds, 0, width * cols * sizeof(double));
+    for (int64_t d = 0; d < width && first + d < cols; d++)
+      seeds[d * cols + first + d] = 1.0;
+    jvp(seeds, out, width, data);
+    for (int64_t d = 0; d < width && first + d < cols; d++)
+      for (int64_t i = 0; i < rows; i++)
+        if (out[d * rows + i] != 0.0)
+          mask[i * cols + first + d] = 1;
+  }
+
+  int64_t nnz = 0;
+  for (int64_t i = 0; i < rows * cols; i++)
+    nnz += mask[i];
+  *colind = (int64_t *)malloc((nnz + 1) * sizeof(int64_t));
+  if (*colind) {
+    nnz = 0;
+    for (int64_t i = 0; i < rows; i++) {
+      rowptr[i] = nnz;
+      for (int64_t j = 0; j < cols; j++)
+        if (mask[i * cols + j])
+          (*colind)[nnz++] = j;
+    }
+    rowptr[rows] = nnz;
+  }
+  free(mask);
+  free(seeds);
+  free(out);
+  return *colind ? nnz : -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ENZYME_RUNTIME_ENZYME_JACOBIAN_SPARSE__
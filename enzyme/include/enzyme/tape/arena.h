@@ -0,0 +1,185 @@
+//===- tape/arena - Thread-local tape arena -------------------------------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains the default runtime for `-enzyme-tape-arena`.
+//
+// When enabled, caches of a gradient (combined forward and reverse pass) are
+// bump allocated from a thread-local arena rather than with malloc. The
+// gradient records the top of the arena on entry and releases everything
+// above it before returning, instead of freeing each cache. Released chunks
+// are retained and reused by subsequent gradient calls on the same thread.
+//
+// Include this header in exactly one translation unit of the program (e.g.
+// `-include enzyme/tape/arena.h`). All functions are weak so that they can be
+// replaced by a custom implementation.
+//
+//===----------------------------------------------------------------------===//
+#ifndef __ENZYME_RUNTIME_ENZYME_TAPE_ARENA__
+#define __ENZYME_RUNTIME_ENZYME_TAPE_ARENA__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __ENZYME_TAPE_ARENA_ATTRIBUTES __attribute__((weak))
+
+// Minimum size of a chunk requested from malloc.
+#ifndef __ENZYME_TAPE_ARENA_CHUNK_SIZE
+#define __ENZYME_TAPE_ARENA_CHUNK_SIZE (1 << 20)
+#endif
+
+// Alignment of every buffer returned by the arena.
+#define __ENZYME_TAPE_ARENA_ALIGN 16
+
+typedef struct __enzyme_tape_chunk {
+  // Chunk filled before this one.
+  struct __enzyme_tape_chunk *prev;
+  // Chunk retained after a release, to be reused before calling malloc.
+  struct __enzyme_tape_chunk *next;
+  // One past the last usable byte of this chunk.
+  char *end;
+} __enzyme_tape_chunk;
+
+typedef struct {
+  // Chunk currently being bump allocated from.
+  __enzyme_tape_chunk *cur;
+  // Next free byte of cur.
+  char *top;
+} __enzyme_tape_arena;
+
+__ENZYME_TAPE_ARENA_ATTRIBUTES
+__thread __enzyme_tape_arena __enzyme_tape_arena_state;
+
+static size_t __enzyme_tape_arena_round(size_t size) {
+  return (size + __ENZYME_TAPE_ARENA_ALIGN - 1) &
+         ~(size_t)(__ENZYME_TAPE_ARENA_ALIGN - 1);
+}
+
+static char *__enzyme_tape_chunk_begin(__enzyme_tape_chunk *chunk) {
+  return (char *)chunk +
+         __enzyme_tape_arena_round(sizeof(__enzyme_tape_chunk));
+}
+
+// Make cur a chunk with at least size free bytes, reusing a retained chunk if
+// it is large enough.
+static void __enzyme_tape_arena_grow(__enzyme_tape_arena *arena, size_t size) {
+  __enzyme_tape_chunk *cur = arena->cur;
+  __enzyme_tape_chunk *next = cur ? cur->next : NULL;
+  if (next &&
+      (size_t)(next->end - __enzyme_tape_chunk_begin(next)) >= size) {
+    arena->cur = next;
+    arena->top = __enzyme_tape_chunk_begin(next);
+    return;
+  }
+  size_t header = __enzyme_tape_arena_round(sizeof(__enzyme_tape_chunk));
+  size_t bytes = header + size;
+  if (bytes < __ENZYME_TAPE_ARENA_CHUNK_SIZE)
+    bytes = __ENZYME_TAPE_ARENA_CHUNK_SIZE;
+  __enzyme_tape_chunk *chunk = (__enzyme_tape_chunk *)malloc(bytes);
+  if (!chunk)
+    abort();
+  chunk->prev = cur;
+  // Splice in front of any retained chunk too small to be used.
+  chunk->next = next;
+  if (next)
+    next->prev = chunk;
+  if (cur)
+    cur->next = chunk;
+  chunk->end = (char *)chunk + bytes;
+  arena->cur = chunk;
+  arena->top = __enzyme_tape_chunk_begin(chunk);
+}
+
+__ENZYME_TAPE_ARENA_ATTRIBUTES
+void *__enzyme_tape_arena_alloc(int64_t size) {
+  __enzyme_tape_arena *arena = &__enzyme_tape_arena_state;
+  size_t rsize = __enzyme_tape_arena_round((size_t)size);
+  if (!arena->cur || (size_t)(arena->cur->end - arena->top) < rsize)
+    __enzyme_tape_arena_grow(arena, rsize);
+  void *res = arena->top;
+  arena->top += rsize;
+  return res;
+}
+
+__ENZYME_TAPE_ARENA_ATTRIBUTES
+void *__enzyme_tape_arena_realloc(void *ptr, int64_t oldsize,
+                                  int64_t newsize) {
+  __enzyme_tape_arena *arena = &__enzyme_tape_arena_state;
+  size_t rold = __enzyme_tape_arena_round((size_t)oldsize);
+  size_t rnew = __enzyme_tape_arena_round((size_t)newsize);
+  // The most recent allocation can simply be extended in place.
+  if (ptr && (char *)ptr + rold == arena->top &&
+      (size_t)(arena->cur->end - (char *)ptr) >= rnew) {
+    arena->top = (char *)ptr + rnew;
+    return ptr;
+  }
+  void *res = __enzyme_tape_arena_alloc(newsize);
+  if (ptr && oldsize)
+    memcpy(res, ptr, (size_t)oldsize);
+  return res;
+}
+
+__ENZYME_TAPE_ARENA_ATTRIBUTES
+void *__enzyme_tape_arena_mark(void) {
+  return __enzyme_tape_arena_state.top;
+}
+
+__ENZYME_TAPE_ARENA_ATTRIBUTES
+void __enzyme_tape_arena_release(void *mark) {
+  __enzyme_tape_arena *arena = &__enzyme_tape_arena_state;
+  __enzyme_tape_chunk *cur = arena->cur;
+  if (!cur)
+    return;
+  // Walk back to the chunk containing the mark, retaining the newer chunks.
+  while (cur->prev && !((char *)mark >= __enzyme_tape_chunk_begin(cur) &&
+                        (char *)mark <= cur->end))
+    cur = cur->prev;
+  arena->cur = cur;
+  if ((char *)mark >= __enzyme_tape_chunk_begin(cur) &&
+      (char *)mark <= cur->end)
+    arena->top = (char *)mark;
+  else
+    arena->top = __enzyme_tape_chunk_begin(cur);
+}
+
+// Return all retained chunks above the current one to the system.
+__ENZYME_TAPE_ARENA_ATTRIBUTES
+void __enzyme_tape_arena_trim(void) {
+  __enzyme_tape_arena *arena = &__enzyme_tape_arena_state;
+  if (!arena->cur)
+    return;
+  __enzyme_tape_chunk *next = arena->cur->next;
+  arena->cur->next = NULL;
+  while (next) {
+    __enzyme_tape_chunk *tofree = next;
+    next = next->next;
+    free(tofree);
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ENZYME_RUNTIME_ENZYME_TAPE_ARENA__
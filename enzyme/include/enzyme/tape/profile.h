@@ -0,0 +1,258 @@
+//===- tape/profile - Tape profiling runtime ------------------------------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains the default runtime for `-enzyme-tape-profile`.
+//
+// When enabled, every cache allocated for the reverse pass reports to
+// `__enzyme_tape_profile` with a description of its site (the differentiated
+// function, the source location and the cached instruction), its address and
+// the number of bytes it holds. Caches grown within a loop of unknown trip
+// count report again each iteration with the bytes used so far, along with
+// their previous address. Freeing a cache reports to
+// `__enzyme_tape_profile_free`. Caches allocated from the tape arena are
+// released in bulk and are counted as live until exit.
+//
+// At exit, the sites holding the most bytes are printed to stderr, along with
+// the number of allocations, the largest number of bytes live at once and the
+// average lifetime of a cache. The number of sites printed is given by the
+// ENZYME_TAPE_PROFILE_TOP environment variable (10 by default).
+//
+// Include this header in exactly one translation unit of the program (e.g.
+// `-include enzyme/tape/profile.h`). All functions are weak so that they can
+// be replaced by a custom implementation.
+//
+//===----------------------------------------------------------------------===//
+#ifndef __ENZYME_RUNTIME_ENZYME_TAPE_PROFILE__
+#define __ENZYME_RUNTIME_ENZYME_TAPE_PROFILE__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __ENZYME_TAPE_PROFILE_ATTRIBUTES __attribute__((weak))
+
+// Number of buckets of the tables of sites and of live caches.
+#define __ENZYME_TAPE_PROFILE_BUCKETS 4096
+
+typedef struct __enzyme_tape_site {
+  // Description of the site, "function\tfile:line:col\tinstruction".
+  const char *name;
+  struct __enzyme_tape_site *next;
+  // Number of caches allocated at this site.
+  uint64_t allocations;
+  // Bytes held by all caches of this site, each counted at its largest.
+  uint64_t bytes;
+  // Bytes currently held by live caches of this site, and their maximum.
+  uint64_t live;
+  uint64_t peak;
+  // Number of freed caches and their total lifetime in seconds.
+  uint64_t freed;
+  double lifetime;
+} __enzyme_tape_site;
+
+typedef struct __enzyme_tape_live {
+  void *ptr;
+  struct __enzyme_tape_live *next;
+  __enzyme_tape_site *site;
+  uint64_t bytes;
+  double start;
+} __enzyme_tape_live;
+
+typedef struct {
+  int lock;
+  int registered;
+  __enzyme_tape_site *sites[__ENZYME_TAPE_PROFILE_BUCKETS];
+  __enzyme_tape_live *live[__ENZYME_TAPE_PROFILE_BUCKETS];
+} __enzyme_tape_profile_state_t;
+
+__ENZYME_TAPE_PROFILE_ATTRIBUTES
+__enzyme_tape_profile_state_t __enzyme_tape_profile_state;
+
+static void __enzyme_tape_profile_lock(void) {
+  while (__atomic_exchange_n(&__enzyme_tape_profile_state.lock, 1,
+                             __ATOMIC_ACQUIRE))
+    ;
+}
+
+static void __enzyme_tape_profile_unlock(void) {
+  __atomic_store_n(&__enzyme_tape_profile_state.lock, 0, __ATOMIC_RELEASE);
+}
+
+static double __enzyme_tape_profile_now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static size_t __enzyme_tape_profile_hash(const void *ptr) {
+  uintptr_t h = (uintptr_t)ptr;
+  h ^= h >> 17;
+  h *= (uintptr_t)0x9E3779B97F4A7C15ull;
+  return (size_t)(h >> 7) % __ENZYME_TAPE_PROFILE_BUCKETS;
+}
+
+// Remove and return the record of the live cache at ptr, if any.
+static __enzyme_tape_live *__enzyme_tape_profile_take(void *ptr) {
+  __enzyme_tape_live **cur =
+      &__enzyme_tape_profile_state.live[__enzyme_tape_profile_hash(ptr)];
+  for (; *cur; cur = &(*cur)->next) {
+    if ((*cur)->ptr == ptr) {
+      __enzyme_tape_live *res = *cur;
+      *cur = res->next;
+      return res;
+    }
+  }
+  return NULL;
+}
+
+// Sites are hashed by description, since each module has its own copy.
+static __enzyme_tape_site *__enzyme_tape_profile_site(const char *name) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (const char *c = name; *c; c++)
+    h = (h ^ (unsigned char)*c) * 0x100000001b3ull;
+  __enzyme_tape_site **bucket =
+      &__enzyme_tape_profile_state.sites[h % __ENZYME_TAPE_PROFILE_BUCKETS];
+  for (__enzyme_tape_site *site = *bucket; site; site = site->next)
+    if (site->name == name || strcmp(site->name, name) == 0)
+      return site;
+  __enzyme_tape_site *site =
+      (__enzyme_tape_site *)calloc(1, sizeof(__enzyme_tape_site));
+  if (!site)
+    abort();
+  site->name = name;
+  site->next = *bucket;
+  *bucket = site;
+  return site;
+}
+
+static int __enzyme_tape_profile_compare(const void *lhs, const void *rhs) {
+  uint64_t l = (*(__enzyme_tape_site *const *)lhs)->bytes;
+  uint64_t r = (*(__enzyme_tape_site *const *)rhs)->bytes;
+  return l < r ? 1 : (l > r ? -1 : 0);
+}
+
+// Print the top sites by bytes held to out. Live caches are counted at their
+// current size.
+__ENZYME_TAPE_PROFILE_ATTRIBUTES
+void __enzyme_tape_profile_report(FILE *out, size_t top) {
+  __enzyme_tape_profile_lock();
+  size_t count = 0;
+  uint64_t total = 0;
+  for (size_t i = 0; i < __ENZYME_TAPE_PROFILE_BUCKETS; i++)
+    for (__enzyme_tape_site *site = __enzyme_tape_profile_state.sites[i]; site;
+         site = site->next)
+      count++;
+  __enzyme_tape_site **sorted =
+      (__enzyme_tape_site **)malloc(sizeof(__enzyme_tape_site *) * count + 1);
+  if (!sorted)
+    abort();
+  count = 0;
+  for (size_t i = 0; i < __ENZYME_TAPE_PROFILE_BUCKETS; i++)
+    for (__enzyme_tape_site *site = __enzyme_tape_profile_state.sites[i]; site;
+         site = site->next) {
+      sorted[count++] = site;
+      total += site->bytes;
+    }
+  qsort(sorted, count, sizeof(__enzyme_tape_site *),
+        __enzyme_tape_profile_compare);
+  fprintf(out, "enzyme tape profile: %llu bytes cached at %llu sites\n",
+          (unsigned long long)total, (unsigned long long)count);
+  fprintf(out, "%14s %10s %14s %14s  %s\n", "bytes", "allocs", "peak live",
+          "avg life (s)", "function / location / cached instruction");
+  for (size_t i = 0; i < count && i < top; i++) {
+    __enzyme_tape_site *site = sorted[i];
+    fprintf(out, "%14llu %10llu %14llu %14.6g  %s\n",
+            (unsigned long long)site->bytes,
+            (unsigned long long)site->allocations,
+            (unsigned long long)site->peak,
+            site->freed ? site->lifetime / (double)site->freed : 0.0,
+            site->name);
+  }
+  free(sorted);
+  __enzyme_tape_profile_unlock();
+}
+
+static void __enzyme_tape_profile_atexit(void) {
+  size_t top = 10;
+  const char *env = getenv("ENZYME_TAPE_PROFILE_TOP");
+  if (env)
+    top = (size_t)strtoull(env, NULL, 10);
+  __enzyme_tape_profile_report(stderr, top);
+}
+
+__ENZYME_TAPE_PROFILE_ATTRIBUTES
+void __enzyme_tape_profile(const char *name, void *old, void *ptr,
+                           uint64_t bytes) {
+  __enzyme_tape_profile_lock();
+  if (!__enzyme_tape_profile_state.registered) {
+    __enzyme_tape_profile_state.registered = 1;
+    atexit(__enzyme_tape_profile_atexit);
+  }
+  __enzyme_tape_live *live = old ? __enzyme_tape_profile_take(old) : NULL;
+  if (!live) {
+    live = (__enzyme_tape_live *)calloc(1, sizeof(__enzyme_tape_live));
+    if (!live)
+      abort();
+    live->site = __enzyme_tape_profile_site(name);
+    live->start = __enzyme_tape_profile_now();
+    live->site->allocations++;
+  }
+  __enzyme_tape_site *site = live->site;
+  if (bytes > live->bytes) {
+    site->bytes += bytes - live->bytes;
+    site->live += bytes - live->bytes;
+    if (site->live > site->peak)
+      site->peak = site->live;
+    live->bytes = bytes;
+  }
+  live->ptr = ptr;
+  __enzyme_tape_live **bucket =
+      &__enzyme_tape_profile_state.live[__enzyme_tape_profile_hash(ptr)];
+  live->next = *bucket;
+  *bucket = live;
+  __enzyme_tape_profile_unlock();
+}
+
+__ENZYME_TAPE_PROFILE_ATTRIBUTES
+void __enzyme_tape_profile_free(void *ptr) {
+  if (!ptr)
+    return;
+  __enzyme_tape_profile_lock();
+  __enzyme_tape_live *live = __enzyme_tape_profile_take(ptr);
+  if (live) {
+    live->site->live -= live->bytes;
+    live->site->freed++;
+    live->site->lifetime += __enzyme_tape_profile_now() - live->start;
+    free(live);
+  }
+  __enzyme_tape_profile_unlock();
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ENZYME_RUNTIME_ENZYME_TAPE_PROFILE__
@@ -0,0 +1,74 @@
+;RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -S | FileCheck %s; fi
+;RUN: %opt < %s %newLoadEnzyme -passes="enzyme" -S | FileCheck %s
+
+declare void @dgemm_64_(i8* nocapture readonly, i8* nocapture readonly, i8* nocapture readonly, i8* nocapture readonly, i8* nocapture readonly, i8* nocapture readonly, i8*, i8* nocapture readonly, i8*, i8* nocapture readonly, i8* nocapture readonly, i8*, i8* nocapture readonly, i64, i64) 
+
+define void @f(i8* %C, i8* %A, i8* %B) {
+entry:
+  %transa = alloca i8, align 1
+  %transb = alloca i8, align 1
+  %m = alloca i64, align 16
+  %m_p = bitcast i64* %m to i8*
+  %n = alloca i64, align 16
+  %n_p = bitcast i64* %n to i8*
+  %k = alloca i64, align 16
+  %k_p = bitcast i64* %k to i8*
+  %alpha = alloca double, align 16
+  %alpha_p = bitcast double* %alpha to i8*
+  %lda = alloca i64, align 16
+  %lda_p = bitcast i64* %lda to i8*
+  %ldb = alloca i64, align 16
+  %ldb_p = bitcast i64* %ldb to i8*
+  %beta = alloca double, align 16
+  %beta_p = bitcast double* %beta to i8*
+  %ldc = alloca i64, align 16
+  %ldc_p = bitcast i64* %ldc to i8*
+  store i8 78, i8* %transa, align 1
+  store i8 84, i8* %transb, align 1
+  store i64 4, i64* %m, align 16
+  store i64 4, i64* %n, align 16
+  store i64 8, i64* %k, align 16
+  store double 1.000000e+00, double* %alpha, align 16
+  store i64 4, i64* %lda, align 16
+  store i64 4, i64* %ldb, align 16
+  store double 0.000000e+00, double* %beta
+  store i64 4, i64* %ldc, align 16
+  call void @dgemm_64_(i8* %transa, i8* %transb, i8* %m_p, i8* %n_p, i8* %k_p, i8* %alpha_p, i8* %A, i8* %lda_p, i8* %B, i8* %ldb_p, i8* %beta_p, i8* %C, i8* %ldc_p, i64 1, i64 1) 
+  ret void
+}
+
+declare dso_local void @__enzyme_fwddiff(...)
+
+define void @active(i8* %C, i8* %dC1, i8* %dC2, i8* %A, i8* %B, i8* %dB1, i8* %dB2) {
+entry:
+  call void (...) @__enzyme_fwddiff(void (i8*,i8*,i8*)* @f, metadata !"enzyme_width", i64 2, metadata !"enzyme_dup", i8* %C, i8* %dC1, i8* %dC2, metadata !"enzyme_const", i8* %A, metadata !"enzyme_dup", i8* %B, i8* %dB1, i8* %dB2)
+  ret void
+}
+
+; CHECK: define internal void @fwddiffe2f(i8* %C, [2 x i8*] %"C'", i8* %A, i8* %B, [2 x i8*] %"B'")
+; CHECK:   %malloccall = tail call noalias nonnull i8* @malloc(i64 %mallocsize)
+; CHECK:   store i8 71, i8* %byref.packed.uplo
+; CHECK-NEXT:   %[[dB1:.+]] = extractvalue [2 x i8*] %"B'", 0
+; CHECK:   call void @dlacpy_64_(i8* %byref.packed.uplo, i8* %[[rB:.+]], i8* %[[cB:.+]], i8* %[[dB1]], i8* %ldb_p, i8* %{{.+}}, i8* %[[ldpB:.+]])
+; CHECK-NEXT:   %[[dB2:.+]] = extractvalue [2 x i8*] %"B'", 1
+; CHECK:   call void @dlacpy_64_(i8* %byref.packed.uplo, i8* %[[rB]], i8* %[[cB]], i8* %[[dB2]], i8* %ldb_p, i8* %{{.+}}, i8* %[[ldpB]])
+; CHECK:   %malloccall2 = tail call noalias nonnull i8* @malloc(i64 %mallocsize1)
+; CHECK:   %[[dC1:.+]] = extractvalue [2 x i8*] %"C'", 0
+; CHECK:   call void @dlacpy_64_(i8* %byref.packed.uplo4, i8* %m_p, i8* %n_p, i8* %[[dC1]], i8* %ldc_p, i8* %{{.+}}, i8* %[[ldpC:.+]])
+; CHECK-NEXT:   %[[dC2:.+]] = extractvalue [2 x i8*] %"C'", 1
+; CHECK:   call void @dlacpy_64_(i8* %byref.packed.uplo4, i8* %m_p, i8* %n_p, i8* %[[dC2]], i8* %ldc_p, i8* %{{.+}}, i8* %[[ldpC]])
+; CHECK:   %[[n:.+]] = load i64, i64* %{{.+}}
+; CHECK-NEXT:   %[[wn:.+]] = mul i64 %[[n]], 2
+; CHECK-NEXT:   store i64 %[[wn]], i64* %byref.fused.n
+; CHECK-NOT: call void @dgemm_64_
+; CHECK:   call void @dgemm_64_(i8* %transa, i8* %transb, i8* %m_p, i8* %{{.+}}, i8* %k_p, i8* %alpha_p, i8* %A, i8* %lda_p, i8* %{{.+}}, i8* %[[ldpB]], i8* %beta_p, i8* %{{.+}}, i8* %[[ldpC]], i64 1, i64 1)
+; CHECK-NOT: call void @dgemm_64_
+; CHECK:   %[[uC1:.+]] = extractvalue [2 x i8*] %"C'", 0
+; CHECK:   call void @dlacpy_64_(i8* %byref.packed.uplo6, i8* %m_p, i8* %n_p, i8* %{{.+}}, i8* %{{.+}}, i8* %[[uC1]], i8* %ldc_p)
+; CHECK:   %[[uC2:.+]] = extractvalue [2 x i8*] %"C'", 1
+; CHECK:   call void @dlacpy_64_(i8* %byref.packed.uplo6, i8* %m_p, i8* %n_p, i8* %{{.+}}, i8* %{{.+}}, i8* %[[uC2]], i8* %ldc_p)
+; CHECK:   tail call void @free(i8* nonnull %{{.+}})
+; CHECK:   tail call void @free(i8* nonnull %{{.+}})
+; CHECK-NOT: call void @dgemm_64_
+; CHECK:   call void @dgemm_64_(i8* %transa, i8* %transb, i8* %m_p, i8* %n_p, i8* %k_p, i8* %alpha_p, i8* %A, i8* %lda_p, i8* %B, i8* %ldb_p, i8* %beta_p, i8* %C, i8* %ldc_p, i64 1, i64 1)
+; CHECK-NEXT:   ret void
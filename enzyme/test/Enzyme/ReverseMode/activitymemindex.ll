@@ -0,0 +1,42 @@
+; RUN: %opt < %s %newLoadEnzyme -enzyme-stats=%t.json -enzyme-preopt=false -passes="enzyme" -S | FileCheck %s
+; RUN: cat %t.json | FileCheck %s --check-prefix=INDEX
+; RUN: %opt < %s %newLoadEnzyme -enzyme-stats=%t2.json -enzyme-activity-memory-index=false -enzyme-preopt=false -passes="enzyme" -S | FileCheck %s
+; RUN: cat %t2.json | FileCheck %s --check-prefix=NOINDEX
+
+; The memory search for %ga and %gb only visits the accesses of their own
+; alloca and of %x, the one for %x skips both non-escaping allocas.
+
+define double @tester(double* %x, i64 %i) {
+entry:
+  %a = alloca [4 x double]
+  %b = alloca [4 x double]
+  %ga = getelementptr inbounds [4 x double], [4 x double]* %a, i64 0, i64 %i
+  %gb = getelementptr inbounds [4 x double], [4 x double]* %b, i64 0, i64 %i
+  %v = load double, double* %x
+  store double %v, double* %ga
+  store double 1.000000e+00, double* %gb
+  %la = load double, double* %ga
+  %lb = load double, double* %gb
+  %m = fmul double %la, %lb
+  ret double %m
+}
+
+declare double @__enzyme_autodiff(...)
+
+define double @test(double* %x, double* %dx, i64 %i) {
+entry:
+  %r = call double (...) @__enzyme_autodiff(double (double*, i64)* @tester, double* %x, double* %dx, i64 %i)
+  ret double %r
+}
+
+; CHECK: define internal void @diffetester(double* %x, double* %"x'", i64 %i, double %differeturn)
+; CHECK: %"a'ipa" = alloca [4 x double]
+; CHECK-NOT: %"b'ipa"
+; CHECK: store double 0.000000e+00, double* %"ga'ipg"
+; CHECK: store double %{{.+}}, double* %"x'"
+
+; INDEX:  "function": "tester",
+; INDEX:  "modRefQueries": 19
+
+; NOINDEX:  "function": "tester",
+; NOINDEX:  "modRefQueries": 24
@@ -0,0 +1,64 @@
+;RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -S | FileCheck %s; fi
+;RUN: %opt < %s %newLoadEnzyme -passes="enzyme" -S | FileCheck %s
+
+; dgesv	(	integer 	N,
+; integer 	NRHS,
+; double precision, dimension( lda, * ) 	A,
+; integer 	LDA,
+; integer, dimension( * ) 	IPIV,
+; double precision, dimension( ldb, * ) 	B,
+; integer 	LDB,
+; integer 	INFO
+; )
+
+declare void @dgesv_64_(i64* nocapture readonly, i64* nocapture readonly, i8* nocapture, i64* nocapture readonly, i64* nocapture, i8* nocapture, i64* nocapture readonly, i64* nocapture)
+
+define void @f(i8* %A, i8* %B) {
+entry:
+  %info = alloca i64, align 1
+  %ipiv = alloca [4 x i64], align 16
+  %n = alloca i64, align 16
+  %nrhs = alloca i64, align 16
+  store i64 4, i64* %n, align 16
+  store i64 2, i64* %nrhs, align 16
+  %ipiv_p = getelementptr inbounds [4 x i64], [4 x i64]* %ipiv, i64 0, i64 0
+  call void @dgesv_64_(i64* %n, i64* %nrhs, i8* %A, i64* %n, i64* %ipiv_p, i8* %B, i64* %n, i64* %info)
+  ; overwrite the pivots, so that they have to be cached
+  %ipiv_8 = bitcast i64* %ipiv_p to i8*
+  call void @llvm.memset.p0i8.i64(i8* %ipiv_8, i8 0, i64 32, i1 false)
+  ret void
+}
+
+declare void @llvm.memset.p0i8.i64(i8* nocapture writeonly, i8, i64, i1)
+
+declare dso_local void @__enzyme_autodiff(...)
+
+define void @active(i8* %A, i8* %dA, i8* %B, i8* %dB) {
+entry:
+  call void (...) @__enzyme_autodiff(void (i8*, i8*)* @f, metadata !"enzyme_dup", i8* %A, i8* %dA, metadata !"enzyme_dup", i8* %B, i8* %dB)
+  ret void
+}
+
+; CHECK: define internal void @diffef(i8* %A, i8* %"A'", i8* %B, i8* %"B'")
+; CHECK: entry:
+; CHECK:   call void @dgesv_64_(i64* %n, i64* %nrhs, i8* %A, i64* %n, i64* %ipiv_p, i8* %B, i64* %n, i64* %info)
+; CHECK:   %cache.ipiv = bitcast i8* %malloccall to i64*
+; CHECK:   call void @llvm.memcpy.p0i64.p0i64.i64(i64* %cache.ipiv, i64* %ipiv_p, i64 %{{.*}}, i1 false)
+; CHECK:   call void @llvm.memset.p0i8.i64(i8* %ipiv_8, i8 0, i64 32, i1 false)
+
+; CHECK: invertentry:
+; CHECK:   call void @dgetrs_64_(i8* %byref.constant.char.T, i64* %n, i64* %nrhs, i8* %A, i64* %n, i64* %cache.ipiv, i8* %"B'", i64* %n, i64* %{{.*}}, i64 1)
+; CHECK:   call void @dlacpy_64_(i8* %byref.constant.char.L, i64* %n, i64* %n, i8* %"A'", i64* %n, i8* %[[tmp:.+]], i64* %n, i64 1)
+; CHECK:   call void @dtrmm_64_(
+; CHECK:   call void @dlascl_64_(
+; CHECK:   call void @dtrmm_64_(i8* %byref.constant.char.R,
+; CHECK:   call void @dlacpy_64_(i8* %byref.constant.char.U21, i64* %n, i64* %n, i8* %"A'", i64* %n, i8* %[[tmp]], i64* %n, i64 1)
+; CHECK:   call void @dtrsm_64_(
+; CHECK:   call void @dtrsm_64_(
+; CHECK:   call void @dlaswp_64_(i64* %n, i8* %[[tmp]], i64* %n, i64* %byref.constant.int.134, i64* %n, i64* %cache.ipiv, i64* %byref.constant.int.-1)
+; CHECK:   call void @dlacpy_64_(i8* %byref.constant.char.G, i64* %n, i64* %n, i8* %[[tmp]], i64* %n, i8* %"A'", i64* %n, i64 1)
+; CHECK:   call void @dgemm_64_(i8* %byref.constant.char.N35, i8* %byref.constant.char.C, i64* %n, i64* %n, i64* %nrhs, double* %byref.constant.fp.-1, i8* %"B'", i64* %n, i8* %B, i64* %n, double* %byref.constant.fp.1.037, i8* %"A'", i64* %n, i64 1, i64 1)
+; CHECK:   %[[ipiv8:.+]] = bitcast i64* %cache.ipiv to i8*
+; CHECK:   tail call void @free(i8* nonnull %[[ipiv8]])
+; CHECK:   ret void
+; CHECK: }
@@ -0,0 +1,57 @@
+;RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -S | FileCheck %s; fi
+;RUN: %opt < %s %newLoadEnzyme -passes="enzyme" -S | FileCheck %s
+
+; dgetrf	(	integer 	M,
+; integer 	N,
+; double precision, dimension( lda, * ) 	A,
+; integer 	LDA,
+; integer, dimension( * ) 	IPIV,
+; integer 	INFO
+; )
+
+declare void @dgetrf_64_(i64* nocapture readonly, i64* nocapture readonly, i8* nocapture, i64* nocapture readonly, i64* nocapture, i64* nocapture)
+
+define void @f(i8* %A) {
+entry:
+  %info = alloca i64, align 1
+  %ipiv = alloca [4 x i64], align 16
+  %n = alloca i64, align 16
+  %lda = alloca i64, align 16
+  store i64 4, i64* %n, align 16
+  store i64 4, i64* %lda, align 16
+  %ipiv_p = getelementptr inbounds [4 x i64], [4 x i64]* %ipiv, i64 0, i64 0
+  call void @dgetrf_64_(i64* %n, i64* %n, i8* %A, i64* %lda, i64* %ipiv_p, i64* %info)
+  ret void
+}
+
+declare dso_local void @__enzyme_autodiff(...)
+
+define void @active(i8* %A, i8* %dA) {
+entry:
+  call void (...) @__enzyme_autodiff(void (i8*)* @f, metadata !"enzyme_dup", i8* %A, i8* %dA)
+  ret void
+}
+
+; CHECK: define internal void @diffef(i8* %A, i8* %"A'")
+; CHECK: entry:
+; CHECK:   call void @dgetrf_64_(i64* %n, i64* %n, i8* %A, i64* %lda, i64* %ipiv_p, i64* %info)
+
+; CHECK: invertentry:
+; CHECK:   %malloccall = tail call noalias nonnull i8* @malloc(i64 %mallocsize)
+; CHECK:   call void @llvm.memset.p0i8.i64(i8* %malloccall, i8 0, i64 %{{.*}}, i1 false)
+; CHECK:   %[[tmp:.+]] = bitcast double* %{{.*}} to i8*
+; CHECK:   call void @dlacpy_64_(i8* %byref.constant.char.L, i64* %n, i64* %n, i8* %"A'", i64* %lda, i8* %[[tmp]], i64* %n, i64 1)
+; CHECK:   call void @dtrmm_64_(i8* %byref.constant.char.L1, i8* %byref.constant.char.L2, i8* %byref.constant.char.T, i8* %byref.constant.char.U, i64* %n, i64* %n, double* %byref.constant.fp.1.0, i8* %A, i64* %lda, i8* %[[tmp]], i64* %n, i64 1, i64 1, i64 1, i64 1)
+; CHECK:   call void @dcopy_64_(i64* %n, i8* %"A'", i64* %byref.Add, i8* %[[diag:.+]], i64* %byref.constant.int.15)
+; CHECK:   call void @dlascl_64_(i8* %byref.constant.char.L6, i64* %byref.constant.int.0, i64* %byref.constant.int.07, double* %byref.constant.fp.1.08, double* %byref.constant.fp.0.0, i64* %n, i64* %n, i8* %"A'", i64* %lda, i64* %0, i64 1)
+; CHECK:   call void @dcopy_64_(i64* %n, i8* %[[diag]], i64* %byref.constant.int.19, i8* %"A'", i64* %byref.Add11)
+; CHECK:   call void @dtrmm_64_(i8* %byref.constant.char.R, i8* %byref.constant.char.U12, i8* %byref.constant.char.T13, i8* %byref.constant.char.N14, i64* %n, i64* %n, double* %byref.constant.fp.1.015, i8* %A, i64* %lda, i8* %"A'", i64* %lda, i64 1, i64 1, i64 1, i64 1)
+; CHECK:   call void @dlacpy_64_(i8* %byref.constant.char.U17, i64* %n, i64* %n, i8* %"A'", i64* %lda, i8* %[[tmp]], i64* %n, i64 1)
+; CHECK:   call void @dtrsm_64_(i8* %byref.constant.char.L18, i8* %byref.constant.char.L19, i8* %byref.constant.char.T20, i8* %byref.constant.char.U21, i64* %n, i64* %n, double* %byref.constant.fp.1.022, i8* %A, i64* %lda, i8* %[[tmp]], i64* %n, i64 1, i64 1, i64 1, i64 1)
+; CHECK:   call void @dtrsm_64_(i8* %byref.constant.char.R24, i8* %byref.constant.char.U25, i8* %byref.constant.char.T26, i8* %byref.constant.char.N27, i64* %n, i64* %n, double* %byref.constant.fp.1.028, i8* %A, i64* %lda, i8* %[[tmp]], i64* %n, i64 1, i64 1, i64 1, i64 1)
+; CHECK:   store i64 -1, i64* %byref.constant.int.-1
+; CHECK:   call void @dlaswp_64_(i64* %n, i8* %[[tmp]], i64* %n, i64* %byref.constant.int.130, i64* %n, i64* %ipiv_p, i64* %byref.constant.int.-1)
+; CHECK:   call void @dlacpy_64_(i8* %byref.constant.char.G, i64* %n, i64* %n, i8* %[[tmp]], i64* %n, i8* %"A'", i64* %lda, i64 1)
+; CHECK:   tail call void @free(i8* nonnull %
+; CHECK:   ret void
+; CHECK: }
@@ -0,0 +1,57 @@
+;RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-lapack-copy=1 -enzyme-lapack-packed-cache=1 -S | FileCheck %s; fi
+;RUN: %opt < %s %newLoadEnzyme -passes="enzyme" -enzyme-lapack-copy=1 -enzyme-lapack-packed-cache=1 -S | FileCheck %s
+
+declare void @dpotrf_64_(i8* nocapture readonly, i64* nocapture readonly, i8* nocapture readonly, i64* nocapture readonly, i8* nocapture, i64)
+
+define void @f(i8* %A) {
+entry:
+  %info = alloca i64, align 1
+  %info_p = bitcast i64* %info to i8*
+  %uplo = alloca i8, align 1
+  %n = alloca i64, align 16
+  %lda = alloca i64, align 16
+  store i8 85, i8* %uplo, align 1
+  store i64 4, i64* %n, align 16
+  store i64 4, i64* %lda, align 16
+  call void @dpotrf_64_(i8* %uplo, i64* %n, i8* %A, i64* %lda, i8* %info_p, i64 1) 
+  %Ad = bitcast i8* %A to double*
+  store double 0.000000e+00, double* %Ad, align 8
+  ret void
+}
+
+declare dso_local void @__enzyme_autodiff(...)
+
+define void @active(i8* %A, i8* %dA) {
+entry:
+  call void (...) @__enzyme_autodiff(void (i8*)* @f, metadata !"enzyme_dup", i8* %A, i8* %dA)
+  ret void
+}
+
+; CHECK: define internal void @diffef(i8* %A, i8* %"A'")
+; CHECK: entry:
+; CHECK:   call void @dpotrf_64_(i8* %uplo, i64* %n, i8* %A, i64* %lda, i8* %info_p, i64 1)
+; CHECK-NEXT:   %[[n:.+]] = load i64, i64* %n
+; CHECK-NEXT:   %{{.+}} = load i64, i64* %n
+; CHECK-NEXT:   %[[n1:.+]] = add i64 %[[n]], 1
+; CHECK-NEXT:   %[[nn:.+]] = mul i64 %[[n]], %[[n1]]
+; CHECK-NEXT:   %[[half:.+]] = udiv i64 %[[nn]], 2
+; CHECK-NEXT:   %mallocsize = mul nuw nsw i64 %[[half]], 8
+; CHECK-NEXT:   %malloccall = tail call noalias nonnull i8* @malloc(i64 %mallocsize)
+; CHECK-NEXT:   %cache.A = bitcast i8* %malloccall to double*
+; CHECK-NEXT:   call void @dtrttp_64_(i8* %uplo, i64* %n, i8* %A, i64* %lda, double* %cache.A, i64* %packed.info)
+; CHECK:   store double 0.000000e+00, double* %Ad
+
+; CHECK: invertentry:
+; CHECK:   %[[unpacked:.+]] = tail call noalias nonnull i8* @malloc(i64 %mallocsize1)
+; CHECK:   call void @llvm.memset.p0i8.i64(i8* %[[unpacked]], i8 0, i64 %{{.*}}, i1 false)
+; CHECK-NEXT:   call void @dtpttr_64_(i8* %uplo, i64* %n, double* %cache.A, double* %[[unpackedd:.+]], i64* %n, i64* %unpacked.info)
+; CHECK-NEXT:   %[[fr:.+]] = bitcast double* %cache.A to i8*
+; CHECK-NEXT:   tail call void @free(i8* nonnull %[[fr]])
+; CHECK-NEXT:   %[[ua:.+]] = bitcast double* %[[unpackedd]] to i8*
+; CHECK:   call void @dtrmm_64_(i8* %byref.uplo_to_side.uplo, i8* %uplo, i8* %byref.constant.char.T, i8* %byref.constant.char.N, i64* %n, i64* %n, double* %byref.constant.fp.1.0, i8* %[[ua]], i64* %{{.+}}, i8* %{{.+}}, i64* %n, i64 1, i64 1, i64 1, i64 1)
+; CHECK:   call void @dtrsm_64_({{.*}}, i8* %[[ua]], i64* %{{.+}}, i8* %{{.+}}, i64* %n, i64 1, i64 1, i64 1, i64 1)
+; CHECK:   call void @dtrsm_64_({{.*}}, i8* %[[ua]], i64* %{{.+}}, i8* %{{.+}}, i64* %n, i64 1, i64 1, i64 1, i64 1)
+; CHECK: invertentry_end:
+; CHECK:   %[[fu:.+]] = bitcast double* %[[unpackedd]] to i8*
+; CHECK-NEXT:   tail call void @free(i8* nonnull %[[fu]])
+; CHECK-NEXT:   ret void
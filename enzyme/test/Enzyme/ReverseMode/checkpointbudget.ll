@@ -0,0 +1,69 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-checkpoint-budget=800 -enzyme-print-perf -enzyme-preopt=false -S -o /dev/null 2>&1 | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-checkpoint-budget=800 -enzyme-print-perf -enzyme-preopt=false -passes="enzyme" -S -o /dev/null 2>&1 | FileCheck %s
+
+define double @iterate(double %x0) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %x = phi double [ %x0, %entry ], [ %next, %loop ]
+  %s = call double @llvm.sin.f64(double %x)
+  %next = fmul double %x, %s
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp eq i64 %inc, 1000
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret double %next
+}
+
+define double @iterate_until(double %x0) {
+entry:
+  br label %loop
+
+loop:
+  %x = phi double [ %x0, %entry ], [ %next, %loop ]
+  %s = call double @llvm.sin.f64(double %x)
+  %next = fmul double %x, %s
+  %cmp = fcmp olt double %next, 1.000000e-03
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret double %next
+}
+
+define double @short(double %x0) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %x = phi double [ %x0, %entry ], [ %next, %loop ]
+  %s = call double @llvm.sin.f64(double %x)
+  %next = fmul double %x, %s
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp eq i64 %inc, 10
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret double %next
+}
+
+declare double @llvm.sin.f64(double)
+
+declare double @__enzyme_autodiff(...)
+
+define double @test(double %x) {
+entry:
+  %a = call double (...) @__enzyme_autodiff(double (double)* @iterate, double %x)
+  %b = call double (...) @__enzyme_autodiff(double (double)* @iterate_until, double %x)
+  %c = call double (...) @__enzyme_autodiff(double (double)* @short, double %x)
+  %ab = fadd double %a, %b
+  %r = fadd double %ab, %c
+  ret double %r
+}
+
+; CHECK: Tape of loop loop in diffeiterate needs 8000 bytes, exceeding checkpoint budget; binomial checkpointing with 99 snapshots of 8 bytes needs 800 bytes and recomputes 1899 iterations, each at most 2 times
+; CHECK: Tape of loop loop in diffeiterate_until needs 8 bytes per iteration; 99 snapshots of 8 bytes fit the checkpoint budget, reversing up to 100/5050/171700 iterations when running each at most 1/2/3 times
+; CHECK: Tape of loop loop in diffeshort needs 80 bytes, within checkpoint budget
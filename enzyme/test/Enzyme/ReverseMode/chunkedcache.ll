@@ -0,0 +1,83 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-chunked-cache -enzyme-chunked-cache-block=16 -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-chunked-cache -enzyme-chunked-cache-block=16 -enzyme-preopt=false -passes="enzyme,function(mem2reg,instsimplify,%simplifycfg)" -S | FileCheck %s
+
+define double @dynsquare(double* noalias nocapture %arg) {
+bb:
+  br label %bb3
+
+bb3:                                              ; preds = %bb3, %bb
+  %i = phi i64 [ 0, %bb ], [ %i11, %bb3 ]
+  %i4 = phi double [ 0.000000e+00, %bb ], [ %i10, %bb3 ]
+  %i5 = getelementptr inbounds double, double* %arg, i64 %i
+  %i6 = load double, double* %i5, align 8
+  %i9 = fmul double %i6, %i6
+  %i10 = fadd double %i4, %i9
+  %i11 = add nuw nsw i64 %i, 1
+  %i12 = fcmp ogt double %i10, 1.000000e+02
+  br i1 %i12, label %bb2, label %bb3
+
+bb2:                                              ; preds = %bb3
+  store double 0.000000e+00, double* %arg, align 8
+  ret double %i10
+}
+
+define double @ddynsquare(double* %arg, double* %arg1) {
+bb:
+  %i = tail call double (...) @__enzyme_autodiff(double (double*)* @dynsquare, double* %arg, double* %arg1)
+  ret double %i
+}
+
+declare double @__enzyme_autodiff(...)
+
+; CHECK: define internal void @diffedynsquare(double* noalias nocapture %arg, double* nocapture %"arg'", double %differeturn)
+; CHECK: bb3:
+; CHECK-NEXT:   %i6_cache.0 = phi double** [ null, %bb ], [ %16, %__enzyme_chunkedallocation.exit ]
+; CHECK:   %slot.i = lshr i64 %iv, 4
+; CHECK-NEXT:   %1 = and i64 %iv, 15
+; CHECK-NEXT:   %2 = icmp eq i64 %1, 0
+; CHECK-NEXT:   br i1 %2, label %newblock.i, label %__enzyme_chunkedallocation.exit
+
+; CHECK: growdir.i:
+; CHECK-NEXT:   %6 = shl i64 %3, 1
+; CHECK-NEXT:   %7 = mul nuw nsw i64 %6, 8
+; CHECK-NEXT:   %8 = bitcast i8** %0 to i8*
+; CHECK-NEXT:   %9 = call i8* @realloc(i8* %8, i64 %7)
+
+; CHECK: insert.i:
+; CHECK-NEXT:   %11 = phi i8** [ %10, %growdir.i ], [ %0, %newblock.i ]
+; CHECK-NEXT:   %12 = call noalias nonnull i8* @malloc(i64 128)
+; CHECK-NEXT:   %13 = getelementptr inbounds i8*, i8** %11, i64 %slot.i
+; CHECK-NEXT:   store i8* %12, i8** %13, align 8
+; CHECK-NEXT:   %14 = getelementptr inbounds i8*, i8** %11, i64 %3
+; CHECK-NEXT:   store i8* null, i8** %14, align 8
+
+; CHECK: __enzyme_chunkedallocation.exit:
+; CHECK-NEXT:   %15 = phi i8** [ %11, %insert.i ], [ %0, %bb3 ]
+; CHECK-NEXT:   %16 = bitcast i8** %15 to double**
+; CHECK-NEXT:   %i5 = getelementptr inbounds double, double* %arg, i64 %iv
+; CHECK-NEXT:   %i6 = load double, double* %i5, align 8
+; CHECK-NEXT:   %17 = lshr i64 %iv, 4
+; CHECK-NEXT:   %18 = and i64 %iv, 15
+; CHECK-NEXT:   %19 = getelementptr inbounds double*, double** %16, i64 %17
+; CHECK-NEXT:   %20 = load double*, double** %19, align 8
+; CHECK-NEXT:   %21 = getelementptr inbounds double, double* %20, i64 %18
+; CHECK-NEXT:   store double %i6, double* %21, align 8, !invariant.group
+
+; CHECK: invertbb:
+; CHECK-NEXT:   call void @__enzyme_chunkedfree(i8** %15)
+; CHECK-NEXT:   ret void
+
+; CHECK: invertbb3:
+; CHECK:   %22 = lshr i64 %"iv'ac.0", 4
+; CHECK-NEXT:   %23 = and i64 %"iv'ac.0", 15
+; CHECK-NEXT:   %24 = getelementptr inbounds double*, double** %16, i64 %22
+; CHECK-NEXT:   %25 = load double*, double** %24, align 8
+; CHECK-NEXT:   %26 = getelementptr inbounds double, double* %25, i64 %23
+; CHECK-NEXT:   %27 = load double, double* %26, align 8, !invariant.group
+
+; CHECK: define internal void @__enzyme_chunkedfree(i8** %dir)
+; CHECK: body:
+; CHECK-NEXT:   tail call void @free(i8* nonnull %2)
+; CHECK: done:
+; CHECK-NEXT:   %5 = bitcast i8** %dir to i8*
+; CHECK-NEXT:   tail call void @free(i8* nonnull %5)
@@ -0,0 +1,67 @@
+; RUN: rm -rf %t.dir
+; RUN: %opt < %s %newLoadEnzyme -passes="enzyme" -S -o %t.nocache.ll
+; RUN: %opt < %s %newLoadEnzyme -enzyme-derivative-cache-dir=%t.dir -passes="enzyme" -S -o %t.store.ll
+; RUN: diff %t.nocache.ll %t.store.ll
+; RUN: ls %t.dir | FileCheck %s --check-prefix=ENTRIES
+; RUN: %opt < %s %newLoadEnzyme -enzyme-derivative-cache-dir=%t.dir -passes="enzyme" -S -o %t.load.ll
+; RUN: FileCheck %s < %t.load.ll
+; RUN: %opt < %t.load.ll -verify -disable-output
+
+@scale = internal constant double 3.000000e+00
+
+define internal double @square(double %x) {
+entry:
+  %m = fmul double %x, %x
+  ret double %m
+}
+
+define double @f(double %x) {
+entry:
+  %s = load double, double* @scale
+  %sq = call double @square(double %x)
+  %m = fmul double %sq, %s
+  ret double %m
+}
+
+define double @g(double %x) {
+entry:
+  %sq = call double @square(double %x)
+  ret double %sq
+}
+
+declare double @__enzyme_autodiff(...)
+declare double @__enzyme_fwddiff(...)
+
+define double @test(double %x) {
+entry:
+  %a = call double (...) @__enzyme_autodiff(double (double)* @g, double %x)
+  %b = call double (...) @__enzyme_fwddiff(double (double)* @g, double %x, double 1.000000e+00)
+  %c = call double (...) @__enzyme_autodiff(double (double)* @f, double %x)
+  %r = fadd double %a, %b
+  %r2 = fadd double %r, %c
+  ret double %r2
+}
+
+; The reverse and forward derivatives of @g and @square are cached, while that
+; of @f refers to the internal global @scale and is not.
+; ENTRIES-COUNT-4: {{[0-9a-f]+}}.bc
+; ENTRIES-NOT: .bc
+
+; CHECK: define double @test(double %x)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = call { double } @diffeg(double %x, double 1.000000e+00)
+; CHECK:        %2 = call {{(fast )?}}double @fwddiffeg(double %x, double 1.000000e+00)
+; CHECK-NEXT:   %3 = call { double } @diffef(double %x, double 1.000000e+00)
+
+; CHECK: define internal { double } @diffeg(double %x, double %differeturn)
+; CHECK:   call { double } @diffesquare(double %x,
+
+; CHECK: define internal { double } @diffesquare(double %x, double %differeturn)
+
+; CHECK: define internal double @fwddiffeg(double %x, double %"x'")
+
+; CHECK: define internal { double } @diffef(double %x, double %differeturn)
+; CHECK:   call { double } @diffesquare(double %x,
+
+; CHECK-NOT: @diffesquare.1
+; CHECK-NOT: enzyme.derivative_cache
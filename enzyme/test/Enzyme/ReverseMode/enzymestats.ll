@@ -0,0 +1,75 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-stats=%t.json -enzyme-preopt=false -S -o /dev/null && cat %t.json | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-stats=%t.json -enzyme-preopt=false -passes="enzyme" -S -o /dev/null && cat %t.json | FileCheck %s
+
+define internal double @square(double* %p) {
+entry:
+  %x = load double, double* %p
+  store double 0.000000e+00, double* %p
+  %m = fmul double %x, %x
+  ret double %m
+}
+
+define double @sumsquares(double* %arr, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %acc = phi double [ 0.000000e+00, %entry ], [ %add, %loop ]
+  %gep = getelementptr inbounds double, double* %arr, i64 %i
+  %sq = call double @square(double* %gep)
+  %add = fadd double %acc, %sq
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp eq i64 %inc, %n
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret double %add
+}
+
+declare void @__enzyme_autodiff(...)
+
+define void @test(double* %arr, double* %darr, i64 %n) {
+entry:
+  call void (...) @__enzyme_autodiff(double (double*, i64)* @sumsquares, double* %arr, double* %darr, i64 %n)
+  ret void
+}
+
+; CHECK: "functions": [
+; CHECK:       "function": "square",
+; CHECK-NEXT:  "mode": "ReverseModePrimal",
+; CHECK-NEXT:  "typeAnalysis": {
+; CHECK-NEXT:    "worklistPops": {{[1-9][0-9]*}},
+; CHECK-NEXT:    "phiHypothesisRounds": {{[0-9]+}}
+; CHECK-NEXT:  },
+; CHECK-NEXT:  "activityAnalysis": {
+; CHECK-NEXT:    "hypotheses": {{[0-9]+}},
+; CHECK-NEXT:    "modRefQueries": {{[0-9]+}}
+; CHECK-NEXT:  },
+; CHECK-NEXT:  "unwrapCache": {
+; CHECK-NEXT:    "hits": {{[0-9]+}},
+; CHECK-NEXT:    "misses": {{[0-9]+}}
+; CHECK-NEXT:  },
+; CHECK-NEXT:  "lookupCache": {
+; CHECK-NEXT:    "hits": {{[0-9]+}},
+; CHECK-NEXT:    "misses": {{[0-9]+}}
+; CHECK-NEXT:  },
+; CHECK-NEXT:  "minCut": {
+; CHECK-NEXT:    "cached": {{[0-9]+}},
+; CHECK-NEXT:    "recomputed": {{[0-9]+}}
+; CHECK-NEXT:  },
+; CHECK-NEXT:  "tapeBytes": 8
+
+; CHECK:       "function": "square",
+; CHECK-NEXT:  "mode": "ReverseModeGradient",
+
+; CHECK:       "function": "sumsquares",
+; CHECK-NEXT:  "mode": "ReverseModeCombined",
+; CHECK-NEXT:  "typeAnalysis": {
+; CHECK-NEXT:    "worklistPops": {{[1-9][0-9]*}},
+; CHECK:       "unwrapCache": {
+; CHECK-NEXT:    "hits": {{[0-9]+}},
+; CHECK-NEXT:    "misses": {{[1-9][0-9]*}}
+; CHECK:       "lookupCache": {
+; CHECK-NEXT:    "hits": {{[0-9]+}},
+; CHECK-NEXT:    "misses": {{[1-9][0-9]*}}
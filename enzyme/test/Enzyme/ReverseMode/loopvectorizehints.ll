@@ -0,0 +1,47 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme-preopt=false -enzyme -S | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-preopt=false -passes="enzyme" -S | FileCheck %s
+
+define void @f(double* %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %xg = getelementptr inbounds double, double* %x, i64 %i
+  %xv = load double, double* %xg, align 8
+  %m = fmul double %xv, %xv
+  store double %m, double* %xg, align 8
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp eq i64 %inc, %n
+  br i1 %cmp, label %exit, label %loop, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+declare void @__enzyme_autodiff(...)
+
+define void @test(double* %x, double* %dx, i64 %n) {
+entry:
+  call void (...) @__enzyme_autodiff(void (double*, i64)* @f, double* %x, double* %dx, i64 %n)
+  ret void
+}
+
+!0 = distinct !{!0, !1, !2, !3, !4, !5}
+!1 = !{!"llvm.loop.mustprogress"}
+!2 = !{!"llvm.loop.vectorize.width", i32 4}
+!3 = !{!"llvm.loop.vectorize.enable", i1 true}
+!4 = !{!"llvm.loop.interleave.count", i32 2}
+!5 = !{!"llvm.loop.unroll.disable"}
+
+; CHECK: define internal void @diffef(double* %x, double* %"x'", i64 %n)
+; CHECK: incinvertloop:
+; CHECK-NEXT:   %[[av:.+]] = load i64, i64* %"iv'ac"
+; CHECK-NEXT:   %[[sub:.+]] = add nsw i64 %[[av]], -1
+; CHECK-NEXT:   store i64 %[[sub]], i64* %"iv'ac"
+; CHECK-NEXT:   br label %invertloop, !llvm.loop ![[rev:[0-9]+]]
+
+; CHECK: ![[width:[0-9]+]] = !{!"llvm.loop.vectorize.width", i32 4}
+; CHECK-NEXT: ![[enable:[0-9]+]] = !{!"llvm.loop.vectorize.enable", i1 true}
+; CHECK-NEXT: ![[interleave:[0-9]+]] = !{!"llvm.loop.interleave.count", i32 2}
+; CHECK: ![[rev]] = distinct !{![[rev]], ![[width]], ![[enable]], ![[interleave]]}
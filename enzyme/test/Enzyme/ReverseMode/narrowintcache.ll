@@ -0,0 +1,57 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-narrow-int-cache -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-narrow-int-cache -enzyme-preopt=false -passes="enzyme,function(mem2reg,instsimplify,%simplifycfg)" -S | FileCheck %s
+
+define double @gather(double* nocapture readonly %x, i64* nocapture %cols, i64* nocapture %offs, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %acc = phi double [ 0.000000e+00, %entry ], [ %add, %loop ]
+  %cp = getelementptr inbounds i64, i64* %cols, i64 %i
+  %c = load i64, i64* %cp, align 8, !range !0
+  store i64 0, i64* %cp, align 8
+  %op = getelementptr inbounds i64, i64* %offs, i64 %i
+  %o = load i64, i64* %op, align 8
+  store i64 0, i64* %op, align 8
+  %r = srem i64 %o, 100
+  %idx = add nsw i64 %c, %r
+  %xp = getelementptr inbounds double, double* %x, i64 %idx
+  %xv = load double, double* %xp, align 8
+  %m = fmul double %xv, %xv
+  %add = fadd double %acc, %m
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp eq i64 %inc, %n
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret double %add
+}
+
+declare double @__enzyme_autodiff(...)
+
+define double @dgather(double* %x, double* %dx, i64* %cols, i64* %offs, i64 %n) {
+entry:
+  %r = call double (...) @__enzyme_autodiff(double (double*, i64*, i64*, i64)* @gather, double* %x, double* %dx, metadata !"enzyme_const", i64* %cols, metadata !"enzyme_const", i64* %offs, i64 %n)
+  ret double %r
+}
+
+!0 = !{i64 0, i64 1000}
+
+; CHECK: define internal void @diffegather(double* nocapture readonly %x, double* nocapture %"x'", i64* nocapture %cols, i64* nocapture %offs, i64 %n, double %differeturn)
+; CHECK: entry:
+; CHECK:   %[[size:.+]] = mul nuw nsw i64 %n, 2
+; CHECK-NEXT:   %[[mc:.+]] = tail call noalias nonnull i8* @malloc(i64 %[[size]])
+; CHECK-NEXT:   %idx_narrow_malloccache = bitcast i8* %[[mc]] to i16*
+
+; CHECK: loop:
+; CHECK:   %idx = add nsw i64 %c, %r
+; CHECK-NEXT:   %idx_narrow = trunc i64 %idx to i16
+; CHECK:   %[[sp:.+]] = getelementptr inbounds i16, i16* %idx_narrow_malloccache, i64 %iv
+; CHECK-NEXT:   store i16 %idx_narrow, i16* %[[sp]], align 2, !invariant.group
+
+; CHECK: invertloop:
+; CHECK:   %[[lp:.+]] = getelementptr inbounds i16, i16* %idx_narrow_malloccache, i64 %"iv'ac.0"
+; CHECK-NEXT:   %[[ld:.+]] = load i16, i16* %[[lp]], align 2, !invariant.group
+; CHECK-NEXT:   %[[ext:.+]] = sext i16 %[[ld]] to i64
+; CHECK-NEXT:   %"xp'ipg_unwrap" = getelementptr inbounds double, double* %"x'", i64 %[[ext]]
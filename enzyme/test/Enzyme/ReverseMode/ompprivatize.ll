@@ -0,0 +1,114 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme-preopt=false -enzyme -S | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-preopt=false -passes="enzyme" -S | FileCheck %s
+; RUN: %opt < %s %newLoadEnzyme -enzyme-preopt=false -enzyme-privatize-shadows=0 -passes="enzyme" -S | FileCheck %s --check-prefix=ATOMIC
+
+source_filename = "scale.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+%struct.ident_t = type { i32, i32, i32, i32, i8* }
+
+@0 = private unnamed_addr constant [23 x i8] c";unknown;unknown;0;0;;\00", align 1
+@1 = private unnamed_addr constant %struct.ident_t { i32 0, i32 514, i32 0, i32 0, i8* getelementptr inbounds ([23 x i8], [23 x i8]* @0, i32 0, i32 0) }, align 8
+@2 = private unnamed_addr constant %struct.ident_t { i32 0, i32 2, i32 0, i32 0, i8* getelementptr inbounds ([23 x i8], [23 x i8]* @0, i32 0, i32 0) }, align 8
+
+define dso_local void @caller(double* %a, double* %da, double* %x, double* %dx, double* %out, double* %dout, i64 %n) {
+entry:
+  call void @__enzyme_autodiff(i8* bitcast (void (double*, double*, double*, i64)* @scale to i8*), double* %a, double* %da, double* %x, double* %dx, double* %out, double* %dout, i64 %n)
+  ret void
+}
+
+declare void @__enzyme_autodiff(i8*, double*, double*, double*, double*, double*, double*, i64)
+
+define internal void @scale(double* noalias %a, double* noalias %x, double* noalias %out, i64 %length) {
+entry:
+  tail call void (%struct.ident_t*, i32, void (i32*, i32*, ...)*, ...) @__kmpc_fork_call(%struct.ident_t* nonnull @2, i32 4, void (i32*, i32*, ...)* bitcast (void (i32*, i32*, i64, double*, double*, double*)* @.omp_outlined. to void (i32*, i32*, ...)*), i64 %length, double* %a, double* %x, double* %out)
+  ret void
+}
+
+define internal void @.omp_outlined.(i32* noalias nocapture readonly %.global_tid., i32* noalias nocapture readnone %.bound_tid., i64 %length, double* noalias nocapture readonly %a, double* noalias nocapture readonly %x, double* noalias nocapture %out) {
+entry:
+  %.omp.lb = alloca i64, align 8
+  %.omp.ub = alloca i64, align 8
+  %.omp.stride = alloca i64, align 8
+  %.omp.is_last = alloca i32, align 4
+  %sub4 = add i64 %length, -1
+  %cmp.not = icmp eq i64 %length, 0
+  br i1 %cmp.not, label %omp.precond.end, label %omp.precond.then
+
+omp.precond.then:
+  store i64 0, i64* %.omp.lb, align 8
+  store i64 %sub4, i64* %.omp.ub, align 8
+  store i64 1, i64* %.omp.stride, align 8
+  store i32 0, i32* %.omp.is_last, align 4
+  %tid = load i32, i32* %.global_tid., align 4
+  call void @__kmpc_for_static_init_8u(%struct.ident_t* nonnull @1, i32 %tid, i32 34, i32* nonnull %.omp.is_last, i64* nonnull %.omp.lb, i64* nonnull %.omp.ub, i64* nonnull %.omp.stride, i64 1, i64 1)
+  %ub = load i64, i64* %.omp.ub, align 8
+  %cmp6 = icmp ugt i64 %ub, %sub4
+  %cond = select i1 %cmp6, i64 %sub4, i64 %ub
+  store i64 %cond, i64* %.omp.ub, align 8
+  %lb = load i64, i64* %.omp.lb, align 8
+  %add29 = add i64 %cond, 1
+  %cmp730 = icmp ult i64 %lb, %add29
+  br i1 %cmp730, label %omp.inner.for.body, label %omp.loop.exit
+
+omp.inner.for.body:
+  %iv = phi i64 [ %iv.next, %omp.inner.for.body ], [ %lb, %omp.precond.then ]
+  %av = load double, double* %a, align 8
+  %xgep = getelementptr inbounds double, double* %x, i64 %iv
+  %xv = load double, double* %xgep, align 8
+  %m = fmul double %av, %xv
+  %ogep = getelementptr inbounds double, double* %out, i64 %iv
+  store double %m, double* %ogep, align 8
+  %iv.next = add nuw i64 %iv, 1
+  %ub2 = load i64, i64* %.omp.ub, align 8
+  %add = add i64 %ub2, 1
+  %cmp7 = icmp ult i64 %iv.next, %add
+  br i1 %cmp7, label %omp.inner.for.body, label %omp.loop.exit
+
+omp.loop.exit:
+  call void @__kmpc_for_static_fini(%struct.ident_t* nonnull @1, i32 %tid)
+  br label %omp.precond.end
+
+omp.precond.end:
+  ret void
+}
+
+declare void @__kmpc_for_static_init_8u(%struct.ident_t*, i32, i32, i32*, i64*, i64*, i64*, i64, i64)
+
+declare void @__kmpc_for_static_fini(%struct.ident_t*, i32)
+
+declare !callback !0 void @__kmpc_fork_call(%struct.ident_t*, i32, void (i32*, i32*, ...)*, ...)
+
+!0 = !{!1}
+!1 = !{i64 2, i64 -1, i64 -1, i1 true}
+
+; Every iteration reads the shared %a, so its adjoint is summed per thread and
+; added to the shared shadow once on return, while the adjoints of %x are at
+; distinct locations per iteration and remain atomic.
+
+; CHECK: define internal void @diffe.omp_outlined.(i32* noalias nocapture readonly %.global_tid., i32* noalias nocapture readnone %.bound_tid., i64 %length, double* noalias nocapture readonly %a, double* nocapture %"a'", double* noalias nocapture readonly %x, double* nocapture %"x'", double* noalias nocapture %out, double* nocapture %"out'")
+; CHECK-NEXT: entry:
+; CHECK:        %"a'priv" = alloca double, align 8
+; CHECK-NEXT:   store double 0.000000e+00, double* %"a'priv", align 8
+
+; CHECK: invertentry:
+; CHECK-NEXT:   %[[sum:.+]] = load double, double* %"a'priv", align 8
+; CHECK-NEXT:   %{{.+}} = atomicrmw fadd double* %"a'", double %[[sum]] monotonic, align 8
+; CHECK-NEXT:   ret void
+
+; CHECK: invertomp.inner.for.body:
+; CHECK:        %"xgep'ipg_unwrap" = getelementptr inbounds double, double* %"x'", i64 %_unwrap1
+; CHECK-NEXT:   %{{.+}} = atomicrmw fadd double* %"xgep'ipg_unwrap", double %{{.+}} monotonic, align 8
+; CHECK-NEXT:   %[[dav:.+]] = load double, double* %"av'de", align 8
+; CHECK-NEXT:   store double 0.000000e+00, double* %"av'de", align 8
+; CHECK-NEXT:   %[[prev:.+]] = load double, double* %"a'priv", align 8
+; CHECK-NEXT:   %[[add:.+]] = fadd fast double %[[prev]], %[[dav]]
+; CHECK-NEXT:   store double %[[add]], double* %"a'priv", align 8
+
+; ATOMIC-NOT: %"a'priv"
+; ATOMIC: invertomp.inner.for.body:
+; ATOMIC:        %{{.+}} = atomicrmw fadd double* %"xgep'ipg_unwrap"
+; ATOMIC-NEXT:   %[[dav:.+]] = load double, double* %"av'de", align 8
+; ATOMIC-NEXT:   store double 0.000000e+00, double* %"av'de", align 8
+; ATOMIC-NEXT:   %{{.+}} = atomicrmw fadd double* %"a'", double %[[dav]] monotonic, align 8
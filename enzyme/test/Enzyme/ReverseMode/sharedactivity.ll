@@ -0,0 +1,59 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-stats=%t.json -enzyme-preopt=false -S -o /dev/null && cat %t.json | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-stats=%t.json -enzyme-preopt=false -passes="enzyme" -S -o /dev/null && cat %t.json | FileCheck %s
+; RUN: %opt < %s %newLoadEnzyme -enzyme-stats=%t.json -enzyme-preopt=false -enzyme-shared-activity=false -passes="enzyme" -S -o /dev/null && cat %t.json | FileCheck %s --check-prefix=NOSHARE
+
+; The reverse pass of square reuses the activity analysis of its augmented
+; forward pass.
+
+define internal double @square(double* %p) {
+entry:
+  %x = load double, double* %p
+  store double 0.000000e+00, double* %p
+  %m = fmul double %x, %x
+  ret double %m
+}
+
+define double @sumsquares(double* %arr, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %acc = phi double [ 0.000000e+00, %entry ], [ %add, %loop ]
+  %gep = getelementptr inbounds double, double* %arr, i64 %i
+  %sq = call double @square(double* %gep)
+  %add = fadd double %acc, %sq
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp eq i64 %inc, %n
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret double %add
+}
+
+declare void @__enzyme_autodiff(...)
+
+define void @test(double* %arr, double* %darr, i64 %n) {
+entry:
+  call void (...) @__enzyme_autodiff(double (double*, i64)* @sumsquares, double* %arr, double* %darr, i64 %n)
+  ret void
+}
+
+; CHECK:       "function": "square",
+; CHECK-NEXT:  "mode": "ReverseModePrimal",
+; CHECK:       "activityAnalysis": {
+; CHECK-NEXT:    "hypotheses": {{[1-9][0-9]*}},
+; CHECK:       "function": "square",
+; CHECK-NEXT:  "mode": "ReverseModeGradient",
+; CHECK:       "activityAnalysis": {
+; CHECK-NEXT:    "hypotheses": 0,
+; CHECK-NEXT:    "modRefQueries": 0
+
+; NOSHARE:       "function": "square",
+; NOSHARE-NEXT:  "mode": "ReverseModePrimal",
+; NOSHARE:       "activityAnalysis": {
+; NOSHARE-NEXT:    "hypotheses": {{[1-9][0-9]*}},
+; NOSHARE:       "function": "square",
+; NOSHARE-NEXT:  "mode": "ReverseModeGradient",
+; NOSHARE:       "activityAnalysis": {
+; NOSHARE-NEXT:    "hypotheses": {{[1-9][0-9]*}},
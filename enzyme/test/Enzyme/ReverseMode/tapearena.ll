@@ -0,0 +1,88 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-tape-arena -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-tape-arena -enzyme-preopt=false -passes="enzyme,function(mem2reg,instsimplify,%simplifycfg)" -S | FileCheck %s
+
+define double @square(double* noalias nocapture %arg, double* noalias nocapture %arg1) {
+bb:
+  br label %bb3
+
+bb3:                                              ; preds = %bb3, %bb
+  %i = phi i64 [ 0, %bb ], [ %i11, %bb3 ]
+  %i4 = phi double [ 0.000000e+00, %bb ], [ %i10, %bb3 ]
+  %i5 = getelementptr inbounds double, double* %arg, i64 %i
+  %i6 = load double, double* %i5, align 8
+  %i7 = getelementptr inbounds double, double* %arg1, i64 %i
+  %i8 = load double, double* %i7, align 8
+  %i9 = fmul double %i6, %i8
+  %i10 = fadd double %i4, %i9
+  %i11 = add nuw nsw i64 %i, 1
+  %i12 = icmp eq i64 %i11, 100
+  br i1 %i12, label %bb2, label %bb3
+
+bb2:                                              ; preds = %bb3
+  store double 0.000000e+00, double* %arg, align 8
+  store double 0.000000e+00, double* %arg1, align 8
+  ret double %i10
+}
+
+define double @dynsquare(double* noalias nocapture %arg, double* noalias nocapture %arg1) {
+bb:
+  br label %bb3
+
+bb3:                                              ; preds = %bb3, %bb
+  %i = phi i64 [ 0, %bb ], [ %i11, %bb3 ]
+  %i4 = phi double [ 0.000000e+00, %bb ], [ %i10, %bb3 ]
+  %i5 = getelementptr inbounds double, double* %arg, i64 %i
+  %i6 = load double, double* %i5, align 8
+  %i7 = getelementptr inbounds double, double* %arg1, i64 %i
+  %i8 = load double, double* %i7, align 8
+  %i9 = fmul double %i6, %i8
+  %i10 = fadd double %i4, %i9
+  %i11 = add nuw nsw i64 %i, 1
+  %i12 = fcmp ogt double %i10, 1.000000e+02
+  br i1 %i12, label %bb2, label %bb3
+
+bb2:                                              ; preds = %bb3
+  store double 0.000000e+00, double* %arg, align 8
+  store double 0.000000e+00, double* %arg1, align 8
+  ret double %i10
+}
+
+define double @dsquare(double* %arg, double* %arg1, double* %arg2, double* %arg3) {
+bb:
+  %i = tail call double (...) @__enzyme_autodiff(double (double*, double*)* @square, double* %arg, double* %arg1, double* %arg2, double* %arg3)
+  ret double %i
+}
+
+define double @ddynsquare(double* %arg, double* %arg1, double* %arg2, double* %arg3) {
+bb:
+  %i = tail call double (...) @__enzyme_autodiff(double (double*, double*)* @dynsquare, double* %arg, double* %arg1, double* %arg2, double* %arg3)
+  ret double %i
+}
+
+declare double @__enzyme_autodiff(...)
+
+; CHECK: define internal void @diffesquare(double* noalias nocapture %arg, double* nocapture %"arg'", double* noalias nocapture %arg1, double* nocapture %"arg1'", double %differeturn)
+; CHECK-NEXT: bb:
+; CHECK-NEXT:   %tapearena_mark = call i8* @__enzyme_tape_arena_mark()
+; CHECK-NEXT:   %0 = call noalias nonnull i8* @__enzyme_tape_arena_alloc(i64 800)
+; CHECK-NEXT:   %i8_malloccache = bitcast i8* %0 to double*
+; CHECK:   %2 = call noalias nonnull i8* @__enzyme_tape_arena_alloc(i64 800)
+; CHECK-NEXT:   %i6_malloccache = bitcast i8* %2 to double*
+; CHECK-NOT: @free(
+; CHECK: invertbb:
+; CHECK-NEXT:   call void @__enzyme_tape_arena_release(i8* %tapearena_mark)
+; CHECK-NEXT:   ret void
+
+; CHECK: define internal void @diffedynsquare(double* noalias nocapture %arg, double* nocapture %"arg'", double* noalias nocapture %arg1, double* nocapture %"arg1'", double %differeturn)
+; CHECK-NEXT: bb:
+; CHECK-NEXT:   %tapearena_mark = call i8* @__enzyme_tape_arena_mark()
+; CHECK:   %12 = call i8* @__enzyme_tape_arena_realloc(i8* %0, i64 %11, i64 %8)
+; CHECK:   %27 = call i8* @__enzyme_tape_arena_realloc(i8* %15, i64 %26, i64 %23)
+; CHECK-NOT: @free(
+; CHECK: invertbb:
+; CHECK-NEXT:   call void @__enzyme_tape_arena_release(i8* %tapearena_mark)
+; CHECK-NEXT:   ret void
+
+; CHECK: define internal i8* @__enzyme_exponentialallocation.arena(i8* %ptr, i64 %size, i64 %tsize)
+; CHECK: grow:
+; CHECK:   %11 = call i8* @__enzyme_tape_arena_realloc(i8* %ptr, i64 %10, i64 %7)
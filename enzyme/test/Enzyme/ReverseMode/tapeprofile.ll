@@ -0,0 +1,85 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-tape-profile -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-tape-profile -enzyme-preopt=false -passes="enzyme,function(mem2reg,instsimplify,%simplifycfg)" -S | FileCheck %s
+
+define double @dynsquare(double* noalias nocapture %arg) {
+bb:
+  br label %bb3
+
+bb3:                                              ; preds = %bb3, %bb
+  %i = phi i64 [ 0, %bb ], [ %i11, %bb3 ]
+  %i4 = phi double [ 0.000000e+00, %bb ], [ %i10, %bb3 ]
+  %i5 = getelementptr inbounds double, double* %arg, i64 %i
+  %i6 = load double, double* %i5, align 8
+  %i9 = fmul double %i6, %i6
+  %i10 = fadd double %i4, %i9
+  %i11 = add nuw nsw i64 %i, 1
+  %i12 = fcmp ogt double %i10, 1.000000e+02
+  br i1 %i12, label %bb2, label %bb3
+
+bb2:                                              ; preds = %bb3
+  store double 0.000000e+00, double* %arg, align 8
+  ret double %i10
+}
+
+define double @ddynsquare(double* %arg, double* %arg1) {
+bb:
+  %i = tail call double (...) @__enzyme_autodiff(double (double*)* @dynsquare, double* %arg, double* %arg1)
+  ret double %i
+}
+
+declare double @__enzyme_autodiff(...)
+
+define double @square(double* noalias nocapture %arg, i64 %n) {
+bb:
+  br label %bb3
+
+bb3:                                              ; preds = %bb3, %bb
+  %i = phi i64 [ 0, %bb ], [ %i11, %bb3 ]
+  %i4 = phi double [ 0.000000e+00, %bb ], [ %i10, %bb3 ]
+  %i5 = getelementptr inbounds double, double* %arg, i64 %i
+  %i6 = load double, double* %i5, align 8
+  %i9 = fmul double %i6, %i6
+  %i10 = fadd double %i4, %i9
+  %i11 = add nuw nsw i64 %i, 1
+  %i12 = icmp eq i64 %i11, %n
+  br i1 %i12, label %bb2, label %bb3
+
+bb2:                                              ; preds = %bb3
+  store double 0.000000e+00, double* %arg, align 8
+  ret double %i10
+}
+
+define double @dsquare(double* %arg, double* %arg1, i64 %n) {
+bb:
+  %i = tail call double (...) @__enzyme_autodiff(double (double*, i64)* @square, double* %arg, double* %arg1, i64 %n)
+  ret double %i
+}
+
+; CHECK: @tapeprofile.site = private unnamed_addr constant [57 x i8] c"diffedynsquare\09?\09%i6 = load double, double* %i5, align 8\00"
+; CHECK: @tapeprofile.site.1 = private unnamed_addr constant [54 x i8] c"diffesquare\09?\09%i6 = load double, double* %i5, align 8\00"
+
+; CHECK: define internal void @diffedynsquare(double* noalias nocapture %arg, double* nocapture %"arg'", double %differeturn)
+; CHECK: bb3:
+; CHECK:   %[[old:.+]] = bitcast double* %i6_cache.0 to i8*
+; CHECK: __enzyme_exponentialallocation.exit:
+; CHECK-NEXT:   %[[new:.+]] = phi i8* [ %{{.+}}, %grow.i ], [ %[[old]], %bb3 ]
+; CHECK-NEXT:   %{{.+}} = bitcast i8* %[[new]] to double*
+; CHECK-NEXT:   %[[bytes:.+]] = mul nuw nsw i64 %iv.next, 8
+; CHECK-NEXT:   call void @__enzyme_tape_profile(i8* getelementptr inbounds ([57 x i8], [57 x i8]* @tapeprofile.site, i32 0, i32 0), i8* %[[old]], i8* %[[new]], i64 %[[bytes]])
+
+; CHECK: invertbb:
+; CHECK-NEXT:   call void @__enzyme_tape_profile_free(i8* %[[new]])
+; CHECK-NEXT:   tail call void @free(i8* nonnull %[[new]])
+; CHECK-NEXT:   ret void
+
+; CHECK: define internal void @diffesquare(double* noalias nocapture %arg, double* nocapture %"arg'", i64 %n, double %differeturn)
+; CHECK: bb:
+; CHECK:   %malloccall = tail call noalias nonnull i8* @malloc(i64 %mallocsize)
+; CHECK-NEXT:   %i6_malloccache = bitcast i8* %malloccall to double*
+; CHECK-NEXT:   %[[sbytes:.+]] = mul nuw nsw i64 %n, 8
+; CHECK-NEXT:   call void @__enzyme_tape_profile(i8* getelementptr inbounds ([54 x i8], [54 x i8]* @tapeprofile.site.1, i32 0, i32 0), i8* null, i8* %malloccall, i64 %[[sbytes]])
+
+; CHECK: invertbb:
+; CHECK-NEXT:   call void @__enzyme_tape_profile_free(i8* %malloccall)
+; CHECK-NEXT:   tail call void @free(i8* nonnull %malloccall)
+; CHECK-NEXT:   ret void
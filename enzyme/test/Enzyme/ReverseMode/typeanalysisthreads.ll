@@ -0,0 +1,74 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -S -o %t.serial.ll && %opt < %s %loadEnzyme -enzyme -enzyme-type-analysis-threads=4 -enzyme-preopt=false -S -o %t.parallel.ll && diff %t.serial.ll %t.parallel.ll && FileCheck %s < %t.parallel.ll; fi
+; RUN: %opt < %s %newLoadEnzyme -enzyme-preopt=false -passes="enzyme" -S -o %t.serial.ll
+; RUN: %opt < %s %newLoadEnzyme -enzyme-type-analysis-threads=4 -enzyme-preopt=false -passes="enzyme" -S -o %t.parallel.ll
+; RUN: diff %t.serial.ll %t.parallel.ll
+; RUN: FileCheck %s < %t.parallel.ll
+
+%pair = type { double, i64 }
+
+@scale = internal constant [2 x double] [double 2.000000e+00, double 3.000000e+00]
+
+define internal double @square(double %x) {
+entry:
+  %m = fmul double %x, %x
+  ret double %m
+}
+
+define double @sumsquares(double* %arr, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %acc = phi double [ 0.000000e+00, %entry ], [ %add, %loop ]
+  %gep = getelementptr inbounds double, double* %arr, i64 %i
+  %x = load double, double* %gep
+  %sq = call double @square(double %x)
+  %add = fadd double %acc, %sq
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp eq i64 %inc, %n
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret double %add
+}
+
+define double @cube(double %x) {
+entry:
+  %sq = call double @square(double %x)
+  %c = fmul double %sq, %x
+  ret double %c
+}
+
+define double @scaled(double %x) {
+entry:
+  %s = load double, double* getelementptr inbounds ([2 x double], [2 x double]* @scale, i64 0, i64 1)
+  %m = fmul double %x, %s
+  ret double %m
+}
+
+define double @aggregate(double %x, i64 %n) {
+entry:
+  %p0 = insertvalue %pair undef, double %x, 0
+  %p1 = insertvalue %pair %p0, i64 %n, 1
+  %e = extractvalue %pair %p1, 0
+  %m = fmul double %e, %e
+  ret double %m
+}
+
+declare void @__enzyme_autodiff(...)
+declare double @__enzyme_autodiff1(...)
+
+define void @test(double* %arr, double* %darr, i64 %n) {
+entry:
+  call void (...) @__enzyme_autodiff(double (double*, i64)* @sumsquares, double* %arr, double* %darr, i64 %n)
+  %a = call double (...) @__enzyme_autodiff1(double (double)* @cube, double 2.000000e+00)
+  %b = call double (...) @__enzyme_autodiff1(double (double)* @scaled, double 2.000000e+00)
+  %c = call double (...) @__enzyme_autodiff1(double (double, i64)* @aggregate, double 2.000000e+00, i64 %n)
+  ret void
+}
+
+; CHECK: define internal void @diffesumsquares(double* %arr, double* %"arr'", i64 %n, double %differeturn)
+; CHECK: define internal { double } @diffecube(double %x, double %differeturn)
+; CHECK: define internal { double } @diffescaled(double %x, double %differeturn)
+; CHECK: define internal { double } @diffeaggregate(double %x, i64 %n, double %differeturn)
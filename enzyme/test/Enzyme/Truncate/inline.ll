@@ -0,0 +1,37 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -S | FileCheck %s; fi
+; RUN: %opt < %s %newLoadEnzyme -passes="enzyme" -S | FileCheck %s
+
+; Runtime operations marked alwaysinline (as in enzyme/fprt/softfloat.h) are
+; inlined into the truncated function.
+
+define void @f(double* %x) {
+  %y = load double, double* %x
+  %m = fmul double %y, %y
+  store double %m, double* %x
+  ret void
+}
+
+define internal double @__enzyme_fprt_64_52_binop_fmul(double %a, double %b, i64 %exponent, i64 %significand, i64 %mode) alwaysinline {
+  %r = fmul double %a, %b
+  %t = call double @round(double %r, i64 %exponent, i64 %significand)
+  ret double %t
+}
+
+declare double @round(double, i64, i64)
+
+declare void (double*)* @__enzyme_truncate_op_func(...)
+
+define void @tester_op(double* %data) {
+entry:
+  %ptr = call void (double*)* (...) @__enzyme_truncate_op_func(void (double*)* @f, i64 64, i64 5, i64 10)
+  call void %ptr(double* %data)
+  ret void
+}
+
+; CHECK: define internal void @__enzyme_done_truncate_op_func_64_52to16_10_f(double* %x) {
+; CHECK-NEXT:   %y = load double, double* %x, align 8
+; CHECK-NEXT:   %r.i = fmul double %y, %y
+; CHECK-NEXT:   %t.i = call double @round(double %r.i, i64 5, i64 10)
+; CHECK-NEXT:   store double %t.i, double* %x, align 8
+; CHECK-NEXT:   ret void
+; CHECK-NEXT: }
@@ -0,0 +1,69 @@
+// RUN: if [ %llvmver -ge 10 ]; then %clang -std=c11 -O0 %s -S -emit-llvm -o - %loadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 10 ]; then %clang -std=c11 -O1 %s -S -emit-llvm -o - %loadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 10 ]; then %clang -std=c11 -O2 %s -S -emit-llvm -o - %loadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 10 ]; then %clang -std=c11 -O3 %s -S -emit-llvm -o - %loadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -std=c11 -O0 %s -S -emit-llvm -o - %newLoadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -std=c11 -O1 %s -S -emit-llvm -o - %newLoadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -std=c11 -O2 %s -S -emit-llvm -o - %newLoadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -std=c11 -O3 %s -S -emit-llvm -o - %newLoadClangEnzyme | %lli - ; fi
+
+#include "../test_utils.h"
+
+#include <enzyme/checkpoint/revolve.h>
+#include <math.h>
+
+void __enzyme_autodiff(void *, ...);
+
+#define STEPS 500
+
+typedef struct {
+  double x, v;
+} pendulum;
+
+void step(pendulum *p, int64_t i) {
+  double dt = 0.01;
+  p->x += dt * p->v;
+  p->v -= dt * sin(p->x);
+}
+
+void simulate(pendulum *p) {
+  for (int64_t i = 0; i < STEPS; i++)
+    step(p, i);
+}
+
+static void forward(void *state, int64_t i, void *data) {
+  step((pendulum *)state, i);
+}
+
+static void adjoint(void *state, int64_t i, void *data) {
+  __enzyme_autodiff((void *)step, (pendulum *)state, (pendulum *)data, i);
+}
+
+int main() {
+  pendulum ref = {0.5, 0.0};
+  pendulum dref = {1.0, 0.0};
+  __enzyme_autodiff((void *)simulate, &ref, &dref);
+
+  for (int64_t snaps = 1; snaps <= 20; snaps += 3) {
+    pendulum p = {0.5, 0.0};
+    pendulum dp = {1.0, 0.0};
+    __enzyme_checkpoint_stats stats;
+    int err = __enzyme_checkpoint_loop(STEPS, snaps, &p, sizeof(p), forward,
+                                       adjoint, &dp, &stats);
+    __enzyme_checkpoint_report(stdout, &stats);
+    APPROX_EQ(err, 0, 0.0);
+    APPROX_EQ(p.x, ref.x, 1e-10);
+    APPROX_EQ(p.v, ref.v, 1e-10);
+    APPROX_EQ(dp.x, dref.x, 1e-10);
+    APPROX_EQ(dp.v, dref.v, 1e-10);
+    APPROX_EQ(stats.forward_steps,
+              __enzyme_checkpoint_forward_steps(STEPS, snaps), 0.0);
+    APPROX_EQ(stats.repetitions,
+              __enzyme_checkpoint_repetitions(STEPS, snaps), 0.0);
+  }
+
+  int64_t snaps = __enzyme_checkpoint_snaps_for_budget(
+      STEPS, sizeof(pendulum), 10 * sizeof(pendulum));
+  APPROX_EQ(snaps, 10, 0.0);
+  return 0;
+}
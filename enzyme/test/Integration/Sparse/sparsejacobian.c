@@ -0,0 +1,134 @@
+// RUN: if [ %llvmver -ge 10 ]; then %clang -std=c11 -O0 %s -S -emit-llvm -o - %loadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 10 ]; then %clang -std=c11 -O1 %s -S -emit-llvm -o - %loadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 10 ]; then %clang -std=c11 -O2 %s -S -emit-llvm -o - %loadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 10 ]; then %clang -std=c11 -O3 %s -S -emit-llvm -o - %loadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -std=c11 -O0 %s -S -emit-llvm -o - %newLoadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -std=c11 -O1 %s -S -emit-llvm -o - %newLoadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -std=c11 -O2 %s -S -emit-llvm -o - %newLoadClangEnzyme | %lli - ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -std=c11 -O3 %s -S -emit-llvm -o - %newLoadClangEnzyme | %lli - ; fi
+
+#include "../test_utils.h"
+
+#include <enzyme/jacobian/sparse.h>
+#include <math.h>
+
+extern int enzyme_width;
+extern int enzyme_dup;
+extern int enzyme_dupv;
+extern int enzyme_dupnoneedv;
+extern int enzyme_const;
+
+void __enzyme_fwddiff(void *, ...);
+void __enzyme_autodiff(void *, ...);
+
+#define N 20
+#define WIDTH 2
+
+// Tridiagonal Jacobian.
+void f(const double *x, double *y) {
+  for (int i = 0; i < N; i++) {
+    y[i] = x[i] * x[i];
+    if (i + 1 < N)
+      y[i] += x[i] * x[i + 1];
+    if (i > 0)
+      y[i] += sin(x[i - 1]);
+  }
+}
+
+// Tridiagonal Hessian.
+double g(const double *x) {
+  double res = 0;
+  for (int i = 0; i < N; i++) {
+    res += cos(x[i]);
+    if (i + 1 < N)
+      res += x[i] * x[i] * x[i + 1];
+  }
+  return res;
+}
+
+void grad_g(const double *x, double *dx) {
+  for (int i = 0; i < N; i++)
+    dx[i] = 0;
+  __enzyme_autodiff((void *)g, enzyme_dup, x, dx);
+}
+
+void jvp(const double *seeds, double *out, int64_t width, void *data) {
+  double y[N];
+  __enzyme_fwddiff((void *)f, enzyme_width, WIDTH, enzyme_dupv,
+                   N * sizeof(double), (double *)data, seeds,
+                   enzyme_dupnoneedv, N * sizeof(double), y, out);
+}
+
+void vjp(const double *seeds, double *out, int64_t width, void *data) {
+  for (int64_t d = 0; d < width; d++) {
+    double y[N], dy[N];
+    for (int i = 0; i < N; i++) {
+      dy[i] = seeds[d * N + i];
+      out[d * N + i] = 0;
+    }
+    __enzyme_autodiff((void *)f, enzyme_dup, (double *)data, out + d * N,
+                      enzyme_dup, y, dy);
+  }
+}
+
+void hvp(const double *seeds, double *out, int64_t width, void *data) {
+  double dx[N];
+  __enzyme_fwddiff((void *)grad_g, enzyme_width, WIDTH, enzyme_dupv,
+                   N * sizeof(double), (double *)data, seeds,
+                   enzyme_dupnoneedv, N * sizeof(double), dx, out);
+}
+
+int main() {
+  double x[N];
+  for (int i = 0; i < N; i++)
+    x[i] = 0.3 + 0.1 * i;
+
+  int64_t rowptr[N + 1];
+  int64_t *colind;
+  int64_t nnz =
+      __enzyme_detect_sparsity(N, N, jvp, x, WIDTH, rowptr, &colind);
+  TEST_EQ(nnz, 3 * N - 2);
+  __enzyme_sparsity_pattern pattern = {N, N, rowptr, colind};
+
+  int64_t colors[N];
+  TEST_EQ(__enzyme_color_columns(&pattern, colors), 3);
+  TEST_EQ(__enzyme_color_rows(&pattern, colors), 3);
+
+  double values[3 * N];
+  TEST_EQ(__enzyme_sparse_jacobian_forward(&pattern, jvp, x, WIDTH, values),
+          2);
+  for (int i = 0; i < N; i++)
+    for (int64_t k = rowptr[i]; k < rowptr[i + 1]; k++) {
+      int64_t j = colind[k];
+      double expected = j == i       ? 2 * x[i] + (i + 1 < N ? x[i + 1] : 0)
+                        : j == i + 1 ? x[i]
+                                     : cos(x[j]);
+      APPROX_EQ(values[k], expected, 1e-10);
+    }
+
+  for (int64_t k = 0; k < nnz; k++)
+    values[k] = 0;
+  TEST_EQ(__enzyme_sparse_jacobian_reverse(&pattern, vjp, x, WIDTH, values),
+          2);
+  for (int i = 0; i < N; i++)
+    for (int64_t k = rowptr[i]; k < rowptr[i + 1]; k++) {
+      int64_t j = colind[k];
+      double expected = j == i       ? 2 * x[i] + (i + 1 < N ? x[i + 1] : 0)
+                        : j == i + 1 ? x[i]
+                                     : cos(x[j]);
+      APPROX_EQ(values[k], expected, 1e-10);
+    }
+
+  TEST_EQ(__enzyme_star_color(&pattern, colors) <= 3, 1);
+  __enzyme_sparse_hessian(&pattern, hvp, x, WIDTH, values);
+  for (int i = 0; i < N; i++)
+    for (int64_t k = rowptr[i]; k < rowptr[i + 1]; k++) {
+      int64_t j = colind[k];
+      double expected = j == i ? (i + 1 < N ? 2 * x[i + 1] : 0) - cos(x[i])
+                               : 2 * x[i < j ? i : j];
+      APPROX_EQ(values[k], expected, 1e-10);
+    }
+
+  free(colind);
+  return 0;
+}
@@ -0,0 +1,60 @@
+// clang-format off
+// RUN: if [ %llvmver -ge 12 ] && [ %hasMPFR == "yes" ] ; then %clang -O0 %s -o %s.a.out -include enzyme/fprt/mpfr.h -lm -lmpfr -lpthread && %s.a.out ; fi
+// RUN: if [ %llvmver -ge 12 ] && [ %hasMPFR == "yes" ] ; then %clang -O2 %s -o %s.a.out -include enzyme/fprt/mpfr.h -lm -lmpfr -lpthread && %s.a.out ; fi
+// clang-format on
+
+#include <pthread.h>
+
+#include "../test_utils.h"
+
+#define MODE 1
+#define STEPS 100000
+
+// Storing the result keeps the runtime call from becoming a tail call, which
+// would make the caller of constant() the call site.
+__attribute__((noinline)) void constant(double c, double *out) {
+  *out = __enzyme_fprt_64_52_const(c, 11, 52, MODE);
+}
+
+void *sum(void *out) {
+  double acc = __enzyme_fprt_64_52_new(0, 11, 52, MODE);
+  for (int i = 0; i < STEPS; i++) {
+    double half = __enzyme_fprt_64_52_const(0.5, 11, 52, MODE);
+    double next = __enzyme_fprt_64_52_binop_fadd(acc, half, 11, 52, MODE);
+    __enzyme_fprt_64_52_delete(acc, 11, 52, MODE);
+    acc = next;
+  }
+  *(double *)out = __enzyme_fprt_64_52_get(acc, 11, 52, MODE);
+  return nullptr;
+}
+
+int main() {
+  // A constant is created once per call site.
+  double a, b;
+  constant(1.5, &a);
+  constant(1.5, &b);
+  TEST_EQ(__enzyme_fprt_double_to_ptr(a) == __enzyme_fprt_double_to_ptr(b), 1);
+  TEST_EQ(__enzyme_fprt_64_52_get(a, 11, 52, MODE), 1.5);
+
+  // Deleting it has no effect.
+  __enzyme_fprt_64_52_delete(a, 11, 52, MODE);
+  double c = __enzyme_fprt_64_52_new(3.0, 11, 52, MODE);
+  TEST_EQ(__enzyme_fprt_64_52_get(b, 11, 52, MODE), 1.5);
+
+  // Deleted values are reused.
+  __enzyme_fprt_64_52_delete(c, 11, 52, MODE);
+  double d = __enzyme_fprt_64_52_new(4.0, 11, 52, MODE);
+  TEST_EQ(__enzyme_fprt_double_to_ptr(c) == __enzyme_fprt_double_to_ptr(d), 1);
+  TEST_EQ(__enzyme_fprt_64_52_get(d, 11, 52, MODE), 4.0);
+
+  // Every thread allocates from its own pool.
+  pthread_t threads[4];
+  double results[4];
+  for (int i = 0; i < 4; i++)
+    pthread_create(&threads[i], nullptr, sum, &results[i]);
+  for (int i = 0; i < 4; i++) {
+    pthread_join(threads[i], nullptr);
+    TEST_EQ(results[i], 0.5 * STEPS);
+  }
+  return 0;
+}
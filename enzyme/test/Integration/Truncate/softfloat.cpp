@@ -0,0 +1,79 @@
+// clang-format off
+// RUN: if [ %llvmver -ge 12 ]; then %clang -O0 -ffp-contract=off %s -o %s.a.out %newLoadClangEnzyme -include enzyme/fprt/softfloat.h -lm && %s.a.out ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -O2 -ffp-contract=off %s -o %s.a.out %newLoadClangEnzyme -include enzyme/fprt/softfloat.h -lm && %s.a.out ; fi
+// RUN: if [ %llvmver -ge 12 ]; then %clang -O3 -ffp-contract=off %s -o %s.a.out %newLoadClangEnzyme -include enzyme/fprt/softfloat.h -lm && %s.a.out ; fi
+// clang-format on
+
+#include <math.h>
+
+#include "../test_utils.h"
+
+#define N 64
+
+double simple_add(double a, double b) { return a + b; }
+double simple_mul(double a, double b) { return a * b; }
+double compute(double *A, double *B, double *C, int n) {
+  for (int i = 0; i < n; i++) {
+    C[i] = A[i] * 2 + B[i] * sqrt(A[i]);
+  }
+  return C[0];
+}
+
+typedef double (*fty)(double *, double *, double *, int);
+typedef double (*fty2)(double, double);
+
+extern fty __enzyme_truncate_op_func_2(...);
+extern fty2 __enzyme_truncate_op_func(...);
+extern fty2 __enzyme_truncate_mem_func(...);
+extern double __enzyme_truncate_mem_value(...);
+extern double __enzyme_expand_mem_value(...);
+
+int main() {
+  // fp16
+  fty2 add_fp16 = __enzyme_truncate_op_func(simple_add, 64, 5, 10);
+  APPROX_EQ(add_fp16(1, ldexp(1, -10)), 1 + ldexp(1, -10), 0);
+  // Ties round to even.
+  APPROX_EQ(add_fp16(1, ldexp(1, -11)), 1, 0);
+  APPROX_EQ(add_fp16(1 + ldexp(1, -10), ldexp(1, -11)), 1 + ldexp(1, -9), 0);
+  // Overflow and subnormals.
+  TEST_EQ(isinf(add_fp16(60000, 10000)), 1);
+  APPROX_EQ(add_fp16(ldexp(1, -24), ldexp(1, -26)), ldexp(1, -24), 0);
+  APPROX_EQ(add_fp16(ldexp(1, -26), 0), 0, 0);
+
+  // bf16
+  fty2 add_bf16 = __enzyme_truncate_op_func(simple_add, 64, 8, 7);
+  APPROX_EQ(add_bf16(256, 1), 256, 0);
+  APPROX_EQ(add_bf16(256, 3), 260, 0);
+  APPROX_EQ(add_bf16(1e38, 1e38), 2 * add_bf16(1e38, 0), 0);
+
+  // fp8 e4m3 and e5m2
+  fty2 mul_e4m3 = __enzyme_truncate_op_func(simple_mul, 64, 4, 3);
+  APPROX_EQ(mul_e4m3(3, 3), 9, 0);
+  APPROX_EQ(mul_e4m3(3, 5.5), 16, 0);
+  APPROX_EQ(mul_e4m3(0.1, 1), 0.1015625, 0);
+  TEST_EQ(isinf(mul_e4m3(16, 16)), 1);
+  fty2 mul_e5m2 = __enzyme_truncate_op_func(simple_mul, 64, 5, 2);
+  APPROX_EQ(mul_e5m2(16, 16), 256, 0);
+  APPROX_EQ(mul_e5m2(3, 3), 8, 0);
+
+  // Truncating to fp32 behaves like computing in float.
+  double A[N], B[N], C[N];
+  for (int i = 0; i < N; i++) {
+    A[i] = 1 + 0.37 * i;
+    B[i] = 1 + 0.11 * (i % 7);
+  }
+  __enzyme_truncate_op_func_2(compute, 64, 8, 23)(A, B, C, N);
+  for (int i = 0; i < N; i++) {
+    float a = A[i], b = B[i];
+    float expected = a * 2.0f + b * sqrtf(a);
+    APPROX_EQ(C[i], (double)expected, 0);
+  }
+
+  // Memory mode
+  double a = __enzyme_truncate_mem_value(1.0, 64, 16);
+  double b = __enzyme_truncate_mem_value(ldexp(1, -11), 64, 16);
+  double c = __enzyme_truncate_mem_func(simple_add, 64, 16)(a, b);
+  APPROX_EQ(__enzyme_expand_mem_value(c, 64, 16), 1, 0);
+
+  return 0;
+}
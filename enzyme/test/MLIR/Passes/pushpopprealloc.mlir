@@ -0,0 +1,85 @@
+// RUN: %eopt --convert-enzyme-to-memref %s | FileCheck %s
+
+// Pushes and pops run once per iteration of a counted loop are lowered to
+// direct stores and loads into a cache reserved before the loop.
+
+module {
+  func.func private @diffeppow(%x: f64, %out: memref<f64>, %n: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %0 = "enzyme.init"() : () -> !enzyme.Cache<f64>
+    scf.for %iv = %c0 to %n step %c1 {
+      "enzyme.push"(%0, %x) : (!enzyme.Cache<f64>, f64) -> ()
+    }
+    scf.for %div = %c0 to %n step %c1 {
+      %1 = "enzyme.pop"(%0) : (!enzyme.Cache<f64>) -> f64
+      memref.store %1, %out[] : memref<f64>
+    }
+    return
+  }
+
+  func.func private @diffeaffine(%x: f64) {
+    %0 = "enzyme.init"() : () -> !enzyme.Cache<f64>
+    affine.for %iv = 0 to 10 step 3 {
+      "enzyme.push"(%0, %x) : (!enzyme.Cache<f64>, f64) -> ()
+    }
+    return
+  }
+
+  func.func private @diffecond(%x: f64, %c: i1, %n: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %0 = "enzyme.init"() : () -> !enzyme.Cache<f64>
+    scf.for %iv = %c0 to %n step %c1 {
+      scf.if %c {
+        "enzyme.push"(%0, %x) : (!enzyme.Cache<f64>, f64) -> ()
+      }
+    }
+    return
+  }
+}
+
+// CHECK: func.func private @__enzyme_reserve_f64(%[[elementsField:.+]]: memref<memref<?xf64>>, %[[sizeField:.+]]: memref<index>, %[[capacityField:.+]]: memref<index>, %[[count:.+]]: index) {
+// CHECK:   %[[required:.+]] = arith.addi %{{.+}}, %[[count]] : index
+// CHECK:   scf.if
+// CHECK:     memref.alloc
+// CHECK:     memref.copy
+// CHECK:   return
+
+// CHECK-LABEL: func.func private @diffeppow
+// CHECK:   %[[extent:.+]] = arith.subi %arg2, %c0 : index
+// CHECK:   %[[trip:.+]] = arith.ceildivsi %[[extent]], %c1 : index
+// CHECK:   %[[tripcount:.+]] = arith.select %{{.+}}, %{{.+}}, %[[trip]] : index
+// CHECK:   call @__enzyme_reserve_f64(%{{.+}}, %{{.+}}, %{{.+}}, %[[tripcount]])
+// CHECK:   %[[base:.+]] = memref.load %{{.+}}[] : memref<index>
+// CHECK:   %[[elements:.+]] = memref.load %{{.+}}[] : memref<memref<?xf64>>
+// CHECK:   scf.for %[[iv:.+]] = %c0 to %arg2 step %c1 {
+// CHECK-NOT: call
+// CHECK:     %[[offset:.+]] = arith.subi %[[iv]], %c0 : index
+// CHECK:     %[[iter:.+]] = arith.divui %[[offset]], %c1 : index
+// CHECK:     %[[index:.+]] = arith.addi %[[base]], %[[iter]] : index
+// CHECK:     memref.store %arg0, %[[elements]][%[[index]]] : memref<?xf64>
+// CHECK:   }
+// CHECK:   %[[pushed:.+]] = arith.addi %[[base]], %[[tripcount]] : index
+// CHECK:   memref.store %[[pushed]], %{{.+}}[] : memref<index>
+// CHECK:   %[[size:.+]] = memref.load %{{.+}}[] : memref<index>
+// CHECK:   cf.assert %{{.+}}, "pop on empty cache"
+// CHECK:   scf.for %[[div:.+]] = %c0 to %arg2 step %c1 {
+// CHECK-NOT: call
+// CHECK:     %[[popped:.+]] = memref.load %{{.+}}[%{{.+}}] : memref<?xf64>
+// CHECK:     memref.store %[[popped]], %arg1[] : memref<f64>
+// CHECK:   }
+// CHECK:   %[[remaining:.+]] = arith.subi %[[size]], %{{.+}} : index
+// CHECK:   memref.store %[[remaining]], %{{.+}}[] : memref<index>
+
+// CHECK-LABEL: func.func private @diffeaffine
+// CHECK:   %[[c4:.+]] = arith.constant 4 : index
+// CHECK:   call @__enzyme_reserve_f64(%{{.+}}, %{{.+}}, %{{.+}}, %[[c4]])
+// CHECK:   affine.for
+// CHECK-NOT: call
+// CHECK:     memref.store %arg0
+
+// CHECK-LABEL: func.func private @diffecond
+// CHECK:   scf.for
+// CHECK:     scf.if
+// CHECK:       call @__enzyme_push_f64
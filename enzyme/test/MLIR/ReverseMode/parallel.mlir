@@ -0,0 +1,45 @@
+// RUN: %eopt --enzyme -canonicalize --remove-unnecessary-enzyme-ops -canonicalize %s | FileCheck %s
+
+module {
+  func.func @scale(%x: f64, %m: memref<?xf64>, %n: index) {
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    scf.parallel (%i) = (%c0) to (%n) step (%c1) {
+      %v = memref.load %m[%i] : memref<?xf64>
+      %p = arith.mulf %v, %x : f64
+      memref.store %p, %m[%i] : memref<?xf64>
+      scf.reduce
+    }
+    return
+  }
+
+  func.func @dscale(%x: f64, %m: memref<?xf64>, %dm: memref<?xf64>, %n: index) -> f64 {
+    %r = enzyme.autodiff @scale(%x, %m, %dm, %n) { activity=[#enzyme<activity enzyme_active>, #enzyme<activity enzyme_dup>, #enzyme<activity enzyme_const>], ret_activity=[] } : (f64, memref<?xf64>, memref<?xf64>, index) -> f64
+    return %r : f64
+  }
+}
+
+// The primal loop stores the values its adjoint needs into a slot per
+// iteration rather than pushing them onto a shared stack.
+// CHECK-LABEL: func.func private @diffescale
+// CHECK:         %[[slots:.+]] = memref.alloc(%{{.+}}) : memref<?xf64>
+// CHECK:         scf.parallel (%[[iv:.+]]) = (%c0) to (%{{.+}}) step (%c1) {
+// CHECK-NOT:       enzyme.push
+// CHECK:           memref.store %{{.+}}, %[[slots]][%{{.+}}] : memref<?xf64>
+// CHECK:           scf.reduce
+// CHECK-NEXT:    }
+
+// The adjoint loop is parallel as well. The adjoint of %x is accumulated by
+// each iteration separately and combined by scf.reduce, and shadow memory is
+// updated atomically.
+// CHECK:         %[[dx:.+]] = scf.parallel (%[[div:.+]]) = (%c0) to (%{{.+}}) step (%c1) init (%{{.+}}) -> f64 {
+// CHECK-NOT:       enzyme.pop
+// CHECK:           %[[cached:.+]] = memref.load %[[slots]][%{{.+}}] : memref<?xf64>
+// CHECK:           memref.atomic_rmw addf %{{.+}}, %{{.+}}[%[[div]]] : (f64, memref<?xf64>) -> f64
+// CHECK:           scf.reduce(%{{.+}} : f64) {
+// CHECK-NEXT:      ^bb0(%[[lhs:.+]]: f64, %[[rhs:.+]]: f64):
+// CHECK-NEXT:        %[[sum:.+]] = arith.addf %[[lhs]], %[[rhs]] : f64
+// CHECK-NEXT:        scf.reduce.return %[[sum]] : f64
+// CHECK-NEXT:      }
+// CHECK-NEXT:    }
+// CHECK:         memref.dealloc %[[slots]] : memref<?xf64>
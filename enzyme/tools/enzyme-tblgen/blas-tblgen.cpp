@@ -57,6 +57,29 @@ bool hasDiffeRet(Init *resultTree) {
   return false;
 }
 
+// Whether the rule passes a constant mode (e.g. Char<"N">) to a blas call.
+bool hasCharConstant(Init *resultTree) {
+  if (DagInit *resultRoot = dyn_cast<DagInit>(resultTree)) {
+    for (auto arg : resultRoot->getArgs()) {
+      if (hasCharConstant(arg))
+        return true;
+    }
+  }
+  if (DefInit *DefArg = dyn_cast<DefInit>(resultTree)) {
+    if (DefArg->getDef()->isSubClassOf("Char"))
+      return true;
+  }
+  return false;
+}
+
+bool hasCharConstant(const TGPattern &pattern) {
+  for (auto rule : pattern.getRules()) {
+    if (hasCharConstant(rule.getRuleDag()))
+      return true;
+  }
+  return false;
+}
+
 bool hasAdjoint(const TGPattern &pattern, Init *resultTree, StringRef argName) {
   if (DagInit *resultRoot = dyn_cast<DagInit>(resultTree)) {
     auto opName = resultRoot->getOperator()->getAsString();
@@ -207,7 +230,7 @@ void emit_free_and_ending(const TGPattern &pattern, raw_ostream &os) {
   auto typeMap = pattern.getArgTypeMap();
   for (size_t i = 0; i < nameVec.size(); i++) {
     auto ty = typeMap.lookup(i);
-    if (isVecLikeArg(ty)) {
+    if (isVecLikeArg(ty) || ty == ArgType::piv) {
       auto name = nameVec[i];
       os << "      if (cache_" << name << ") {\n"
          << "        CreateDealloc(Builder2, free_" << name << ");\n"
@@ -449,15 +472,20 @@ void emit_helper(const TGPattern &pattern, raw_ostream &os) {
           "(Type*) getInt8PtrTy(call.getContext()) : "
           "(Type*) Type::getInt8Ty(call.getContext());\n";
 
+  bool hasEnum = false;
   for (auto name : enumerate(nameVec)) {
     assert(argTypeMap.count(name.index()) == 1);
     auto ty = argTypeMap.lookup(name.index());
     if (ty == ArgType::trans || ty == ArgType::side || ty == ArgType::uplo) {
       os << "  Type *cublasEnumType = nullptr;\n";
       os << "  if (cublas) cublasEnumType = type_" << name.value() << ";\n";
+      hasEnum = true;
       break;
     }
   }
+  // e.g. getrf has no mode argument, but its rules pass constant modes.
+  if (!hasEnum && hasCharConstant(pattern))
+    os << "  Type *cublasEnumType = Type::getInt32Ty(call.getContext());\n";
 
   bool hasInt = false;
   for (auto name : enumerate(nameVec)) {
@@ -529,7 +557,7 @@ void emit_scalar_types(const TGPattern &pattern, raw_ostream &os) {
       break;
     }
   }
-  if (hasTrans) {
+  if (hasTrans || hasCharConstant(pattern)) {
     os << "  Value *valueN = nullptr;\n"
        << "  Value *valueT = nullptr;\n"
        << "  Value *valueC = nullptr;\n"
@@ -723,6 +751,12 @@ void emit_extract_calls(const TGPattern &pattern, raw_ostream &os) {
     // might use it. So instead we insert a constantint 1 on the call site.
   }
 
+  for (size_t i = 0; i < nameVec.size(); i++) {
+    if (typeMap.lookup(i) != ArgType::piv)
+      continue;
+    extract_mat_or_vec(nameVec[i], os);
+  }
+
   os << "  } else {\n"
      << "\n";
 
@@ -1367,7 +1401,8 @@ void rev_call_arg(bool forward, DagInit *ruleDag, const TGPattern &pattern,
     case ArgType::vincInc:
     case ArgType::vincData:
     case ArgType::mldLD:
-    case ArgType::mldData: {
+    case ArgType::mldData:
+    case ArgType::piv: {
       os << "{";
       os << "arg_" << name;
       if (ty == ArgType::vincData) {
@@ -1417,7 +1452,7 @@ void rev_call_args(bool forward, Twine argName, const TGPattern &pattern,
   os << "        if (byRef) {\n";
   int n = 0;
   if (func == "gemv" || func == "lascl" || func == "potrs" || func == "potrf" ||
-      func == "lacpy" || func == "spmv" || func == "spr2")
+      func == "lacpy" || func == "spmv" || func == "spr2" || func == "getrs")
     n = 1;
   if (func == "gemm" || func == "syrk" || func == "syr2k" || func == "symm")
     n = 2;
@@ -1630,6 +1665,195 @@ void emit_if_rule_condition(const TGPattern &pattern, DagInit *ruleDag,
   os << ") {\n";
 }
 
+void emit_dag(bool forward, Twine resultVarName, DagInit *ruleDag,
+              Twine argPrefix, raw_ostream &os, StringRef argName,
+              ssize_t actArg, const TGPattern &pattern, bool runtimeChecked,
+              StringMap<Twine> &vars);
+
+// The matrix shadows a FuseLanes rule packs, in the order of its call.
+static SmallVector<std::string, 2> fusedShadows(DagInit *ruleDag) {
+  SmallVector<std::string, 2> names;
+  auto callDag = cast<DagInit>(ruleDag->getArg(0));
+  for (size_t i = 0; i < callDag->getNumArgs(); i++) {
+    auto sub = dyn_cast<DagInit>(callDag->getArg(i));
+    if (!sub)
+      continue;
+    auto Def = cast<DefInit>(sub->getOperator())->getDef();
+    if (Def->getName() == "Shadow" || Def->isSubClassOf("Shadow"))
+      names.push_back(sub->getArgName(0)->getAsUnquotedString());
+  }
+  return names;
+}
+
+// Flag recording whether a FuseLanes rule was already emitted for all lanes.
+static std::string fusedLanesFlag(DagInit *ruleDag) {
+  std::string flag = "fused";
+  for (auto &name : fusedShadows(ruleDag))
+    flag += "_" + name;
+  return flag;
+}
+
+static void collectFirstUseVars(DagInit *ruleDag,
+                                SmallVectorImpl<StringRef> &vars) {
+  auto Def = cast<DefInit>(ruleDag->getOperator())->getDef();
+  if (Def->getName() == "FirstUse" || Def->isSubClassOf("FirstUse"))
+    if (!llvm::is_contained(vars, Def->getValueAsString("var")))
+      vars.push_back(Def->getValueAsString("var"));
+  for (size_t i = 0; i < ruleDag->getNumArgs(); i++)
+    if (auto sub = dyn_cast<DagInit>(ruleDag->getArg(i)))
+      collectFirstUseVars(sub, vars);
+}
+
+static void collectFuseLanes(DagInit *ruleDag,
+                             SmallVectorImpl<DagInit *> &fused) {
+  auto Def = cast<DefInit>(ruleDag->getOperator())->getDef();
+  if (Def->isSubClassOf("FuseLanes")) {
+    fused.push_back(ruleDag);
+    return;
+  }
+  for (size_t i = 0; i < ruleDag->getNumArgs(); i++)
+    if (auto sub = dyn_cast<DagInit>(ruleDag->getArg(i)))
+      collectFuseLanes(sub, fused);
+}
+
+// The packed call is emitted with the widened length and the packed shadows
+// and their leading dimensions in place of the original ones, so these may
+// not be used for anything else within it.
+static void checkFusedArgs(const TGPattern &pattern, DagInit *ruleDag,
+                           const StringSet<> &replaced, bool topLevel) {
+  for (size_t i = 0; i < ruleDag->getNumArgs(); i++) {
+    if (auto sub = dyn_cast<DagInit>(ruleDag->getArg(i))) {
+      auto Def = cast<DefInit>(sub->getOperator())->getDef();
+      if (!(topLevel &&
+            (Def->getName() == "Shadow" || Def->isSubClassOf("Shadow"))))
+        checkFusedArgs(pattern, sub, replaced, /*topLevel*/ false);
+      continue;
+    }
+    if (!ruleDag->getArgName(i))
+      continue;
+    auto name = ruleDag->getArgNameStr(i);
+    if (replaced.count(name) && !(topLevel && pattern.getTypeOfArg(name) ==
+                                                 ArgType::len))
+      PrintFatalError(pattern.getLoc(),
+                      Twine("FuseLanes cannot use $") + name +
+                          " other than as the widened length or a packed "
+                          "shadow");
+  }
+}
+
+// With a vector width > 1, compute the call of a FuseLanes rule once for all
+// lanes on packed copies of its matrix shadows.
+void emit_fused_lanes(const TGPattern &pattern, DagInit *ruleDag,
+                      raw_ostream &os) {
+  auto Def = cast<DefInit>(ruleDag->getOperator())->getDef();
+  const auto cols = Def->getValueAsString("cols");
+  if (ruleDag->getNumArgs() != 1 || !isa<DagInit>(ruleDag->getArg(0)) ||
+      !cast<DefInit>(cast<DagInit>(ruleDag->getArg(0))->getOperator())
+           ->getDef()
+           ->isSubClassOf("BlasCall"))
+    PrintFatalError(pattern.getLoc(), "FuseLanes must wrap a single BlasCall");
+  auto callDag = cast<DagInit>(ruleDag->getArg(0));
+
+  const auto nameVec = pattern.getArgNames();
+  const auto mutables = pattern.getMutableArgs();
+  const auto shadows = fusedShadows(ruleDag);
+  if (shadows.empty())
+    PrintFatalError(pattern.getLoc(), "FuseLanes call uses no shadow matrix");
+
+  StringSet<> replaced;
+  replaced.insert(cols);
+  for (auto &name : shadows) {
+    size_t argIdx = pattern.getArgNameMap().lookup(name);
+    if (pattern.getTypeOfArg(name) != ArgType::mldData)
+      PrintFatalError(pattern.getLoc(),
+                      Twine("FuseLanes can only pack matrices, not $") + name);
+    auto dims = pattern.getRelatedLengthArgs(argIdx);
+    if (nameVec[dims.back()] != cols)
+      PrintFatalError(pattern.getLoc(),
+                      Twine("$") + cols + " is not the column count of $" +
+                          name);
+    if (dims.size() == 3 && pattern.getTypeOfArg(nameVec[dims[0]]) !=
+                                ArgType::trans)
+      PrintFatalError(pattern.getLoc(),
+                      Twine("FuseLanes cannot pack $") + name);
+    replaced.insert(name);
+    replaced.insert(nameVec[argIdx + 1]);
+  }
+  checkFusedArgs(pattern, callDag, replaced, /*topLevel*/ true);
+
+  const auto flag = fusedLanesFlag(ruleDag);
+  os << "    // FuseLanes\n";
+  os << "    bool " << flag << " = false;\n";
+  os << "    if (gutils->getWidth() > 1 && EnzymeBlasFuseLanes && byRef && "
+        "!cublas && !julia_decl";
+  for (auto &name : shadows)
+    os << " && active_" << name;
+  os << ") {\n";
+  os << "      auto &M = *gutils->oldFunc->getParent();\n";
+  os << "      Value *width = ConstantInt::get(intType, gutils->getWidth());\n";
+  for (auto &name : shadows) {
+    size_t argIdx = pattern.getArgNameMap().lookup(name);
+    auto dims = pattern.getRelatedLengthArgs(argIdx);
+    auto ldName = nameVec[argIdx + 1];
+    std::string trans =
+        dims.size() == 3 ? "arg_" + nameVec[dims[0]] : "nullptr";
+    auto rows = nameVec[dims[dims.size() - 2]];
+    os << "      Value *packed_" << name
+       << " = CreateAllocation(Builder2, fpType, Builder2.CreateMul("
+          "Builder2.CreateMul(load_if_ref(Builder2, intType, arg_"
+       << rows << ", byRef), load_if_ref(Builder2, intType, arg_" << cols
+       << ", byRef)), width), \"packed." << name << "\");\n";
+    os << "      Value *packed_" << ldName
+       << " = copyShadowLanes(Builder2, M, blas, allocationBuilder, intType, "
+          "fpType, "
+       << trans << ", arg_" << rows << ", arg_" << cols << ", d_" << name
+       << ", arg_" << ldName << ", packed_" << name
+       << ", gutils->getWidth(), /*unpack*/ false);\n";
+  }
+  os << "      Value *fused_" << cols
+     << " = Builder2.CreatePointerCast(to_blas_callconv(Builder2, "
+        "Builder2.CreateMul(load_if_ref(Builder2, intType, arg_"
+     << cols << ", byRef), width), byRef, cublas, julia_decl_type, "
+     << "allocationBuilder, \"fused." << cols << "\"), type_" << cols
+     << ");\n";
+  os << "      {\n";
+  os << "        Value *arg_" << cols << " = fused_" << cols << ";\n";
+  for (auto &name : shadows) {
+    size_t argIdx = pattern.getArgNameMap().lookup(name);
+    auto ldName = nameVec[argIdx + 1];
+    os << "        Value *d_" << name << " = Builder2.CreatePointerCast(packed_"
+       << name << ", type_" << name << ");\n";
+    os << "        Value *arg_" << ldName << " = packed_" << ldName << ";\n";
+  }
+  SmallVector<StringRef, 1> firstUses;
+  collectFirstUseVars(callDag, firstUses);
+  for (auto var : firstUses)
+    os << "        Value *first_use_" << var << " = Builder2.getTrue();\n";
+  StringMap<Twine> vars;
+  emit_dag(/*forward*/ true, "", callDag, "fused_args", os, "", /*actArg*/ -1,
+           pattern, /*runtimeChecked*/ false, vars);
+  os << "      }\n";
+  for (auto &name : shadows) {
+    size_t argIdx = pattern.getArgNameMap().lookup(name);
+    if (!mutables.count(argIdx))
+      continue;
+    auto dims = pattern.getRelatedLengthArgs(argIdx);
+    auto ldName = nameVec[argIdx + 1];
+    std::string trans =
+        dims.size() == 3 ? "arg_" + nameVec[dims[0]] : "nullptr";
+    auto rows = nameVec[dims[dims.size() - 2]];
+    os << "      copyShadowLanes(Builder2, M, blas, allocationBuilder, intType, "
+          "fpType, "
+       << trans << ", arg_" << rows << ", arg_" << cols << ", d_" << name
+       << ", arg_" << ldName << ", packed_" << name
+       << ", gutils->getWidth(), /*unpack*/ true);\n";
+  }
+  for (auto &name : shadows)
+    os << "      CreateDealloc(Builder2, packed_" << name << ");\n";
+  os << "      " << flag << " = true;\n";
+  os << "    }\n";
+}
+
 void emit_dag(bool forward, Twine resultVarName, DagInit *ruleDag,
               Twine argPrefix, raw_ostream &os, StringRef argName,
               ssize_t actArg, const TGPattern &pattern, bool runtimeChecked,
@@ -1844,6 +2068,22 @@ void emit_dag(bool forward, Twine resultVarName, DagInit *ruleDag,
     os << "        }\n";
     return;
   }
+  if (Def->isSubClassOf("FuseLanes")) {
+    assert(forward);
+    // Already computed for all lanes by emit_fused_lanes, so only record
+    // that the first uses happened.
+    os << "        if (" << fusedLanesFlag(ruleDag) << ") {\n";
+    SmallVector<StringRef, 1> firstUses;
+    collectFirstUseVars(ruleDag, firstUses);
+    for (auto var : firstUses)
+      os << "          first_use_" << var << " = Builder2.getFalse();\n";
+    os << "        } else {\n";
+    emit_dag(forward, resultVarName, cast<DagInit>(ruleDag->getArg(0)),
+             argName + "_0", os, argName, actArg, pattern, runtimeChecked,
+             vars);
+    os << "        }\n";
+    return;
+  }
   if (Def->getName() == "FirstUse" || Def->isSubClassOf("FirstUse")) {
     os << "        {\n";
     os << "      // FirstUse\n";
@@ -2075,6 +2315,11 @@ void emit_fwd_rewrite_rules(const TGPattern &pattern, raw_ostream &os) {
     }
   }
 
+  SmallVector<DagInit *, 1> fused;
+  collectFuseLanes(duals, fused);
+  for (auto ruleDag : fused)
+    emit_fused_lanes(pattern, ruleDag, os);
+
   os << "    Value *dres = applyChainRule(\n"
      << "        call.getType(), Builder2,\n"
      << "        [&](";
@@ -2187,6 +2432,8 @@ void emit_rev_rewrite_rules(const StringMap<TGPattern> &patternMap,
     }
   }
 
+  emit_unpack_cached(pattern, os);
+
   os << "  if(EnzymeRuntimeActivityCheck && cacheMode) {\n";
   for (size_t i = 0; i < activeArgs.size(); i++) {
     auto name = nameVec[activeArgs[i]];
@@ -2244,9 +2491,12 @@ void emit_rev_rewrite_rules(const StringMap<TGPattern> &patternMap,
 
   os << "      auto bb_name = Builder2.GetInsertBlock()->getName();\n";
   for (size_t iteri = 0; iteri < activeArgs.size(); iteri++) {
-    // trtrs does in reversed arg order.
-    size_t i = (pattern.getName() != "trtrs") ? iteri
-                                              : (activeArgs.size() - 1 - iteri);
+    // trtrs, getrs and gesv do in reversed arg order, since the rule of A
+    // needs the adjoint of B.
+    const bool reversed = pattern.getName() == "trtrs" ||
+                          pattern.getName() == "getrs" ||
+                          pattern.getName() == "gesv";
+    size_t i = !reversed ? iteri : (activeArgs.size() - 1 - iteri);
     auto rule = rules[i];
     const size_t actArg = activeArgs[i];
     const auto ruleDag = rule.getRuleDag();
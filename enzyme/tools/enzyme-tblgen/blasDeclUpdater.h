@@ -167,7 +167,8 @@ void emit_attributeBLAS(const TGPattern &pattern, raw_ostream &os) {
   for (size_t argPos = 0; argPos < numArgs; argPos++) {
     auto typeOfArg = argTypeMap.lookup(argPos);
     size_t i = (lv23 ? argPos - 1 : argPos);
-    if (typeOfArg == ArgType::vincData || typeOfArg == ArgType::mldData) {
+    if (typeOfArg == ArgType::vincData || typeOfArg == ArgType::mldData ||
+        typeOfArg == ArgType::piv) {
       os << "  F->addParamAttr(" << i << " + offset"
          << ", llvm::Attribute::NoCapture);\n";
       if (mutableArgs.count(argPos) == 0) {
@@ -98,6 +98,7 @@ void emit_BLASTA(TGPattern &pattern, raw_ostream &os) {
     os << "  // " << currentType << " " << pattern.getArgNames()[j] << "\n";
     switch (currentType) {
     case ArgType::info:
+    case ArgType::piv:
       os << "  updateAnalysis(call.getArgOperand(" << i
          << " + offset), ttPtrInt, &call);\n";
       break;
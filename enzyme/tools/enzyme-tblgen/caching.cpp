@@ -51,12 +51,36 @@ os << "  bool need_" << name << " = false;\n";
     auto name = nameVec[i];
     os << "  bool cache_" << name << " = cacheMode";
     // scalars passed by value don't have to be cached
-    if (!isVecLikeArg(ty))
+    if (!isVecLikeArg(ty) && ty != ArgType::piv)
       os << " && byRef";
     os << " && overwritten_" << name << " && need_" << name << ";\n";
   }
 }
 
+// A triangular or symmetric matrix only has one of its triangles referenced,
+// as selected by the uplo argument. Either the matrix is described by
+// ["uplo", "n", "n"], or by ["side", "m", "n"] in a function which also
+// takes an uplo argument (trmm, trsm, symm). Returns the name of the uplo
+// argument, or an empty string for a general matrix.
+std::string get_triangle_uplo(const TGPattern &pattern, size_t argIdx) {
+  auto typeMap = pattern.getArgTypeMap();
+  auto nameVec = pattern.getArgNames();
+  if (typeMap.lookup(argIdx) != ArgType::mldData)
+    return "";
+  auto dimensions = pattern.getRelatedLengthArgs(argIdx);
+  if (dimensions.size() != 3)
+    return "";
+  auto startty = typeMap.lookup(dimensions[0]);
+  if (startty == ArgType::uplo)
+    return nameVec[dimensions[0]];
+  if (startty != ArgType::side)
+    return "";
+  for (size_t i = 0; i < nameVec.size(); i++)
+    if (typeMap.lookup(i) == ArgType::uplo)
+      return nameVec[i];
+  return "";
+}
+
 // TODO: maybe update to return set<StringRef>,
 // for the case of multiple inputs
 void get_input_mat(const DagInit *ruleDag, StringSet<> &inputs) {
@@ -106,6 +130,21 @@ void emit_input_caching(const TGPattern &pattern, raw_ostream &os) {
   }
 }
 
+// Triangular and symmetric matrices are cached in packed storage, halving
+// the tape. The lapack conversions only exist for the Fortran abi.
+void emit_packed_cache_info(const TGPattern &pattern, raw_ostream &os) {
+  const auto nameVec = pattern.getArgNames();
+  for (auto argIdx : pattern.getActiveArgs()) {
+    if (get_triangle_uplo(pattern, argIdx) == "")
+      continue;
+    auto name = nameVec[argIdx];
+    os << "  bool packed_" << name << " = cache_" << name
+       << " && EnzymeLapackCopy && EnzymeLapackPackedCache &&\n"
+       << "      byRef && !cublas && !julia_decl &&\n"
+       << "      Mode != DerivativeMode::ForwardModeSplit;\n";
+  }
+}
+
 void emit_cacheTypes(const TGPattern &pattern, raw_ostream &os) {
   auto typeMap = pattern.getArgTypeMap();
   auto nameVec = pattern.getArgNames();
@@ -120,7 +159,8 @@ void emit_cacheTypes(const TGPattern &pattern, raw_ostream &os) {
     } else if (ty == ArgType::fp) {
       scalarType = "fpType";
     } else {
-      assert(ty == ArgType::cblas_layout || isVecLikeArg(ty) || ty == ArgType::info);
+      assert(ty == ArgType::cblas_layout || isVecLikeArg(ty) || ty == ArgType::info ||
+             ty == ArgType::piv);
       continue;
     }
   os
@@ -136,6 +176,14 @@ void emit_cacheTypes(const TGPattern &pattern, raw_ostream &os) {
 << "    cacheTypes.push_back(PointerType::getUnqual(fpType));\n";
     }
   }
+  // pivot indices are integer arrays and come last
+  for (size_t i = 0; i < nameVec.size(); i++) {
+    if (typeMap.lookup(i) == ArgType::piv) {
+      os
+<< "  if (cache_" << nameVec[i] << ")\n"
+<< "    cacheTypes.push_back(PointerType::getUnqual(intType));\n";
+    }
+  }
 }
 
 void emit_vec_like_copy(const TGPattern &pattern, raw_ostream &os) {
@@ -284,7 +332,32 @@ os
 
     os
 << "      auto *len1 = load_if_ref(BuilderZ, intType, M, byRef);\n"
-<< "      auto *len2 = load_if_ref(BuilderZ, intType, N, byRef);\n"
+<< "      auto *len2 = load_if_ref(BuilderZ, intType, N, byRef);\n";
+
+    auto uploName = get_triangle_uplo(pattern, argIdx);
+    if (uploName != "") {
+      size_t uploIdx = llvm::find(nameVec, uploName) - nameVec.begin();
+    os
+<< "      if (packed_" << matName << ") {\n"
+<< "        // only the " << uploName << " triangle is referenced, so it is stored packed\n"
+<< "        auto *packedSize = BuilderZ.CreateUDiv(BuilderZ.CreateMul(len1, BuilderZ.CreateAdd(len1, ConstantInt::get(intType, 1))), ConstantInt::get(intType, 2));\n"
+<< "        auto malins = CreateAllocation(BuilderZ, fpType, packedSize, \"cache." << matName << "\");\n"
+<< "        SmallVector<ValueType, 7> valueTypes = {" << valueTypes << "};\n"
+<< "        valueTypes[" << argIdx << "] = ValueType::Primal;\n"
+<< "        valueTypes[" << argIdx+1 << "] = ValueType::Primal;\n"
+<< "        valueTypes[" << uploIdx << "] = ValueType::Primal;\n";
+    for (auto len_pos : pattern.getRelatedLengthArgs(argIdx, /*hideuplo*/true) ) {
+os << "        valueTypes[" << len_pos << "] = ValueType::Primal;\n";
+    }
+    os
+<< "        Value *info = allocationBuilder.CreateAlloca(intType, nullptr, \"packed.info\");\n"
+<< "        Value *args[] = {arg_" << uploName << ", M, arg_" << matName << ", arg_" << ldName << ", malins, info};\n"
+<< "        callMemcpyPackedLapack(BuilderZ, *gutils->oldFunc->getParent(), blas, args, gutils->getInvertedBundles(&call, valueTypes, BuilderZ, /*lookup*/false), /*unpack*/false);\n"
+<< "        cacheValues.push_back(malins);\n"
+<< "      } else {\n";
+    }
+
+    os
 << "      auto *matSize = BuilderZ.CreateMul(len1, len2);\n"
 << "      Instruction *SubZero = nullptr;\n"
 << "      auto malins = CreateAllocation(BuilderZ, fpType, matSize, \"cache." << matName << "\", /*caller*/nullptr";
@@ -314,9 +387,96 @@ os << "      if (EnzymeLapackCopy) {\n"
 << "            gutils->getInvertedBundles(&call, valueTypes,\n"
 << "            BuilderZ, /*lookup*/ false));\n"
 << "      }\n"
+<< "      cacheValues.push_back(malins);\n";
+    if (uploName != "")
+      os << "      }\n";
+    os
+<< "    }\n";
+    }
+  }
+
+  // pivot indices are never active, but the rules need them unchanged
+  for (size_t argIdx = 0; argIdx < nameVec.size(); argIdx++) {
+    if (typeMap.lookup(argIdx) != ArgType::piv)
+      continue;
+    auto name = nameVec[argIdx];
+    auto dimensions = pattern.getRelatedLengthArgs(argIdx);
+    os
+<< "    if (cache_" << name << ") {\n"
+<< "      Value *malloc_size = load_if_ref(BuilderZ, intType, arg_" << nameVec[dimensions[0]] << ", byRef);\n"
+<< "      auto malins = CreateAllocation(BuilderZ, intType, malloc_size, \"cache." << name << "\");\n"
+<< "      Value *src = arg_" << name << ";\n"
+<< "      if (src->getType()->isIntegerTy())\n"
+<< "        src = BuilderZ.CreateIntToPtr(src, malins->getType());\n"
+<< "      Value *nbytes = BuilderZ.CreateMul(malloc_size, ConstantInt::get(intType, intType->getBitWidth() / 8));\n"
+<< "      Value *margs[] = {malins, src, nbytes, llvm::ConstantInt::getFalse(IntegerType::getInt1Ty(call.getContext()))};\n"
+<< "      Type *tys[] = {margs[0]->getType(), margs[1]->getType(),"
+<< "                     margs[2]->getType()};\n"
+<< "      auto memcpyF = Intrinsic::getDeclaration(gutils->oldFunc->getParent(), Intrinsic::memcpy, tys);\n"
+<< "      BuilderZ.CreateCall(memcpyF, margs);\n"
 << "      cacheValues.push_back(malins);\n"
 << "    }\n";
+  }
+}
+
+// Unpack the triangular matrices which were cached in packed storage into a
+// temporary full matrix, with ld equal to its dimension like any other cached
+// matrix. Needs the scalar args to be looked up already.
+void emit_unpack_cached(const TGPattern &pattern, raw_ostream &os) {
+  auto typeMap = pattern.getArgTypeMap();
+  auto nameVec = pattern.getArgNames();
+
+  std::string valueTypes = "";
+  for (size_t i = 0; i < nameVec.size(); i++) {
+    if (i > 0) valueTypes += ", ";
+    valueTypes += "ValueType::None";
+  }
+
+  for (auto argIdx : pattern.getActiveArgs()) {
+    auto uploName = get_triangle_uplo(pattern, argIdx);
+    if (uploName == "")
+      continue;
+    auto matName = nameVec[argIdx];
+    auto dimensions = pattern.getRelatedLengthArgs(argIdx);
+    size_t uploIdx = llvm::find(nameVec, uploName) - nameVec.begin();
+    // square matrices name the same length twice
+    SmallVector<size_t, 3> used = {uploIdx};
+    for (auto len_pos : pattern.getRelatedLengthArgs(argIdx, /*hideuplo*/true))
+      if (!llvm::is_contained(used, len_pos))
+        used.push_back(len_pos);
+
+    os
+<< "    if (packed_" << matName << ") {\n"
+<< "      SmallVector<ValueType, 7> valueTypes = {" << valueTypes << "};\n";
+    for (auto pos : used) {
+      auto name = nameVec[pos];
+      os
+<< "      valueTypes[" << pos << "] = ValueType::Primal;\n"
+<< "      Value *unpack_" << name << " = (cache_" << name << " || need_" << name << ") ? arg_" << name << " : lookup(arg_" << name << ", Builder2);\n";
+    }
+    if (typeMap.lookup(dimensions[0]) == ArgType::side) {
+      os
+<< "      Value *dim = CreateSelect(Builder2, is_left(Builder2, unpack_" << nameVec[dimensions[0]] << ", byRef, cublas), unpack_" << nameVec[dimensions[1]] << ", unpack_" << nameVec[dimensions[2]] << ");\n";
+    } else {
+      os
+<< "      Value *dim = unpack_" << nameVec[dimensions[1]] << ";\n";
     }
+    os
+<< "      Value *len = load_if_ref(Builder2, intType, dim, byRef);\n"
+<< "      // zero the unreferenced triangle, as the lapack copy of potrf does\n"
+<< "      Instruction *SubZero = nullptr;\n"
+<< "      auto unpacked = CreateAllocation(Builder2, fpType, Builder2.CreateMul(len, len), \"unpacked." << matName << "\", /*caller*/nullptr, &SubZero);\n"
+<< "      Value *info = allocationBuilder.CreateAlloca(intType, nullptr, \"unpacked.info\");\n"
+<< "      Value *args[] = {unpack_" << uploName << ", dim, free_" << matName << ", unpacked, dim, info};\n"
+<< "      callMemcpyPackedLapack(Builder2, *gutils->oldFunc->getParent(), blas, args, gutils->getInvertedBundles(&call, valueTypes, Builder2, /*lookup*/true), /*unpack*/true);\n"
+<< "      if (shouldFree())\n"
+<< "        CreateDealloc(Builder2, free_" << matName << ");\n"
+<< "      free_" << matName << " = unpacked;\n"
+<< "      if (type_" << matName << "->isIntegerTy())\n"
+<< "        arg_" << matName << " = Builder2.CreatePtrToInt(unpacked, type_" << matName << ");\n"
+<< "      else\n"
+<< "        arg_" << matName << " = Builder2.CreatePointerCast(unpacked, type_" << matName << ");\n"
+<< "    }\n";
   }
 }
 
@@ -331,7 +491,11 @@ void emit_cache_for_reverse(const TGPattern &pattern, raw_ostream &os) {
 << "  if ((Mode == DerivativeMode::ReverseModeCombined ||\n"
 << "       Mode == DerivativeMode::ReverseModePrimal) && cachetype) {\n"
 << "    SmallVector<Value *, 2> cacheValues;\n";
-if (pattern.getName() == "potrf" || pattern.getName() == "trtrs") {
+// These overwrite their inputs with results that the reverse pass needs, so
+// cache after the call.
+if (pattern.getName() == "potrf" || pattern.getName() == "trtrs" ||
+    pattern.getName() == "getrf" || pattern.getName() == "getrs" ||
+    pattern.getName() == "gesv") {
 os << "BuilderZ.SetInsertPoint(gutils->getNewFromOriginal(&call)->getNextNode());\n";
 }
   os << "    if (byRef) {\n";
@@ -409,6 +573,11 @@ os << "BuilderZ.SetInsertPoint(gutils->getNewFromOriginal(&call)->getNextNode())
     }
   }
 
+  for (size_t i = 0; i < nameVec.size(); i++) {
+    if (typeMap.lookup(i) == ArgType::piv)
+      os << "  Value *free_" << nameVec[i] << " = nullptr;\n";
+  }
+
   os
 << "  IRBuilder<> Builder2(&call);\n"               
 << "  switch (Mode) {\n"                            
@@ -442,6 +611,7 @@ void emit_caching(const TGPattern &pattern, raw_ostream &os) {
 
   emit_need_cache_info(pattern, os);
   emit_input_caching(pattern, os);
+  emit_packed_cache_info(pattern, os);
   emit_cacheTypes(pattern, os);
 
   os
@@ -65,6 +65,8 @@ const char *TyToString(ArgType ty) {
     return "side";
   case ArgType::info:
     return "info";
+  case ArgType::piv:
+    return "piv";
   default:
     return "unknown";
   }
@@ -309,6 +311,8 @@ void fillArgTypes(const Record *pattern, DenseMap<size_t, ArgType> &argTypes) {
       argTypes.insert(std::make_pair(pos + 1, ArgType::mldLD));
     } else if (val->isSubClassOf("ap")) {
       argTypes.insert(std::make_pair(pos, ArgType::ap));
+    } else if (val->isSubClassOf("piv")) {
+      argTypes.insert(std::make_pair(pos, ArgType::piv));
     } else {
       // TODO: fix assertion
       // assert(isa<DefInit>(val));
@@ -360,7 +364,7 @@ void fillRelatedLenghts(
   size_t pos = 0;
   for (auto val : inputTypes) {
     if (!val->isSubClassOf("vinc") && !val->isSubClassOf("mld") &&
-        !val->isSubClassOf("ap")) {
+        !val->isSubClassOf("ap") && !val->isSubClassOf("piv")) {
       pos += val->getValueAsInt("nelem");
       continue;
     }
@@ -384,7 +388,7 @@ void fillRelatedLenghts(
         assert(argTypes.lookup(lengths[2]) == ArgType::len);
       }
       relatedLengths.insert(std::make_pair(pos, lengths));
-    } else if (val->isSubClassOf("ap")) {
+    } else if (val->isSubClassOf("ap") || val->isSubClassOf("piv")) {
       assert(argsSize == 1);
       assert(argTypes.lookup(lengths[0]) == ArgType::len);
       relatedLengths.insert(std::make_pair(pos, lengths));
@@ -463,7 +467,8 @@ SmallVector<size_t, 3> TGPattern::getRelatedLengthArgs(size_t arg,
   // other args are unrelated to length args
   assert(argTypes.lookup(arg) == ArgType::vincData ||
          argTypes.lookup(arg) == ArgType::mldData ||
-         argTypes.lookup(arg) == ArgType::ap);
+         argTypes.lookup(arg) == ArgType::ap ||
+         argTypes.lookup(arg) == ArgType::piv);
 
   assert(relatedLengths.count(arg) == 1);
   auto related = relatedLengths.lookup(arg);
@@ -27,7 +27,8 @@ enum class ArgType {
   trans,
   diag,
   side,
-  info
+  info,
+  piv
 };
 
 bool is_char_arg(ArgType ty);
@@ -0,0 +1,228 @@
+//===- TypeTreeBench.cpp - Microbenchmark of TypeTree storage -------------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains a microbenchmark comparing the merge throughput of the
+// interned, flat TypeTreeMap used by TypeTrees against the
+// std::map<std::vector<int>, ConcreteType> it replaced.
+//
+// Both maps are driven by the same simplified versions of the TypeTree
+// operations which dominate Type Analysis: orIn (lookup of the sequence and
+// its prefixes, a scan for more or less general sequences of the same length,
+// then insertion), copies, ShiftIndices and Data0. The results of both are
+// checked to be identical.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "TypeTreeMap.h"
+
+using namespace llvm;
+
+static cl::opt<unsigned> Trees("trees", cl::init(64),
+                               cl::desc("Number of distinct type trees"));
+static cl::opt<unsigned> Rounds("rounds", cl::init(20),
+                                cl::desc("Number of rounds merging all pairs "
+                                         "of type trees"));
+static cl::opt<unsigned> Seed("seed", cl::init(0),
+                              cl::desc("Seed of the random type trees"));
+
+typedef std::map<const std::vector<int>, ConcreteType> BaselineMap;
+
+template <typename Map> struct Tree {
+  Map mapping;
+
+  bool insert(const std::vector<int> &Seq, ConcreteType CT) {
+    size_t SeqSize = Seq.size();
+    bool changed = false;
+    for (auto it = mapping.begin(); it != mapping.end();) {
+      const auto &Key = it->first;
+      if (Key.size() == SeqSize) {
+        bool newMoreGeneralThanOld = true;
+        bool oldMoreGeneralThanNew = true;
+        for (size_t i = 0; i < SeqSize; i++) {
+          if (Key[i] == Seq[i])
+            continue;
+          if (Seq[i] == -1) {
+            oldMoreGeneralThanNew = false;
+          } else if (Key[i] == -1) {
+            newMoreGeneralThanOld = false;
+          } else {
+            oldMoreGeneralThanNew = false;
+            newMoreGeneralThanOld = false;
+            break;
+          }
+        }
+        if (oldMoreGeneralThanNew)
+          return changed;
+        if (newMoreGeneralThanOld) {
+          it = mapping.erase(it);
+          changed = true;
+          continue;
+        }
+      }
+      ++it;
+    }
+    mapping.emplace(Seq, CT);
+    return true;
+  }
+
+  bool orIn(const Tree &RHS) {
+    bool changed = false;
+    for (const auto &pair : RHS.mapping) {
+      auto found = mapping.find(pair.first);
+      if (found != mapping.end() && found->second == pair.second)
+        continue;
+      // Pointers must be known at every prefix of the sequence.
+      const std::vector<int> &Seq = pair.first;
+      bool legal = true;
+      for (size_t i = 1; i < Seq.size(); i++) {
+        std::vector<int> prefix(Seq.begin(), Seq.begin() + i);
+        auto pfound = mapping.find(prefix);
+        if (pfound != mapping.end() && pfound->second != BaseType::Pointer &&
+            pfound->second != BaseType::Anything)
+          legal = false;
+      }
+      if (legal)
+        changed |= insert(Seq, pair.second);
+    }
+    return changed;
+  }
+
+  Tree ShiftIndices(int addOffset) const {
+    Tree Result;
+    for (const auto &pair : mapping) {
+      if (pair.first.size() == 0 || pair.first[0] == -1)
+        continue;
+      std::vector<int> next(pair.first);
+      next[0] += addOffset;
+      Result.mapping.emplace(next, pair.second);
+    }
+    return Result;
+  }
+
+  Tree Data0() const {
+    Tree Result;
+    for (const auto &pair : mapping) {
+      if (pair.first.size() == 0 ||
+          (pair.first[0] != 0 && pair.first[0] != -1))
+        continue;
+      std::vector<int> next(pair.first.begin() + 1, pair.first.end());
+      Result.mapping.emplace(next, pair.second);
+    }
+    return Result;
+  }
+
+  std::string str() const {
+    std::string out;
+    raw_string_ostream ss(out);
+    for (const auto &pair : mapping) {
+      ss << "[";
+      for (int idx : pair.first)
+        ss << idx << ",";
+      ss << "]:" << pair.second.str() << " ";
+    }
+    return ss.str();
+  }
+};
+
+/// Generate the same random type trees for either map.
+template <typename Map>
+static std::vector<Tree<Map>> generate(LLVMContext &Ctx) {
+  std::mt19937 rng(Seed);
+  std::vector<Tree<Map>> Result(Trees);
+  for (auto &T : Result) {
+    // Every tree is a pointer to a struct with scalar and pointer fields.
+    T.mapping.emplace(std::vector<int>(), ConcreteType(BaseType::Pointer));
+    unsigned fields = 4 + rng() % 20;
+    for (unsigned f = 0; f < fields; f++) {
+      int off = (rng() % 8 == 0) ? -1 : (int)(rng() % 64) * 4;
+      switch (rng() % 3) {
+      case 0:
+        T.insert({off}, ConcreteType(BaseType::Integer));
+        break;
+      case 1:
+        T.insert({off}, ConcreteType(Type::getDoubleTy(Ctx)));
+        break;
+      case 2: {
+        T.insert({off}, ConcreteType(BaseType::Pointer));
+        unsigned inner = 1 + rng() % 4;
+        for (unsigned i = 0; i < inner; i++) {
+          int ioff = (rng() % 4 == 0) ? -1 : (int)(rng() % 8) * 8;
+          T.insert({off, ioff}, ConcreteType(Type::getFloatTy(Ctx)));
+        }
+        break;
+      }
+      }
+    }
+  }
+  return Result;
+}
+
+template <typename Map>
+static std::string run(LLVMContext &Ctx, StringRef Name,
+                       double &MergesPerSecond) {
+  auto Pool = generate<Map>(Ctx);
+  size_t merges = 0;
+  size_t entries = 0;
+  std::string checksum;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < Rounds; r++) {
+    for (size_t i = 0; i < Pool.size(); i++) {
+      for (size_t j = 0; j < Pool.size(); j++) {
+        Tree<Map> T = Pool[i];
+        T.orIn(Pool[j]);
+        T.orIn(Pool[j].ShiftIndices(8 * (r % 4)));
+        Tree<Map> Inner = T.Data0();
+        Inner.orIn(Pool[(i + j) % Pool.size()].Data0());
+        // Fixpoint check as done after updating an analysis result
+        if (!(T.mapping == Pool[i].mapping))
+          entries += T.mapping.size();
+        entries += Inner.mapping.size();
+        merges += 3;
+        if (r == 0 && i == 0 && j == Pool.size() - 1)
+          checksum = T.str() + Inner.str();
+      }
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  MergesPerSecond = merges / elapsed.count();
+  outs() << Name << ": " << merges << " merges in "
+         << format("%.3f", elapsed.count()) << "s, "
+         << (uint64_t)MergesPerSecond << " merges/s\n";
+  return checksum + std::to_string(entries);
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Compare merge throughput of TypeTree storage\n");
+  LLVMContext Ctx;
+  double baseline, flat;
+  std::string baselineResult =
+      run<BaselineMap>(Ctx, "std::map<std::vector<int>, ConcreteType>",
+                       baseline);
+  std::string flatResult = run<TypeTreeMap>(Ctx, "TypeTreeMap", flat);
+  if (baselineResult != flatResult) {
+    errs() << "TypeTreeMap result differs from std::map\n";
+    return 1;
+  }
+  outs() << "speedup: " << format("%.2f", flat / baseline) << "x\n";
+  return 0;
+}